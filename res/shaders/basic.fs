@@ -1,35 +1,171 @@
 #version 410 core
 
+// Phong with every light of the draw in a single pass (LightBuffer), lights fade to 0 at their max distance
+// clustered: u_light_indices only has the directional lights, the local ones come from the cluster of the fragment (LightGrid)
+// lights with a shadow read it from the atlas (ShadowAtlas), with the volumes between them and the fragment
+
 in vec3 v_position;
 in vec3 v_world_position;
 in vec3 v_normal;
 
 uniform vec3 u_camera_position;
 
+#ifdef USE_INSTANCING
+in vec4 v_instance_color;
+#else
 uniform vec4 u_color;
+#endif
 uniform vec4 u_ambient_light;
 
-uniform vec3 u_light_position;
-uniform vec4 u_light_color;
-uniform float u_light_intensity;
-uniform float u_light_shininess;
+#define MAX_LIGHTS 256
+#define MAX_LIGHTS_PER_DRAW 16
+#define MAX_SHADOW_VIEWS 64
+#define LIGHT_TYPE_DIRECTIONAL 0
+#define LIGHT_TYPE_POINT 1
+#define LIGHT_TYPE_SPOT 2
+
+struct sLight {
+	vec4 position; // xyz world position, w type (eLightType)
+	vec4 direction; // xyz world direction, w cos of the spot cone
+	vec4 color; // rgb color, w intensity
+	vec4 params; // x max distance, y shininess, z first shadow view (-1 without shadow), w number of shadow views
+};
+
+layout(std140) uniform Lights {
+	sLight u_lights[MAX_LIGHTS];
+};
+
+uniform int u_num_lights;
+uniform int u_light_indices[MAX_LIGHTS_PER_DRAW];
+
+uniform bool u_clustered;
+uniform usamplerBuffer u_cluster_grid; // per cluster: offset, count
+uniform usamplerBuffer u_cluster_lights; // light indices
+uniform ivec3 u_cluster_dims; // tiles x, tiles y, slices
+uniform vec2 u_cluster_depth; // slice = log(depth) * x + y
+uniform vec3 u_camera_front;
+uniform vec4 u_viewport;
+
+struct sShadowView {
+	mat4 viewprojection;
+	vec4 rect; // xy offset and zw scale of the tile in the atlas
+	vec4 params; // x depth bias, y normal offset per unit of distance, z constant normal offset, w far plane (0 orthographic)
+};
+
+layout(std140) uniform ShadowViews {
+	sShadowView u_shadow_views[MAX_SHADOW_VIEWS];
+};
+
+uniform bool u_shadows;
+uniform sampler2DShadow u_shadow_atlas;
+uniform sampler2D u_shadow_transmittance; // of the volumes, behind all of them
+uniform sampler2D u_shadow_range; // x closest start, y farthest end (negated) of the volumes
 
 out vec4 FragColor;
 
+// fraction of the light that reaches the fragment: 3x3 PCF against the opaque casters, times the volumes in between
+float computeShadow(sLight l, vec3 N)
+{
+	int first = int(l.params.z);
+	if (!u_shadows || first < 0)
+		return 1.0;
+
+	// a face of the cube for point lights, the first cascade that contains the fragment for directional ones
+	int type = int(l.position.w);
+	int view = first;
+	if (type == LIGHT_TYPE_POINT)
+	{
+		vec3 d = v_world_position - l.position.xyz;
+		vec3 a = abs(d);
+		if (a.x >= a.y && a.x >= a.z)
+			view += d.x > 0.0 ? 0 : 1;
+		else if (a.y >= a.z)
+			view += d.y > 0.0 ? 2 : 3;
+		else
+			view += d.z > 0.0 ? 4 : 5;
+	}
+	int last = type == LIGHT_TYPE_DIRECTIONAL ? first + int(l.params.w) - 1 : view;
+	float light_distance = length(v_world_position - l.position.xyz);
+	vec3 coord = vec3(0.0);
+	for (; view <= last; view++)
+	{
+		sShadowView s = u_shadow_views[view];
+		vec4 clip = s.viewprojection * vec4(v_world_position + N * (s.params.y * light_distance + s.params.z), 1.0);
+		coord = clip.xyz / clip.w * 0.5 + 0.5;
+		if (all(greaterThan(coord.xy, vec2(0.0))) && all(lessThan(coord.xy, vec2(1.0))) && coord.z <= 1.0)
+			break;
+	}
+	if (view > last)
+		return 1.0;
+
+	sShadowView s = u_shadow_views[view];
+	vec2 uv = s.rect.xy + coord.xy * s.rect.zw;
+	vec2 texel = 1.0 / vec2(textureSize(u_shadow_atlas, 0));
+	vec2 uv_min = s.rect.xy + texel * 1.5; // the filter never reads the next tile
+	vec2 uv_max = s.rect.xy + s.rect.zw - texel * 1.5;
+	float lit = 0.0;
+	for (int y = -1; y <= 1; y++)
+		for (int x = -1; x <= 1; x++)
+			lit += texture(u_shadow_atlas, vec3(clamp(uv + vec2(x, y) * texel, uv_min, uv_max), coord.z - s.params.x));
+	lit /= 9.0;
+
+	// behind the volumes all their transmittance, inside them a part
+	vec2 range = texture(u_shadow_range, uv).xy;
+	float depth = s.params.w > 0.0 ? light_distance / s.params.w : coord.z;
+	float inside = clamp((depth - range.x) / max(-range.y - range.x, 1e-5), 0.0, 1.0);
+	return lit * mix(1.0, texture(u_shadow_transmittance, uv).r, inside);
+}
+
+vec3 shade(sLight l, vec3 N, vec3 V)
+{
+	int type = int(l.position.w);
+	vec3 L;
+	float attenuation = 1.0;
+	if (type == LIGHT_TYPE_DIRECTIONAL)
+		L = normalize(-l.direction.xyz);
+	else
+	{
+		vec3 to_light = l.position.xyz - v_world_position;
+		L = normalize(to_light);
+		float ratio = length(to_light) / max(l.params.x, 1e-4);
+		float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+		attenuation = window * window;
+		if (type == LIGHT_TYPE_SPOT)
+			attenuation *= smoothstep(l.direction.w, mix(l.direction.w, 1.0, 0.1), dot(-L, normalize(l.direction.xyz)));
+	}
+	if (attenuation <= 0.0)
+		return vec3(0.0);
+
+	vec3 R = reflect(-L, N);
+	float diff = max(dot(N, L), 0.0);
+	float spec = pow(max(dot(V, R), 0.0), l.params.y);
+	return (diff + spec) * l.color.rgb * l.color.w * attenuation * computeShadow(l, N);
+}
+
 void main()
 {
+#ifdef USE_INSTANCING
+	vec4 color = v_instance_color;
+#else
+	vec4 color = u_color;
+#endif
 	vec3 N = normalize(v_normal);
-	vec3 L = normalize(u_light_position - v_world_position);
 	vec3 V = normalize(u_camera_position - v_world_position);
-	vec3 R = reflect(-L, N);
 
-	// Phong
-	float diff = max(dot(N, L), 0.0);
-	vec4 diffuse = diff * u_light_color;
+	vec3 light = u_ambient_light.rgb;
+	for (int i = 0; i < u_num_lights; i++)
+		light += shade(u_lights[u_light_indices[i]], N, V);
 
-	float spec = pow(max(dot(V, R), 0.0), u_light_shininess);
-	vec4 specular = spec * u_light_color;
+	if (u_clustered)
+	{
+		// same tiles and exponential slices as the grid built in the CPU
+		vec2 tile = (gl_FragCoord.xy - u_viewport.xy) / u_viewport.zw * vec2(u_cluster_dims.xy);
+		float depth = max(dot(v_world_position - u_camera_position, u_camera_front), 1e-4);
+		ivec3 cell = clamp(ivec3(ivec2(tile), int(floor(log(depth) * u_cluster_depth.x + u_cluster_depth.y))), ivec3(0), u_cluster_dims - 1);
+		uvec2 range = texelFetch(u_cluster_grid, (cell.z * u_cluster_dims.y + cell.y) * u_cluster_dims.x + cell.x).xy;
+		for (uint i = 0u; i < range.y; i++)
+			light += shade(u_lights[texelFetch(u_cluster_lights, int(range.x + i)).x], N, V);
+	}
 
-	vec4 phong_color = (u_ambient_light + diffuse + specular) * u_color;
-	FragColor = phong_color * u_light_intensity;
+	FragColor = vec4(light * color.rgb, color.a);
 }
@@ -5,7 +5,14 @@ in vec3 a_normal;
 in vec4 a_color;
 in vec2 a_uv;
 
+#ifdef USE_INSTANCING
+//per instance, from the instance buffer (Mesh::tInstance)
+in mat4 u_model;
+in vec4 a_instance_color;
+out vec4 v_instance_color;
+#else
 uniform mat4 u_model;
+#endif
 uniform mat4 u_viewprojection;
 uniform vec3 u_camera_position;
 
@@ -31,6 +38,10 @@ void main()
 	//store the texture coordinates
 	v_uv = a_uv;
 
+#ifdef USE_INSTANCING
+	v_instance_color = a_instance_color;
+#endif
+
 	//calcule the position of the vertex using the matrices
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
 }
\ No newline at end of file
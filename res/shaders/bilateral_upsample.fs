@@ -0,0 +1,47 @@
+#version 410 core
+
+// Upsamples a low resolution premultiplied layer (volumes) to the screen.
+// The 4 nearest low resolution texels are weighted bilinearly and by how close their scene depth is to the one of
+// this pixel, so a texel computed for a surface at another depth does not bleed across the silhouettes.
+
+in vec2 v_uv;
+
+uniform sampler2D u_color_texture; // low resolution, premultiplied alpha
+uniform sampler2D u_depth_texture; // low resolution scene depth
+uniform sampler2D u_scene_depth; // full resolution
+uniform vec2 u_camera_nearfar;
+uniform float u_depth_sharpness; // how fast the weight falls with the relative depth difference
+
+out vec4 FragColor;
+
+float linearDepth(float z)
+{
+    float n = u_camera_nearfar.x;
+    float f = u_camera_nearfar.y;
+    return 2.0 * n * f / (f + n - (z * 2.0 - 1.0) * (f - n));
+}
+
+void main()
+{
+    ivec2 low_size = textureSize(u_color_texture, 0);
+    float depth = linearDepth(texture(u_scene_depth, v_uv).r);
+
+    vec2 coord = v_uv * vec2(low_size) - 0.5;
+    vec2 base = floor(coord);
+    vec2 f = coord - base;
+
+    vec4 color = vec4(0.0);
+    float total = 0.0;
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < 2; x++) {
+            ivec2 texel = clamp(ivec2(base) + ivec2(x, y), ivec2(0), low_size - 1);
+            float bilinear = (x == 1 ? f.x : 1.0 - f.x) * (y == 1 ? f.y : 1.0 - f.y);
+            float low_depth = linearDepth(texelFetch(u_depth_texture, texel, 0).r);
+            // a tiny bilinear part keeps the result defined when no texel matches
+            float weight = bilinear * (exp(-abs(low_depth - depth) / depth * u_depth_sharpness) + 1e-4);
+            color += texelFetch(u_color_texture, texel, 0) * weight;
+            total += weight;
+        }
+    }
+    FragColor = color / max(total, 1e-8);
+}
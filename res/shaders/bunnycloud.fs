@@ -1,4 +1,19 @@
 #version 410 core
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+// This is an uber-shader: VolumeMaterial compiles one variant per combination of
+//   density:  DENSITY_VDB | DENSITY_NOISE | DENSITY_CONSTANT
+//   lighting: LIGHTING_ABSORPTION | LIGHTING_SCATTERING
+// so the raymarch loops below never branch on uniforms.
+// The lights come from the Lights block (LightBuffer), their type is a branch that is the same for every pixel of the draw.
+
+#if !defined(DENSITY_VDB) && !defined(DENSITY_NOISE) && !defined(DENSITY_CONSTANT)
+#define DENSITY_CONSTANT
+#endif
+
+#if !defined(LIGHTING_ABSORPTION) && !defined(LIGHTING_SCATTERING)
+#define LIGHTING_SCATTERING
+#endif
 
 in vec3 v_position;
 in vec3 v_world_position;
@@ -6,99 +21,133 @@ in vec3 v_normal;
 
 uniform vec3 u_camera_position;
 uniform float u_absorption;
-uniform vec4 u_background_color;
 uniform float u_step_size;
 
-uniform int u_density_type; // 0 = VDB File, 1 = 3D Noise, 2 = Constant density
+// Adaptive step (see VolumeMaterial::applyStepPreset)
+uniform float u_step_distance_scale; // growth per unit of distance to the camera
+uniform vec2 u_step_factors; // min (detailed regions) and max (empty or flat regions) multipliers of u_step_size
+uniform vec2 u_step_weights; // how much the coarse density and its variation count as detail
+uniform float u_step_lod; // mip of the density texture used to classify the regions
+
+#define MAX_STEPS 4096
+
+// Jitter: the first sample of every ray is offset by a fraction of the step taken from a blue noise tile,
+// the fraction changes every frame so the temporal accumulation (VolumePass) averages the banding away
+uniform bool u_jitter;
+uniform sampler2D u_blue_noise;
+uniform float u_jitter_offset; // golden ratio sequence of the frame
+
+// Early termination: under x the transmittance the ray continues with probability y (russian roulette), y = 0 cuts it, x = 0 disables it
+uniform vec2 u_termination;
+
+// Sample counters for the profiler (VolumeProfiler): every ray adds to the ones of its screen tile,
+// only the rays of the tile share them and sample_counters.cs sums the tiles afterwards
+#if defined(GL_ARB_shader_storage_buffer_object)
+#define SAMPLE_COUNTERS
+uniform bool u_profile;
+uniform int u_profile_tile_size; // pixels
+uniform int u_profile_tiles_x; // per row
+uniform int u_profile_num_tiles;
+struct sTileCounters {
+    uint rays; // low 16 bits, the high ones count the terminated rays
+    uint samples; // camera ray samples
+    uint light_samples; // shadow ray samples
+    uint reference_samples; // what the camera rays would take with fixed steps and without termination
+};
+layout(std430) buffer SampleCounters {
+    sTileCounters tiles[];
+};
+#endif
+int g_samples = 0;
+int g_light_samples = 0;
+bool g_terminated = false;
+
+float random(vec3 seed)
+{
+    return fract(sin(dot(seed, vec3(12.9898, 78.233, 37.719))) * 43758.5453);
+}
+
+// fraction of the first step to skip, 0 without jitter
+float jitter(float offset)
+{
+    if (!u_jitter)
+        return 0.0;
+    ivec2 size = textureSize(u_blue_noise, 0);
+    return fract(texelFetch(u_blue_noise, ivec2(gl_FragCoord.xy) % size, 0).r + u_jitter_offset + offset);
+}
 
 // Emission-Absorption
-uniform float u_noise_scale;
-uniform int u_noise_detail;
 uniform vec4 u_color;
 
 
 // Lab 4
-uniform sampler3D u_texture; // VDB File
+uniform sampler3D u_texture; // density: the VDB file, or the noise baked in the CPU (NoiseVolume) for DENSITY_NOISE
 
 out vec4 FragColor;
 
-uniform vec4 u_light_color; // Light color and intensity
-uniform float u_light_intensity; // Light intensity
-uniform vec3 u_local_light_position; // Position of the light source
-uniform float u_light_shininess;
-uniform vec3 u_light_position;
-uniform int u_light_type;
+// Lights (LightBuffer), the draw only gets the indices of the ones whose range reaches the volume
+#define MAX_LIGHTS 256
+#define MAX_LIGHTS_PER_DRAW 16
+#define LIGHT_TYPE_DIRECTIONAL 0
+#define LIGHT_TYPE_SPOT 2
+
+struct sLight {
+    vec4 position; // xyz world position, w type (eLightType)
+    vec4 direction; // xyz world direction, w cos of the spot cone
+    vec4 color; // rgb color, w intensity
+    vec4 params; // x max distance, y shininess
+};
+
+layout(std140) uniform Lights {
+    sLight u_lights[MAX_LIGHTS];
+};
+
+uniform int u_num_lights;
+uniform int u_light_indices[MAX_LIGHTS_PER_DRAW];
+uniform mat4 u_model; // the cone and the max distance of the lights are measured in world space, like the culling does
+uniform mat4 u_inverse_model; // the samples are in the space of the volume box
+uniform bool u_light_sampling; // one light per sample chosen by its contribution (weighted), instead of all of them
 uniform float u_g;
 
 
 uniform float u_scattering; // Scattering coefficient (µs)
 
 
-// Noise functions
-float hash1( float n )
+// Density of the medium at a point of the volume (local space, [-1,1])
+float sampleDensity(vec3 p)
 {
-    return fract( n*17.0*fract( n*0.3183099 ) );
+#if defined(DENSITY_VDB) || defined(DENSITY_NOISE)
+    vec3 texture_coord = (p + 1.0) / 2.0; // Convert to texture coordinates
+    return textureLod(u_texture, texture_coord, 0.0).r; // the mips are the max of every cell, only for sampleDetail
+#else
+    return 1.0; // Constant density
+#endif
 }
 
-float noise( vec3 x )
+// How much detail there is around a point, 0 (empty or flat) to 1, from a coarse version of the density
+float sampleDetail(vec3 p)
 {
-    vec3 p = floor(x);
-    vec3 w = fract(x);
-    
-    vec3 u = w*w*w*(w*(w*6.0-15.0)+10.0);
-    
-    float n = p.x + 317.0*p.y + 157.0*p.z;
-    
-    float a = hash1(n+0.0);
-    float b = hash1(n+1.0);
-    float c = hash1(n+317.0);
-    float d = hash1(n+318.0);
-    float e = hash1(n+157.0);
-    float f = hash1(n+158.0);
-    float g = hash1(n+474.0);
-    float h = hash1(n+475.0);
-
-    float k0 =   a;
-    float k1 =   b - a;
-    float k2 =   c - a;
-    float k3 =   e - a;
-    float k4 =   a - b - c + d;
-    float k5 =   a - c - e + g;
-    float k6 =   a - b - e + f;
-    float k7 = - a + b + c - d + e - f - g + h;
-
-    return -1.0+2.0*(k0 + k1*u.x + k2*u.y + k3*u.z + k4*u.x*u.y + k5*u.y*u.z + k6*u.z*u.x + k7*u.x*u.y*u.z);
+#if defined(DENSITY_VDB) || defined(DENSITY_NOISE)
+    // the mips keep the max of every cell, so thin features are not skipped
+    vec3 texture_coord = (p + 1.0) / 2.0;
+    float texel = exp2(u_step_lod) / float(textureSize(u_texture, 0).x);
+    float coarse = textureLod(u_texture, texture_coord, u_step_lod).r;
+    vec3 variation = abs(vec3(textureLod(u_texture, texture_coord + vec3(texel, 0.0, 0.0), u_step_lod).r,
+                              textureLod(u_texture, texture_coord + vec3(0.0, texel, 0.0), u_step_lod).r,
+                              textureLod(u_texture, texture_coord + vec3(0.0, 0.0, texel), u_step_lod).r) - coarse);
+    return clamp(coarse * u_step_weights.x + (variation.x + variation.y + variation.z) * u_step_weights.y, 0.0, 1.0);
+#else
+    return clamp(u_step_weights.x, 0.0, 1.0);
+#endif
 }
 
-#define MAX_OCTAVES 16
-
-float fractal_noise( vec3 P, float detail )
+// Step length at a point: grows with the distance (the pixel footprint) and in empty regions, shrinks near detail
+float adaptiveStep(vec3 p, float camera_distance)
 {
-    float fscale = 1.0;
-    float amp = 1.0;
-    float sum = 0.0;
-    float octaves = clamp(detail, 0.0, 16.0);
-    int n = int(octaves);
-
-    for (int i = 0; i <= MAX_OCTAVES; i++) {
-        if (i > n) continue;
-        float t = noise(fscale * P);
-        sum += t * amp;
-        amp *= 0.5;
-        fscale *= 2.0;
-    }
-
-    return sum;
-}
-
-float cnoise( vec3 P, float scale, float detail )
-{
-    P *= scale;
-    return clamp(fractal_noise(P, detail), 0.0, 1.0);
+    float footprint = 1.0 + camera_distance * u_step_distance_scale;
+    return u_step_size * footprint * mix(u_step_factors.y, u_step_factors.x, sampleDetail(p));
 }
 
-
-
 // Ray-AABB intersection
 vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     vec3 tMin = (boxMin - rayOrigin) / rayDir;
@@ -118,68 +167,153 @@ float phase_function(vec3 light_dir, vec3 view_dir) {
     return first_term * (numerator / denominator);
 }
 
+// Direction from the sample towards the light
+vec3 getLightDirection(int light, vec3 sample_position)
+{
+    if (int(u_lights[light].position.w) == LIGHT_TYPE_DIRECTIONAL)
+        return normalize(-u_lights[light].direction.xyz);
+    vec3 local_light_position = (u_inverse_model * vec4(u_lights[light].position.xyz, 1.0)).xyz;
+    return normalize(local_light_position - sample_position);
+}
 
+// Light reaching the sample before the medium: spot cone and a window that fades it to 0 at its max distance
+vec3 getLightRadiance(int light, vec3 sample_position)
+{
+    sLight l = u_lights[light];
+    float attenuation = 1.0;
+    int type = int(l.position.w);
+    if (type != LIGHT_TYPE_DIRECTIONAL) {
+        // in world space, a scaled or rotated volume gets the same falloff as the meshes (basic.fs)
+        vec3 to_light = l.position.xyz - (u_model * vec4(sample_position, 1.0)).xyz;
+        float light_distance = length(to_light);
+        if (type == LIGHT_TYPE_SPOT) {
+            float cos_angle = dot(-to_light / max(light_distance, 1e-4), normalize(l.direction.xyz));
+            attenuation = smoothstep(l.direction.w, mix(l.direction.w, 1.0, 0.1), cos_angle);
+        }
+        float ratio = light_distance / max(l.params.x, 1e-4);
+        float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+        attenuation *= window * window;
+    }
+    return l.color.rgb * l.color.w * l.params.y * attenuation;
+}
 
-vec3 computeInScatteredLight(vec3 sample_position) { //compute Ls
-    vec3 light_direction = normalize(u_local_light_position - sample_position);
+vec3 computeInScatteredLight(vec3 sample_position, vec3 light_direction, vec3 light_radiance, float camera_distance) { //compute Ls
     vec2 light_t = intersectAABB(sample_position, light_direction, vec3(-1.0), vec3(1.0));
-    float density;
     if (light_t.x > light_t.y || light_t.y <= 0.0) {
         return vec3(0.0); // No contribution if no intersection
     }
     float optical_thickness = 0.0;
+    float weight = 1.0; // of the survivors of the russian roulette
     vec3 accumulated_light = vec3(0.0);
-    for (float i = light_t.x; i < light_t.y; i += u_step_size) {
+    float i = max(light_t.x, 0.0);
+    // shifted from the camera ray jitter so both are not correlated
+    i += jitter(0.5) * adaptiveStep(sample_position + i * light_direction, camera_distance);
+    for (int n = 0; n < MAX_STEPS && i < light_t.y; n++) {
         vec3 light_sample_position = sample_position + i * light_direction;
-    
-        if (u_density_type == 0) {
-            // Get density from the VDB file
-            vec3 textureCoord = (light_sample_position + 1.0) / 2.0; // Convert to texture coordinates
-            density = texture(u_texture, textureCoord).r;
-        } 
-        else if (u_density_type == 1) density = cnoise(light_sample_position, u_noise_scale, u_noise_detail); // 3D noise
-        else if (u_density_type == 2) density = 1.0; // Constant density
-        optical_thickness += density * u_scattering * u_step_size;
-        float transmittance = exp(-optical_thickness);
-        accumulated_light += u_light_color.xyz * u_light_intensity * transmittance * u_step_size * u_light_shininess;
+        // the footprint of the shadow ray is the one of the camera ray at this sample
+        float dt = min(adaptiveStep(light_sample_position, camera_distance), light_t.y - i);
+        optical_thickness += sampleDensity(light_sample_position) * u_scattering * dt;
+        float transmittance = exp(-optical_thickness) * weight;
+        accumulated_light += light_radiance * transmittance * dt;
+        i += dt;
+        g_light_samples++;
+
+        if (transmittance < u_termination.x) {
+            if (random(vec3(gl_FragCoord.xy, float(n) + camera_distance + u_jitter_offset)) >= u_termination.y)
+                return accumulated_light; // the light that would still reach is 0 on average with the survivors
+            weight /= u_termination.y;
+        }
     };
-    accumulated_light += u_light_color.xyz * u_light_intensity * exp(-optical_thickness) * u_light_shininess; 
+    accumulated_light += light_radiance * exp(-optical_thickness) * weight;
     return accumulated_light;
 }
 
+// Light scattered towards the camera at a sample, from the lights of the draw
+// with u_light_sampling a single shadow ray is marched, to a light picked with probability proportional to its radiance
+// and divided by that probability, so the cost does not grow with the number of lights and the average is the same
+vec3 computeLighting(vec3 p, vec3 ray_direction, float camera_distance, float rnd)
+{
+    if (u_light_sampling && u_num_lights > 1) {
+        float weights[MAX_LIGHTS_PER_DRAW];
+        float total = 0.0;
+        for (int i = 0; i < u_num_lights; i++) {
+            int light = u_light_indices[i];
+            vec3 radiance = getLightRadiance(light, p);
+            weights[i] = dot(radiance, vec3(0.2126, 0.7152, 0.0722));
+            total += weights[i];
+        }
+        if (total <= 0.0)
+            return vec3(0.0);
+
+        float target = rnd * total;
+        int chosen = u_num_lights - 1;
+        for (int i = 0; i < u_num_lights - 1; i++) {
+            target -= weights[i];
+            if (target < 0.0) {
+                chosen = i;
+                break;
+            }
+        }
+        int light = u_light_indices[chosen];
+        vec3 light_direction = getLightDirection(light, p);
+        vec3 radiance = getLightRadiance(light, p) * (total / weights[chosen]);
+        return computeInScatteredLight(p, light_direction, radiance, camera_distance) * phase_function(light_direction, -ray_direction);
+    }
+
+    vec3 lighting = vec3(0.0);
+    for (int i = 0; i < u_num_lights; i++) {
+        int light = u_light_indices[i];
+        vec3 light_direction = getLightDirection(light, p);
+        vec3 radiance = getLightRadiance(light, p);
+        if (dot(radiance, radiance) > 0.0)
+            lighting += computeInScatteredLight(p, light_direction, radiance, camera_distance) * phase_function(light_direction, -ray_direction);
+    }
+    return lighting;
+}
+
 
 vec4 computeColor (vec3 ray_position, vec3 ray_direction, vec2 t){
     // Initialize variables
-    float optical_thickness = 0.0;
-    vec3 accumulated_light = vec3(0.0);
-    float transmittance;
+    float transmittance = 1.0;
     vec3 final_color = vec3(0.0, 0.0, 0.0);
-    vec3 light_color = vec3(u_color.x, u_color.y, u_color.z);
-    vec3 p = vec3(0.0); 
+    vec3 p = vec3(0.0);
     float density;
-    vec3 texture_coord;
-    float scattering_term;
-    vec3 scattered_color;
-    float phase;
-    for (float i=0; i<t.y; i+=u_step_size) {
+    float i = max(t.x, 0.0); // from the entry point (or the camera when it is inside)
+    i += jitter(0.0) * adaptiveStep(ray_position + i * ray_direction, i);
+    for (int n = 0; n < MAX_STEPS && i < t.y; n++) {
         p = ray_position + i * ray_direction;
-        if (u_density_type == 0) {
-            // Get density from the VDB file
-            texture_coord = (p + 1.0) / 2.0; // Convert to texture coordinates
-            density = texture(u_texture, texture_coord).r;
-            accumulated_light = computeInScatteredLight(p);
-        } 
-        else if (u_density_type == 1) density = cnoise(p, u_noise_scale, u_noise_detail); // 3D noise
-        else if (u_density_type == 2) density = 1.0; // Constant density
-        phase = phase_function(u_light_position, ray_direction);
-        scattered_color = computeInScatteredLight(p) * phase;
-        scattering_term = density * u_scattering; 
-        optical_thickness += density * u_absorption * u_step_size;
-        transmittance = exp(-optical_thickness);
-        final_color += u_color.xyz * u_step_size * (u_absorption * transmittance + scattering_term);
+        float dt = min(adaptiveStep(p, i), t.y - i);
+        density = sampleDensity(p);
+
+        // opacity correction: the segment is integrated analytically (Beer-Lambert), so a longer step
+        // absorbs and emits what the short ones it replaces would, instead of scaling a point sample by dt
+        float extinction = density * u_absorption;
+        float step_transmittance = exp(-extinction * dt);
+        float segment = extinction > 1e-5 ? (1.0 - step_transmittance) / extinction : dt; // integral of the transmittance along the step
+#if defined(LIGHTING_SCATTERING)
+        float scattering_term = density * u_scattering;
+        vec3 scattered_color = computeLighting(p, ray_direction, i, random(vec3(gl_FragCoord.xy, float(n) + u_jitter_offset + 0.5)));
+        final_color += transmittance * segment * (u_color.xyz * (u_absorption + scattering_term) + scattered_color * scattering_term);
+#else
+        final_color += transmittance * segment * u_color.xyz * u_absorption;
+#endif
+        transmittance *= step_transmittance;
+        i += dt;
+        g_samples++;
+
+        // the rest of the ray can barely be seen: stop it, or let it continue with its weight raised so the expected result does not change
+        if (transmittance < u_termination.x) {
+            // the frame offset changes the decisions every frame, the progressive accumulation averages them
+            if (random(vec3(gl_FragCoord.xy, float(n) + u_jitter_offset)) >= u_termination.y) {
+                transmittance = 0.0;
+                g_terminated = true;
+                break;
+            }
+            transmittance /= u_termination.y;
+        }
     }
-    final_color += u_background_color.xyz * exp(-optical_thickness);
-    return vec4(final_color, 1.0);
+    // premultiplied, blended over what is behind (ONE, ONE_MINUS_SRC_ALPHA) instead of a fixed background
+    return vec4(final_color, clamp(1.0 - transmittance, 0.0, 1.0));
 }
 
 
@@ -193,9 +327,19 @@ void main() {
 
     // Check for valid intersection
     if (t.x > t.y || t.y <= 0.0) {
-        FragColor = u_background_color;
-        return;
+        discard;
     }
     // Compute final color
     FragColor = computeColor(ray_position, ray_direction, t);
-}
\ No newline at end of file
+
+#if defined(SAMPLE_COUNTERS)
+    if (u_profile) {
+        ivec2 tile = ivec2(gl_FragCoord.xy) / u_profile_tile_size;
+        int index = min(tile.y * u_profile_tiles_x + tile.x, u_profile_num_tiles - 1);
+        atomicAdd(tiles[index].rays, g_terminated ? 0x10001u : 1u);
+        atomicAdd(tiles[index].samples, uint(g_samples));
+        atomicAdd(tiles[index].light_samples, uint(g_light_samples));
+        atomicAdd(tiles[index].reference_samples, uint(ceil((t.y - max(t.x, 0.0)) / u_step_size)));
+    }
+#endif
+}
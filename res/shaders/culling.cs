@@ -0,0 +1,95 @@
+#version 430 core
+
+// one invocation per draw command: frustum test with the current camera, then occlusion against the Hi-Z of the previous frame
+layout(local_size_x = 64) in;
+
+struct sBounds {
+    vec4 sphere; // xyz center, w radius
+    vec4 box_center;
+    vec4 box_halfsize;
+};
+
+// Mesh::tIndirectCommand, only instance_count is written
+struct sCommand {
+    uint count;
+    uint instance_count;
+    uint first;
+    uint base_vertex;
+    uint base_instance;
+};
+
+layout(std430, binding = 0) readonly buffer BoundsBuffer { sBounds bounds[]; };
+layout(std430, binding = 1) buffer CommandBuffer { sCommand commands[]; };
+layout(std430, binding = 2) buffer CounterBuffer { uint visible_count; uint occluded_count; };
+
+uniform uint u_num_draws;
+uniform vec4 u_planes[6]; // xyz normal pointing inside, w distance
+
+uniform bool u_occlusion;
+uniform sampler2D u_hiz; // max depth, nearest mip filtering
+uniform mat4 u_hiz_viewprojection; // camera the pyramid was rendered with
+uniform vec2 u_hiz_size;
+uniform int u_hiz_levels;
+
+bool insideFrustum(sBounds b)
+{
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = u_planes[i];
+        if (dot(plane.xyz, b.sphere.xyz) + plane.w < -b.sphere.w)
+            return false;
+        float distance = dot(plane.xyz, b.box_center.xyz) + plane.w;
+        if (distance + dot(abs(plane.xyz), b.box_halfsize.xyz) < 0.0)
+            return false;
+    }
+    return true;
+}
+
+bool isOccluded(sBounds b)
+{
+    // screen rectangle and nearest depth of the box in the previous frame
+    vec3 rect_min = vec3(1.0);
+    vec3 rect_max = vec3(0.0);
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner_sign = vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = u_hiz_viewprojection * vec4(b.box_center.xyz + b.box_halfsize.xyz * corner_sign, 1.0);
+        if (clip.w <= 0.0)
+            return false; // crosses the camera plane
+        vec3 window = clip.xyz / clip.w * 0.5 + 0.5;
+        rect_min = min(rect_min, window);
+        rect_max = max(rect_max, window);
+    }
+
+    // parts outside the previous view have no depth to compare with
+    if (rect_min.x < 0.0 || rect_min.y < 0.0 || rect_max.x > 1.0 || rect_max.y > 1.0)
+        return false;
+
+    // the level where the rectangle spans 2x2 texels at most
+    vec2 size = (rect_max.xy - rect_min.xy) * u_hiz_size;
+    float level = clamp(ceil(log2(max(max(size.x, size.y), 1.0))), 0.0, float(u_hiz_levels - 1));
+
+    float d0 = textureLod(u_hiz, rect_min.xy, level).r;
+    float d1 = textureLod(u_hiz, vec2(rect_max.x, rect_min.y), level).r;
+    float d2 = textureLod(u_hiz, vec2(rect_min.x, rect_max.y), level).r;
+    float d3 = textureLod(u_hiz, rect_max.xy, level).r;
+    float occluder_depth = max(max(d0, d1), max(d2, d3));
+
+    return rect_min.z > occluder_depth;
+}
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= u_num_draws)
+        return;
+
+    sBounds b = bounds[id];
+    bool visible = insideFrustum(b);
+    if (visible && u_occlusion && isOccluded(b)) {
+        visible = false;
+        atomicAdd(occluded_count, 1u);
+    }
+    if (visible)
+        atomicAdd(visible_count, 1u);
+
+    commands[id].instance_count = visible ? 1u : 0u;
+}
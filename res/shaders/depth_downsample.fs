@@ -0,0 +1,19 @@
+#version 410 core
+
+// Scene depth at a fraction of the resolution, written as the depth of the low resolution target.
+// Keeps the nearest depth of the footprint so volumes are never drawn over an opaque surface in front of them,
+// the pixels left without volume are filled by the bilateral upsample from neighbours at their depth.
+
+uniform sampler2D u_scene_depth;
+uniform int u_factor; // full resolution pixels per low resolution pixel (on each axis)
+
+void main()
+{
+    ivec2 size = textureSize(u_scene_depth, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * u_factor;
+    float depth = 1.0;
+    for (int y = 0; y < u_factor; y++)
+        for (int x = 0; x < u_factor; x++)
+            depth = min(depth, texelFetch(u_scene_depth, min(base + ivec2(x, y), size - 1), 0).r);
+    gl_FragDepth = depth;
+}
@@ -10,6 +10,7 @@ uniform vec3 u_camera_position;
 uniform float u_absorption;
 uniform vec4 u_background_color;
 uniform float u_step_size;
+uniform vec2 u_termination; // transmittance epsilon and russian roulette survival probability (see bunnycloud.fs)
 uniform int u_volume_type;
 uniform float u_noise_scale;
 uniform int u_noise_detail;
@@ -97,6 +98,11 @@ vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
 };
 
 
+float random(vec3 seed)
+{
+    return fract(sin(dot(seed, vec3(12.9898, 78.233, 37.719))) * 43758.5453);
+}
+
 vec4 computeColor (vec3 ray_position, vec3 ray_direction, vec2 t, vec3 bg_color){
     float optical_thickness = 0.0;
     float transmittance;
@@ -106,12 +112,21 @@ vec4 computeColor (vec3 ray_position, vec3 ray_direction, vec2 t, vec3 bg_color)
     vec3 p = vec3(0.0); 
     float absorption_coeffitient = cnoise(p, u_noise_scale, u_noise_detail);
 
-    for (float i=0; i<t.y; i+=u_step_size) {
+    float n = 0.0;
+    for (float i=max(t.x, 0.0); i<t.y; i+=u_step_size) {
         p = ray_position + i * ray_direction;
         absorption_coeffitient = cnoise(p, u_noise_scale, u_noise_detail);
         optical_thickness += absorption_coeffitient * u_absorption * u_step_size;
         transmittance = exp(-optical_thickness);
         color += light_color * u_absorption * transmittance* u_step_size;
+
+        // early termination with russian roulette: the survivors divide their transmittance by the probability
+        if (transmittance < u_termination.x) {
+            if (random(vec3(gl_FragCoord.xy, n)) >= u_termination.y)
+                return vec4(color, 1.0);
+            optical_thickness += log(u_termination.y);
+        }
+        n += 1.0;
     };
 
     color += background_color * exp(-optical_thickness);
@@ -124,10 +139,10 @@ void main()
 {
     // 1. Compute the ray direction.
     vec3 ray_position = u_camera_position;
-    vec3 ray_direction = v_world_position - u_camera_position;
+    vec3 ray_direction = normalize(v_world_position - u_camera_position);
 
     // 2. Compute intersections with the volume auxiliary geometry.
-    vec2 t = intersectAABB(ray_position, normalize(ray_direction), vec3(-1.0, -1.0, -1.0), vec3(1.0, 1.0, 1.0));
+    vec2 t = intersectAABB(ray_position, ray_direction, vec3(-1.0, -1.0, -1.0), vec3(1.0, 1.0, 1.0));
 	if (t.x > t.y) {
         FragColor = vec4(0.0, 0.0, 0.0, 1.0);
         return;
@@ -1,10 +1,18 @@
 #version 410 core
 
+#ifdef USE_INSTANCING
+in vec4 v_instance_color;
+#else
 uniform vec4 u_color;
+#endif
 
 out vec4 FragColor;
 
 void main()
 {
+#ifdef USE_INSTANCING
+	FragColor = v_instance_color;
+#else
 	FragColor = u_color;
+#endif
 }
\ No newline at end of file
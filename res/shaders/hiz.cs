@@ -0,0 +1,33 @@
+#version 430 core
+
+// one level of the Hi-Z pyramid: level 0 copies the depth buffer, the others keep the max depth of the texels below
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform int u_level;
+uniform sampler2D u_depth; // only read for level 0
+uniform ivec2 u_source_size; // size of the level read
+
+layout(r32f, binding = 0) uniform readonly image2D u_source; // previous level
+layout(r32f, binding = 1) uniform writeonly image2D u_destination;
+
+void main()
+{
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(u_destination);
+    if (p.x >= size.x || p.y >= size.y)
+        return;
+
+    float depth = 0.0;
+    if (u_level == 0) {
+        depth = texelFetch(u_depth, p, 0).r;
+    }
+    else {
+        // with odd sizes the last texel also covers the extra row/column, so the pyramid stays conservative
+        ivec2 last = ivec2(p.x == size.x - 1 && (u_source_size.x & 1) != 0 ? 2 : 1, p.y == size.y - 1 && (u_source_size.y & 1) != 0 ? 2 : 1);
+        for (int y = 0; y <= last.y; ++y)
+            for (int x = 0; x <= last.x; ++x)
+                depth = max(depth, imageLoad(u_source, min(p * 2 + ivec2(x, y), u_source_size - 1)).r);
+    }
+
+    imageStore(u_destination, p, vec4(depth));
+}
@@ -0,0 +1,65 @@
+#version 430 core
+
+// sums the tile counters of the volume shaders (VolumeProfiler) into 64 bit totals and clears them for the next frame
+layout(local_size_x = 256) in;
+
+// same layout than the SampleCounters block of bunnycloud.fs
+struct sTileCounters {
+    uint rays; // low 16 bits, the high ones count the terminated rays
+    uint samples;
+    uint light_samples;
+    uint reference_samples;
+};
+
+layout(std430, binding = 3) buffer SampleCounters {
+    sTileCounters tiles[];
+};
+
+// rays, samples, light samples, reference samples and terminated rays, low and high words
+layout(std430, binding = 4) writeonly buffer SampleTotals {
+    uvec2 totals[5];
+};
+
+uniform int u_num_tiles;
+
+shared uvec2 s_sums[256][5];
+
+void add(inout uvec2 total, uvec2 value)
+{
+    uint carry;
+    total.x = uaddCarry(total.x, value.x, carry);
+    total.y += value.y + carry;
+}
+
+void main()
+{
+    uint id = gl_LocalInvocationIndex;
+
+    // a single group strides over every tile, there are only a few thousand
+    uvec2 sums[5] = uvec2[5](uvec2(0u), uvec2(0u), uvec2(0u), uvec2(0u), uvec2(0u));
+    for (int i = int(id); i < u_num_tiles; i += 256) {
+        sTileCounters tile = tiles[i];
+        add(sums[0], uvec2(tile.rays & 0xFFFFu, 0u));
+        add(sums[1], uvec2(tile.samples, 0u));
+        add(sums[2], uvec2(tile.light_samples, 0u));
+        add(sums[3], uvec2(tile.reference_samples, 0u));
+        add(sums[4], uvec2(tile.rays >> 16, 0u));
+        tiles[i] = sTileCounters(0u, 0u, 0u, 0u);
+    }
+    for (int k = 0; k < 5; ++k)
+        s_sums[id][k] = sums[k];
+    memoryBarrierShared();
+    barrier();
+
+    for (uint stride = 128u; stride > 0u; stride >>= 1) {
+        if (id < stride)
+            for (int k = 0; k < 5; ++k)
+                add(s_sums[id][k], s_sums[id + stride][k]);
+        memoryBarrierShared();
+        barrier();
+    }
+
+    if (id == 0u)
+        for (int k = 0; k < 5; ++k)
+            totals[k] = s_sums[0][k];
+}
@@ -0,0 +1,54 @@
+#version 410 core
+
+// Blends a volume layer with its history (VolumePass).
+// The history is reprojected with the previous camera at the depth of the scene behind the pixel, the volumes have no single
+// depth so the reprojection is exact only for the camera rotation, the error of the translation is bounded by the clamp:
+// the history is limited to the range of the 3x3 neighbourhood of the new frame, so disoccluded and outdated values are rejected.
+
+in vec2 v_uv;
+
+uniform sampler2D u_current_texture; // premultiplied, jittered
+uniform sampler2D u_history_texture; // accumulated, linear filter
+uniform sampler2D u_depth_texture; // scene depth at the layer resolution
+uniform mat4 u_inverse_viewprojection;
+uniform mat4 u_previous_viewprojection;
+uniform bool u_history_valid;
+uniform bool u_clamp; // off for the progressive average, nothing moved
+uniform float u_blend; // weight of the new frame
+
+out vec4 FragColor;
+
+void main()
+{
+    ivec2 size = textureSize(u_current_texture, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 current = texelFetch(u_current_texture, texel, 0);
+    if (!u_history_valid) {
+        FragColor = current;
+        return;
+    }
+
+    vec4 low = current;
+    vec4 high = current;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            vec4 neighbour = texelFetch(u_current_texture, clamp(texel + ivec2(x, y), ivec2(0), size - 1), 0);
+            low = min(low, neighbour);
+            high = max(high, neighbour);
+        }
+    }
+
+    float depth = texelFetch(u_depth_texture, texel, 0).r;
+    vec4 world = u_inverse_viewprojection * vec4(v_uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 previous = u_previous_viewprojection * vec4(world.xyz / world.w, 1.0);
+    vec2 previous_uv = previous.xy / previous.w * 0.5 + 0.5;
+    if (previous.w <= 0.0 || any(lessThan(previous_uv, vec2(0.0))) || any(greaterThan(previous_uv, vec2(1.0)))) {
+        FragColor = current;
+        return;
+    }
+
+    vec4 history = texture(u_history_texture, previous_uv);
+    if (u_clamp)
+        history = clamp(history, low, high);
+    FragColor = mix(history, current, u_blend);
+}
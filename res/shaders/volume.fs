@@ -10,6 +10,7 @@ uniform vec3 u_camera_position;
 uniform float u_absorption;
 uniform vec4 u_background_color;
 uniform float u_step_size;
+uniform vec2 u_termination; // transmittance epsilon and russian roulette survival probability (see bunnycloud.fs)
 uniform int u_volume_type;
 uniform float u_noise_scale;
 uniform int u_noise_detail;
@@ -104,19 +105,28 @@ float homogeneousRayMarching(vec2 t){
     return optical_thickness;
 }
 
+float random(vec3 seed)
+{
+    return fract(sin(dot(seed, vec3(12.9898, 78.233, 37.719))) * 43758.5453);
+}
+
 float heterogeneousRayMarching(vec3 ray_position, vec3 ray_direction, vec2 t){
     vec3 p;
     float optical_thickness = 0.0;
     float absorption_coeffitient = 0.2;
-    for (float i=t.x; i<t.y; i+=u_step_size) {
+    float n = 0.0;
+    for (float i=max(t.x, 0.0); i<t.y; i+=u_step_size) {
         p = ray_position + i * ray_direction;
         absorption_coeffitient = cnoise(p, u_noise_scale, u_noise_detail);
         optical_thickness += absorption_coeffitient * u_absorption * u_step_size;
-        
-        // if (optical_thickness > 1.0) {
-        //     vec3 bg_col = vec3(u_background_color.x, u_background_color.y, u_background_color.z);
-        //     return vec4(bg_col, 1.0);
-        // }
+
+        // early termination with russian roulette: the survivors divide their transmittance by the probability
+        if (exp(-optical_thickness) < u_termination.x) {
+            if (random(vec3(gl_FragCoord.xy, n)) >= u_termination.y)
+                return 1e30; // no transmittance
+            optical_thickness += log(u_termination.y);
+        }
+        n += 1.0;
     }
     return optical_thickness;
 }
@@ -126,14 +136,15 @@ void main()
 {
     // 1. Compute the ray direction.
     vec3 ray_position = u_camera_position;
-    vec3 ray_direction = v_world_position - u_camera_position;
+    vec3 ray_direction = normalize(v_world_position - u_camera_position);
     float optical_thickness;
     // 2. Compute intersections with the volume auxiliary geometry.
-    vec2 t = intersectAABB(ray_position, normalize(ray_direction), vec3(-1.0, -1.0, -1.0), vec3(1.0, 1.0, 1.0));
+    vec2 t = intersectAABB(ray_position, ray_direction, vec3(-1.0, -1.0, -1.0), vec3(1.0, 1.0, 1.0));
 	if (t.x > t.y) {
         FragColor = vec4(0.0, 0.0, 0.0, 1.0);
         return;
     }
+    t.x = max(t.x, 0.0);
     if (u_volume_type == 0)
         optical_thickness = homogeneousRayMarching(t);
     else if (u_volume_type == 1) 
@@ -0,0 +1,82 @@
+#version 410 core
+
+// Transmittance of a volume towards the light, for the shadow atlas (a deep shadow of a single segment).
+// The ray from every back face fragment to the light is marched through the box: location 0 is multiplied into the
+// transmittance and location 1 keeps the closest start and the farthest end (negated) of the volumes with a min blend.
+// The depths are the ones the receivers compare: window depth for orthographic views, distance over the far plane for perspective ones.
+
+in vec3 v_position;
+in vec3 v_world_position;
+
+uniform mat4 u_model;
+uniform mat4 u_inverse_model;
+uniform mat4 u_viewprojection;
+uniform vec3 u_light_position;
+uniform vec3 u_light_direction; // where the light points
+uniform bool u_orthographic;
+uniform float u_far;
+uniform float u_extinction;
+uniform bool u_use_texture;
+uniform sampler3D u_texture;
+
+#define SHADOW_STEPS 64
+
+layout(location = 0) out vec4 Transmittance;
+layout(location = 1) out vec4 Range;
+
+float sampleDensity(vec3 p)
+{
+    if (u_use_texture)
+        return textureLod(u_texture, (p + 1.0) / 2.0, 0.0).r;
+    return 1.0;
+}
+
+vec2 intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
+    vec3 tMin = (boxMin - rayOrigin) / rayDir;
+    vec3 tMax = (boxMax - rayOrigin) / rayDir;
+    vec3 t1 = min(tMin, tMax);
+    vec3 t2 = max(tMin, tMax);
+    float tNear = max(max(t1.x, t1.y), t1.z);
+    float tFar = min(min(t2.x, t2.y), t2.z);
+    return vec2(tNear, tFar);
+}
+
+float getDepth(vec3 world_position)
+{
+    if (u_orthographic) {
+        vec4 clip = u_viewprojection * vec4(world_position, 1.0);
+        return clip.z / clip.w * 0.5 + 0.5;
+    }
+    return length(world_position - u_light_position) / u_far;
+}
+
+void main()
+{
+    // in the space of the box, like the raymarch of the volume
+    vec3 origin = v_position;
+    vec3 to_light;
+    float light_distance = 1e6;
+    if (u_orthographic)
+        to_light = normalize((u_inverse_model * vec4(-u_light_direction, 0.0)).xyz);
+    else {
+        to_light = (u_inverse_model * vec4(u_light_position, 1.0)).xyz - origin;
+        light_distance = length(to_light);
+        to_light /= light_distance;
+    }
+
+    // a light inside the box starts the segment
+    vec2 t = intersectAABB(origin, to_light, vec3(-1.0), vec3(1.0));
+    float t_start = max(t.x, 0.0);
+    float t_end = min(t.y, light_distance);
+    if (t_end <= t_start)
+        discard;
+
+    float dt = (t_end - t_start) / float(SHADOW_STEPS);
+    float optical_thickness = 0.0;
+    for (int i = 0; i < SHADOW_STEPS; i++)
+        optical_thickness += sampleDensity(origin + to_light * (t_start + (float(i) + 0.5) * dt)) * u_extinction * dt;
+
+    vec3 start = (u_model * vec4(origin + to_light * t_end, 1.0)).xyz;
+    Transmittance = vec4(exp(-optical_thickness));
+    Range = vec4(getDepth(start), -getDepth(v_world_position), 0.0, 0.0);
+}
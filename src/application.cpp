@@ -1,5 +1,17 @@
 #include "application.h"
 #include "../src/graphics/material.h"
+#include "../src/graphics/glstate.h"
+#include "../src/graphics/textureloader.h"
+#include "../src/framework/culling.h"
+#include "../src/framework/renderproxy.h"
+#include "../src/graphics/gpuculling.h"
+#include "../src/graphics/volumeprofiler.h"
+#include "../src/graphics/lightbuffer.h"
+#include "../src/graphics/lightgrid.h"
+#include "../src/graphics/shadowatlas.h"
+#include "../src/graphics/framegraph.h"
+#include "../src/graphics/texturepool.h"
+#include "../src/graphics/fbopool.h"
 
 bool render_wireframe = false;
 Camera* Application::camera = nullptr;
@@ -51,28 +63,147 @@ void Application::update(float dt)
         this->camera->orbit(-delta.x * dt, delta.y * dt);
     }
     this->lastMousePosition = this->mousePosition;
+
+    // finish the shaders compiled and the textures decoded in background
+    Shader::UpdatePending();
+    TextureLoader::update();
+
+    // world matrices of the nodes moved this frame, copy them to the render proxies and refit the hierarchy with their new bounds
+    TransformHierarchy::Get()->update();
+    RenderProxies::Get()->sync(this->node_list);
+    this->bvh.update(this->node_list);
 }
 
 void Application::render()
 {
-    // set the clear color (the background color)
-    glClearColor(this->background_color.r, this->background_color.g, this->background_color.b, this->background_color.a);
-    // Clear the window and the depth buffer
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    GLState::newFrame();
+    VolumeProfiler::newFrame();
+    TexturePool::newFrame();
+    FBOPool::newFrame();
 
-    // set flags
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    // only the proxies inside the camera frustum are queued
+    RenderProxies* proxies = RenderProxies::Get();
+    // (with GPU culling every proxy is queued, the opaque batches are culled by a compute shader)
+    static std::vector<uint32_t> visible;
+    if (GPUCulling::isActive())
+        Culling::gatherVisible(*proxies, visible);
+    else
+        Culling::cullProxies(*proxies, this->camera, visible, &this->bvh);
+    this->render_queue.build(*proxies, visible, this->camera);
 
-    for (unsigned int i = 0; i < this->node_list.size(); i++)
-    {
-        this->node_list[i]->render(this->camera);
+    // the passes of the frame, the graph culls the ones nobody reads and orders the rest
+    FrameGraph& graph = this->frame_graph;
+    tFrameResource color = graph.importResource("Backbuffer Color", true);
+    tFrameResource depth = graph.importResource("Backbuffer Depth", true);
+    tFrameResource shadows = graph.importResource("Shadow Atlas");
+    tFrameResource lights = graph.importResource("Light Buffer");
+    tFrameResource hiz = graph.importResource("Hi-Z", true); // read by the next frame
 
-        if (this->flag_wireframe) this->node_list[i]->renderWireframe(this->camera);
-    }
+    // the shadow maps that changed, within the budget of the frame
+    graph.addPass("Shadows",
+        [&](FrameGraph::Builder& builder) { builder.write(shadows); },
+        [this, proxies](FrameGraph&) { ShadowAtlas::update(this->light_list, this->camera, *proxies, &this->bvh); });
+
+    // every material reads the lights from the same buffer, uploaded once, and the opaque ones find theirs in the grid
+    graph.addPass("Lights",
+        [&](FrameGraph::Builder& builder) { builder.write(lights); },
+        [this](FrameGraph&) {
+            LightBuffer::update(this->light_list);
+            LightGrid::update(this->camera);
+        });
+
+    graph.addPass("Opaque",
+        [&](FrameGraph::Builder& builder) {
+            builder.read(shadows);
+            builder.read(lights);
+            builder.read(hiz); // the one of the previous frame culls the batches
+            builder.write(color);
+            builder.write(depth);
+        },
+        [this, proxies](FrameGraph&) {
+            // set the clear color (the background color)
+            glClearColor(this->background_color.r, this->background_color.g, this->background_color.b, this->background_color.a);
+            // Clear the window and the depth buffer (the mask is off after the transparent pass)
+            GLState::depthMask(true);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            // set flags
+            GLState::enable(GL_DEPTH_TEST);
+            GLState::enable(GL_CULL_FACE);
+
+            this->render_queue.submit(*proxies, RENDER_PASS_OPAQUE, this->camera);
+        });
+
+    // a single copy of the opaque depth, for the Hi-Z and for the volumes at reduced resolution
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    tFrameResource scene_depth = FRAMEGRAPH_NO_RESOURCE;
+    graph.addPass("Scene Depth",
+        [&](FrameGraph::Builder& builder) {
+            sTextureDesc desc;
+            desc.width = viewport[2];
+            desc.height = viewport[3];
+            desc.format = GL_DEPTH_COMPONENT;
+            desc.type = GL_UNSIGNED_INT;
+            desc.internal_format = GL_DEPTH_COMPONENT24;
+            builder.read(depth);
+            scene_depth = builder.create("Scene Depth", desc);
+        },
+        [&scene_depth](FrameGraph& graph) {
+            Texture* texture = graph.getTexture(scene_depth);
+            texture->bind();
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, (int)texture->width, (int)texture->height);
+            texture->unbind();
+        });
 
-    // Draw the floor grid
-    if (this->flag_grid) drawGrid();
+    // occluders for the GPU culling of the next frame
+    bool uses_hiz = GPUCulling::usesHiZ();
+    graph.addPass("Hi-Z",
+        [&](FrameGraph::Builder& builder) {
+            if (uses_hiz)
+                builder.read(scene_depth);
+            builder.write(hiz);
+        },
+        [this, uses_hiz, &scene_depth](FrameGraph& graph) { GPUCulling::buildHiZ(this->camera, uses_hiz ? graph.getTexture(scene_depth) : NULL); });
+
+    // Draw the floor grid, it does not write depth so the volumes still blend over it
+    graph.addPass("Grid",
+        [&](FrameGraph::Builder& builder) {
+            if (!this->flag_grid)
+                return;
+            builder.read(depth);
+            builder.write(color);
+        },
+        [](FrameGraph&) { drawGrid(); });
+
+    bool volumes_depth = this->volume_pass.needsSceneDepth(this->render_queue, *proxies);
+    graph.addPass("Volumes",
+        [&](FrameGraph::Builder& builder) {
+            builder.read(lights);
+            builder.read(shadows);
+            builder.read(depth);
+            if (volumes_depth)
+                builder.read(scene_depth);
+            builder.write(color);
+        },
+        [this, proxies, &scene_depth](FrameGraph& graph) { this->volume_pass.render(this->render_queue, *proxies, this->camera, graph.getTexture(scene_depth)); });
+
+    // overlays go through the nodes, they are only a few
+    graph.addPass("Overlays",
+        [&](FrameGraph::Builder& builder) {
+            builder.read(depth);
+            builder.write(color);
+        },
+        [this, proxies](FrameGraph&) {
+            for (uint32_t index : visible)
+            {
+                SceneNode* node = proxies->nodes[index];
+                if (this->flag_wireframe || node == this->selected_node) node->renderWireframe(this->camera);
+            }
+        });
+
+    graph.compile();
+    graph.execute();
 }
 
 void Application::renderGUI()
@@ -88,6 +219,82 @@ void Application::renderGUI()
             ImGui::TreePop();
         }
 
+        if (ImGui::TreeNode("GL State")) {
+            GLState::renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Texture Streaming")) {
+            TextureLoader::renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Transforms")) {
+            TransformHierarchy::Get()->renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Render Proxies")) {
+            RenderProxies::Get()->renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Render Queue")) {
+            this->render_queue.renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Culling")) {
+            Culling::renderInMenu();
+            if (ImGui::TreeNode("GPU")) {
+                GPUCulling::renderInMenu();
+                ImGui::TreePop();
+            }
+            if (ImGui::TreeNode("BVH")) {
+                this->bvh.renderInMenu();
+                ImGui::TreePop();
+            }
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Lights")) {
+            LightBuffer::renderInMenu();
+            if (ImGui::TreeNode("Clustered Grid")) {
+                LightGrid::renderInMenu();
+                ImGui::TreePop();
+            }
+            if (ImGui::TreeNode("Shadows")) {
+                ShadowAtlas::renderInMenu();
+                ImGui::TreePop();
+            }
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Frame Graph")) {
+            this->frame_graph.renderInMenu();
+            if (ImGui::TreeNode("Texture Pool")) {
+                TexturePool::renderInMenu();
+                ImGui::TreePop();
+            }
+            if (ImGui::TreeNode("FBO Pool")) {
+                FBOPool::renderInMenu();
+                ImGui::TreePop();
+            }
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Volume Pass")) {
+            this->volume_pass.renderInMenu();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Volume Samples")) {
+            VolumeProfiler::renderInMenu();
+            ImGui::TreePop();
+        }
+
+        ImGui::Text("Selected: %s", this->selected_node ? this->selected_node->name.c_str() : "none");
+
         unsigned int count = 0;
         std::stringstream ss;
         for (auto& node : this->node_list) {
@@ -103,6 +310,27 @@ void Application::renderGUI()
 
 void Application::shutdown() { }
 
+// called from the main loop when the framebuffer size changes
+void Application::onResize(int width, int height)
+{
+    this->window_width = width;
+    this->window_height = height;
+    this->camera->setAspectRatio(width / (float)height);
+    this->camera->updateProjectionMatrix();
+
+    // the offscreen targets of the old size are not reused, they are deleted instead of waiting to go idle
+    TexturePool::onResize();
+    FBOPool::onResize();
+}
+
+SceneNode* Application::pickNode(const glm::vec2& position)
+{
+    glm::vec3 origin, direction;
+    ImVec2 window_size = ImGui::GetIO().DisplaySize; // mouse positions are in window coordinates, not framebuffer pixels
+    this->camera->getRay(position.x, position.y, window_size.x, window_size.y, origin, direction);
+    return this->bvh.raycast(origin, direction);
+}
+
 // keycodes: https://www.glfw.org/docs/3.3/group__keys.html
 void Application::onKeyDown(int key, int scancode)
 {
@@ -142,12 +370,17 @@ void Application::onLeftMouseDown()
 {
     this->dragging = true;
     this->lastMousePosition = this->mousePosition;
+    this->clickPosition = this->mousePosition;
 }
 
 void Application::onLeftMouseUp()
 {
     this->dragging = false;
     this->lastMousePosition = this->mousePosition;
+
+    // a click without dragging selects the node under the mouse
+    if (glm::length(this->mousePosition - this->clickPosition) < 3.f)
+        this->selected_node = pickNode(this->mousePosition);
 }
 
 void Application::onMiddleMouseDown() { }
@@ -4,6 +4,10 @@
 #include "framework/camera.h"
 #include "framework/scenenode.h"
 #include "framework/light.h"
+#include "framework/bvh.h"
+#include "graphics/renderqueue.h"
+#include "graphics/volumepass.h"
+#include "graphics/framegraph.h"
 
 #include <glm/vec2.hpp>
 
@@ -17,6 +21,12 @@ public:
 	glm::vec4 ambient_light;
 	std::vector<Light*> light_list;
 
+	SceneBVH bvh; // over node_list, updated every frame
+	RenderQueue render_queue; // visible proxies of the frame, sorted by state and depth
+	VolumePass volume_pass; // transparent draws, at reduced resolution when their material asks for it
+	FrameGraph frame_graph; // passes of the frame, declared again every frame
+	SceneNode* selected_node = NULL; // picked with the left click
+
 	int window_width;
 	int window_height;
 
@@ -27,6 +37,7 @@ public:
 	bool dragging;
 	glm::vec2 mousePosition;
 	glm::vec2 lastMousePosition;
+	glm::vec2 clickPosition;
 	glm::vec4 background_color = glm::vec4(1.0f, 0.1f, 0.1f, 1.0f);
 
 	void init(GLFWwindow* window);
@@ -35,6 +46,9 @@ public:
 	void renderGUI();
 	void shutdown();
 
+	SceneNode* pickNode(const glm::vec2& position);
+
+	void onResize(int width, int height);
 	void onKeyDown(int key, int scancode);
 	void onKeyUp(int key, int scancode);
 	void onRightMouseDown();
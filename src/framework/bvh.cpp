@@ -0,0 +1,504 @@
+#include "bvh.h"
+
+#include "scenenode.h"
+#include "culling.h"
+#include "../graphics/collision.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+static float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 size = glm::max(max - min, glm::vec3(0.f));
+	return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// slab test, returns the entry distance or FLT_MAX if the box is missed
+static float intersectBox(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin, const glm::vec3& inv_dir, float max_t)
+{
+	glm::vec3 t0 = (min - origin) * inv_dir;
+	glm::vec3 t1 = (max - origin) * inv_dir;
+	glm::vec3 tmin = glm::min(t0, t1);
+	glm::vec3 tmax = glm::max(t0, t1);
+	float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.f));
+	float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, max_t));
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+static bool overlaps(const glm::vec3& min_a, const glm::vec3& max_a, const glm::vec3& min_b, const glm::vec3& max_b)
+{
+	return min_a.x <= max_b.x && max_a.x >= min_b.x && min_a.y <= max_b.y && max_a.y >= min_b.y && min_a.z <= max_b.z && max_a.z >= min_b.z;
+}
+
+void SceneBVH::clear()
+{
+	this->nodes.clear();
+	this->node_indices.clear();
+	this->parents.clear();
+	this->leaf_of.clear();
+	this->scene_nodes.clear();
+	this->box_min.clear();
+	this->box_max.clear();
+}
+
+void SceneBVH::build(const std::vector<SceneNode*>& scene_nodes)
+{
+	clear();
+	this->scene_nodes = scene_nodes;
+	this->box_min.resize(scene_nodes.size());
+	this->box_max.resize(scene_nodes.size());
+	this->leaf_of.assign(scene_nodes.size(), -1);
+
+	//only nodes with geometry have bounds
+	for (int i = 0; i < (int)scene_nodes.size(); ++i)
+	{
+		SceneNode* node = scene_nodes[i];
+		if (!node->mesh)
+			continue;
+		node->updateBounds();
+		this->box_min[i] = node->world_box.center - node->world_box.halfsize;
+		this->box_max[i] = node->world_box.center + node->world_box.halfsize;
+		this->node_indices.push_back(i);
+	}
+
+	this->stats.depth = 0;
+	if (!this->node_indices.empty())
+	{
+		this->nodes.reserve(this->node_indices.size() * 2);
+		this->nodes.push_back(sNode());
+		this->parents.push_back(-1);
+		buildRecursive(0, 0, (int)this->node_indices.size(), 1);
+	}
+
+	for (int i = 0; i < (int)this->nodes.size(); ++i)
+		if (this->nodes[i].count)
+			for (int j = 0; j < this->nodes[i].count; ++j)
+				this->leaf_of[this->node_indices[this->nodes[i].first + j]] = i;
+
+	this->stats.num_nodes = (int)this->nodes.size();
+	this->stats.rebuilds++;
+	this->stats.refits = 0;
+	this->stats.build_sah_cost = this->stats.sah_cost = computeSAHCost();
+}
+
+void SceneBVH::buildRecursive(int index, int first, int count, int depth)
+{
+	this->stats.depth = std::max(this->stats.depth, depth);
+
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+	glm::vec3 centroid_min(FLT_MAX), centroid_max(-FLT_MAX);
+	for (int i = first; i < first + count; ++i)
+	{
+		int n = this->node_indices[i];
+		min = glm::min(min, this->box_min[n]);
+		max = glm::max(max, this->box_max[n]);
+		glm::vec3 centroid = (this->box_min[n] + this->box_max[n]) * 0.5f;
+		centroid_min = glm::min(centroid_min, centroid);
+		centroid_max = glm::max(centroid_max, centroid);
+	}
+
+	sNode& node = this->nodes[index];
+	node.min = min;
+	node.max = max;
+	node.first = first;
+	node.count = count;
+
+	if (count <= 1)
+		return;
+
+	//binned SAH: centroids are put in buckets along every axis and the best boundary between buckets is chosen
+	struct sBin { glm::vec3 min = glm::vec3(FLT_MAX); glm::vec3 max = glm::vec3(-FLT_MAX); int count = 0; };
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_split = 0;
+	glm::vec3 extent = centroid_max - centroid_min;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (extent[axis] <= 0.f)
+			continue;
+
+		sBin bins[BVH_NUM_BINS];
+		float scale = BVH_NUM_BINS / extent[axis];
+		for (int i = first; i < first + count; ++i)
+		{
+			int n = this->node_indices[i];
+			float centroid = (this->box_min[n][axis] + this->box_max[n][axis]) * 0.5f;
+			int b = std::min(BVH_NUM_BINS - 1, (int)((centroid - centroid_min[axis]) * scale));
+			bins[b].count++;
+			bins[b].min = glm::min(bins[b].min, this->box_min[n]);
+			bins[b].max = glm::max(bins[b].max, this->box_max[n]);
+		}
+
+		//sweep from the right storing the cost of every suffix, then from the left
+		float right_area[BVH_NUM_BINS];
+		int right_count[BVH_NUM_BINS];
+		glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+		int accum = 0;
+		for (int b = BVH_NUM_BINS - 1; b > 0; --b)
+		{
+			bmin = glm::min(bmin, bins[b].min);
+			bmax = glm::max(bmax, bins[b].max);
+			accum += bins[b].count;
+			right_area[b] = accum ? surfaceArea(bmin, bmax) : 0.f;
+			right_count[b] = accum;
+		}
+
+		bmin = glm::vec3(FLT_MAX);
+		bmax = glm::vec3(-FLT_MAX);
+		accum = 0;
+		for (int b = 0; b < BVH_NUM_BINS - 1; ++b)
+		{
+			bmin = glm::min(bmin, bins[b].min);
+			bmax = glm::max(bmax, bins[b].max);
+			accum += bins[b].count;
+			if (!accum || !right_count[b + 1])
+				continue;
+			float cost = accum * surfaceArea(bmin, bmax) + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b + 1;
+			}
+		}
+	}
+
+	//small groups stay as a leaf when splitting does not pay
+	float leaf_cost = count * surfaceArea(min, max);
+	if (count <= BVH_MAX_LEAF_SIZE && (best_axis == -1 || best_cost >= leaf_cost))
+		return;
+
+	//past some depth the list is just split in halves, so the traversal stacks can not overflow
+	int middle = first + count / 2;
+	if (best_axis != -1 && depth < BVH_MAX_DEPTH / 2)
+	{
+		float scale = BVH_NUM_BINS / extent[best_axis];
+		float base = centroid_min[best_axis];
+		int* begin = &this->node_indices[first];
+		int* split = std::partition(begin, begin + count, [&](int n) {
+			float centroid = (this->box_min[n][best_axis] + this->box_max[n][best_axis]) * 0.5f;
+			return std::min(BVH_NUM_BINS - 1, (int)((centroid - base) * scale)) < best_split;
+		});
+		middle = first + (int)(split - begin);
+	}
+	//else all the centroids are in the same place, split the list in two halves
+
+	int left = (int)this->nodes.size();
+	this->nodes[index].first = left;
+	this->nodes[index].count = 0;
+	this->nodes.push_back(sNode());
+	this->nodes.push_back(sNode());
+	this->parents.push_back(index);
+	this->parents.push_back(index);
+
+	buildRecursive(left, first, middle - first, depth + 1);
+	buildRecursive(left + 1, middle, first + count - middle, depth + 1);
+}
+
+void SceneBVH::update(const std::vector<SceneNode*>& scene_nodes)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	//nodes added, removed or with a mesh assigned need a new tree, it is checked in the same pass that refreshes the bounds
+	bool rebuild = scene_nodes.size() != this->scene_nodes.size();
+	this->changed.clear();
+	for (int i = 0; !rebuild && i < (int)scene_nodes.size(); ++i)
+	{
+		SceneNode* node = scene_nodes[i];
+		if (node != this->scene_nodes[i] || (node->mesh != NULL) != (this->leaf_of[i] != -1))
+			rebuild = true;
+		else if (this->leaf_of[i] != -1 && node->updateBounds())
+		{
+			this->box_min[i] = node->world_box.center - node->world_box.halfsize;
+			this->box_max[i] = node->world_box.center + node->world_box.halfsize;
+			this->changed.push_back(i);
+		}
+	}
+
+	if (rebuild)
+		build(scene_nodes);
+	else if (!this->changed.empty())
+	{
+		//few changes walk up from their leaves, many of them are cheaper with a single pass over the whole tree
+		if (this->changed.size() * this->stats.depth < this->nodes.size())
+		{
+			for (int n : this->changed)
+				for (int index = this->leaf_of[n]; index != -1; index = this->parents[index])
+					refitNode(index);
+		}
+		else
+			refitFull();
+
+		this->stats.refits++;
+		this->stats.sah_cost = (float)(this->sah_sum / std::max(surfaceArea(this->nodes[0].min, this->nodes[0].max), 1e-6f));
+		if (this->stats.sah_cost > this->stats.build_sah_cost * this->rebuild_ratio)
+			build(scene_nodes);
+	}
+
+	this->stats.maintenance_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void SceneBVH::refitNode(int index)
+{
+	sNode& node = this->nodes[index];
+	float weight = (float)(node.count ? node.count : 1);
+	this->sah_sum -= surfaceArea(node.min, node.max) * weight;
+
+	if (node.count)
+	{
+		node.min = glm::vec3(FLT_MAX);
+		node.max = glm::vec3(-FLT_MAX);
+		for (int i = node.first; i < node.first + node.count; ++i)
+		{
+			node.min = glm::min(node.min, this->box_min[this->node_indices[i]]);
+			node.max = glm::max(node.max, this->box_max[this->node_indices[i]]);
+		}
+	}
+	else
+	{
+		const sNode& left = this->nodes[node.first];
+		const sNode& right = this->nodes[node.first + 1];
+		node.min = glm::min(left.min, right.min);
+		node.max = glm::max(left.max, right.max);
+	}
+
+	//the cost is kept up to date here, so checking the quality of the tree does not need to visit all of it
+	this->sah_sum += surfaceArea(node.min, node.max) * weight;
+}
+
+void SceneBVH::refitFull()
+{
+	//children are always stored after their parent, going backwards refits bottom-up
+	for (int i = (int)this->nodes.size() - 1; i >= 0; --i)
+		refitNode(i);
+}
+
+float SceneBVH::computeSAHCost()
+{
+	this->sah_sum = 0.0;
+	if (this->nodes.empty())
+		return 0.f;
+
+	for (const sNode& node : this->nodes)
+		this->sah_sum += surfaceArea(node.min, node.max) * (node.count ? node.count : 1);
+	return (float)(this->sah_sum / std::max(surfaceArea(this->nodes[0].min, this->nodes[0].max), 1e-6f));
+}
+
+void SceneBVH::addSubtree(int index, std::vector<int>& out_indices) const
+{
+	const sNode& node = this->nodes[index];
+	if (node.count)
+	{
+		for (int i = node.first; i < node.first + node.count; ++i)
+			out_indices.push_back(this->node_indices[i]);
+		return;
+	}
+	addSubtree(node.first, out_indices);
+	addSubtree(node.first + 1, out_indices);
+}
+
+void SceneBVH::cullFrustum(const Frustum& frustum, std::vector<int>& out_indices) const
+{
+	if (this->nodes.empty())
+		return;
+
+	//every entry carries the planes still to test, a subtree fully inside a plane skips it for all its children
+	struct sEntry { int index; int planes; };
+	sEntry stack[BVH_MAX_DEPTH * 2];
+	int size = 0;
+	stack[size++] = { 0, 0x3F };
+
+	while (size)
+	{
+		sEntry entry = stack[--size];
+		const sNode& node = this->nodes[entry.index];
+		glm::vec3 center = (node.min + node.max) * 0.5f;
+		glm::vec3 halfsize = (node.max - node.min) * 0.5f;
+
+		bool outside = false;
+		int planes = entry.planes;
+		for (int p = 0; p < 6 && !outside; ++p)
+		{
+			if (!(planes & (1 << p)))
+				continue;
+			glm::vec3 normal = glm::vec3(frustum.planes[p]);
+			float distance = glm::dot(normal, center) + frustum.planes[p].w;
+			float extent = glm::dot(glm::abs(normal), halfsize);
+			if (distance + extent < 0.f)
+				outside = true;
+			else if (distance - extent >= 0.f)
+				planes &= ~(1 << p);
+		}
+
+		if (outside)
+			continue;
+		if (!planes || node.count)
+		{
+			//leaves are checked again with the bounds of every node, a leaf box contains several of them
+			if (node.count && planes)
+			{
+				for (int i = node.first; i < node.first + node.count; ++i)
+				{
+					int n = this->node_indices[i];
+					SceneNode* scene_node = this->scene_nodes[n];
+					if (frustum.testSphere(glm::vec3(scene_node->world_sphere), scene_node->world_sphere.w) && frustum.testBox(scene_node->world_box))
+						out_indices.push_back(n);
+				}
+			}
+			else
+				addSubtree(entry.index, out_indices);
+			continue;
+		}
+
+		stack[size++] = { node.first, planes };
+		stack[size++] = { node.first + 1, planes };
+	}
+}
+
+void SceneBVH::queryBox(const BoundingBox& box, std::vector<int>& out_indices) const
+{
+	if (this->nodes.empty())
+		return;
+
+	glm::vec3 min = box.center - box.halfsize;
+	glm::vec3 max = box.center + box.halfsize;
+	int stack[BVH_MAX_DEPTH * 2];
+	int size = 0;
+	stack[size++] = 0;
+
+	while (size)
+	{
+		const sNode& node = this->nodes[stack[--size]];
+		if (!overlaps(node.min, node.max, min, max))
+			continue;
+		if (node.count)
+		{
+			for (int i = node.first; i < node.first + node.count; ++i)
+			{
+				int n = this->node_indices[i];
+				if (overlaps(this->box_min[n], this->box_max[n], min, max))
+					out_indices.push_back(n);
+			}
+			continue;
+		}
+		stack[size++] = node.first;
+		stack[size++] = node.first + 1;
+	}
+}
+
+void SceneBVH::querySphere(const glm::vec3& center, float radius, std::vector<int>& out_indices) const
+{
+	if (this->nodes.empty())
+		return;
+
+	//distance from the center to the closest point of the box
+	float radius2 = radius * radius;
+	auto touches = [&](const glm::vec3& min, const glm::vec3& max) {
+		glm::vec3 closest = glm::clamp(center, min, max);
+		glm::vec3 delta = closest - center;
+		return glm::dot(delta, delta) <= radius2;
+	};
+
+	int stack[BVH_MAX_DEPTH * 2];
+	int size = 0;
+	stack[size++] = 0;
+
+	while (size)
+	{
+		const sNode& node = this->nodes[stack[--size]];
+		if (!touches(node.min, node.max))
+			continue;
+		if (node.count)
+		{
+			for (int i = node.first; i < node.first + node.count; ++i)
+			{
+				int n = this->node_indices[i];
+				if (touches(this->box_min[n], this->box_max[n]))
+					out_indices.push_back(n);
+			}
+			continue;
+		}
+		stack[size++] = node.first;
+		stack[size++] = node.first + 1;
+	}
+}
+
+SceneNode* SceneBVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float max_t, float* out_t) const
+{
+	if (this->nodes.empty())
+		return NULL;
+
+	glm::vec3 inv_dir = 1.f / direction;
+	SceneNode* closest = NULL;
+	float closest_t = max_t;
+
+	int stack[BVH_MAX_DEPTH * 2];
+	int size = 0;
+	if (intersectBox(this->nodes[0].min, this->nodes[0].max, origin, inv_dir, closest_t) != FLT_MAX)
+		stack[size++] = 0;
+
+	while (size)
+	{
+		const sNode& node = this->nodes[stack[--size]];
+
+		if (node.count)
+		{
+			for (int i = node.first; i < node.first + node.count; ++i)
+			{
+				SceneNode* scene_node = this->scene_nodes[this->node_indices[i]];
+				if (!scene_node->visible)
+					continue;
+
+				//the world AABB is loose for rotated nodes, the ray is moved to local space and tested with the mesh box,
+				//then with the triangles of the mesh
+				glm::mat4 inverse_model = glm::inverse(scene_node->getGlobalMatrix());
+				glm::vec3 local_origin = inverse_model * glm::vec4(origin, 1.f);
+				glm::vec3 local_dir = inverse_model * glm::vec4(direction, 0.f); // not normalized, so t is the same in both spaces
+				Mesh* mesh = scene_node->mesh;
+				float t = intersectBox(mesh->box.center - mesh->box.halfsize, mesh->box.center + mesh->box.halfsize, local_origin, 1.f / local_dir, closest_t);
+				if (t >= closest_t)
+					continue;
+
+				glm::vec3 normal;
+				if (mesh->createCollisionModel() && !mesh->collision_model->testRay(local_origin, local_dir, closest_t, t, normal))
+					continue;
+
+				closest_t = t;
+				closest = scene_node;
+			}
+			continue;
+		}
+
+		//visit the closest child first so the other one can be discarded by the distance
+		const sNode& left = this->nodes[node.first];
+		const sNode& right = this->nodes[node.first + 1];
+		float t_left = intersectBox(left.min, left.max, origin, inv_dir, closest_t);
+		float t_right = intersectBox(right.min, right.max, origin, inv_dir, closest_t);
+		if (t_left > t_right)
+		{
+			if (t_left != FLT_MAX) stack[size++] = node.first;
+			stack[size++] = node.first + 1;
+		}
+		else
+		{
+			if (t_right != FLT_MAX) stack[size++] = node.first + 1;
+			if (t_left != FLT_MAX) stack[size++] = node.first;
+		}
+	}
+
+	if (out_t)
+		*out_t = closest_t;
+	return closest;
+}
+
+void SceneBVH::renderInMenu()
+{
+	ImGui::Text("Nodes: %d (depth %d)", this->stats.num_nodes, this->stats.depth);
+	ImGui::Text("SAH cost: %.2f (built %.2f)", this->stats.sah_cost, this->stats.build_sah_cost);
+	ImGui::Text("Rebuilds: %d, refits since: %d", this->stats.rebuilds, this->stats.refits);
+	ImGui::Text("Maintenance: %.3f ms", this->stats.maintenance_time);
+	ImGui::SliderFloat("Rebuild ratio", &this->rebuild_ratio, 1.1f, 4.f);
+}
@@ -0,0 +1,77 @@
+/*
+	Dynamic bounding volume hierarchy over the world bounds of the scene nodes.
+	Built with binned SAH, refitted when nodes move and rebuilt when the node list changes or the tree gets too loose.
+	Used for frustum culling, ray picking and range queries.
+*/
+
+#pragma once
+
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/matrix.hpp>
+
+class SceneNode;
+class Frustum;
+class BoundingBox;
+
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_NUM_BINS 12
+#define BVH_MAX_DEPTH 64
+
+class SceneBVH
+{
+public:
+	struct sNode {
+		glm::vec3 min;
+		int first; // leaf: first index in node_indices, internal: left child (right child is first + 1)
+		glm::vec3 max;
+		int count; // number of scene nodes in a leaf, 0 for internal nodes
+	};
+
+	struct sStats {
+		int num_nodes = 0;
+		int depth = 0;
+		int rebuilds = 0;
+		int refits = 0; // since the last build
+		float sah_cost = 0.f; // relative to the root area
+		float build_sah_cost = 0.f;
+		double maintenance_time = 0.0; // ms spent in the last update
+	};
+
+	float rebuild_ratio = 1.5f; // rebuild when the SAH cost grows this much after refits
+	sStats stats;
+
+	// refreshes the bounds of the nodes and refits the tree, rebuilds it when the list is different from the last call
+	void update(const std::vector<SceneNode*>& scene_nodes);
+	void build(const std::vector<SceneNode*>& scene_nodes);
+	void clear();
+
+	// the queries return indices in the list passed to update()
+	void cullFrustum(const Frustum& frustum, std::vector<int>& out_indices) const;
+	void queryBox(const BoundingBox& box, std::vector<int>& out_indices) const;
+	void querySphere(const glm::vec3& center, float radius, std::vector<int>& out_indices) const;
+
+	// closest node hit by the ray (tested with its triangles), NULL if none, t is the distance in units of direction
+	SceneNode* raycast(const glm::vec3& origin, const glm::vec3& direction, float max_t = 1e20f, float* out_t = NULL) const;
+
+	void renderInMenu();
+
+private:
+	std::vector<sNode> nodes;
+	std::vector<int> node_indices; // scene node index of every leaf entry
+	std::vector<int> parents;
+	std::vector<int> leaf_of; // leaf that contains every scene node, -1 if not in the tree
+
+	std::vector<SceneNode*> scene_nodes; // copy of the list used to build
+	std::vector<glm::vec3> box_min; // world bounds of every scene node
+	std::vector<glm::vec3> box_max;
+	std::vector<int> changed;
+	double sah_sum = 0.0; // sum of the areas weighted by the nodes below, refitNode keeps it updated
+
+	void buildRecursive(int index, int first, int count, int depth);
+	void refitFull();
+	void refitNode(int index);
+	float computeSAHCost(); // recomputes sah_sum from scratch, returns it relative to the root area
+	void addSubtree(int index, std::vector<int>& out_indices) const;
+};
@@ -34,6 +34,17 @@ glm::vec3 Camera::projectVector(glm::vec3 pos, bool& negZ)
 		return glm::vec3(result.x, result.y, result.z) / result.w;
 }
 
+void Camera::getRay(float x, float y, float window_width, float window_height, glm::vec3& origin, glm::vec3& direction)
+{
+	// unproject the pixel at the near and far planes, works for both projections
+	glm::vec2 ndc(x / window_width * 2.f - 1.f, 1.f - y / window_height * 2.f);
+	glm::mat4 inverse_vp = glm::inverse(viewprojection_matrix);
+	glm::vec4 near_point = inverse_vp * glm::vec4(ndc.x, ndc.y, -1.f, 1.f);
+	glm::vec4 far_point = inverse_vp * glm::vec4(ndc.x, ndc.y, 1.f, 1.f);
+	origin = glm::vec3(near_point) / near_point.w;
+	direction = glm::normalize(glm::vec3(far_point) / far_point.w - origin);
+}
+
 void Camera::rotate(float angle, const glm::vec3& axis)
 {
 	glm::vec3 front = center - eye;
@@ -234,7 +245,10 @@ void Camera::updateProjectionMatrix()
 
 void Camera::updateViewProjectionMatrix()
 {
-	viewprojection_matrix = projection_matrix * view_matrix;
+	glm::mat4 viewprojection = projection_matrix * view_matrix;
+	if (viewprojection != viewprojection_matrix)
+		version++;
+	viewprojection_matrix = viewprojection;
 }
 
 glm::mat4 Camera::getViewProjectionMatrix()
@@ -35,6 +35,7 @@ public:
 	glm::mat4 view_matrix;
 	glm::mat4 projection_matrix;
 	glm::mat4 viewprojection_matrix;
+	unsigned int version = 0; // increased every time the viewprojection changes, consumers compare it with the one they saw
 
 	Camera();
 
@@ -56,6 +57,9 @@ public:
 	// so it does not have to be rendered!
 	glm::vec3 projectVector(glm::vec3 pos, bool& negZ);
 
+	// Ray going through a pixel of the window (y down), from the near plane, direction normalized
+	void getRay(float x, float y, float window_width, float window_height, glm::vec3& origin, glm::vec3& direction);
+
 	// Set the info for each projection
 	void setPerspective(float fov, float aspect, float near_plane, float far_plane);
 	void setOrthographic(float left, float right, float top, float bottom, float near_plane, float far_plane);
@@ -0,0 +1,170 @@
+#include "culling.h"
+
+#include "camera.h"
+#include "scenenode.h"
+#include "bvh.h"
+#include "renderproxy.h"
+
+#include "includes.h"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define CULLING_SSE
+	#include <xmmintrin.h>
+#endif
+
+bool Culling::enabled = true;
+bool Culling::use_bvh = true;
+Culling::sCounters Culling::counters;
+
+void Frustum::fromMatrix(const glm::mat4& m)
+{
+	//rows of the matrix (glm is column major)
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	this->planes[LEFT] = row3 + row0;
+	this->planes[RIGHT] = row3 - row0;
+	this->planes[BOTTOM] = row3 + row1;
+	this->planes[TOP] = row3 - row1;
+	this->planes[NEAR_PLANE] = row3 + row2;
+	this->planes[FAR_PLANE] = row3 - row2;
+
+	for (int i = 0; i < 6; ++i)
+		this->planes[i] /= glm::length(glm::vec3(this->planes[i]));
+}
+
+bool Frustum::testSphere(const glm::vec3& center, float radius) const
+{
+	for (int i = 0; i < 6; ++i)
+		if (glm::dot(glm::vec3(this->planes[i]), center) + this->planes[i].w < -radius)
+			return false;
+	return true;
+}
+
+bool Frustum::testBox(const BoundingBox& box) const
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		glm::vec3 normal = glm::vec3(this->planes[i]);
+		float distance = glm::dot(normal, box.center) + this->planes[i].w;
+		float extent = glm::dot(glm::abs(normal), box.halfsize);
+		if (distance + extent < 0.f)
+			return false;
+	}
+	return true;
+}
+
+void Culling::cullProxies(const RenderProxies& proxies, Camera* camera, std::vector<uint32_t>& visible, const SceneBVH* bvh)
+{
+	static std::vector<uint8_t> inside; // reused every frame
+
+	visible.clear();
+	counters = sCounters();
+
+	int size = proxies.size();
+	const uint8_t* flags = proxies.flags.data();
+
+	if (!enabled)
+	{
+		gatherVisible(proxies, visible);
+		counters.tested = counters.visible = (int)visible.size();
+		return;
+	}
+
+	Frustum frustum;
+	frustum.fromMatrix(camera->viewprojection_matrix);
+	inside.assign(proxies.paddedSize(), 0);
+
+	if (bvh && use_bvh)
+	{
+		static std::vector<int> indices;
+		indices.clear();
+		bvh->cullFrustum(frustum, indices);
+		for (int index : indices)
+			inside[index] = 1;
+	}
+	else
+	{
+		//the proxies are already in SoA, 4 of them fit in a SSE register
+		int count = proxies.paddedSize();
+		int i = 0;
+#ifdef CULLING_SSE
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 sign_mask = _mm_set1_ps(-0.f);
+		for (; i < count; i += 4)
+		{
+			__m128 sx = _mm_loadu_ps(&proxies.sphere_x[i]), sy = _mm_loadu_ps(&proxies.sphere_y[i]), sz = _mm_loadu_ps(&proxies.sphere_z[i]), sr = _mm_loadu_ps(&proxies.sphere_radius[i]);
+			__m128 bx = _mm_loadu_ps(&proxies.box_x[i]), by = _mm_loadu_ps(&proxies.box_y[i]), bz = _mm_loadu_ps(&proxies.box_z[i]);
+			__m128 hx = _mm_loadu_ps(&proxies.half_x[i]), hy = _mm_loadu_ps(&proxies.half_y[i]), hz = _mm_loadu_ps(&proxies.half_z[i]);
+			__m128 outside = _mm_setzero_ps();
+
+			for (int p = 0; p < 6; ++p)
+			{
+				const glm::vec4& plane = frustum.planes[p];
+				__m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z), nw = _mm_set1_ps(plane.w);
+
+				//sphere: outside if the center is further than the radius behind the plane
+				__m128 ds = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, sx), _mm_mul_ps(ny, sy)), _mm_add_ps(_mm_mul_ps(nz, sz), nw));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(ds, sr), zero));
+
+				//box: outside if even the corner most aligned with the normal is behind
+				__m128 db = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, bx), _mm_mul_ps(ny, by)), _mm_add_ps(_mm_mul_ps(nz, bz), nw));
+				__m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, nx), hx), _mm_mul_ps(_mm_andnot_ps(sign_mask, ny), hy)), _mm_mul_ps(_mm_andnot_ps(sign_mask, nz), hz));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(db, extent), zero));
+			}
+
+			int mask = _mm_movemask_ps(outside);
+			for (int k = 0; k < 4; ++k)
+				inside[i + k] = !(mask & (1 << k));
+		}
+#endif
+
+		for (; i < count; ++i)
+		{
+			BoundingBox box(glm::vec3(proxies.box_x[i], proxies.box_y[i], proxies.box_z[i]), glm::vec3(proxies.half_x[i], proxies.half_y[i], proxies.half_z[i]));
+			inside[i] = frustum.testSphere(glm::vec3(proxies.sphere_x[i], proxies.sphere_y[i], proxies.sphere_z[i]), proxies.sphere_radius[i]) && frustum.testBox(box);
+		}
+	}
+
+	//keep the order of the list, proxies without mesh are not culled
+	for (int i = 0; i < size; ++i)
+	{
+		uint8_t flag = flags[i];
+		if (!(flag & PROXY_VISIBLE))
+			continue;
+		if (!(flag & PROXY_HAS_MESH))
+		{
+			visible.push_back(i);
+			continue;
+		}
+		counters.tested++;
+		if (inside[i])
+			visible.push_back(i);
+		else
+			counters.culled++;
+	}
+
+	counters.visible = (int)visible.size();
+}
+
+void Culling::gatherVisible(const RenderProxies& proxies, std::vector<uint32_t>& visible)
+{
+	visible.clear();
+	int size = proxies.size();
+	for (int i = 0; i < size; ++i)
+		if (proxies.flags[i] & PROXY_VISIBLE)
+			visible.push_back(i);
+}
+
+void Culling::renderInMenu()
+{
+	ImGui::Checkbox("Frustum culling", &enabled);
+	ImGui::Checkbox("Use BVH", &use_bvh);
+	ImGui::Text("Tested: %d", counters.tested);
+	ImGui::Text("Visible: %d", counters.visible);
+	ImGui::Text("Culled: %d", counters.culled);
+}
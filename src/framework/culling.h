@@ -0,0 +1,54 @@
+/*
+	Frustum culling of the render proxies.
+	The planes are extracted from the camera viewprojection, proxies are tested 4 at a time (SSE) straight from their SoA bounds.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/matrix.hpp>
+
+class Camera;
+class RenderProxies;
+class BoundingBox;
+class SceneBVH;
+
+class Frustum
+{
+public:
+	enum { LEFT, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE };
+
+	glm::vec4 planes[6]; // xyz normal pointing inside (normalized), w distance
+
+	// works for perspective and orthographic cameras (OpenGL clip space)
+	void fromMatrix(const glm::mat4& viewprojection);
+
+	bool testSphere(const glm::vec3& center, float radius) const;
+	bool testBox(const BoundingBox& box) const;
+};
+
+class Culling
+{
+public:
+	struct sCounters {
+		int tested = 0;
+		int visible = 0;
+		int culled = 0;
+	};
+
+	static bool enabled;
+	static bool use_bvh;
+	static sCounters counters; // last cullProxies call
+
+	// fills visible with the indices of the proxies that have to be rendered (keeping the order), proxies without mesh always pass
+	// with a bvh (already updated with the same node list) only the subtrees touching the frustum are visited
+	static void cullProxies(const RenderProxies& proxies, Camera* camera, std::vector<uint32_t>& visible, const SceneBVH* bvh = NULL);
+
+	// every proxy flagged visible, for when the culling is done later (GPU culling)
+	static void gatherVisible(const RenderProxies& proxies, std::vector<uint32_t>& visible);
+
+	static void renderInMenu();
+};
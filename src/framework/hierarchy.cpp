@@ -0,0 +1,139 @@
+#include "hierarchy.h"
+
+#include "scenenode.h"
+#include "includes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+TransformHierarchy* TransformHierarchy::Get()
+{
+	static TransformHierarchy hierarchy;
+	return &hierarchy;
+}
+
+void TransformHierarchy::add(SceneNode* node)
+{
+	this->registered.push_back(node);
+	this->structure_dirty = true;
+}
+
+void TransformHierarchy::remove(SceneNode* node)
+{
+	auto it = std::find(this->registered.begin(), this->registered.end(), node);
+	if (it != this->registered.end())
+		this->registered.erase(it);
+	this->moved.erase(std::remove(this->moved.begin(), this->moved.end(), node), this->moved.end());
+	this->structure_dirty = true;
+}
+
+void TransformHierarchy::markDirty(SceneNode* node)
+{
+	//before the first linearization everything is computed anyway
+	if (this->structure_dirty || node->transform_index < 0)
+		return;
+	this->dirty[node->transform_index] = 1;
+	this->first_dirty = std::min(this->first_dirty, node->transform_index);
+}
+
+void TransformHierarchy::linearize()
+{
+	this->nodes.clear();
+	this->parents.clear();
+
+	for (SceneNode* node : this->registered)
+	{
+		if (node->parent)
+			continue;
+		node->transform_index = (int)this->nodes.size();
+		this->nodes.push_back(node);
+		this->parents.push_back(-1);
+	}
+
+	//the list itself is the queue of the breadth-first traversal
+	for (size_t i = 0; i < this->nodes.size(); ++i)
+	{
+		for (SceneNode* child : this->nodes[i]->children)
+		{
+			child->transform_index = (int)this->nodes.size();
+			this->nodes.push_back(child);
+			this->parents.push_back((int)i);
+		}
+	}
+
+	assert(this->nodes.size() == this->registered.size() && "nodes in the hierarchy that were not registered");
+
+	this->worlds.resize(this->nodes.size());
+	this->dirty.assign(this->nodes.size(), 1);
+	this->first_dirty = 0;
+	this->structure_dirty = false;
+	this->moved.clear();
+	this->all_moved = true;
+	this->stats.nodes = (int)this->nodes.size();
+	this->stats.linearizations++;
+}
+
+void TransformHierarchy::update()
+{
+	if (this->structure_dirty)
+		linearize();
+
+	this->stats.updated = 0;
+	if (this->first_dirty == INT_MAX)
+		return;
+
+	//a node is recomputed if it or its parent were marked, marking it too so the change reaches its own children
+	int size = (int)this->nodes.size();
+	for (int i = this->first_dirty; i < size; ++i)
+	{
+		int parent = this->parents[i];
+		if (!this->dirty[i] && (parent < 0 || !this->dirty[parent]))
+			continue;
+
+		this->dirty[i] = 1;
+		SceneNode* node = this->nodes[i];
+		this->worlds[i] = parent < 0 ? node->model : this->worlds[parent] * node->model;
+		node->world_version++;
+		this->stats.updated++;
+		if (!this->all_moved)
+			this->moved.push_back(node);
+	}
+
+	//nobody is consuming the list, stop growing it
+	if (this->moved.size() > this->nodes.size())
+	{
+		this->moved.clear();
+		this->all_moved = true;
+	}
+
+	if (size > this->first_dirty)
+		memset(&this->dirty[this->first_dirty], 0, size - this->first_dirty);
+	this->first_dirty = INT_MAX;
+}
+
+const glm::mat4& TransformHierarchy::getWorld(const SceneNode* node)
+{
+	if (this->structure_dirty || this->first_dirty != INT_MAX)
+		update();
+	return this->worlds[node->transform_index];
+}
+
+bool TransformHierarchy::takeMoved(std::vector<SceneNode*>& out)
+{
+	if (this->structure_dirty || this->first_dirty != INT_MAX)
+		update();
+
+	bool all = this->all_moved;
+	out.swap(this->moved);
+	this->moved.clear();
+	this->all_moved = false;
+	return all;
+}
+
+void TransformHierarchy::renderInMenu()
+{
+	ImGui::Text("Nodes: %d", this->stats.nodes);
+	ImGui::Text("Updated last pass: %d", this->stats.updated);
+	ImGui::Text("Linearizations: %d", this->stats.linearizations);
+}
@@ -0,0 +1,60 @@
+/*
+	World matrices of all the scene nodes, stored in contiguous arrays in breadth-first order.
+	Parents always come before their children, so a single forward pass updates everything,
+	and it starts at the first dirty node: frames where nothing moved do no work at all.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <climits>
+#include <glm/matrix.hpp>
+
+class SceneNode;
+
+class TransformHierarchy
+{
+public:
+	struct sStats {
+		int nodes = 0;
+		int updated = 0; // world matrices recomputed in the last pass
+		int linearizations = 0;
+	};
+
+	sStats stats;
+
+	void add(SceneNode* node);
+	void remove(SceneNode* node);
+	void onStructureChanged() { this->structure_dirty = true; } // parents changed, the arrays have to be linearized again
+	void markDirty(SceneNode* node); // its local matrix changed, the subtree is recomputed in the next pass
+
+	// once per frame (getWorld also calls it if there are pending changes)
+	void update();
+	const glm::mat4& getWorld(const SceneNode* node);
+
+	// fills out with the nodes recomputed since the last call, returns true if everything has to be considered moved
+	bool takeMoved(std::vector<SceneNode*>& out);
+
+	void renderInMenu();
+
+	static TransformHierarchy* Get();
+
+private:
+	std::vector<SceneNode*> registered; // creation order, roots are linearized in this order
+
+	//breadth-first arrays
+	std::vector<SceneNode*> nodes;
+	std::vector<int> parents; // -1 for roots
+	std::vector<glm::mat4> worlds;
+	std::vector<uint8_t> dirty;
+
+	int first_dirty = INT_MAX;
+	bool structure_dirty = true;
+
+	//pending for takeMoved()
+	std::vector<SceneNode*> moved;
+	bool all_moved = true;
+
+	void linearize();
+};
@@ -13,10 +13,10 @@ public:
 
 	float shininess = 10.f;
 	float max_distance = 100.f;
+	float cone_angle = 30.f; // spot lights only, in degrees
 	bool cast_shadows = false;
 
 	Light(glm::vec3 position = glm::vec3(0.f), eLightType type = LIGHT_DIRECTIONAL, float intensity = 1.f, glm::vec4 color = glm::vec4(1.f));
 
-	void setUniforms(Shader* shader, const glm::mat4& model);
 	void renderInMenu();
 };
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "renderproxy.h"
+
+#include "scenenode.h"
+#include "hierarchy.h"
+#include "includes.h"
+
+#include <algorithm>
+
+RenderProxies* RenderProxies::Get()
+{
+	static RenderProxies proxies;
+	return &proxies;
+}
+
+uint32_t RenderProxies::getMeshId(Mesh* mesh)
+{
+	auto it = this->mesh_lookup.find(mesh);
+	if (it != this->mesh_lookup.end())
+		return it->second;
+	uint32_t id = (uint32_t)this->meshes.size();
+	this->meshes.push_back(mesh);
+	this->mesh_lookup[mesh] = id;
+	return id;
+}
+
+uint32_t RenderProxies::getMaterialId(Material* material)
+{
+	auto it = this->material_lookup.find(material);
+	if (it != this->material_lookup.end())
+		return it->second;
+	uint32_t id = (uint32_t)this->materials.size();
+	this->materials.push_back(material);
+	this->material_lookup[material] = id;
+	return id;
+}
+
+void RenderProxies::markDirty(SceneNode* node)
+{
+	this->dirty_nodes.push_back(node);
+}
+
+void RenderProxies::remove(SceneNode* node)
+{
+	this->dirty_nodes.erase(std::remove(this->dirty_nodes.begin(), this->dirty_nodes.end(), node), this->dirty_nodes.end());
+}
+
+void RenderProxies::copyNode(int index)
+{
+	SceneNode* node = this->nodes[index];
+	uint8_t flags = 0;
+	if (node->visible) flags |= PROXY_VISIBLE;
+	if (node->mesh) flags |= PROXY_HAS_MESH;
+	if (node->material) flags |= PROXY_HAS_MATERIAL;
+	if (node->material && node->material->isTransparent()) flags |= PROXY_TRANSPARENT;
+
+	this->flags[index] = flags;
+	this->models[index] = node->getGlobalMatrix();
+	this->mesh_ids[index] = getMeshId(node->mesh);
+	this->material_ids[index] = getMaterialId(node->material);
+
+	if (node->mesh)
+	{
+		node->updateBounds();
+		const glm::vec4& sphere = node->world_sphere;
+		const BoundingBox& box = node->world_box;
+		this->sphere_x[index] = sphere.x; this->sphere_y[index] = sphere.y; this->sphere_z[index] = sphere.z; this->sphere_radius[index] = sphere.w;
+		this->box_x[index] = box.center.x; this->box_y[index] = box.center.y; this->box_z[index] = box.center.z;
+		this->half_x[index] = box.halfsize.x; this->half_y[index] = box.halfsize.y; this->half_z[index] = box.halfsize.z;
+	}
+	this->stats.synced++;
+}
+
+void RenderProxies::rebuild(const std::vector<SceneNode*>& node_list)
+{
+	this->nodes = node_list;
+	int count = (int)node_list.size();
+	int padded = (count + 3) & ~3;
+
+	this->flags.assign(padded, 0);
+	this->models.resize(count);
+	this->mesh_ids.resize(count);
+	this->material_ids.resize(count);
+	for (std::vector<float>* array : { &this->sphere_x, &this->sphere_y, &this->sphere_z, &this->sphere_radius, &this->box_x, &this->box_y, &this->box_z, &this->half_x, &this->half_y, &this->half_z })
+		array->assign(padded, 0.f);
+
+	for (int i = 0; i < count; ++i)
+	{
+		node_list[i]->proxy_index = i;
+		copyNode(i);
+	}
+	this->stats.rebuilds++;
+}
+
+void RenderProxies::sync(const std::vector<SceneNode*>& node_list)
+{
+	static std::vector<SceneNode*> moved; // reused every frame
+	this->stats.synced = 0;
+
+	bool all_moved = TransformHierarchy::Get()->takeMoved(moved);
+	if (all_moved || node_list != this->nodes)
+	{
+		rebuild(node_list);
+		this->dirty_nodes.clear();
+	}
+	else
+	{
+		//a node may appear in both lists, copying it twice is cheaper than checking
+		for (std::vector<SceneNode*>* list : { &moved, &this->dirty_nodes })
+			for (SceneNode* node : *list)
+			{
+				int index = node->proxy_index;
+				if (index >= 0 && index < size() && this->nodes[index] == node)
+					copyNode(index);
+			}
+		this->dirty_nodes.clear();
+	}
+
+	this->stats.proxies = size();
+}
+
+void RenderProxies::renderInMenu()
+{
+	ImGui::Text("Proxies: %d", this->stats.proxies);
+	ImGui::Text("Synced last frame: %d", this->stats.synced);
+	ImGui::Text("Rebuilds: %d", this->stats.rebuilds);
+	ImGui::Text("Meshes: %d, materials: %d", (int)this->meshes.size(), (int)this->materials.size());
+}
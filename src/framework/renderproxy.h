@@ -0,0 +1,76 @@
+/*
+	Render proxies: the data of the scene nodes that every frame needs (flags, world matrices, bounds, mesh and material ids),
+	packed in contiguous arrays in the order of the node list. Culling and draw submission iterate these arrays linearly
+	instead of following node pointers and calling virtual methods, the SceneNode stays as the facade used to edit the scene.
+	Only the proxies of the nodes that changed are copied again every frame.
+*/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <glm/vec4.hpp>
+#include <glm/matrix.hpp>
+
+class SceneNode;
+class Mesh;
+class Material;
+
+enum eProxyFlags {
+	PROXY_VISIBLE = 1 << 0,
+	PROXY_HAS_MESH = 1 << 1, // nodes without mesh have no bounds, they are never culled
+	PROXY_HAS_MATERIAL = 1 << 2, // only these are submitted
+	PROXY_TRANSPARENT = 1 << 3, // the material is blended, drawn in the transparent pass
+};
+
+class RenderProxies
+{
+public:
+	struct sStats {
+		int proxies = 0;
+		int synced = 0; // proxies copied again in the last sync
+		int rebuilds = 0;
+	};
+
+	sStats stats;
+
+	//one entry per node
+	std::vector<SceneNode*> nodes; // only to go back to the facade (picking, menus), never read while rendering
+	std::vector<uint8_t> flags; // eProxyFlags
+	std::vector<glm::mat4> models; // world matrices
+	std::vector<uint32_t> mesh_ids;
+	std::vector<uint32_t> material_ids;
+
+	//world bounds in SoA, padded to a multiple of 4 so they can be tested 4 at a time (padding entries have no flags)
+	std::vector<float> sphere_x, sphere_y, sphere_z, sphere_radius;
+	std::vector<float> box_x, box_y, box_z, half_x, half_y, half_z;
+
+	//tables the ids point to, entries are never removed so the ids stay valid
+	std::vector<Mesh*> meshes;
+	std::vector<Material*> materials;
+
+	int size() const { return (int)this->nodes.size(); }
+	int paddedSize() const { return (int)this->sphere_x.size(); }
+
+	// once per frame after the TransformHierarchy update, rebuilds everything if the list is not the one of the last call
+	void sync(const std::vector<SceneNode*>& node_list);
+
+	// the mesh, material or visibility of the node changed (the world matrix is tracked by the hierarchy)
+	void markDirty(SceneNode* node);
+	void remove(SceneNode* node); // the node is being deleted
+
+	void renderInMenu();
+
+	static RenderProxies* Get();
+
+private:
+	std::vector<SceneNode*> dirty_nodes;
+	std::unordered_map<Mesh*, uint32_t> mesh_lookup;
+	std::unordered_map<Material*, uint32_t> material_lookup;
+
+	uint32_t getMeshId(Mesh* mesh);
+	uint32_t getMaterialId(Material* material);
+	void rebuild(const std::vector<SceneNode*>& node_list);
+	void copyNode(int index);
+};
@@ -16,26 +16,112 @@ SceneNode::SceneNode()
 {
 	this->type = NODE_BASE;
 	this->name = std::string("Node" + std::to_string(this->lastNameId++));
+	TransformHierarchy::Get()->add(this);
 }
 
 SceneNode::SceneNode(const char* name)
 {
 	this->type = NODE_BASE;
 	this->name = name;
+	TransformHierarchy::Get()->add(this);
 }
 
-SceneNode::~SceneNode() { }
+SceneNode::~SceneNode()
+{
+	//children become roots
+	for (SceneNode* child : this->children)
+		child->parent = NULL;
+	this->children.clear();
+	if (this->parent)
+		this->parent->removeChild(this);
+	TransformHierarchy::Get()->remove(this);
+	RenderProxies::Get()->remove(this);
+}
+
+void SceneNode::addChild(SceneNode* child)
+{
+	assert(child != this && !this->isDescendantOf(child) && "cycles are not allowed in the hierarchy");
+	if (child->parent == this)
+		return;
+	if (child->parent)
+		child->parent->removeChild(child);
+
+	child->parent = this;
+	this->children.push_back(child);
+	TransformHierarchy::Get()->onStructureChanged();
+}
+
+void SceneNode::removeChild(SceneNode* child)
+{
+	auto it = std::find(this->children.begin(), this->children.end(), child);
+	if (it == this->children.end())
+		return;
+
+	this->children.erase(it);
+	child->parent = NULL;
+	TransformHierarchy::Get()->onStructureChanged();
+}
+
+bool SceneNode::isDescendantOf(const SceneNode* node) const
+{
+	for (SceneNode* current = this->parent; current; current = current->parent)
+		if (current == node)
+			return true;
+	return false;
+}
 
 void SceneNode::render(Camera* camera)
 {
 	if (this->material && this->visible)
-		this->material->render(this->mesh, this->model, camera);
+		this->material->render(this->mesh, getGlobalMatrix(), camera);
+}
+
+bool SceneNode::updateBounds()
+{
+	const glm::mat4& world = getGlobalMatrix();
+	if (!this->mesh || (this->mesh == this->bounds_mesh && this->world_version == this->bounds_version))
+		return false;
+
+	this->bounds_mesh = this->mesh;
+	this->bounds_version = this->world_version;
+	this->world_box = transformBoundingBox(world, this->mesh->box);
+
+	//the sphere is kept apart from the box, for rotated nodes it is usually tighter than the world AABB
+	float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+	glm::vec3 center = world * glm::vec4(this->mesh->box.center, 1.f);
+	this->world_sphere = glm::vec4(center, glm::length(this->mesh->box.halfsize) * scale);
+	return true;
 }
 
 void SceneNode::renderWireframe(Camera* camera)
 {
 	WireframeMaterial mat = WireframeMaterial();
-	mat.render(this->mesh, this->model, camera);
+	mat.render(this->mesh, getGlobalMatrix(), camera);
+}
+
+bool SceneNode::editTransformInMenu(bool only_position)
+{
+	//decomposing and recomposing every frame adds float noise, and the node would look moved to the caches
+	if (this->model != this->menu_model)
+	{
+		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(this->model), this->menu_translation, this->menu_rotation, this->menu_scale);
+		this->menu_model = this->model;
+	}
+
+	bool changed = ImGui::DragFloat3("Position", this->menu_translation, 0.1f);
+	if (!only_position)
+	{
+		changed |= ImGui::DragFloat3("Rotation", this->menu_rotation, 0.1f);
+		changed |= ImGui::DragFloat3("Scale", this->menu_scale, 0.1f);
+	}
+
+	if (changed)
+	{
+		ImGuizmo::RecomposeMatrixFromComponents(this->menu_translation, this->menu_rotation, this->menu_scale, glm::value_ptr(this->model));
+		this->menu_model = this->model;
+		markDirty();
+	}
+	return changed;
 }
 
 void SceneNode::renderInMenu()
@@ -43,16 +129,25 @@ void SceneNode::renderInMenu()
 	// Model edit
 	if (ImGui::TreeNode("Model")) 
 	{
-		float matrixTranslation[3], matrixRotation[3], matrixScale[3];
-		ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(this->model), matrixTranslation, matrixRotation, matrixScale);
-		ImGui::DragFloat3("Position", matrixTranslation, 0.1f);
-		ImGui::DragFloat3("Rotation", matrixRotation, 0.1f);
-		ImGui::DragFloat3("Scale", matrixScale, 0.1f);
-		ImGuizmo::RecomposeMatrixFromComponents(matrixTranslation, matrixRotation, matrixScale, glm::value_ptr(this->model));
-		
+		editTransformInMenu();
 		ImGui::TreePop();
 	}
 
+	// Parent, any node that is not below this one
+	if (ImGui::BeginCombo("Parent", this->parent ? this->parent->name.c_str() : "None"))
+	{
+		if (ImGui::Selectable("None", this->parent == NULL) && this->parent)
+			this->parent->removeChild(this);
+		for (SceneNode* node : Application::instance->node_list)
+		{
+			if (node == this || node->isDescendantOf(this))
+				continue;
+			if (ImGui::Selectable(node->name.c_str(), node == this->parent))
+				node->addChild(this);
+		}
+		ImGui::EndCombo();
+	}
+
 	// Material
 	if (this->material && ImGui::TreeNode("Material"))
 	{
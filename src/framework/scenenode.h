@@ -7,6 +7,8 @@
 #include "../graphics/mesh.h"
 #include "../graphics/material.h"
 #include "framework/utils.h"
+#include "hierarchy.h"
+#include "renderproxy.h"
 
 class Light;
 enum eType { NODE_BASE, NODE_VOLUME, NODE_LIGHT };
@@ -18,19 +20,57 @@ public:
 	static unsigned int lastNameId;
 	std::string name;
 
-	glm::mat4 model = glm::mat4(1.f);
+	glm::mat4 model = glm::mat4(1.f); // local transform (relative to the parent), call markDirty() after changing it
 	Mesh* mesh = NULL;
 	Material* material = NULL;
 
 	bool visible = true;
 
+	//packed copy used for rendering, call markProxyDirty() after changing the mesh, the material or the visibility
+	int proxy_index = -1; // entry in the RenderProxies arrays
+	void markProxyDirty() { this->version++; RenderProxies::Get()->markDirty(this); }
+
+	//increased with every change of the node that is not its transform (world_version tracks it), like the parameters of a light
+	unsigned int version = 0;
+	void markChanged() { this->version++; }
+
+	//hierarchy, the world matrices are cached in the TransformHierarchy
+	SceneNode* parent = NULL;
+	std::vector<SceneNode*> children;
+	int transform_index = -1; // slot in the hierarchy arrays
+	unsigned int world_version = 0; // increased every time the world matrix is recomputed
+
+	void addChild(SceneNode* child);
+	void removeChild(SceneNode* child);
+	bool isDescendantOf(const SceneNode* node) const;
+	void setModel(const glm::mat4& model) { this->model = model; markDirty(); }
+	void markDirty() { TransformHierarchy::Get()->markDirty(this); }
+	const glm::mat4& getGlobalMatrix() { return TransformHierarchy::Get()->getWorld(this); }
+	glm::vec3 getGlobalPosition() { return glm::vec3(getGlobalMatrix()[3]); }
+
+	//world space bounds (from mesh->box and the world matrix), only recomputed when any of both changes
+	BoundingBox world_box;
+	glm::vec4 world_sphere = glm::vec4(0.f); // xyz center, w radius
+	bool updateBounds(); // returns true if they had to be recomputed
+
 	SceneNode();
 	SceneNode(const char* name);
-	~SceneNode();
+	virtual ~SceneNode();
 
 	virtual void render(Camera* camera);
 	virtual void renderWireframe(Camera* camera);
 	virtual void renderInMenu();
+
+protected:
+	unsigned int bounds_version = 0; // world_version used for the cached bounds
+	Mesh* bounds_mesh = NULL;
+
+	//components shown in the menu, decomposed only when the model changes elsewhere
+	float menu_translation[3] = { 0.f, 0.f, 0.f };
+	float menu_rotation[3] = { 0.f, 0.f, 0.f };
+	float menu_scale[3] = { 1.f, 1.f, 1.f };
+	glm::mat4 menu_model = glm::mat4(0.f);
+	bool editTransformInMenu(bool only_position = false); // returns true if the user changed it
 };
 
 //extend the SceneNode class:
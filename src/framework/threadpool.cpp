@@ -0,0 +1,109 @@
+#include "threadpool.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+
+ThreadPool::ThreadPool(int num_threads)
+{
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	for (int i = 0; i < num_threads; ++i)
+		this->workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->condition.notify_all();
+
+	for (std::thread& worker : this->workers)
+		worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->jobs.push_back(std::move(job));
+	}
+	this->condition.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->condition.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+			if (this->stopping && this->jobs.empty())
+				return;
+			job = std::move(this->jobs.front());
+			this->jobs.pop_front();
+		}
+		job();
+	}
+}
+
+bool ThreadPool::runPendingJob()
+{
+	std::function<void()> job;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->jobs.empty())
+			return false;
+		job = std::move(this->jobs.front());
+		this->jobs.pop_front();
+	}
+	job();
+	return true;
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& fn, int min_chunk)
+{
+	int count = end - begin;
+	if (count <= 0)
+		return;
+
+	//a few chunks per thread balance uneven work without much queue overhead
+	int num_chunks = std::min((getNumThreads() + 1) * 4, (count + min_chunk - 1) / std::max(1, min_chunk));
+	if (num_chunks <= 1)
+	{
+		fn(begin, end);
+		return;
+	}
+
+	int chunk_size = (count + num_chunks - 1) / num_chunks;
+	num_chunks = (count + chunk_size - 1) / chunk_size;
+	std::atomic<int> remaining(num_chunks);
+
+	for (int i = 1; i < num_chunks; ++i)
+	{
+		int chunk_begin = begin + i * chunk_size;
+		int chunk_end = std::min(end, chunk_begin + chunk_size);
+		submit([&fn, &remaining, chunk_begin, chunk_end]() {
+			fn(chunk_begin, chunk_end);
+			remaining--;
+		});
+	}
+
+	fn(begin, std::min(end, begin + chunk_size));
+	remaining--;
+
+	//help with the queue instead of sleeping (also avoids deadlocks when called from a worker)
+	while (remaining > 0)
+		if (!runPendingJob())
+			std::this_thread::yield();
+}
+
+ThreadPool* ThreadPool::Get()
+{
+	static ThreadPool pool;
+	return &pool;
+}
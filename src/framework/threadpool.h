@@ -0,0 +1,41 @@
+/*
+	Simple pool of worker threads shared by the whole app (image decoding, CPU baking, ...).
+	Jobs must not call OpenGL, the context only lives in the main thread.
+*/
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class ThreadPool
+{
+public:
+	ThreadPool(int num_threads = 0); // 0 uses all the cores but one (left for the main thread)
+	~ThreadPool();
+
+	int getNumThreads() const { return (int)this->workers.size(); }
+
+	// runs the job in some worker, returns immediately
+	void submit(std::function<void()> job);
+
+	// splits [begin, end) in chunks run in parallel, fn receives the range of each chunk
+	// the calling thread also works on the chunks and returns once all of them are done
+	void parallelFor(int begin, int end, const std::function<void(int, int)>& fn, int min_chunk = 1);
+
+	static ThreadPool* Get(); // the shared pool
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	void workerLoop();
+	bool runPendingJob(); // runs one queued job in the calling thread, false if there was none
+};
@@ -12,6 +12,7 @@
 #include "camera.h"
 #include "../graphics/shader.h"
 #include "../graphics/mesh.h"
+#include "../graphics/glstate.h"
 
 #include <glm/gtx/transform.hpp>
 
@@ -155,6 +156,28 @@ bool readFile(const std::string& filename, std::string& content)
 	return true;
 }
 
+//the whole file, the decoding is done from memory (see decoders.h), it is called from the loading threads too
+bool readFileBytes(const std::string& filename, std::vector<uint8_t>& content)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size <= 0)
+	{
+		fclose(file);
+		return false;
+	}
+
+	content.resize((size_t)size);
+	bool ok = fread(content.data(), 1, (size_t)size, file) == (size_t)size;
+	fclose(file);
+	return ok;
+}
+
 char const* gl_error_string(GLenum const err) noexcept
 {
 	switch (err)
@@ -211,6 +234,21 @@ bool checkGLErrors()
 	return true;
 }
 
+bool isGLExtensionSupported(const char* name)
+{
+	GLint num_extensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+
+	for (GLint i = 0; i < num_extensions; ++i)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
 std::vector<std::string>& split(const std::string& s, char delim, std::vector<std::string>& elems) {
 	std::stringstream ss(s);
 	std::string item;
@@ -326,9 +364,9 @@ void drawGrid()
 	}
 
 	glLineWidth(1);
-	glEnable(GL_BLEND);
-	glDepthMask(false);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLState::enable(GL_BLEND);
+	GLState::depthMask(false);
+	GLState::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	Shader* grid_shader = Shader::getDefaultShader("grid");
 	grid_shader->enable();
 	glm::mat4 m = glm::mat4(1.f);
@@ -340,8 +378,8 @@ void drawGrid()
 	grid_shader->setUniform("u_camera_position", Camera::current->eye);
 	grid_shader->setUniform("u_viewprojection", Camera::current->viewprojection_matrix);
 	grid->render(GL_LINES); //background grid
-	glDisable(GL_BLEND);
-	glDepthMask(true);
+	GLState::disable(GL_BLEND);
+	GLState::depthMask(true);
 	grid_shader->disable();
 }
 
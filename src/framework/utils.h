@@ -18,6 +18,7 @@
 long getTime();
 float* snapshot();
 bool readFile(const std::string& filename, std::string& content);
+bool readFileBytes(const std::string& filename, std::vector<uint8_t>& content); // binary, false if missing or empty
 
 //generic purposes fuctions
 void drawGrid();
@@ -26,6 +27,9 @@ glm::vec3 transformQuat(const glm::vec3& a, const glm::quat& q);
 //check opengl errors
 bool checkGLErrors();
 
+//check if the current context exposes an extension (e.g. "GL_KHR_parallel_shader_compile")
+bool isGLExtensionSupported(const char* name);
+
 std::string getPath();
 
 //Vector2 getDesktopSize(int display_index = 0);
@@ -0,0 +1,135 @@
+#include "bluenoise.h"
+
+#include "texture.h"
+
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+Texture* BlueNoise::texture = NULL;
+
+//energy of every pixel: sum of a toroidal gaussian centered on every point of the pattern
+class VoidAndCluster
+{
+public:
+	int size;
+	std::vector<float> kernel; // by toroidal offset
+	std::vector<float> energy;
+	std::vector<bool> pattern;
+
+	VoidAndCluster(int size) : size(size)
+	{
+		int n = size * size;
+		this->kernel.resize(n);
+		this->energy.assign(n, 0.f);
+		this->pattern.assign(n, false);
+		for (int y = 0; y < size; ++y)
+			for (int x = 0; x < size; ++x)
+			{
+				int dx = std::min(x, size - x);
+				int dy = std::min(y, size - y);
+				this->kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * BLUENOISE_SIGMA * BLUENOISE_SIGMA));
+			}
+	}
+
+	void set(int index, bool value)
+	{
+		this->pattern[index] = value;
+		float sign = value ? 1.f : -1.f;
+		int px = index % this->size, py = index / this->size;
+		for (int y = 0; y < this->size; ++y)
+		{
+			const float* row = &this->kernel[((y - py + this->size) % this->size) * this->size];
+			float* out = &this->energy[y * this->size];
+			//the row of the kernel wraps at px, two loops instead of a modulo per pixel
+			for (int x = 0; x < px; ++x)
+				out[x] += sign * row[x - px + this->size];
+			for (int x = px; x < this->size; ++x)
+				out[x] += sign * row[x - px];
+		}
+	}
+
+	// tightest cluster: the point with the most energy, largest void: the empty pixel with the least
+	int find(bool point, bool highest) const
+	{
+		int best = -1;
+		for (int i = 0; i < (int)this->energy.size(); ++i)
+			if (this->pattern[i] == point && (best < 0 || (highest ? this->energy[i] > this->energy[best] : this->energy[i] < this->energy[best])))
+				best = i;
+		return best;
+	}
+};
+
+void BlueNoise::generate(int size, std::vector<int>& ranks)
+{
+	int n = size * size;
+	ranks.assign(n, 0);
+	VoidAndCluster vc(size);
+
+	//initial pattern: a tenth of the pixels at random, then points move from the clusters to the voids until it is stable
+	std::mt19937 rng(1234);
+	int initial = std::max(n / 10, 1);
+	for (int placed = 0; placed < initial;)
+	{
+		int index = (int)(rng() % n);
+		if (!vc.pattern[index])
+		{
+			vc.set(index, true);
+			placed++;
+		}
+	}
+	for (int iteration = 0; iteration < n; ++iteration)
+	{
+		int cluster = vc.find(true, true);
+		vc.set(cluster, false);
+		int gap = vc.find(false, false);
+		vc.set(gap, true);
+		if (gap == cluster)
+			break;
+	}
+
+	//ranks of the initial points, removing the tightest clusters first gives them the highest ranks
+	VoidAndCluster removal = vc;
+	for (int rank = initial - 1; rank >= 0; --rank)
+	{
+		int cluster = removal.find(true, true);
+		removal.set(cluster, false);
+		ranks[cluster] = rank;
+	}
+
+	//the rest fill the largest voids
+	for (int rank = initial; rank < n; ++rank)
+	{
+		int gap = vc.find(false, false);
+		vc.set(gap, true);
+		ranks[gap] = rank;
+	}
+}
+
+Texture* BlueNoise::getTexture()
+{
+	if (texture)
+		return texture;
+
+	std::vector<int> ranks;
+	generate(BLUENOISE_SIZE, ranks);
+	std::vector<uint8_t> data(ranks.size());
+	for (size_t i = 0; i < ranks.size(); ++i)
+		data[i] = (uint8_t)(ranks[i] * 256 / (int)ranks.size());
+
+	texture = new Texture();
+	texture->create(BLUENOISE_SIZE, BLUENOISE_SIZE, GL_RED, GL_UNSIGNED_BYTE, false, data.data(), GL_R8);
+	texture->bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	texture->unbind();
+	return texture;
+}
+
+float BlueNoise::getFrameOffset(unsigned int frame)
+{
+	//golden ratio sequence, the most evenly spread in [0, 1) for any number of frames
+	return (float)std::fmod(frame * 0.61803398875, 1.0);
+}
@@ -0,0 +1,30 @@
+/*
+	Blue noise: a tileable texture of ranks (every value once) without low frequencies, generated once with void-and-cluster (Ulichney).
+	Offsetting ray starts by it instead of white noise spreads the error evenly over the screen, so it is
+	hidden by a small blur or by accumulating frames. Adding the golden ratio every frame gives a new pattern that keeps the property in time.
+*/
+
+#pragma once
+
+#include <vector>
+
+class Texture;
+
+#define BLUENOISE_SIZE 64
+#define BLUENOISE_SIGMA 1.5f // of the gaussian that measures the clusters, in pixels
+
+class BlueNoise
+{
+public:
+	// R8 texture of BLUENOISE_SIZE^2, nearest and repeated, the shaders read it with texelFetch(coord & (size - 1))
+	static Texture* getTexture();
+
+	// rank of every pixel (0 .. size^2 - 1), row major
+	static void generate(int size, std::vector<int>& ranks);
+
+	// offset to add (modulo 1) to the texture values in a frame
+	static float getFrameOffset(unsigned int frame);
+
+private:
+	static Texture* texture;
+};
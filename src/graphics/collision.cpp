@@ -0,0 +1,421 @@
+#include "collision.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <cmath>
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#define COLLISION_SSE
+	#include <xmmintrin.h>
+#endif
+
+static_assert(sizeof(CollisionModel::sNode) == 32, "collision nodes must stay in 32 bytes");
+
+static float surfaceArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 size = glm::max(max - min, glm::vec3(0.f));
+	return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void CollisionModel::build(const glm::vec3* positions, size_t num_positions, size_t stride, const glm::vec3* indices, size_t num_triangles_indexed)
+{
+	this->nodes.clear();
+	this->vertices.clear();
+
+	//gather the triangles, positions can be inside an interleaved buffer
+	auto position = [&](size_t i) { return *(const glm::vec3*)((const uint8_t*)positions + i * stride); };
+	std::vector<glm::vec3> source;
+	if (indices)
+	{
+		source.resize(num_triangles_indexed * 3);
+		for (size_t i = 0; i < num_triangles_indexed; ++i)
+			for (int k = 0; k < 3; ++k)
+				source[i * 3 + k] = position((size_t)indices[i][k]);
+	}
+	else
+	{
+		source.resize(num_positions - num_positions % 3);
+		for (size_t i = 0; i < source.size(); ++i)
+			source[i] = position(i);
+	}
+
+	uint32_t num_triangles = (uint32_t)(source.size() / 3);
+	if (!num_triangles)
+		return;
+
+	std::vector<uint32_t> triangles(num_triangles);
+	std::vector<glm::vec3> centroids(num_triangles), tri_min(num_triangles), tri_max(num_triangles);
+	for (uint32_t i = 0; i < num_triangles; ++i)
+	{
+		const glm::vec3* v = &source[i * 3];
+		triangles[i] = i;
+		tri_min[i] = glm::min(v[0], glm::min(v[1], v[2]));
+		tri_max[i] = glm::max(v[0], glm::max(v[1], v[2]));
+		centroids[i] = (tri_min[i] + tri_max[i]) * 0.5f;
+	}
+
+	this->nodes.reserve(num_triangles * 2 / COLLISION_MAX_LEAF_TRIANGLES + 1);
+	this->nodes.push_back(sNode());
+	buildRecursive(0, 0, num_triangles, 1, triangles, centroids, tri_min, tri_max);
+	this->nodes.shrink_to_fit();
+
+	//store the triangles in the order of the leaves
+	this->vertices.resize(source.size());
+	for (uint32_t i = 0; i < num_triangles; ++i)
+		memcpy(&this->vertices[i * 3], &source[triangles[i] * 3], sizeof(glm::vec3) * 3);
+}
+
+void CollisionModel::buildRecursive(uint32_t index, uint32_t first, uint32_t count, int depth, std::vector<uint32_t>& triangles, const std::vector<glm::vec3>& centroids, const std::vector<glm::vec3>& tri_min, const std::vector<glm::vec3>& tri_max)
+{
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+	glm::vec3 centroid_min(FLT_MAX), centroid_max(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		uint32_t t = triangles[i];
+		min = glm::min(min, tri_min[t]);
+		max = glm::max(max, tri_max[t]);
+		centroid_min = glm::min(centroid_min, centroids[t]);
+		centroid_max = glm::max(centroid_max, centroids[t]);
+	}
+
+	this->nodes[index].min = min;
+	this->nodes[index].max = max;
+	this->nodes[index].first = first;
+	this->nodes[index].count = count;
+
+	if (count <= 1)
+		return;
+
+	//binned SAH, same approach than the scene BVH
+	struct sBin { glm::vec3 min = glm::vec3(FLT_MAX); glm::vec3 max = glm::vec3(-FLT_MAX); uint32_t count = 0; };
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_split = 0;
+	glm::vec3 extent = centroid_max - centroid_min;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (extent[axis] <= 0.f)
+			continue;
+
+		sBin bins[COLLISION_NUM_BINS];
+		float scale = COLLISION_NUM_BINS / extent[axis];
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			uint32_t t = triangles[i];
+			int b = std::min(COLLISION_NUM_BINS - 1, (int)((centroids[t][axis] - centroid_min[axis]) * scale));
+			bins[b].count++;
+			bins[b].min = glm::min(bins[b].min, tri_min[t]);
+			bins[b].max = glm::max(bins[b].max, tri_max[t]);
+		}
+
+		float right_area[COLLISION_NUM_BINS];
+		uint32_t right_count[COLLISION_NUM_BINS];
+		glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+		uint32_t accum = 0;
+		for (int b = COLLISION_NUM_BINS - 1; b > 0; --b)
+		{
+			bmin = glm::min(bmin, bins[b].min);
+			bmax = glm::max(bmax, bins[b].max);
+			accum += bins[b].count;
+			right_area[b] = accum ? surfaceArea(bmin, bmax) : 0.f;
+			right_count[b] = accum;
+		}
+
+		bmin = glm::vec3(FLT_MAX);
+		bmax = glm::vec3(-FLT_MAX);
+		accum = 0;
+		for (int b = 0; b < COLLISION_NUM_BINS - 1; ++b)
+		{
+			bmin = glm::min(bmin, bins[b].min);
+			bmax = glm::max(bmax, bins[b].max);
+			accum += bins[b].count;
+			if (!accum || !right_count[b + 1])
+				continue;
+			float cost = accum * surfaceArea(bmin, bmax) + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b + 1;
+			}
+		}
+	}
+
+	//costs relative to a triangle test, visiting a node costs about the same
+	float split_cost = 1.f + best_cost / std::max(surfaceArea(min, max), 1e-12f);
+	if (count <= COLLISION_MAX_LEAF_TRIANGLES && (best_axis == -1 || split_cost >= (float)count))
+		return;
+
+	//deep nodes (or triangles with the same centroid) are split in halves, that bounds the traversal stack
+	uint32_t middle = first + count / 2;
+	if (best_axis != -1 && depth < COLLISION_MAX_DEPTH / 2)
+	{
+		float scale = COLLISION_NUM_BINS / extent[best_axis];
+		float base = centroid_min[best_axis];
+		uint32_t* begin = &triangles[first];
+		uint32_t* split = std::partition(begin, begin + count, [&](uint32_t t) {
+			return std::min(COLLISION_NUM_BINS - 1, (int)((centroids[t][best_axis] - base) * scale)) < best_split;
+		});
+		middle = first + (uint32_t)(split - begin);
+	}
+
+	uint32_t left = (uint32_t)this->nodes.size();
+	this->nodes[index].first = left;
+	this->nodes[index].count = 0;
+	this->nodes.push_back(sNode());
+	this->nodes.push_back(sNode());
+
+	buildRecursive(left, first, middle - first, depth + 1, triangles, centroids, tri_min, tri_max);
+	buildRecursive(left + 1, middle, first + count - middle, depth + 1, triangles, centroids, tri_min, tri_max);
+}
+
+#ifdef COLLISION_SSE
+// slab test of one node, the 4th lane of the loads is the integer of the node so it is replaced by the x lane
+static inline float intersectNode(const CollisionModel::sNode& node, __m128 origin, __m128 inv_dir, float max_t)
+{
+	__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.min.x), origin), inv_dir);
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.max.x), origin), inv_dir);
+	__m128 tmin = _mm_min_ps(t0, t1);
+	__m128 tmax = _mm_max_ps(t0, t1);
+	tmin = _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(0, 2, 1, 0));
+	tmax = _mm_shuffle_ps(tmax, tmax, _MM_SHUFFLE(0, 2, 1, 0));
+	tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(1, 0, 3, 2)));
+	tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(2, 3, 0, 1)));
+	tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, _MM_SHUFFLE(1, 0, 3, 2)));
+	tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, _MM_SHUFFLE(2, 3, 0, 1)));
+	float enter = std::max(_mm_cvtss_f32(tmin), 0.f);
+	float exit = std::min(_mm_cvtss_f32(tmax), max_t);
+	return enter <= exit ? enter : FLT_MAX;
+}
+#else
+static inline float intersectNode(const CollisionModel::sNode& node, const glm::vec3& origin, const glm::vec3& inv_dir, float max_t)
+{
+	glm::vec3 t0 = (node.min - origin) * inv_dir;
+	glm::vec3 t1 = (node.max - origin) * inv_dir;
+	glm::vec3 tmin = glm::min(t0, t1);
+	glm::vec3 tmax = glm::max(t0, t1);
+	float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.f));
+	float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, max_t));
+	return enter <= exit ? enter : FLT_MAX;
+}
+#endif
+
+// Moller-Trumbore, both faces
+static inline bool intersectTriangle(const glm::vec3* v, const glm::vec3& origin, const glm::vec3& direction, float max_t, float& out_t)
+{
+	glm::vec3 e1 = v[1] - v[0];
+	glm::vec3 e2 = v[2] - v[0];
+	glm::vec3 p = glm::cross(direction, e2);
+	float det = glm::dot(e1, p);
+	if (std::fabs(det) < 1e-12f)
+		return false;
+	float inv_det = 1.f / det;
+	glm::vec3 s = origin - v[0];
+	float u = glm::dot(s, p) * inv_det;
+	if (u < 0.f || u > 1.f)
+		return false;
+	glm::vec3 q = glm::cross(s, e1);
+	float w = glm::dot(direction, q) * inv_det;
+	if (w < 0.f || u + w > 1.f)
+		return false;
+	float t = glm::dot(e2, q) * inv_det;
+	if (t < 0.f || t >= max_t)
+		return false;
+	out_t = t;
+	return true;
+}
+
+bool CollisionModel::testRay(const glm::vec3& origin, const glm::vec3& direction, float max_t, float& out_t, glm::vec3& out_normal) const
+{
+	if (this->nodes.empty())
+		return false;
+
+	glm::vec3 inv = 1.f / direction;
+#ifdef COLLISION_SSE
+	__m128 sse_origin = _mm_set_ps(0.f, origin.z, origin.y, origin.x);
+	__m128 sse_inv = _mm_set_ps(0.f, inv.z, inv.y, inv.x);
+	#define INTERSECT_NODE(node) intersectNode(node, sse_origin, sse_inv, closest_t)
+#else
+	#define INTERSECT_NODE(node) intersectNode(node, origin, inv, closest_t)
+#endif
+
+	float closest_t = max_t;
+	int closest_triangle = -1;
+
+	//entries keep the distance to the box, so nodes behind a hit found meanwhile are skipped
+	struct sEntry { uint32_t index; float t; };
+	sEntry stack[COLLISION_MAX_DEPTH * 2];
+	int size = 0;
+	float t_root = INTERSECT_NODE(this->nodes[0]);
+	if (t_root != FLT_MAX)
+		stack[size++] = { 0, t_root };
+
+	while (size)
+	{
+		sEntry entry = stack[--size];
+		if (entry.t > closest_t)
+			continue;
+
+		const sNode& node = this->nodes[entry.index];
+		if (node.count)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				float t;
+				if (intersectTriangle(&this->vertices[i * 3], origin, direction, closest_t, t))
+				{
+					closest_t = t;
+					closest_triangle = (int)i;
+				}
+			}
+			continue;
+		}
+
+		//nearest child on top of the stack
+		float t_left = INTERSECT_NODE(this->nodes[node.first]);
+		float t_right = INTERSECT_NODE(this->nodes[node.first + 1]);
+		if (t_left > t_right)
+		{
+			if (t_left != FLT_MAX) stack[size++] = { node.first, t_left };
+			stack[size++] = { node.first + 1, t_right };
+		}
+		else
+		{
+			if (t_right != FLT_MAX) stack[size++] = { node.first + 1, t_right };
+			if (t_left != FLT_MAX) stack[size++] = { node.first, t_left };
+		}
+	}
+#undef INTERSECT_NODE
+
+	if (closest_triangle == -1)
+		return false;
+
+	const glm::vec3* v = &this->vertices[closest_triangle * 3];
+	out_normal = glm::normalize(glm::cross(v[1] - v[0], v[2] - v[0]));
+	if (glm::dot(out_normal, direction) > 0.f)
+		out_normal = -out_normal; // facing the ray
+	out_t = closest_t;
+	return true;
+}
+
+// from Real-Time Collision Detection (Ericson), 5.1.5
+static glm::vec3 closestPointTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.f && d2 <= 0.f) return a;
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.f && d4 <= d3) return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) return a + ab * (d1 / (d1 - d3));
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.f && d5 <= d6) return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+bool CollisionModel::testSphere(const glm::vec3& center, float radius, glm::vec3& out_point, glm::vec3& out_normal) const
+{
+	if (this->nodes.empty())
+		return false;
+
+	float best_dist2 = radius * radius;
+	int closest_triangle = -1;
+
+	uint32_t stack[COLLISION_MAX_DEPTH * 2];
+	int size = 0;
+	stack[size++] = 0;
+
+	while (size)
+	{
+		const sNode& node = this->nodes[stack[--size]];
+		glm::vec3 delta = glm::clamp(center, node.min, node.max) - center;
+		if (glm::dot(delta, delta) > best_dist2)
+			continue; // the radius shrinks as closer triangles are found
+
+		if (node.count)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				const glm::vec3* v = &this->vertices[i * 3];
+				glm::vec3 point = closestPointTriangle(center, v[0], v[1], v[2]);
+				glm::vec3 d = point - center;
+				float dist2 = glm::dot(d, d);
+				if (dist2 <= best_dist2)
+				{
+					best_dist2 = dist2;
+					closest_triangle = (int)i;
+					out_point = point;
+				}
+			}
+			continue;
+		}
+
+		stack[size++] = node.first;
+		stack[size++] = node.first + 1;
+	}
+
+	if (closest_triangle == -1)
+		return false;
+
+	//push direction, the face normal when the center is on the surface
+	const glm::vec3* v = &this->vertices[closest_triangle * 3];
+	if (best_dist2 > 1e-12f)
+		out_normal = glm::normalize(center - out_point);
+	else
+		out_normal = glm::normalize(glm::cross(v[1] - v[0], v[2] - v[0]));
+	return true;
+}
+
+void CollisionModel::write(std::vector<uint8_t>& out) const
+{
+	uint32_t header[2] = { (uint32_t)this->nodes.size(), (uint32_t)this->vertices.size() };
+	size_t start = out.size();
+	out.resize(start + sizeof(header) + this->nodes.size() * sizeof(sNode) + this->vertices.size() * sizeof(glm::vec3));
+	uint8_t* pos = &out[start];
+	memcpy(pos, header, sizeof(header));
+	pos += sizeof(header);
+	if (header[0])
+		memcpy(pos, this->nodes.data(), this->nodes.size() * sizeof(sNode));
+	pos += this->nodes.size() * sizeof(sNode);
+	if (header[1])
+		memcpy(pos, this->vertices.data(), this->vertices.size() * sizeof(glm::vec3));
+}
+
+size_t CollisionModel::read(const uint8_t* data, size_t size)
+{
+	uint32_t header[2];
+	if (size < sizeof(header))
+		return 0;
+	memcpy(header, data, sizeof(header));
+
+	size_t total = sizeof(header) + header[0] * sizeof(sNode) + header[1] * sizeof(glm::vec3);
+	if (total > size || header[1] % 3)
+		return 0;
+
+	const uint8_t* pos = data + sizeof(header);
+	this->nodes.resize(header[0]);
+	if (header[0])
+		memcpy(this->nodes.data(), pos, header[0] * sizeof(sNode));
+	pos += header[0] * sizeof(sNode);
+	this->vertices.resize(header[1]);
+	if (header[1])
+		memcpy(this->vertices.data(), pos, header[1] * sizeof(glm::vec3));
+	return total;
+}
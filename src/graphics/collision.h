@@ -0,0 +1,47 @@
+/*
+	Triangle BVH of a mesh for ray and sphere queries (picking, simple collisions), all in object space.
+	Nodes are 32 bytes and the triangles are stored in leaf order, so a traversal reads memory mostly forward.
+	It can be serialized, the Mesh stores it inside the .mbin.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/vec3.hpp>
+
+#define COLLISION_MAX_LEAF_TRIANGLES 4
+#define COLLISION_NUM_BINS 16
+#define COLLISION_MAX_DEPTH 64
+
+class CollisionModel
+{
+public:
+	struct sNode {
+		glm::vec3 min;
+		uint32_t first; // leaf: first triangle, internal: left child (right child is first + 1)
+		glm::vec3 max;
+		uint32_t count; // triangles in a leaf, 0 for internal nodes
+	};
+
+	std::vector<sNode> nodes;
+	std::vector<glm::vec3> vertices; // 3 per triangle, in the order of the leaves
+
+	// triangle soup (3 vertices per triangle) or indexed, indices are the mesh ones (3 per glm::vec3)
+	void build(const glm::vec3* positions, size_t num_positions, size_t stride, const glm::vec3* indices = NULL, size_t num_triangles_indexed = 0);
+
+	// closest hit, t in units of direction (it does not need to be normalized)
+	bool testRay(const glm::vec3& origin, const glm::vec3& direction, float max_t, float& out_t, glm::vec3& out_normal) const;
+
+	// closest point of the surface to the center if it is inside the sphere
+	bool testSphere(const glm::vec3& center, float radius, glm::vec3& out_point, glm::vec3& out_normal) const;
+
+	size_t getNumTriangles() const { return this->vertices.size() / 3; }
+
+	// raw copy of nodes and vertices, read returns the bytes consumed (0 if the data is not valid)
+	void write(std::vector<uint8_t>& out) const;
+	size_t read(const uint8_t* data, size_t size);
+
+private:
+	void buildRecursive(uint32_t index, uint32_t first, uint32_t count, int depth, std::vector<uint32_t>& triangles, const std::vector<glm::vec3>& centroids, const std::vector<glm::vec3>& tri_min, const std::vector<glm::vec3>& tri_max);
+};
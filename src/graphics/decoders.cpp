@@ -0,0 +1,560 @@
+#include "decoders.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+//TGA format from: http://www.paulbourke.net/dataformats/tga/
+bool decodeTGA(std::vector<uint8_t>& out_image, int& width, int& height, int& bytes_per_pixel, bool& origin_topleft, const uint8_t* in_tga, size_t in_size)
+{
+	const uint8_t TGAheader[12] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	if (!in_tga || in_size < 18 || memcmp(TGAheader, in_tga, sizeof(TGAheader)) != 0)
+		return false;
+
+	const uint8_t* header = in_tga + 12;
+	width = header[1] * 256 + header[0];
+	height = header[3] * 256 + header[2];
+	bytes_per_pixel = header[4] / 8;
+	origin_topleft = (header[5] & (1 << 5)) != 0;
+
+	if ((bytes_per_pixel != 3 && bytes_per_pixel != 4) || width <= 0 || height <= 0)
+		return false;
+
+	size_t image_size = (size_t)width * height * bytes_per_pixel;
+	if (in_size - 18 < image_size)
+		return false;
+
+	out_image.resize(image_size);
+	const uint8_t* src = in_tga + 18;
+	uint8_t* dst = out_image.data();
+
+	//flip BGR to RGB pixels while copying
+	for (size_t i = 0; i < image_size; i += bytes_per_pixel)
+	{
+		dst[i] = src[i + 2];
+		dst[i + 1] = src[i + 1];
+		dst[i + 2] = src[i];
+		if (bytes_per_pixel == 4)
+			dst[i + 3] = src[i + 3];
+	}
+
+	return true;
+}
+
+// ******************************************
+// INFLATE (canonical huffman decoding, based on the structure of zlib's puff.c)
+
+namespace {
+
+	struct sBitReader {
+		const uint8_t* data;
+		size_t size;
+		size_t pos;
+		uint32_t bitbuf;
+		int bitcnt;
+		bool error;
+
+		int bits(int need)
+		{
+			uint32_t val = bitbuf;
+			while (bitcnt < need)
+			{
+				if (pos == size) {
+					error = true;
+					return 0;
+				}
+				val |= (uint32_t)data[pos++] << bitcnt;
+				bitcnt += 8;
+			}
+			bitbuf = val >> need;
+			bitcnt -= need;
+			return (int)(val & ((1u << need) - 1));
+		}
+	};
+
+	#define HUFFMAN_MAX_BITS 15
+
+	struct sHuffman {
+		short count[HUFFMAN_MAX_BITS + 1]; // number of symbols of each length
+		short symbol[288]; // symbols ordered by code
+	};
+
+	// returns 0 for a complete code, < 0 for an over-subscribed one and > 0 for an incomplete one
+	int buildHuffman(sHuffman& h, const short* length, int n)
+	{
+		memset(h.count, 0, sizeof(h.count));
+		for (int i = 0; i < n; ++i)
+			h.count[length[i]]++;
+		if (h.count[0] == n)
+			return 0;
+
+		int left = 1;
+		for (int len = 1; len <= HUFFMAN_MAX_BITS; ++len)
+		{
+			left <<= 1;
+			left -= h.count[len];
+			if (left < 0)
+				return left;
+		}
+
+		short offs[HUFFMAN_MAX_BITS + 1];
+		offs[1] = 0;
+		for (int len = 1; len < HUFFMAN_MAX_BITS; ++len)
+			offs[len + 1] = offs[len] + h.count[len];
+
+		for (int i = 0; i < n; ++i)
+			if (length[i] != 0)
+				h.symbol[offs[length[i]]++] = (short)i;
+
+		return left;
+	}
+
+	int decodeSymbol(sBitReader& s, const sHuffman& h)
+	{
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len <= HUFFMAN_MAX_BITS; ++len)
+		{
+			code |= s.bits(1);
+			int count = h.count[len];
+			if (code - count < first)
+				return h.symbol[index + (code - first)];
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+		}
+		return -1; // ran out of codes
+	}
+
+	const short length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const short length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const short dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const short dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	bool inflateCodes(sBitReader& s, std::vector<uint8_t>& out, const sHuffman& lencode, const sHuffman& distcode)
+	{
+		while (true)
+		{
+			int symbol = decodeSymbol(s, lencode);
+			if (symbol < 0 || s.error)
+				return false;
+
+			if (symbol < 256)
+				out.push_back((uint8_t)symbol);
+			else if (symbol == 256)
+				return true; // end of block
+			else
+			{
+				symbol -= 257;
+				if (symbol >= 29)
+					return false;
+				int len = length_base[symbol] + s.bits(length_extra[symbol]);
+
+				symbol = decodeSymbol(s, distcode);
+				if (symbol < 0 || symbol >= 30)
+					return false;
+				size_t dist = dist_base[symbol] + s.bits(dist_extra[symbol]);
+				if (s.error || dist > out.size())
+					return false;
+
+				//the copy may overlap the bytes being written, so go byte by byte
+				size_t from = out.size() - dist;
+				for (int i = 0; i < len; ++i)
+					out.push_back(out[from + i]);
+			}
+		}
+	}
+
+	bool inflateStored(sBitReader& s, std::vector<uint8_t>& out)
+	{
+		//stored blocks start at a byte boundary
+		s.bitbuf = 0;
+		s.bitcnt = 0;
+
+		if (s.pos + 4 > s.size)
+			return false;
+		unsigned int len = s.data[s.pos] | (s.data[s.pos + 1] << 8);
+		unsigned int nlen = s.data[s.pos + 2] | (s.data[s.pos + 3] << 8);
+		s.pos += 4;
+		if (len != (~nlen & 0xffff) || s.pos + len > s.size)
+			return false;
+
+		out.insert(out.end(), s.data + s.pos, s.data + s.pos + len);
+		s.pos += len;
+		return true;
+	}
+
+	struct sFixedCodes {
+		sHuffman lencode, distcode;
+
+		sFixedCodes()
+		{
+			short lengths[288];
+			int symbol = 0;
+			for (; symbol < 144; ++symbol) lengths[symbol] = 8;
+			for (; symbol < 256; ++symbol) lengths[symbol] = 9;
+			for (; symbol < 280; ++symbol) lengths[symbol] = 7;
+			for (; symbol < 288; ++symbol) lengths[symbol] = 8;
+			buildHuffman(lencode, lengths, 288);
+
+			for (symbol = 0; symbol < 30; ++symbol) lengths[symbol] = 5;
+			buildHuffman(distcode, lengths, 30);
+		}
+	};
+
+	bool inflateFixed(sBitReader& s, std::vector<uint8_t>& out)
+	{
+		static const sFixedCodes fixed; // built once, thread safe initialization
+		return inflateCodes(s, out, fixed.lencode, fixed.distcode);
+	}
+
+	bool inflateDynamic(sBitReader& s, std::vector<uint8_t>& out)
+	{
+		const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		short lengths[320];
+		sHuffman lencode, distcode;
+
+		int nlen = s.bits(5) + 257;
+		int ndist = s.bits(5) + 1;
+		int ncode = s.bits(4) + 4;
+		if (s.error || nlen > 286 || ndist > 30)
+			return false;
+
+		int index = 0;
+		for (; index < ncode; ++index)
+			lengths[order[index]] = (short)s.bits(3);
+		for (; index < 19; ++index)
+			lengths[order[index]] = 0;
+
+		if (buildHuffman(lencode, lengths, 19) != 0)
+			return false; // code lengths code must be complete
+
+		index = 0;
+		while (index < nlen + ndist)
+		{
+			int symbol = decodeSymbol(s, lencode);
+			if (symbol < 0 || s.error)
+				return false;
+
+			if (symbol < 16)
+				lengths[index++] = (short)symbol;
+			else
+			{
+				short len = 0;
+				if (symbol == 16)
+				{
+					if (index == 0)
+						return false; // nothing to repeat
+					len = lengths[index - 1];
+					symbol = 3 + s.bits(2);
+				}
+				else if (symbol == 17)
+					symbol = 3 + s.bits(3);
+				else
+					symbol = 11 + s.bits(7);
+
+				if (index + symbol > nlen + ndist)
+					return false;
+				while (symbol--)
+					lengths[index++] = len;
+			}
+		}
+
+		if (lengths[256] == 0)
+			return false; // no end of block code
+
+		int err = buildHuffman(lencode, lengths, nlen);
+		if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1))
+			return false; // incomplete codes are only allowed for a single length
+		err = buildHuffman(distcode, lengths + nlen, ndist);
+		if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1))
+			return false;
+
+		return inflateCodes(s, out, lencode, distcode);
+	}
+}
+
+bool inflateZlib(std::vector<uint8_t>& out, const uint8_t* in, size_t in_size)
+{
+	if (in_size < 2)
+		return false;
+
+	//zlib header: deflate method, no preset dictionary
+	unsigned int cmf = in[0], flg = in[1];
+	if ((cmf & 0x0f) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20))
+		return false;
+
+	sBitReader s = { in, in_size, 2, 0, 0, false };
+
+	int last = 0;
+	do {
+		last = s.bits(1);
+		int type = s.bits(2);
+		if (s.error)
+			return false;
+
+		bool ok = false;
+		if (type == 0)
+			ok = inflateStored(s, out);
+		else if (type == 1)
+			ok = inflateFixed(s, out);
+		else if (type == 2)
+			ok = inflateDynamic(s, out);
+		if (!ok)
+			return false;
+	} while (!last);
+
+	return true;
+}
+
+// ******************************************
+// PNG
+
+static uint32_t readU32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static int paethPredictor(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+// reverts the filter of one scanline in place, prev is the previous (already unfiltered) scanline or NULL
+static bool unfilterScanline(uint8_t* line, const uint8_t* prev, int filter, size_t length, size_t bpp)
+{
+	switch (filter)
+	{
+	case 0: break;
+	case 1:
+		for (size_t i = bpp; i < length; ++i)
+			line[i] += line[i - bpp];
+		break;
+	case 2:
+		if (prev)
+			for (size_t i = 0; i < length; ++i)
+				line[i] += prev[i];
+		break;
+	case 3:
+		for (size_t i = 0; i < length; ++i)
+		{
+			int a = i >= bpp ? line[i - bpp] : 0;
+			int b = prev ? prev[i] : 0;
+			line[i] += (uint8_t)((a + b) >> 1);
+		}
+		break;
+	case 4:
+		for (size_t i = 0; i < length; ++i)
+		{
+			int a = i >= bpp ? line[i - bpp] : 0;
+			int b = prev ? prev[i] : 0;
+			int c = (prev && i >= bpp) ? prev[i - bpp] : 0;
+			line[i] += (uint8_t)paethPredictor(a, b, c);
+		}
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+// reads the n-th sample of a scanline (any bit depth), 16 bits samples are returned complete
+static inline unsigned int readSample(const uint8_t* line, size_t index, int bit_depth)
+{
+	if (bit_depth == 8)
+		return line[index];
+	if (bit_depth == 16)
+		return (line[index * 2] << 8) | line[index * 2 + 1];
+
+	size_t bit = index * bit_depth;
+	unsigned int mask = (1u << bit_depth) - 1;
+	return (line[bit >> 3] >> (8 - bit_depth - (bit & 7))) & mask;
+}
+
+int decodePNG(std::vector<uint8_t>& out_image, int& width, int& height, const uint8_t* in_png, size_t in_size, bool convert_to_rgba32)
+{
+	const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	if (!convert_to_rgba32)
+		return 1; // only RGBA output is supported
+	if (!in_png || in_size < 8 || memcmp(in_png, signature, 8) != 0)
+		return 2;
+
+	int bit_depth = 0, color_type = -1, interlace = 0;
+	uint8_t palette[256 * 4];
+	memset(palette, 255, sizeof(palette));
+	bool has_key = false;
+	unsigned int key[3] = { 0, 0, 0 };
+
+	//scratch memory is kept per thread so decoding many files does not reallocate
+	thread_local std::vector<uint8_t> idat;
+	thread_local std::vector<uint8_t> raw;
+	idat.clear();
+	raw.clear();
+
+	size_t pos = 8;
+	while (pos + 12 <= in_size)
+	{
+		uint32_t length = readU32(in_png + pos);
+		if (length > in_size - pos - 12)
+			return 3; // truncated chunk
+		const uint8_t* type = in_png + pos + 4;
+		const uint8_t* chunk = in_png + pos + 8;
+
+		if (memcmp(type, "IHDR", 4) == 0)
+		{
+			if (length < 13)
+				return 4;
+			width = (int)readU32(chunk);
+			height = (int)readU32(chunk + 4);
+			bit_depth = chunk[8];
+			color_type = chunk[9];
+			if (chunk[10] != 0 || chunk[11] != 0)
+				return 5; // unknown compression or filter method
+			interlace = chunk[12];
+		}
+		else if (memcmp(type, "PLTE", 4) == 0)
+		{
+			size_t num = std::min<size_t>(length / 3, 256);
+			for (size_t i = 0; i < num; ++i)
+			{
+				palette[i * 4] = chunk[i * 3];
+				palette[i * 4 + 1] = chunk[i * 3 + 1];
+				palette[i * 4 + 2] = chunk[i * 3 + 2];
+			}
+		}
+		else if (memcmp(type, "tRNS", 4) == 0)
+		{
+			if (color_type == 3)
+			{
+				for (size_t i = 0; i < length && i < 256; ++i)
+					palette[i * 4 + 3] = chunk[i];
+			}
+			else if (color_type == 0 && length >= 2)
+			{
+				has_key = true;
+				key[0] = key[1] = key[2] = (chunk[0] << 8) | chunk[1];
+			}
+			else if (color_type == 2 && length >= 6)
+			{
+				has_key = true;
+				for (int i = 0; i < 3; ++i)
+					key[i] = (chunk[i * 2] << 8) | chunk[i * 2 + 1];
+			}
+		}
+		else if (memcmp(type, "IDAT", 4) == 0)
+			idat.insert(idat.end(), chunk, chunk + length);
+		else if (memcmp(type, "IEND", 4) == 0)
+			break;
+
+		pos += 12 + length; // length + type + data + crc
+	}
+
+	int channels = 0;
+	switch (color_type)
+	{
+	case 0: channels = 1; break; // gray
+	case 2: channels = 3; break; // rgb
+	case 3: channels = 1; break; // palette
+	case 4: channels = 2; break; // gray + alpha
+	case 6: channels = 4; break; // rgba
+	default: return 6;
+	}
+
+	bool valid_depth = bit_depth == 8 || (bit_depth == 16 && color_type != 3) ||
+		((bit_depth == 1 || bit_depth == 2 || bit_depth == 4) && (color_type == 0 || color_type == 3));
+	if (!valid_depth || width <= 0 || height <= 0 || width > (1 << 16) || height > (1 << 16) || interlace > 1)
+		return 7;
+
+	size_t bits_per_pixel = (size_t)channels * bit_depth;
+	size_t bpp = std::max<size_t>(1, bits_per_pixel / 8); // bytes per complete pixel, used by the filters
+
+	//Adam7 passes, a non interlaced image is a single pass covering everything
+	const int pass_x[7] = { 0, 4, 0, 2, 0, 1, 0 };
+	const int pass_y[7] = { 0, 0, 4, 0, 2, 0, 1 };
+	const int pass_dx[7] = { 8, 8, 4, 4, 2, 2, 1 };
+	const int pass_dy[7] = { 8, 8, 8, 4, 4, 2, 2 };
+	int num_passes = interlace ? 7 : 1;
+
+	size_t expected = 0;
+	for (int p = 0; p < num_passes; ++p)
+	{
+		size_t pw = interlace ? (width - pass_x[p] + pass_dx[p] - 1) / pass_dx[p] : width;
+		size_t ph = interlace ? (height - pass_y[p] + pass_dy[p] - 1) / pass_dy[p] : height;
+		if (pw && ph)
+			expected += ph * (1 + (pw * bits_per_pixel + 7) / 8);
+	}
+
+	raw.reserve(expected);
+	if (!inflateZlib(raw, idat.data(), idat.size()) || raw.size() < expected)
+		return 8;
+
+	out_image.resize((size_t)width * height * 4);
+	uint8_t* out = out_image.data();
+	unsigned int max_value = (1u << bit_depth) - 1;
+
+	size_t offset = 0;
+	for (int p = 0; p < num_passes; ++p)
+	{
+		int sx = interlace ? pass_x[p] : 0, sy = interlace ? pass_y[p] : 0;
+		int dx = interlace ? pass_dx[p] : 1, dy = interlace ? pass_dy[p] : 1;
+		size_t pw = (width - sx + dx - 1) / dx;
+		size_t ph = (height - sy + dy - 1) / dy;
+		if (!pw || !ph)
+			continue;
+
+		size_t stride = (pw * bits_per_pixel + 7) / 8;
+		const uint8_t* prev = NULL;
+		for (size_t y = 0; y < ph; ++y)
+		{
+			uint8_t* line = raw.data() + offset + 1;
+			if (!unfilterScanline(line, prev, raw[offset], stride, bpp))
+				return 9;
+			offset += stride + 1;
+			prev = line;
+
+			uint8_t* dst_row = out + ((sy + y * dy) * (size_t)width) * 4;
+			for (size_t x = 0; x < pw; ++x)
+			{
+				uint8_t* dst = dst_row + (sx + x * dx) * 4;
+				if (color_type == 3)
+				{
+					unsigned int index = readSample(line, x, bit_depth);
+					memcpy(dst, palette + index * 4, 4);
+					continue;
+				}
+
+				unsigned int samples[4];
+				for (int c = 0; c < channels; ++c)
+					samples[c] = readSample(line, x * channels + c, bit_depth);
+
+				//scale to 8 bits (16 bits keep the high byte)
+				uint8_t values[4];
+				for (int c = 0; c < channels; ++c)
+					values[c] = bit_depth == 16 ? (uint8_t)(samples[c] >> 8) : (uint8_t)(samples[c] * 255 / max_value);
+
+				if (channels <= 2) // gray or gray + alpha
+				{
+					dst[0] = dst[1] = dst[2] = values[0];
+					dst[3] = channels == 2 ? values[1] : (has_key && samples[0] == key[0] ? 0 : 255);
+				}
+				else
+				{
+					dst[0] = values[0];
+					dst[1] = values[1];
+					dst[2] = values[2];
+					if (channels == 4)
+						dst[3] = values[3];
+					else
+						dst[3] = (has_key && samples[0] == key[0] && samples[1] == key[1] && samples[2] == key[2]) ? 0 : 255;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,20 @@
+/*
+	Image decoders working from memory, so they can run in worker threads (no GL calls, no globals).
+	The output vector is reused as is, callers can pass pooled buffers to avoid reallocations.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// decodes an uncompressed TGA (24 or 32 bits), pixels are returned as RGB or RGBA
+bool decodeTGA(std::vector<uint8_t>& out_image, int& width, int& height, int& bytes_per_pixel, bool& origin_topleft, const uint8_t* in_tga, size_t in_size);
+
+// decodes a PNG of any color type, bit depth and interlacing, returns 0 on success
+// pixels are always returned as RGBA 8 bits per channel (convert_to_rgba32 is kept for compatibility, only true is supported)
+int decodePNG(std::vector<uint8_t>& out_image, int& width, int& height, const uint8_t* in_png, size_t in_size, bool convert_to_rgba32 = true);
+
+// raw DEFLATE stream inside a zlib container (RFC 1950/1951), appends to out, returns false on corrupted data
+bool inflateZlib(std::vector<uint8_t>& out, const uint8_t* in, size_t in_size);
@@ -0,0 +1,211 @@
+#include "fbo.h"
+
+#include "texture.h"
+
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+
+FBO::FBO()
+{
+	fbo_id = 0;
+	width = height = samples = 0;
+	depth_texture = NULL;
+	depth_renderbuffer = 0;
+	owns_textures = false;
+	previous_fbo = 0;
+	previous_viewport[0] = previous_viewport[1] = previous_viewport[2] = previous_viewport[3] = 0;
+}
+
+FBO::~FBO()
+{
+	freeTextures();
+	if (fbo_id)
+		glDeleteFramebuffers(1, &fbo_id);
+}
+
+void FBO::freeTextures()
+{
+	if (owns_textures)
+	{
+		for (Texture* texture : color_textures)
+			delete texture;
+		delete depth_texture;
+	}
+	color_textures.clear();
+	depth_texture = NULL;
+	owns_textures = false;
+
+	if (color_renderbuffers.size())
+		glDeleteRenderbuffers((GLsizei)color_renderbuffers.size(), color_renderbuffers.data());
+	if (depth_renderbuffer)
+		glDeleteRenderbuffers(1, &depth_renderbuffer);
+	color_renderbuffers.clear();
+	depth_renderbuffer = 0;
+	samples = 0;
+}
+
+bool FBO::create(int width, int height, int num_textures, unsigned int format, unsigned int type, bool use_depth_texture, unsigned int internal_format, int samples)
+{
+	assert(width && height && num_textures <= FBO_MAX_COLOR_TEXTURES && "invalid FBO");
+	freeTextures();
+
+	this->width = width;
+	this->height = height;
+
+	//textures can not be multisampled here, renderbuffers are only drawn and resolved
+	if (samples > 1)
+	{
+		GLint max_samples = 0;
+		glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+		this->samples = std::min(samples, (int)max_samples);
+		color_renderbuffers.resize(num_textures);
+		if (num_textures)
+			glGenRenderbuffers(num_textures, color_renderbuffers.data());
+		for (GLuint renderbuffer : color_renderbuffers)
+		{
+			glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER, this->samples, internal_format ? internal_format : GL_RGBA8, width, height);
+		}
+		if (use_depth_texture)
+		{
+			glGenRenderbuffers(1, &depth_renderbuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER, this->samples, GL_DEPTH_COMPONENT24, width, height);
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		return attach();
+	}
+
+	//render targets are read at the same resolution (or by texelFetch), no mipmaps
+	for (int i = 0; i < num_textures; ++i)
+	{
+		Texture* texture = new Texture();
+		texture->create(width, height, format, type, false, NULL, internal_format);
+		color_textures.push_back(texture);
+	}
+
+	if (use_depth_texture)
+	{
+		depth_texture = new Texture();
+		depth_texture->create(width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false, NULL, GL_DEPTH_COMPONENT24);
+		depth_texture->bind();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		depth_texture->unbind();
+	}
+
+	owns_textures = true;
+	return attach();
+}
+
+bool FBO::setTextures(const std::vector<Texture*>& textures, Texture* depth_texture)
+{
+	assert((textures.size() || depth_texture) && textures.size() <= FBO_MAX_COLOR_TEXTURES && "invalid FBO");
+	freeTextures();
+
+	Texture* first = textures.size() ? textures[0] : depth_texture;
+	for (Texture* texture : textures)
+		assert(texture->width == first->width && texture->height == first->height && "all the textures must have the same size");
+
+	color_textures = textures;
+	this->depth_texture = depth_texture;
+	width = (int)first->width;
+	height = (int)first->height;
+	return attach();
+}
+
+bool FBO::attach()
+{
+	if (!fbo_id)
+		glGenFramebuffers(1, &fbo_id);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+
+	for (int i = 0; i < FBO_MAX_COLOR_TEXTURES; ++i)
+	{
+		if (samples)
+		{
+			GLuint id = i < (int)color_renderbuffers.size() ? color_renderbuffers[i] : 0;
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_RENDERBUFFER, id);
+			continue;
+		}
+		GLuint id = i < (int)color_textures.size() ? color_textures[i]->texture_id : 0;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, id, 0);
+	}
+	if (samples)
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+	else
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture ? depth_texture->texture_id : 0, 0);
+	setDrawBuffers();
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "[ERROR] FBO incomplete: 0x" << std::hex << status << std::dec << " (" << width << "x" << height << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// of the FBO bound as draw framebuffer
+void FBO::setDrawBuffers()
+{
+	GLenum buffers[FBO_MAX_COLOR_TEXTURES];
+	int num_colors = getNumColorAttachments();
+	for (int i = 0; i < num_colors; ++i)
+		buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+
+	//depth only targets draw no color
+	if (num_colors)
+		glDrawBuffers(num_colors, buffers);
+	else
+		glDrawBuffer(GL_NONE);
+}
+
+void FBO::bind()
+{
+	assert(fbo_id && "FBO not created");
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_fbo);
+	glGetIntegerv(GL_VIEWPORT, previous_viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_id);
+	glViewport(0, 0, width, height);
+}
+
+void FBO::unbind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+	glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+}
+
+void FBO::resolve(FBO* target)
+{
+	assert(fbo_id && (!target || (target->width == width && target->height == height)) && "the resolve needs a target of the same size");
+	GLint previous_read = 0, previous_draw = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_read);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_draw);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_id);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target ? target->fbo_id : previous_draw);
+
+	//a blit writes every enabled draw buffer, one attachment at a time
+	int num_colors = target ? std::min(getNumColorAttachments(), target->getNumColorAttachments()) : std::min(getNumColorAttachments(), 1);
+	for (int i = 0; i < num_colors; ++i)
+	{
+		glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+		if (target)
+			glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+	if (hasDepth() && (!target || target->hasDepth()))
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+	if (target)
+		target->setDrawBuffers();
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previous_read);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous_draw);
+}
@@ -0,0 +1,59 @@
+/*
+	Framebuffer object: renders into textures instead of the screen.
+	Several color textures can be attached (multiple render targets) plus an optional depth texture,
+	bind() redirects the drawing to them and sets the viewport, unbind() restores the previous target.
+	Multisampled FBOs use renderbuffers instead of textures, they are read after resolve() into a regular one.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <vector>
+
+class Texture;
+
+#define FBO_MAX_COLOR_TEXTURES 4
+
+class FBO
+{
+public:
+	GLuint fbo_id;
+	int width;
+	int height;
+	int samples; // 0 if it is not multisampled
+
+	std::vector<Texture*> color_textures;
+	Texture* depth_texture;
+	bool owns_textures; // created by create(), deleted with the FBO
+
+	// attachments of the multisampled FBOs, always owned
+	std::vector<GLuint> color_renderbuffers;
+	GLuint depth_renderbuffer;
+
+	FBO();
+	~FBO();
+
+	// creates the textures and attaches them, format/type/internal_format are the ones of Texture::create
+	// with more than one sample they are multisampled renderbuffers of the internal format (GL_RGBA8 if it is 0)
+	bool create(int width, int height, int num_textures = 1, unsigned int format = GL_RGBA, unsigned int type = GL_UNSIGNED_BYTE, bool use_depth_texture = true, unsigned int internal_format = 0, int samples = 0);
+	// attaches existing textures (all of the same size), they are not deleted with the FBO
+	bool setTextures(const std::vector<Texture*>& textures, Texture* depth_texture = NULL);
+
+	void bind(); // drawing goes to the textures and the viewport covers them
+	void unbind(); // back to the framebuffer and viewport there were before bind()
+
+	// copies the color attachments and the depth into a target of the same size (the bound framebuffer if NULL, only the first color)
+	void resolve(FBO* target = NULL);
+	int getNumColorAttachments() const { return (int)(samples ? color_renderbuffers.size() : color_textures.size()); }
+	bool hasDepth() const { return depth_texture || depth_renderbuffer; }
+
+	void freeTextures();
+
+private:
+	GLint previous_fbo;
+	GLint previous_viewport[4];
+
+	bool attach();
+	void setDrawBuffers();
+};
@@ -0,0 +1,114 @@
+#include "fbopool.h"
+
+#include "fbo.h"
+#include "texturepool.h"
+
+#include <algorithm>
+
+FBOPool::sStats FBOPool::stats;
+std::vector<FBOPool::sEntry> FBOPool::entries;
+int FBOPool::frame = 0;
+int FBOPool::generation = 0;
+
+size_t sFBODesc::getBytes() const
+{
+	sTextureDesc color;
+	color.width = width;
+	color.height = height;
+	color.internal_format = internal_format ? internal_format : GL_RGBA8;
+	size_t bytes = color.getBytes() * num_textures;
+	if (depth)
+		bytes += (size_t)4 * width * height;
+	return bytes * std::max(samples, 1);
+}
+
+FBO* FBOPool::acquire(const sFBODesc& desc)
+{
+	for (sEntry& entry : entries)
+	{
+		if (entry.in_use || !(entry.desc == desc))
+			continue;
+		entry.in_use = true;
+		entry.last_frame = frame;
+		stats.reused++;
+		stats.in_use++;
+		return entry.fbo;
+	}
+
+	FBO* fbo = new FBO();
+	if (!fbo->create(desc.width, desc.height, desc.num_textures, desc.format, desc.type, desc.depth, desc.internal_format, desc.samples))
+	{
+		delete fbo;
+		return NULL;
+	}
+
+	entries.push_back({ fbo, desc, true, frame, generation });
+	stats.created++;
+	stats.fbos++;
+	stats.in_use++;
+	stats.bytes += desc.getBytes();
+	return fbo;
+}
+
+void FBOPool::release(FBO* fbo)
+{
+	if (!fbo)
+		return;
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		sEntry& entry = entries[i];
+		if (entry.fbo != fbo || !entry.in_use)
+			continue;
+		entry.in_use = false;
+		entry.last_frame = frame;
+		stats.in_use--;
+		if (entry.generation != generation)
+			destroy(i);
+		return;
+	}
+}
+
+void FBOPool::destroy(size_t index)
+{
+	sEntry& entry = entries[index];
+	stats.fbos--;
+	stats.bytes -= entry.desc.getBytes();
+	delete entry.fbo;
+	entries[index] = entries.back();
+	entries.pop_back();
+}
+
+void FBOPool::newFrame()
+{
+	frame++;
+	for (size_t i = 0; i < entries.size();)
+	{
+		if (!entries[i].in_use && frame - entries[i].last_frame > FBOPOOL_MAX_IDLE_FRAMES)
+			destroy(i);
+		else
+			++i;
+	}
+}
+
+void FBOPool::onResize()
+{
+	generation++;
+	stats.resizes++;
+	for (size_t i = 0; i < entries.size();)
+	{
+		if (!entries[i].in_use)
+			destroy(i);
+		else
+			++i;
+	}
+}
+
+void FBOPool::renderInMenu()
+{
+	ImGui::Text("FBOs: %d (%d in use)", stats.fbos, stats.in_use);
+	ImGui::Text("Memory: %.2f MB", stats.bytes / (1024.0 * 1024.0));
+	ImGui::Text("Created: %d, reused: %d, resizes: %d", stats.created, stats.reused, stats.resizes);
+	for (const sEntry& entry : entries)
+		ImGui::Text("%dx%d x%d 0x%04X%s%s%s", entry.desc.width, entry.desc.height, entry.desc.num_textures, entry.desc.internal_format,
+			entry.desc.depth ? " +depth" : "", entry.desc.samples > 1 ? " MSAA" : "", entry.in_use ? " (in use)" : "");
+}
@@ -0,0 +1,76 @@
+/*
+	FBO pool: offscreen targets are requested by description (size, format, attachments and samples) and given back
+	when the technique stops using them, so they are recycled between frames and between techniques instead of each one
+	creating its own. When the window is resized the free targets are deleted and the ones in use are deleted when they
+	are released, the old sizes are not kept around.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <vector>
+#include <cstddef>
+
+class FBO;
+
+#define FBOPOOL_MAX_IDLE_FRAMES 60 // free targets unused for longer are deleted
+
+struct sFBODesc
+{
+	int width = 0;
+	int height = 0;
+	int num_textures = 1; // color attachments, 0 for depth only targets
+	unsigned int format = GL_RGBA; // the ones of FBO::create
+	unsigned int type = GL_UNSIGNED_BYTE;
+	unsigned int internal_format = 0;
+	bool depth = true;
+	int samples = 0;
+
+	bool operator==(const sFBODesc& other) const {
+		return width == other.width && height == other.height && num_textures == other.num_textures && format == other.format
+			&& type == other.type && internal_format == other.internal_format && depth == other.depth && samples == other.samples;
+	}
+	size_t getBytes() const; // approximated from the internal format
+};
+
+class FBOPool
+{
+public:
+	struct sStats {
+		int fbos = 0; // allocated, in use or free
+		int in_use = 0;
+		int created = 0; // since the start
+		int reused = 0;
+		int resizes = 0;
+		size_t bytes = 0;
+	};
+
+	static sStats stats;
+
+	// a target with the description, its content and the filters of its textures are the ones the last user left
+	static FBO* acquire(const sFBODesc& desc);
+	static void release(FBO* fbo);
+
+	// deletes the targets idle for too long
+	static void newFrame();
+	// the window changed size, the targets made for the old one are not reused
+	static void onResize();
+
+	static void renderInMenu();
+
+private:
+	struct sEntry {
+		FBO* fbo;
+		sFBODesc desc;
+		bool in_use;
+		int last_frame; // released or acquired
+		int generation; // resizes before it was created
+	};
+
+	static std::vector<sEntry> entries;
+	static int frame;
+	static int generation;
+
+	static void destroy(size_t index);
+};
@@ -0,0 +1,246 @@
+#include "framegraph.h"
+
+#include "texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+
+tFrameResource FrameGraph::Builder::create(const char* name, const sTextureDesc& desc)
+{
+	tFrameResource resource = graph->addResource(name, true, false);
+	graph->resources[resource].desc = desc;
+	graph->passes[pass].creates.push_back(resource);
+	return write(resource);
+}
+
+tFrameResource FrameGraph::Builder::read(tFrameResource resource)
+{
+	if (resource == FRAMEGRAPH_NO_RESOURCE)
+		return resource;
+	sResource& r = graph->resources[resource];
+	sPass& p = graph->passes[pass];
+	p.reads.push_back(resource);
+	if (r.writer >= 0 && r.writer != pass)
+	{
+		p.inputs.push_back(r.writer);
+		p.after.push_back(r.writer);
+	}
+	r.readers.push_back(pass);
+	return resource;
+}
+
+tFrameResource FrameGraph::Builder::write(tFrameResource resource)
+{
+	if (resource == FRAMEGRAPH_NO_RESOURCE)
+		return resource;
+	sResource& r = graph->resources[resource];
+	sPass& p = graph->passes[pass];
+	p.writes.push_back(resource);
+
+	//after the previous writer and after whoever read its result, not needed by them though
+	if (r.writer >= 0 && r.writer != pass)
+		p.after.push_back(r.writer);
+	for (int reader : r.readers)
+		if (reader != pass)
+			p.after.push_back(reader);
+	r.writer = pass;
+	r.readers.clear();
+	return resource;
+}
+
+void FrameGraph::Builder::sideEffect()
+{
+	graph->passes[pass].side_effect = true;
+}
+
+tFrameResource FrameGraph::addResource(const char* name, bool transient, bool output)
+{
+	sResource resource;
+	resource.name = name;
+	resource.transient = transient;
+	resource.output = output;
+	this->resources.push_back(resource);
+	return (tFrameResource)this->resources.size() - 1;
+}
+
+tFrameResource FrameGraph::importResource(const char* name, bool output)
+{
+	return addResource(name, false, output);
+}
+
+tFrameResource FrameGraph::importTexture(const char* name, Texture* texture, bool output)
+{
+	tFrameResource resource = addResource(name, false, output);
+	this->resources[resource].texture = texture;
+	return resource;
+}
+
+void FrameGraph::addPass(const char* name, tSetup setup, tExecute execute)
+{
+	assert(!this->compiled && "passes are added before compiling");
+	sPass pass;
+	pass.name = name;
+	pass.execute = execute;
+	this->passes.push_back(pass);
+
+	Builder builder(this, (int)this->passes.size() - 1);
+	setup(builder);
+}
+
+void FrameGraph::compile()
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	int num_passes = (int)this->passes.size();
+
+	//culling: from the passes that must run, back through what they read
+	std::vector<int> stack;
+	for (int i = 0; i < num_passes; ++i)
+	{
+		sPass& pass = this->passes[i];
+		pass.culled = true;
+		bool needed = pass.side_effect;
+		for (tFrameResource resource : pass.writes)
+			needed |= this->resources[resource].output;
+		if (needed)
+			stack.push_back(i);
+	}
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+		sPass& pass = this->passes[index];
+		if (!pass.culled)
+			continue;
+		pass.culled = false;
+		for (int input : pass.inputs)
+			if (this->passes[input].culled)
+				stack.push_back(input);
+	}
+
+	//ordering: every pass waits for the ones it follows, among the ready ones the first declared goes first
+	std::vector<int> pending(num_passes, 0);
+	std::vector<std::vector<int>> followers(num_passes);
+	for (int i = 0; i < num_passes; ++i)
+	{
+		if (this->passes[i].culled)
+			continue;
+		std::vector<int>& after = this->passes[i].after;
+		std::sort(after.begin(), after.end());
+		after.erase(std::unique(after.begin(), after.end()), after.end());
+		for (int previous : after)
+			if (!this->passes[previous].culled)
+			{
+				pending[i]++;
+				followers[previous].push_back(i);
+			}
+	}
+	std::vector<int> ready;
+	for (int i = 0; i < num_passes; ++i)
+		if (!this->passes[i].culled && !pending[i])
+			ready.push_back(i);
+	this->order.clear();
+	while (!ready.empty())
+	{
+		auto first = std::min_element(ready.begin(), ready.end());
+		int index = *first;
+		ready.erase(first);
+		this->order.push_back(index);
+		for (int follower : followers[index])
+			if (--pending[follower] == 0)
+				ready.push_back(follower);
+	}
+
+	//lifetimes of the transients, from the first to the last pass that touches them
+	for (int position = 0; position < (int)this->order.size(); ++position)
+	{
+		const sPass& pass = this->passes[this->order[position]];
+		for (const std::vector<tFrameResource>* list : { &pass.reads, &pass.writes })
+			for (tFrameResource resource : *list)
+			{
+				sResource& r = this->resources[resource];
+				if (r.first_use < 0)
+					r.first_use = position;
+				r.last_use = position;
+			}
+	}
+
+	this->stats.passes = num_passes;
+	this->stats.culled = num_passes - (int)this->order.size();
+	this->stats.transients = 0;
+	for (const sResource& resource : this->resources)
+		if (resource.transient && resource.first_use >= 0)
+			this->stats.transients++;
+	this->compiled = true;
+	this->stats.compile_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void FrameGraph::execute()
+{
+	if (!this->compiled)
+		compile();
+
+	for (int position = 0; position < (int)this->order.size(); ++position)
+	{
+		sPass& pass = this->passes[this->order[position]];
+		for (tFrameResource resource : pass.creates)
+		{
+			sResource& r = this->resources[resource];
+			if (r.first_use == position)
+				r.texture = TexturePool::acquire(r.desc);
+		}
+
+		pass.execute(*this);
+
+		//given back as soon as possible, the next transient with the same description takes the same texture
+		for (sResource& r : this->resources)
+			if (r.transient && r.texture && r.last_use == position)
+			{
+				TexturePool::release(r.texture);
+				r.texture = NULL;
+			}
+	}
+
+	this->last_order.clear();
+	this->last_culled.clear();
+	this->last_transients.clear();
+	for (int index : this->order)
+		this->last_order.push_back(this->passes[index].name);
+	for (const sPass& pass : this->passes)
+		if (pass.culled)
+			this->last_culled.push_back(pass.name);
+	for (const sResource& resource : this->resources)
+		if (resource.transient && resource.first_use >= 0)
+			this->last_transients.push_back(resource.name + " (" + std::to_string(resource.desc.width) + "x" + std::to_string(resource.desc.height) + ")");
+
+	this->passes.clear();
+	this->resources.clear();
+	this->order.clear();
+	this->compiled = false;
+}
+
+Texture* FrameGraph::getTexture(tFrameResource resource) const
+{
+	if (resource == FRAMEGRAPH_NO_RESOURCE)
+		return NULL;
+	return this->resources[resource].texture;
+}
+
+void FrameGraph::renderInMenu()
+{
+	ImGui::Text("Passes: %d (%d culled)", this->stats.passes, this->stats.culled);
+	ImGui::Text("Transient textures: %d", this->stats.transients);
+	ImGui::Text("Compile: %.3f ms", this->stats.compile_time);
+	if (ImGui::TreeNode("Order")) {
+		for (size_t i = 0; i < this->last_order.size(); ++i)
+			ImGui::Text("%d. %s", (int)i + 1, this->last_order[i].c_str());
+		for (const std::string& name : this->last_culled)
+			ImGui::Text("%s (culled)", name.c_str());
+		ImGui::TreePop();
+	}
+	if (ImGui::TreeNode("Transients")) {
+		for (const std::string& name : this->last_transients)
+			ImGui::Text("%s", name.c_str());
+		ImGui::TreePop();
+	}
+}
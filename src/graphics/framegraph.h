@@ -0,0 +1,107 @@
+/*
+	Frame graph: the frame is described as passes that declare the resources they read and write, then compiled and executed.
+	Compiling culls the passes whose results nobody uses (only the ones with side effects or writing an output resource are needed,
+	and what they read), and orders the rest so every pass runs after the ones it depends on.
+	Resources are imported (the framebuffer, buffers and textures that live between frames, the graph only orders their use)
+	or transient: textures created by a pass that only exist from their first to their last use, taken from the TexturePool
+	and given back right after, so targets with the same description share memory along the frame.
+	The passes are declared again every frame, so they can depend on the settings of that frame.
+*/
+
+#pragma once
+
+#include "texturepool.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+
+class Texture;
+
+typedef int tFrameResource; // index of the resource in the frame
+#define FRAMEGRAPH_NO_RESOURCE -1
+
+class FrameGraph
+{
+public:
+	// what a pass declares in its setup, it is only valid inside it
+	class Builder
+	{
+	public:
+		tFrameResource create(const char* name, const sTextureDesc& desc); // transient, the pass writes it
+		tFrameResource read(tFrameResource resource);
+		tFrameResource write(tFrameResource resource);
+		void sideEffect(); // never culled (its work is for later frames or outside the graph)
+
+	private:
+		friend class FrameGraph;
+		FrameGraph* graph;
+		int pass;
+		Builder(FrameGraph* graph, int pass) : graph(graph), pass(pass) {}
+	};
+
+	typedef std::function<void(Builder&)> tSetup;
+	typedef std::function<void(FrameGraph&)> tExecute;
+
+	struct sStats {
+		int passes = 0;
+		int culled = 0;
+		int transients = 0; // textures created by passes that were not culled
+		double compile_time = 0.0; // ms
+	};
+
+	sStats stats;
+
+	// output resources are what the frame produces, the passes that write them are never culled
+	tFrameResource importResource(const char* name, bool output = false);
+	tFrameResource importTexture(const char* name, Texture* texture, bool output = false);
+
+	// the setup runs right away and declares what the pass uses, the execution waits for execute()
+	void addPass(const char* name, tSetup setup, tExecute execute);
+
+	void compile();
+	// runs the passes in order and clears the graph for the next frame
+	void execute();
+
+	// during execute(), the texture of a transient or imported texture resource
+	Texture* getTexture(tFrameResource resource) const;
+
+	void renderInMenu();
+
+private:
+	struct sResource {
+		std::string name;
+		bool transient = false;
+		bool output = false;
+		sTextureDesc desc;
+		Texture* texture = NULL;
+		int writer = -1; // last pass that wrote it while declaring
+		std::vector<int> readers; // since that write
+		int first_use = -1; // position in the execution order
+		int last_use = -1;
+	};
+
+	struct sPass {
+		std::string name;
+		tExecute execute;
+		std::vector<tFrameResource> creates;
+		std::vector<tFrameResource> reads;
+		std::vector<tFrameResource> writes;
+		std::vector<int> inputs; // passes that wrote what this one reads, they are needed if this one is
+		std::vector<int> after; // passes it must follow: inputs, previous writers and readers of what it writes
+		bool side_effect = false;
+		bool culled = false;
+	};
+
+	std::vector<sResource> resources;
+	std::vector<sPass> passes;
+	std::vector<int> order; // of the passes that are not culled
+	bool compiled = false;
+
+	// the last frame, for the menu
+	std::vector<std::string> last_order;
+	std::vector<std::string> last_culled;
+	std::vector<std::string> last_transients;
+
+	tFrameResource addResource(const char* name, bool transient, bool output);
+};
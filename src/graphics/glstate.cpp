@@ -0,0 +1,212 @@
+#include "glstate.h"
+
+#include <cassert>
+
+// value used for state that has not been set yet through the cache
+#define GLSTATE_UNKNOWN 0xFFFFFFFF
+
+GLState::sCounters GLState::counters;
+GLState::sCounters GLState::last_frame;
+
+GLuint GLState::program = GLSTATE_UNKNOWN;
+int GLState::active_unit = -1;
+GLuint GLState::textures[GLSTATE_MAX_TEXTURE_UNITS][3];
+int GLState::caps[3] = { -1, -1, -1 };
+GLenum GLState::blend_src = GLSTATE_UNKNOWN;
+GLenum GLState::blend_dst = GLSTATE_UNKNOWN;
+GLenum GLState::depth_func = GLSTATE_UNKNOWN;
+int GLState::depth_write = -1;
+GLenum GLState::polygon_mode = GLSTATE_UNKNOWN;
+
+static bool textures_ready = false; // the texture table starts as unknown
+
+static int getTargetIndex(GLenum target)
+{
+	switch (target) {
+	case GL_TEXTURE_2D: return 0;
+	case GL_TEXTURE_3D: return 1;
+	case GL_TEXTURE_CUBE_MAP: return 2;
+	}
+	return -1;
+}
+
+static int getCapIndex(GLenum cap)
+{
+	switch (cap) {
+	case GL_BLEND: return 0;
+	case GL_DEPTH_TEST: return 1;
+	case GL_CULL_FACE: return 2;
+	}
+	return -1;
+}
+
+void GLState::useProgram(GLuint program)
+{
+	if (GLState::program == program) {
+		counters.program_skipped++;
+		return;
+	}
+
+	glUseProgram(program);
+	GLState::program = program;
+	counters.program_changes++;
+}
+
+void GLState::activeTexture(int unit)
+{
+	assert(unit >= 0 && unit < GLSTATE_MAX_TEXTURE_UNITS && "texture unit out of range");
+	if (active_unit == unit) {
+		counters.texture_skipped++;
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + unit);
+	active_unit = unit;
+	counters.texture_changes++;
+}
+
+void GLState::bindTexture(GLenum target, GLuint texture)
+{
+	if (!textures_ready)
+		invalidate();
+
+	int index = getTargetIndex(target);
+	if (active_unit == -1 || index == -1) {
+		// unknown unit or target, cannot be cached
+		glBindTexture(target, texture);
+		if (active_unit != -1)
+			counters.texture_changes++;
+		return;
+	}
+
+	GLuint& bound = textures[active_unit][index];
+	if (bound == texture) {
+		counters.texture_skipped++;
+		return;
+	}
+
+	glBindTexture(target, texture);
+	bound = texture;
+	counters.texture_changes++;
+}
+
+void GLState::bindTexture(int unit, GLenum target, GLuint texture)
+{
+	// the unit must be active BEFORE binding, otherwise the texture ends in the previous unit
+	activeTexture(unit);
+	bindTexture(target, texture);
+}
+
+void GLState::setEnabled(GLenum cap, bool enabled)
+{
+	int index = getCapIndex(cap);
+	if (index != -1 && caps[index] == (int)enabled) {
+		counters.state_skipped++;
+		return;
+	}
+
+	if (enabled)
+		glEnable(cap);
+	else
+		glDisable(cap);
+
+	if (index != -1)
+		caps[index] = (int)enabled;
+	counters.state_changes++;
+}
+
+void GLState::blendFunc(GLenum src, GLenum dst)
+{
+	if (blend_src == src && blend_dst == dst) {
+		counters.state_skipped++;
+		return;
+	}
+
+	glBlendFunc(src, dst);
+	blend_src = src;
+	blend_dst = dst;
+	counters.state_changes++;
+}
+
+void GLState::depthFunc(GLenum func)
+{
+	if (depth_func == func) {
+		counters.state_skipped++;
+		return;
+	}
+
+	glDepthFunc(func);
+	depth_func = func;
+	counters.state_changes++;
+}
+
+void GLState::depthMask(bool write)
+{
+	if (depth_write == (int)write) {
+		counters.state_skipped++;
+		return;
+	}
+
+	glDepthMask(write ? GL_TRUE : GL_FALSE);
+	depth_write = (int)write;
+	counters.state_changes++;
+}
+
+void GLState::polygonMode(GLenum mode)
+{
+	if (polygon_mode == mode) {
+		counters.state_skipped++;
+		return;
+	}
+
+	glPolygonMode(GL_FRONT_AND_BACK, mode);
+	polygon_mode = mode;
+	counters.state_changes++;
+}
+
+void GLState::onTextureDeleted(GLuint texture)
+{
+	if (!textures_ready)
+		return;
+
+	for (int i = 0; i < GLSTATE_MAX_TEXTURE_UNITS; ++i)
+		for (int j = 0; j < 3; ++j)
+			if (textures[i][j] == texture)
+				textures[i][j] = 0;
+}
+
+void GLState::onProgramDeleted(GLuint program)
+{
+	// a deleted program stays in use until another one is bound, just force the next bind
+	if (GLState::program == program)
+		GLState::program = GLSTATE_UNKNOWN;
+}
+
+void GLState::invalidate()
+{
+	program = GLSTATE_UNKNOWN;
+	active_unit = -1;
+	for (int i = 0; i < GLSTATE_MAX_TEXTURE_UNITS; ++i)
+		for (int j = 0; j < 3; ++j)
+			textures[i][j] = GLSTATE_UNKNOWN;
+	textures_ready = true;
+
+	caps[0] = caps[1] = caps[2] = -1;
+	blend_src = blend_dst = GLSTATE_UNKNOWN;
+	depth_func = GLSTATE_UNKNOWN;
+	depth_write = -1;
+	polygon_mode = GLSTATE_UNKNOWN;
+}
+
+void GLState::newFrame()
+{
+	last_frame = counters;
+	counters = sCounters();
+}
+
+void GLState::renderInMenu()
+{
+	ImGui::Text("Program binds: %d (%d skipped)", last_frame.program_changes, last_frame.program_skipped);
+	ImGui::Text("Texture binds: %d (%d skipped)", last_frame.texture_changes, last_frame.texture_skipped);
+	ImGui::Text("State changes: %d (%d skipped)", last_frame.state_changes, last_frame.state_skipped);
+}
@@ -0,0 +1,65 @@
+/*
+	Cache of the OpenGL state (program, texture units, blend/depth/cull, polygon mode).
+	Every change goes through here so redundant GL calls are filtered before reaching the driver.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#define GLSTATE_MAX_TEXTURE_UNITS 16
+
+class GLState
+{
+public:
+	// calls that reached the driver vs calls filtered because the state was already set
+	struct sCounters {
+		unsigned int program_changes = 0;
+		unsigned int program_skipped = 0;
+		unsigned int texture_changes = 0;
+		unsigned int texture_skipped = 0;
+		unsigned int state_changes = 0;
+		unsigned int state_skipped = 0;
+	};
+
+	static sCounters counters; // current frame
+	static sCounters last_frame;
+
+	static void useProgram(GLuint program);
+
+	static void activeTexture(int unit);
+	static void bindTexture(GLenum target, GLuint texture); // in the active unit
+	static void bindTexture(int unit, GLenum target, GLuint texture);
+
+	// only GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE are cached, other caps go straight to GL
+	static void setEnabled(GLenum cap, bool enabled);
+	static void enable(GLenum cap) { setEnabled(cap, true); }
+	static void disable(GLenum cap) { setEnabled(cap, false); }
+
+	static void blendFunc(GLenum src, GLenum dst);
+	static void depthFunc(GLenum func);
+	static void depthMask(bool write);
+	static void polygonMode(GLenum mode); // GL_FRONT_AND_BACK
+
+	// GL deletes bindings of deleted objects, the cache must forget them too
+	static void onTextureDeleted(GLuint texture);
+	static void onProgramDeleted(GLuint program);
+
+	// forget everything (after code that changes GL state behind our back)
+	static void invalidate();
+
+	// stores the counters of the finished frame and starts counting again
+	static void newFrame();
+	static void renderInMenu();
+
+private:
+	static GLuint program;
+	static int active_unit;
+	static GLuint textures[GLSTATE_MAX_TEXTURE_UNITS][3]; // 2D, 3D, cubemap per unit
+	static int caps[3]; // blend, depth test, cull face (-1 unknown)
+	static GLenum blend_src;
+	static GLenum blend_dst;
+	static GLenum depth_func;
+	static int depth_write;
+	static GLenum polygon_mode;
+};
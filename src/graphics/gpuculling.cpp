@@ -0,0 +1,287 @@
+#include "gpuculling.h"
+
+#include "glstate.h"
+#include "shader.h"
+#include "mipmaps.h"
+#include "texture.h"
+#include "../framework/camera.h"
+#include "../framework/culling.h"
+#include "../framework/utils.h"
+
+#include <cstring>
+#include <algorithm>
+
+bool GPUCulling::enabled = true;
+bool GPUCulling::occlusion = true;
+GPUCulling::sStats GPUCulling::stats;
+
+std::vector<Mesh::tInstance> GPUCulling::instances;
+std::vector<GPUCulling::sBounds> GPUCulling::bounds;
+std::vector<Mesh::tIndirectCommand> GPUCulling::commands;
+
+bool GPUCulling::initialized = false;
+bool GPUCulling::failed = false;
+GLuint GPUCulling::cull_program = 0;
+GLuint GPUCulling::hiz_program = 0;
+GLuint GPUCulling::instance_buffer = 0;
+GLuint GPUCulling::bounds_buffer = 0;
+GLuint GPUCulling::command_buffer = 0;
+GLuint GPUCulling::counter_buffer = 0;
+bool GPUCulling::counters_pending = false;
+
+GLuint GPUCulling::hiz_texture = 0;
+glm::mat4 GPUCulling::hiz_viewprojection = glm::mat4(1.f);
+bool GPUCulling::hiz_valid = false;
+
+bool GPUCulling::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+		//compute runs in the CPU there, culling in the CPU directly is faster
+		const char* renderer = (const char*)glGetString(GL_RENDERER);
+		bool software = renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe") || strstr(renderer, "SwiftShader"));
+
+		supported = (major > 4 || (major == 4 && minor >= 3)) && !software;
+		if (!supported)
+			std::cout << "[INFO] GPU culling not available (" << major << "." << minor << (software ? ", software renderer" : "") << "), using CPU culling" << std::endl;
+	}
+	return supported == 1;
+}
+
+bool GPUCulling::isActive()
+{
+	return enabled && isSupported() && init();
+}
+
+GLuint GPUCulling::loadComputeProgram(const char* filename)
+{
+	std::string code;
+	if (!readFile(filename, code))
+	{
+		std::cout << "[ERROR] Compute shader not found: " << filename << std::endl;
+		return 0;
+	}
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	const char* source = code.c_str();
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+
+	GLint status = 0;
+	char log[2048];
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status)
+	{
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		std::cout << "[ERROR] Compute shader " << filename << " failed to compile:\n" << log << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glLinkProgram(program);
+	glDeleteShader(shader); // released with the program
+
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status)
+	{
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		std::cout << "[ERROR] Compute shader " << filename << " failed to link:\n" << log << std::endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+bool GPUCulling::init()
+{
+	if (initialized)
+		return !failed;
+	initialized = true;
+
+	cull_program = loadComputeProgram("res/shaders/culling.cs");
+	hiz_program = loadComputeProgram("res/shaders/hiz.cs");
+	if (!cull_program || !hiz_program)
+	{
+		std::cout << "[WARN] GPU culling disabled, using CPU culling" << std::endl;
+		failed = true;
+		return false;
+	}
+
+	GLuint buffers[4];
+	glGenBuffers(4, buffers);
+	instance_buffer = buffers[0];
+	bounds_buffer = buffers[1];
+	command_buffer = buffers[2];
+	counter_buffer = buffers[3];
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2, NULL, GL_DYNAMIC_READ);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return true;
+}
+
+void GPUCulling::begin()
+{
+	instances.clear();
+	bounds.clear();
+	commands.clear();
+}
+
+void GPUCulling::dispatch(Camera* camera)
+{
+	//counters of the previous dispatch, the GPU had a whole frame to finish it
+	if (counters_pending)
+	{
+		GLuint counters[2] = { 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+		stats.visible = (int)counters[0];
+		stats.occluded = (int)counters[1];
+		counters_pending = false;
+	}
+
+	int num_draws = (int)commands.size();
+	stats.tested = num_draws;
+	if (!num_draws)
+		return;
+
+	//orphaned every frame, the driver gives new memory if the previous draws still use it
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Mesh::tInstance), instances.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bounds_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(sBounds), bounds.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(Mesh::tIndirectCommand), commands.data(), GL_STREAM_DRAW);
+	GLuint zero[2] = { 0, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bounds_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, command_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, counter_buffer);
+
+	Frustum frustum;
+	frustum.fromMatrix(camera->viewprojection_matrix);
+	bool test_occlusion = occlusion && hiz_valid;
+
+	GLState::useProgram(cull_program);
+	glUniform1ui(glGetUniformLocation(cull_program, "u_num_draws"), (GLuint)num_draws);
+	glUniform4fv(glGetUniformLocation(cull_program, "u_planes"), 6, &frustum.planes[0].x);
+	glUniform1i(glGetUniformLocation(cull_program, "u_occlusion"), test_occlusion);
+	if (test_occlusion)
+	{
+		GLState::bindTexture(0, GL_TEXTURE_2D, hiz_texture);
+		glUniform1i(glGetUniformLocation(cull_program, "u_hiz"), 0);
+		glUniformMatrix4fv(glGetUniformLocation(cull_program, "u_hiz_viewprojection"), 1, GL_FALSE, &hiz_viewprojection[0][0]);
+		glUniform2f(glGetUniformLocation(cull_program, "u_hiz_size"), (float)stats.hiz_width, (float)stats.hiz_height);
+		glUniform1i(glGetUniformLocation(cull_program, "u_hiz_levels"), stats.hiz_levels);
+	}
+
+	glDispatchCompute((num_draws + GPUCULLING_GROUP_SIZE - 1) / GPUCULLING_GROUP_SIZE, 1, 1);
+
+	//the commands are read as indirect arguments, the counters with glGetBufferSubData
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	counters_pending = true;
+}
+
+Mesh::tIndirectBatch GPUCulling::getBatch(int first_command, int num_commands)
+{
+	Mesh::tIndirectBatch batch;
+	batch.instance_buffer = instance_buffer;
+	batch.command_buffer = command_buffer;
+	batch.command_offset = (size_t)first_command * sizeof(Mesh::tIndirectCommand);
+	batch.num_commands = num_commands;
+	return batch;
+}
+
+void GPUCulling::allocateHiZ(int width, int height)
+{
+	if (hiz_texture)
+	{
+		GLState::onTextureDeleted(hiz_texture);
+		glDeleteTextures(1, &hiz_texture);
+	}
+
+	stats.hiz_width = width;
+	stats.hiz_height = height;
+	stats.hiz_levels = getNumMipLevels(width, height, 1);
+
+	glGenTextures(1, &hiz_texture);
+	GLState::bindTexture(0, GL_TEXTURE_2D, hiz_texture);
+	glTexStorage2D(GL_TEXTURE_2D, stats.hiz_levels, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void GPUCulling::buildHiZ(Camera* camera, Texture* scene_depth)
+{
+	if (!usesHiZ() || !scene_depth)
+	{
+		hiz_valid = false;
+		return;
+	}
+
+	//the size of the copy, whatever the target it comes from
+	int width = (int)scene_depth->width;
+	int height = (int)scene_depth->height;
+	if (width <= 0 || height <= 0)
+		return;
+	if (width != stats.hiz_width || height != stats.hiz_height || !hiz_texture)
+		allocateHiZ(width, height);
+
+	GLState::bindTexture(0, GL_TEXTURE_2D, scene_depth->texture_id);
+
+	GLState::useProgram(hiz_program);
+	glUniform1i(glGetUniformLocation(hiz_program, "u_depth"), 0);
+	GLint level_location = glGetUniformLocation(hiz_program, "u_level");
+	GLint source_size_location = glGetUniformLocation(hiz_program, "u_source_size");
+
+	//level 0 converts the depth copy, every other level reduces the previous one
+	int w = width, h = height;
+	int source_w = width, source_h = height;
+	for (int level = 0; level < stats.hiz_levels; ++level)
+	{
+		glBindImageTexture(0, hiz_texture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, hiz_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glUniform1i(level_location, level);
+		glUniform2i(source_size_location, source_w, source_h);
+
+		glDispatchCompute((w + GPUCULLING_HIZ_GROUP_SIZE - 1) / GPUCULLING_HIZ_GROUP_SIZE, (h + GPUCULLING_HIZ_GROUP_SIZE - 1) / GPUCULLING_HIZ_GROUP_SIZE, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		source_w = w; source_h = h;
+		w = getMipSize(w); h = getMipSize(h);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	hiz_viewprojection = camera->viewprojection_matrix;
+	hiz_valid = true;
+}
+
+void GPUCulling::renderInMenu()
+{
+	if (!isSupported())
+	{
+		ImGui::Text("Not supported (needs GL 4.3 in a hardware driver)");
+		return;
+	}
+	ImGui::Checkbox("GPU culling", &enabled);
+	ImGui::Checkbox("Occlusion (Hi-Z)", &occlusion);
+	if (!isActive())
+		return;
+	ImGui::Text("Tested: %d", stats.tested);
+	ImGui::Text("Visible: %d, occluded: %d", stats.visible, stats.occluded);
+	ImGui::Text("Hi-Z: %dx%d, %d levels", stats.hiz_width, stats.hiz_height, stats.hiz_levels);
+}
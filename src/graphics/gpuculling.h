@@ -0,0 +1,86 @@
+/*
+	GPU culling: the bounds of the opaque batches are uploaded to SSBOs and a compute shader tests them against the camera frustum
+	and a hierarchical Z pyramid built from the previous frame depth, writing the instance count of their indirect draw commands.
+	The batches are then drawn with multi-draw-indirect, nothing is read back to decide what is drawn.
+	Needs GL 4.3 (compute shaders, SSBOs, multi-draw-indirect), otherwise and on software rasterizers the CPU culling is used.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+#include "mesh.h"
+
+#include <vector>
+#include <glm/vec4.hpp>
+#include <glm/matrix.hpp>
+
+class Camera;
+class Texture;
+
+#define GPUCULLING_GROUP_SIZE 64 // local_size_x of culling.cs
+#define GPUCULLING_HIZ_GROUP_SIZE 8 // local_size_x/y of hiz.cs
+
+class GPUCulling
+{
+public:
+	// std430 layout, one per draw command
+	struct sBounds {
+		glm::vec4 sphere; // xyz center, w radius
+		glm::vec4 box_center;
+		glm::vec4 box_halfsize;
+	};
+
+	struct sStats {
+		int tested = 0;
+		int visible = 0; // from the counters of the previous dispatch, so they are one frame late
+		int occluded = 0;
+		int hiz_width = 0;
+		int hiz_height = 0;
+		int hiz_levels = 0;
+	};
+
+	static bool enabled;
+	static bool occlusion; // test against the Hi-Z pyramid too, not only the frustum
+	static sStats stats;
+
+	// the draws of the frame, filled between begin() and dispatch(), the commands point to the instances with their base instance
+	static std::vector<Mesh::tInstance> instances;
+	static std::vector<sBounds> bounds;
+	static std::vector<Mesh::tIndirectCommand> commands;
+
+	static bool isSupported(); // GL 4.3 context in a hardware driver
+	static bool isActive(); // enabled, supported and the compute programs are compiled
+
+	static void begin();
+	// uploads the draws and culls them, the commands are ready for the indirect draws afterwards
+	static void dispatch(Camera* camera);
+	static Mesh::tIndirectBatch getBatch(int first_command, int num_commands);
+
+	// after the opaque pass: reduces a copy of its depth buffer, the next frame tests against it
+	// (without occlusion it only invalidates the pyramid, scene_depth can be NULL then)
+	static void buildHiZ(Camera* camera, Texture* scene_depth);
+	static bool usesHiZ() { return occlusion && isActive(); }
+
+	static void renderInMenu();
+
+	// 0 if it does not compile or link, the errors go to the console
+	static GLuint loadComputeProgram(const char* filename);
+
+private:
+	static bool initialized;
+	static bool failed;
+	static GLuint cull_program;
+	static GLuint hiz_program;
+	static GLuint instance_buffer;
+	static GLuint bounds_buffer;
+	static GLuint command_buffer;
+	static GLuint counter_buffer;
+	static bool counters_pending; // a dispatch wrote them and they were not read yet
+
+	static GLuint hiz_texture; // max depth of every texel footprint, full mip chain
+	static glm::mat4 hiz_viewprojection; // camera the pyramid was rendered with
+	static bool hiz_valid;
+
+	static bool init();
+	static void allocateHiZ(int width, int height);
+};
@@ -0,0 +1,117 @@
+#include "lightbuffer.h"
+
+#include "shader.h"
+#include "mesh.h"
+#include "shadowatlas.h"
+#include "../framework/light.h"
+
+#include <algorithm>
+
+std::vector<LightBuffer::sLight> LightBuffer::lights;
+LightBuffer::sStats LightBuffer::stats;
+GLuint LightBuffer::buffer = 0;
+
+void LightBuffer::update(const std::vector<Light*>& light_list)
+{
+	lights.clear();
+	for (Light* light : light_list)
+	{
+		if ((int)lights.size() == LIGHTBUFFER_MAX_LIGHTS)
+			break;
+		if (!light->visible)
+			continue;
+
+		const glm::mat4& global = light->getGlobalMatrix();
+		sLight packed;
+		packed.position = glm::vec4(glm::vec3(global[3]), (float)light->light_type);
+		packed.direction = glm::vec4(glm::vec3(global[2]), cosf(light->cone_angle * 3.14159265359f / 180.f));
+		packed.color = glm::vec4(glm::vec3(light->color), light->intensity);
+		int num_views = 0;
+		int first_view = ShadowAtlas::getFirstView(light, num_views);
+		packed.params = glm::vec4(light->max_distance, light->shininess, (float)first_view, (float)num_views);
+		lights.push_back(packed);
+	}
+
+	stats.lights = (int)lights.size();
+	stats.draws = stats.passed = stats.rejected = 0;
+
+	//the whole array every frame, it is small and the block size is fixed
+	if (!buffer)
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(sLight) * LIGHTBUFFER_MAX_LIGHTS, NULL, GL_DYNAMIC_DRAW);
+	}
+	else
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	if (lights.size())
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(sLight) * lights.size(), lights.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTBUFFER_BINDING, buffer);
+}
+
+bool LightBuffer::bindBlock(Shader* shader)
+{
+	GLuint block = glGetUniformBlockIndex(shader->getProgram(), "Lights");
+	if (block == GL_INVALID_INDEX || !buffer)
+		return false;
+	glUniformBlockBinding(shader->getProgram(), block, LIGHTBUFFER_BINDING);
+	return true;
+}
+
+void LightBuffer::bind(Shader* shader)
+{
+	int indices[LIGHTBUFFER_MAX_PER_DRAW];
+	int count = std::min((int)lights.size(), LIGHTBUFFER_MAX_PER_DRAW);
+	for (int i = 0; i < count; ++i)
+		indices[i] = i;
+	bind(shader, indices, count);
+}
+
+void LightBuffer::bind(Shader* shader, const BoundingBox& world_box)
+{
+	int indices[LIGHTBUFFER_MAX_PER_DRAW];
+	int count = cull(world_box, indices, LIGHTBUFFER_MAX_PER_DRAW);
+	bind(shader, indices, count);
+}
+
+void LightBuffer::bind(Shader* shader, const int* indices, int count)
+{
+	if (!bindBlock(shader))
+		count = 0;
+	count = std::min(count, LIGHTBUFFER_MAX_PER_DRAW);
+	shader->setUniform("u_num_lights", count);
+	if (count)
+		shader->setUniform1Array("u_light_indices", indices, count);
+}
+
+int LightBuffer::cull(const BoundingBox& world_box, int* indices, int max_indices)
+{
+	int count = 0;
+	for (int i = 0; i < (int)lights.size() && count < max_indices; ++i)
+	{
+		const sLight& light = lights[i];
+		if ((int)light.position.w != LIGHT_DIRECTIONAL)
+		{
+			//distance from the light to the closest point of the box
+			glm::vec3 offset = glm::max(glm::abs(glm::vec3(light.position) - world_box.center) - world_box.halfsize, glm::vec3(0.f));
+			if (glm::dot(offset, offset) > light.params.x * light.params.x)
+			{
+				stats.rejected++;
+				continue;
+			}
+		}
+		indices[count++] = i;
+	}
+	stats.draws++;
+	stats.passed += count;
+	return count;
+}
+
+void LightBuffer::renderInMenu()
+{
+	ImGui::Text("Lights in the buffer: %d/%d", stats.lights, LIGHTBUFFER_MAX_LIGHTS);
+	ImGui::Text("Culled draws: %d", stats.draws);
+	ImGui::Text("Lights per draw: %.2f", stats.draws ? stats.passed / (float)stats.draws : 0.f);
+	ImGui::Text("Rejected by distance: %d", stats.rejected);
+}
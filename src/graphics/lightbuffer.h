@@ -0,0 +1,62 @@
+/*
+	Light buffer: the lights of the scene packed in a uniform buffer once per frame, shared by every shader with the Lights block.
+	Each draw culls the list against its world bounds (Light::max_distance, directional lights always pass) and passes
+	the indices of the lights that reach it, so a single draw loops over the relevant lights instead of drawing once per light.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/matrix.hpp>
+
+class Light;
+class Shader;
+class BoundingBox;
+
+#define LIGHTBUFFER_MAX_LIGHTS 256 // size of the array in the Lights block of the shaders (256 * 64 bytes, the minimum block size GL guarantees)
+#define LIGHTBUFFER_MAX_PER_DRAW 16 // size of u_light_indices
+#define LIGHTBUFFER_BINDING 0 // uniform buffer binding point
+
+class LightBuffer
+{
+public:
+	// std140 layout, one per light
+	struct sLight {
+		glm::vec4 position; // xyz world position, w eLightType
+		glm::vec4 direction; // xyz world direction (the z axis of the light), w cos of the spot cone
+		glm::vec4 color; // rgb color, w intensity
+		glm::vec4 params; // x max_distance, y shininess, z first view in the ShadowAtlas (-1 without shadow), w number of views
+	};
+
+	struct sStats {
+		int lights = 0; // in the buffer
+		int draws = 0; // culled draws in the last frame
+		int passed = 0; // lights that reached them, summed
+		int rejected = 0;
+	};
+
+	static std::vector<sLight> lights; // of this frame, in the order of the list
+	static sStats stats;
+
+	// once per frame before drawing and after ShadowAtlas::update, lights over LIGHTBUFFER_MAX_LIGHTS are left out
+	static void update(const std::vector<Light*>& light_list);
+	// the Lights block of the shader reads the buffer, and u_num_lights/u_light_indices get every light (no culling)
+	static void bind(Shader* shader);
+	// same with only the lights that reach a world box
+	static void bind(Shader* shader, const BoundingBox& world_box);
+	// same with a list already chosen by the caller (at most LIGHTBUFFER_MAX_PER_DRAW)
+	static void bind(Shader* shader, const int* indices, int count);
+
+	// indices of the lights that reach the box, returns how many (at most max_indices)
+	static int cull(const BoundingBox& world_box, int* indices, int max_indices);
+
+	static void renderInMenu();
+
+private:
+	static GLuint buffer;
+	static bool bindBlock(Shader* shader);
+};
@@ -0,0 +1,230 @@
+#include "lightgrid.h"
+
+#include "lightbuffer.h"
+#include "shader.h"
+#include "glstate.h"
+#include "../framework/camera.h"
+#include "../framework/light.h"
+#include "../framework/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+
+bool LightGrid::enabled = true;
+LightGrid::sStats LightGrid::stats;
+bool LightGrid::active = false;
+std::vector<LightGrid::sCluster> LightGrid::clusters;
+glm::mat4 LightGrid::clusters_projection;
+glm::vec4 LightGrid::clusters_viewport;
+std::vector<uint32_t> LightGrid::cells;
+std::vector<uint16_t> LightGrid::indices;
+std::vector<int> LightGrid::directional;
+glm::vec4 LightGrid::viewport;
+glm::vec2 LightGrid::depth_params;
+glm::vec3 LightGrid::camera_front;
+GLuint LightGrid::buffers[2] = { 0, 0 };
+GLuint LightGrid::textures[2] = { 0, 0 };
+
+static_assert(LIGHTBUFFER_MAX_LIGHTS <= 65536, "the light indices are stored in 16 bits");
+
+void LightGrid::buildClusters(Camera* camera)
+{
+	clusters.resize(LIGHTGRID_NUM_CLUSTERS);
+	clusters_projection = camera->projection_matrix;
+	clusters_viewport = viewport;
+
+	//view space point of a NDC position at a depth, the camera looks down -z
+	const glm::mat4& projection = camera->projection_matrix;
+	auto unproject = [&](float x, float y, float depth) {
+		return glm::vec3(x * depth / projection[0][0], y * depth / projection[1][1], -depth);
+	};
+
+	float ratio = camera->far_plane / camera->near_plane;
+	for (int s = 0; s < LIGHTGRID_SLICES; ++s)
+	{
+		float depths[2] = {
+			camera->near_plane * powf(ratio, s / (float)LIGHTGRID_SLICES),
+			camera->near_plane * powf(ratio, (s + 1) / (float)LIGHTGRID_SLICES)
+		};
+		for (int y = 0; y < LIGHTGRID_TILES_Y; ++y)
+			for (int x = 0; x < LIGHTGRID_TILES_X; ++x)
+			{
+				float x0 = -1.f + 2.f * x / LIGHTGRID_TILES_X, x1 = -1.f + 2.f * (x + 1) / LIGHTGRID_TILES_X;
+				float y0 = -1.f + 2.f * y / LIGHTGRID_TILES_Y, y1 = -1.f + 2.f * (y + 1) / LIGHTGRID_TILES_Y;
+
+				//the slab of the frustum is a truncated pyramid, its box covers the 8 corners
+				sCluster& cluster = clusters[(s * LIGHTGRID_TILES_Y + y) * LIGHTGRID_TILES_X + x];
+				cluster.min = glm::vec3(FLT_MAX);
+				cluster.max = glm::vec3(-FLT_MAX);
+				for (float depth : depths)
+					for (glm::vec2 corner : { glm::vec2(x0, y0), glm::vec2(x1, y0), glm::vec2(x0, y1), glm::vec2(x1, y1) })
+					{
+						glm::vec3 p = unproject(corner.x, corner.y, depth);
+						cluster.min = glm::min(cluster.min, p);
+						cluster.max = glm::max(cluster.max, p);
+					}
+			}
+	}
+}
+
+void LightGrid::update(Camera* camera)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	stats = sStats();
+	active = false;
+	directional.clear();
+	if (!enabled || camera->type != Camera::PERSPECTIVE)
+		return;
+
+	GLint rect[4];
+	glGetIntegerv(GL_VIEWPORT, rect);
+	if (rect[2] <= 0 || rect[3] <= 0)
+		return;
+	viewport = glm::vec4(rect[0], rect[1], rect[2], rect[3]);
+	if (clusters.empty() || clusters_projection != camera->projection_matrix || clusters_viewport != viewport)
+		buildClusters(camera);
+
+	float near_plane = camera->near_plane, far_plane = camera->far_plane;
+	float log_ratio = logf(far_plane / near_plane);
+	depth_params = glm::vec2(LIGHTGRID_SLICES / log_ratio, -LIGHTGRID_SLICES * logf(near_plane) / log_ratio);
+	const glm::mat4& view = camera->view_matrix;
+	camera_front = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+
+	auto getSlice = [](float depth) {
+		return std::clamp((int)floorf(logf(depth) * depth_params.x + depth_params.y), 0, LIGHTGRID_SLICES - 1);
+	};
+
+	//the ranges of the local lights as view space spheres, with the slices they span
+	struct sSphere {
+		glm::vec3 center;
+		float radius;
+		int first_slice;
+		int last_slice;
+		uint16_t index;
+	};
+	static std::vector<sSphere> spheres;
+	spheres.clear();
+	const std::vector<LightBuffer::sLight>& lights = LightBuffer::lights;
+	for (int i = 0; i < (int)lights.size(); ++i)
+	{
+		const LightBuffer::sLight& light = lights[i];
+		if ((int)light.position.w == LIGHT_DIRECTIONAL)
+		{
+			directional.push_back(i);
+			continue;
+		}
+		sSphere sphere;
+		sphere.center = glm::vec3(view * glm::vec4(glm::vec3(light.position), 1.f));
+		sphere.radius = light.params.x;
+		float depth = -sphere.center.z;
+		if (sphere.radius <= 0.f || depth + sphere.radius < near_plane || depth - sphere.radius > far_plane)
+			continue;
+		sphere.first_slice = getSlice(std::max(depth - sphere.radius, near_plane));
+		sphere.last_slice = getSlice(std::min(depth + sphere.radius, far_plane));
+		sphere.index = (uint16_t)i;
+		spheres.push_back(sphere);
+	}
+	stats.local_lights = (int)spheres.size();
+	stats.directional_lights = (int)directional.size();
+
+	//every slice fills its own list, then they are joined and the offsets moved
+	static std::vector<std::vector<uint16_t>> slice_indices(LIGHTGRID_SLICES);
+	cells.resize(LIGHTGRID_NUM_CLUSTERS * 2);
+	ThreadPool::Get()->parallelFor(0, LIGHTGRID_SLICES, [&](int begin, int end) {
+		for (int s = begin; s < end; ++s)
+		{
+			std::vector<uint16_t>& list = slice_indices[s];
+			list.clear();
+			for (int c = s * LIGHTGRID_TILES_X * LIGHTGRID_TILES_Y; c < (s + 1) * LIGHTGRID_TILES_X * LIGHTGRID_TILES_Y; ++c)
+			{
+				const sCluster& cluster = clusters[c];
+				size_t first = list.size();
+				for (const sSphere& sphere : spheres)
+				{
+					if (s < sphere.first_slice || s > sphere.last_slice)
+						continue;
+					glm::vec3 offset = glm::max(glm::max(cluster.min - sphere.center, sphere.center - cluster.max), glm::vec3(0.f));
+					if (glm::dot(offset, offset) <= sphere.radius * sphere.radius)
+						list.push_back(sphere.index);
+				}
+				cells[c * 2] = (uint32_t)first;
+				cells[c * 2 + 1] = (uint32_t)(list.size() - first);
+			}
+		}
+	}, 1);
+
+	indices.clear();
+	for (int s = 0; s < LIGHTGRID_SLICES; ++s)
+	{
+		uint32_t base = (uint32_t)indices.size();
+		for (int c = s * LIGHTGRID_TILES_X * LIGHTGRID_TILES_Y; c < (s + 1) * LIGHTGRID_TILES_X * LIGHTGRID_TILES_Y; ++c)
+		{
+			cells[c * 2] += base;
+			stats.max_per_cluster = std::max(stats.max_per_cluster, (int)cells[c * 2 + 1]);
+			if (!cells[c * 2 + 1])
+				stats.empty_clusters++;
+		}
+		indices.insert(indices.end(), slice_indices[s].begin(), slice_indices[s].end());
+	}
+	stats.indices = (int)indices.size();
+
+	upload();
+	active = true;
+	stats.build_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightGrid::upload()
+{
+	if (!buffers[0])
+	{
+		glGenBuffers(2, buffers);
+		glGenTextures(2, textures);
+		GLenum formats[2] = { GL_RG32UI, GL_R16UI };
+		for (int i = 0; i < 2; ++i)
+		{
+			glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, 4, NULL, GL_STREAM_DRAW);
+			GLState::bindTexture(GL_TEXTURE_BUFFER, textures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+		}
+	}
+
+	//orphaned every frame, the draws of the previous one can still be reading them
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+	glBufferData(GL_TEXTURE_BUFFER, cells.size() * sizeof(uint32_t), cells.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+	if (indices.size())
+		glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+bool LightGrid::bind(Shader* shader)
+{
+	//the samplers always point to their own units, so they never share one with a sampler of other type
+	shader->setUniform("u_cluster_grid", LIGHTGRID_GRID_UNIT);
+	shader->setUniform("u_cluster_lights", LIGHTGRID_LIGHTS_UNIT);
+	shader->setUniform("u_clustered", active);
+	if (!active)
+		return false;
+
+	GLState::bindTexture(LIGHTGRID_GRID_UNIT, GL_TEXTURE_BUFFER, textures[0]);
+	GLState::bindTexture(LIGHTGRID_LIGHTS_UNIT, GL_TEXTURE_BUFFER, textures[1]);
+	shader->setUniform3("u_cluster_dims", LIGHTGRID_TILES_X, LIGHTGRID_TILES_Y, LIGHTGRID_SLICES);
+	shader->setUniform("u_cluster_depth", depth_params);
+	shader->setUniform("u_camera_front", camera_front);
+	shader->setUniform("u_viewport", viewport);
+	LightBuffer::bind(shader, directional.data(), (int)directional.size());
+	return true;
+}
+
+void LightGrid::renderInMenu()
+{
+	ImGui::Checkbox("Enabled", &enabled);
+	ImGui::Text("Grid: %dx%dx%d clusters", LIGHTGRID_TILES_X, LIGHTGRID_TILES_Y, LIGHTGRID_SLICES);
+	ImGui::Text("Local lights: %d, directional: %d", stats.local_lights, stats.directional_lights);
+	ImGui::Text("Light indices: %d (%.2f per cluster, max %d)", stats.indices, stats.indices / (float)LIGHTGRID_NUM_CLUSTERS, stats.max_per_cluster);
+	ImGui::Text("Empty clusters: %d", stats.empty_clusters);
+	ImGui::Text("Build: %.3f ms", stats.build_time);
+}
@@ -0,0 +1,77 @@
+/*
+	Light grid for clustered forward shading: the view frustum is split in screen tiles and exponential depth slices,
+	and every cluster stores the indices of the point and spot lights whose range (Light::max_distance) touches it.
+	The grid is built in the CPU once per frame after LightBuffer::update and uploaded to two buffer textures,
+	so a single draw per mesh loops only over the lights of the cluster of each fragment, whatever the number of lights.
+	It is not built in a compute shader because it must also work on the fallback context of main.cpp (GL 4.1 shaders,
+	no compute), the 4.3 one is not always available.
+	Directional lights reach every cluster and are passed apart, with the per draw indices of LightBuffer.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <vector>
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/matrix.hpp>
+
+class Camera;
+class Shader;
+
+#define LIGHTGRID_TILES_X 16
+#define LIGHTGRID_TILES_Y 9
+#define LIGHTGRID_SLICES 24
+#define LIGHTGRID_NUM_CLUSTERS (LIGHTGRID_TILES_X * LIGHTGRID_TILES_Y * LIGHTGRID_SLICES)
+#define LIGHTGRID_GRID_UNIT 6 // texture units of the buffer textures
+#define LIGHTGRID_LIGHTS_UNIT 7
+
+class LightGrid
+{
+public:
+	struct sStats {
+		int local_lights = 0; // point and spot lights in the grid
+		int directional_lights = 0;
+		int indices = 0; // light references in all the clusters
+		int max_per_cluster = 0;
+		int empty_clusters = 0;
+		double build_time = 0.0; // ms
+	};
+
+	static bool enabled;
+	static sStats stats;
+
+	// after LightBuffer::update, with the camera and the viewport of the frame
+	// perspective cameras only, otherwise the grid is not used and the draws cull per draw
+	static void update(Camera* camera);
+
+	// binds the grid and passes the directional lights in u_light_indices, false if there is no grid this frame
+	static bool bind(Shader* shader);
+
+	static void renderInMenu();
+
+private:
+	// view space bounds of every cluster, rebuilt when the projection or the viewport change
+	struct sCluster {
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	static bool active; // built this frame
+	static std::vector<sCluster> clusters;
+	static glm::mat4 clusters_projection; // the bounds were built with them
+	static glm::vec4 clusters_viewport;
+	static std::vector<uint32_t> cells; // per cluster: offset, count
+	static std::vector<uint16_t> indices; // light indices of all the clusters, one run per cluster
+	static std::vector<int> directional; // LightBuffer indices
+	static glm::vec4 viewport;
+	static glm::vec2 depth_params; // slice = log(depth) * x + y
+	static glm::vec3 camera_front; // depth of a point is its distance along it
+	static GLuint buffers[2]; // cells, indices
+	static GLuint textures[2];
+
+	static void buildClusters(Camera* camera);
+	static void upload();
+};
@@ -1,6 +1,14 @@
 #include "material.h"
 
 #include "application.h"
+#include "glstate.h"
+#include "volumeprofiler.h"
+#include "volumepass.h"
+#include "bluenoise.h"
+#include "noisevolume.h"
+#include "lightbuffer.h"
+#include "lightgrid.h"
+#include "shadowatlas.h"
 
 // From lab 4:
 #include "../easyVDB/src/openvdbReader.h"
@@ -9,6 +17,8 @@
 #include <istream>
 #include <fstream>
 #include <algorithm>
+#include <typeinfo>
+#include <functional>
 
 //--------------- LAB 4 AUX. FUNCTIONS -----------------------------
 
@@ -131,16 +141,89 @@ void VolumeMaterial::estimate3DTexture(easyVDB::OpenVDBReader* vdbReader)
 		// now we create the texture with the data
 		// use this: https://www.khronos.org/opengl/wiki/OpenGL_Type
 		// and this: https://registry.khronos.org/OpenGL-Refpages/gl4/html/glTexImage3D.xhtml
+		// the mip chain is built in the CPU, the density is read from level 0 and the coarse levels with textureLod
 		this->texture = new Texture();
-		this->texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, false, data, GL_R8);
+		this->texture->mip_filter = MIP_FILTER_MAX; // the adaptive step reads a coarse level, it must not miss thin features
+		this->texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, true, data, GL_R8);
+		markDirty();
 	}
 }
 
 
+// materials declare the state they need instead of restoring it after every draw,
+// the cache filters it when consecutive nodes use the same state
+static void setSolidState()
+{
+	GLState::polygonMode(GL_FILL);
+	GLState::enable(GL_CULL_FACE);
+	GLState::disable(GL_BLEND);
+	GLState::depthMask(true);
+}
+
+// the volume shaders return premultiplied color and 1 - transmittance as alpha
+static void setVolumeState()
+{
+	GLState::polygonMode(GL_FILL);
+	GLState::enable(GL_CULL_FACE);
+	GLState::enable(GL_BLEND);
+	GLState::blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	GLState::depthMask(false); // tested against the opaque geometry, volumes behind must still be seen
+}
+
+void Material::renderShadow(Mesh* mesh, glm::mat4 model, Camera* light_camera)
+{
+	//compiled right away, a map drawn without its casters would not be drawn again until they move
+	static Shader* depth_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/flat.fs");
+	if (!mesh || !depth_shader)
+		return;
+
+	depth_shader->enable();
+	depth_shader->setUniform("u_viewprojection", light_camera->viewprojection_matrix);
+	depth_shader->setUniform("u_model", model);
+	depth_shader->setUniform("u_color", glm::vec4(1.f));
+	mesh->render(GL_TRIANGLES);
+	depth_shader->disable();
+}
+
+bool Material::renderFallback(Mesh* mesh, glm::mat4 model, Camera* camera)
+{
+	if (this->shader->isReady())
+		return false;
+
+	Shader* fallback = Shader::getFallbackShader();
+	fallback->enable();
+	fallback->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	fallback->setUniform("u_model", model);
+	fallback->setUniform("u_color", glm::vec4(glm::vec3(this->color), 1.f));
+
+	mesh->render(GL_TRIANGLES);
+
+	fallback->disable();
+	return true;
+}
+
+// instances from memory, or already in the GPU if there is a batch
+static bool drawInstanceData(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, const Mesh::tIndirectBatch* batch)
+{
+	if (batch)
+		return mesh->renderIndirect(GL_TRIANGLES, *batch);
+	mesh->renderInstanced(GL_TRIANGLES, instances, num_instances);
+	return true;
+}
+
+size_t Material::getInstancingHash()
+{
+	//the color is not part of it, it goes in the instance buffer
+	size_t hash = typeid(*this).hash_code();
+	hash ^= std::hash<Shader*>()(this->shader) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	hash ^= std::hash<Texture*>()(this->texture) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	return hash;
+}
+
 FlatMaterial::FlatMaterial(glm::vec4 color)
 {
 	this->color = color;
-	this->shader = Shader::Get("res/shaders/basic.vs", "res/shaders/flat.fs");
+	this->shader = Shader::GetAsync("res/shaders/basic.vs", "res/shaders/flat.fs");
 }
 
 FlatMaterial::~FlatMaterial() { }
@@ -158,6 +241,11 @@ void FlatMaterial::setUniforms(Camera* camera, glm::mat4 model)
 void FlatMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 {
 	if (mesh && this->shader) {
+		setSolidState();
+
+		if (renderFallback(mesh, model, camera))
+			return;
+
 		// enable shader
 		this->shader->enable();
 
@@ -171,15 +259,44 @@ void FlatMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 	}
 }
 
+bool FlatMaterial::renderInstanced(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, Camera* camera)
+{
+	setSolidState();
+	return drawInstances(mesh, instances, num_instances, NULL, camera);
+}
+
+bool FlatMaterial::renderIndirect(Mesh* mesh, const Mesh::tIndirectBatch& batch, Camera* camera)
+{
+	setSolidState();
+	return drawInstances(mesh, NULL, 0, &batch, camera);
+}
+
+bool FlatMaterial::drawInstances(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, const Mesh::tIndirectBatch* batch, Camera* camera)
+{
+	Shader* shader = this->shader ? this->shader->getInstancedVariant() : NULL;
+	if (!mesh || !shader || !shader->isReady())
+		return false;
+
+	shader->enable();
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_camera_position", camera->eye);
+
+	bool drawn = drawInstanceData(mesh, instances, num_instances, batch);
+
+	shader->disable();
+	return drawn;
+}
+
 void FlatMaterial::renderInMenu()
 {
-	ImGui::ColorEdit3("Color", (float*)&this->color);
+	if (ImGui::ColorEdit3("Color", (float*)&this->color))
+		markDirty();
 }
 
 WireframeMaterial::WireframeMaterial()
 {
 	this->color = glm::vec4(1.f);
-	this->shader = Shader::Get("res/shaders/basic.vs", "res/shaders/flat.fs");
+	this->shader = Shader::GetAsync("res/shaders/basic.vs", "res/shaders/flat.fs");
 }
 
 WireframeMaterial::~WireframeMaterial() { }
@@ -188,8 +305,12 @@ void WireframeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 {
 	if (this->shader && mesh)
 	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glDisable(GL_CULL_FACE);
+		//no restore afterwards, the next material sets what it needs
+		GLState::polygonMode(GL_LINE);
+		GLState::disable(GL_CULL_FACE);
+
+		if (renderFallback(mesh, model, camera))
+			return;
 
 		//enable shader
 		this->shader->enable();
@@ -200,16 +321,29 @@ void WireframeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 		//do the draw call
 		mesh->render(GL_TRIANGLES);
 
-		glEnable(GL_CULL_FACE);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		this->shader->disable();
 	}
 }
 
+bool WireframeMaterial::renderInstanced(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, Camera* camera)
+{
+	GLState::polygonMode(GL_LINE);
+	GLState::disable(GL_CULL_FACE);
+	return drawInstances(mesh, instances, num_instances, NULL, camera);
+}
+
+bool WireframeMaterial::renderIndirect(Mesh* mesh, const Mesh::tIndirectBatch& batch, Camera* camera)
+{
+	GLState::polygonMode(GL_LINE);
+	GLState::disable(GL_CULL_FACE);
+	return drawInstances(mesh, NULL, 0, &batch, camera);
+}
+
 StandardMaterial::StandardMaterial(glm::vec4 color)
 {
 	this->color = color;
-	this->base_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/flat.fs");
-	this->normal_shader = Shader::Get("res/shaders/basic.vs", "res/shaders/normal.fs");
+	this->base_shader = Shader::GetAsync("res/shaders/basic.vs", "res/shaders/basic.fs");
+	this->normal_shader = Shader::GetAsync("res/shaders/basic.vs", "res/shaders/normal.fs");
 	this->shader = this->base_shader;
 }
 
@@ -225,56 +359,72 @@ void StandardMaterial::setUniforms(Camera* camera, glm::mat4 model)
 	this->shader->setUniform("u_color", this->color);
 
 	if (this->texture) {
-		this->shader->setUniform("u_texture", this->texture);
+		this->shader->setUniform("u_texture", this->texture, 0);
 	}
 }
 
 void StandardMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 {
-	bool first_pass = true;
 	if (mesh && this->shader)
 	{
-		// enable shader
-		this->shader->enable();
-
-		// Multi pass render
-		int num_lights = Application::instance->light_list.size();
-		for (int nlight = -1; nlight < num_lights; nlight++)
-		{
-			if (nlight == -1) { nlight++; } // hotfix
+		setSolidState();
+		GLState::depthFunc(GL_LESS);
 
-			// upload uniforms
-			setUniforms(camera, model);
+		if (renderFallback(mesh, model, camera))
+			return;
 
-			// upload light uniforms
-			if (!first_pass) {
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-				glDepthFunc(GL_LEQUAL);
-			}
-			this->shader->setUniform("u_ambient_light", Application::instance->ambient_light * (float)first_pass);
-
-			if (num_lights > 0) {
-				Light* light = Application::instance->light_list[nlight];
-				light->setUniforms(this->shader, model);
-			}
-			else {
-				// Set some uniforms in case there is no light
-				this->shader->setUniform("u_light_intensity", 1.f);
-				this->shader->setUniform("u_light_shininess", 1.f);
-				this->shader->setUniform("u_light_color", glm::vec4(0.f));	
-			}
+		// enable shader
+		this->shader->enable();
 
-			// do the draw call
-			mesh->render(GL_TRIANGLES);
+		// upload uniforms, the lights of the cluster of every fragment are looped in the shader
+		// (without the grid, the ones that reach the node)
+		setUniforms(camera, model);
+		this->shader->setUniform("u_ambient_light", Application::instance->ambient_light);
+		if (!LightGrid::bind(this->shader))
+			LightBuffer::bind(this->shader, transformBoundingBox(model, mesh->box));
+		ShadowAtlas::bind(this->shader);
 
-			first_pass = false;
-		}
+		// do the draw call
+		mesh->render(GL_TRIANGLES);
 
 		// disable shader
 		this->shader->disable();
 	}
 }
 
+bool StandardMaterial::renderInstanced(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, Camera* camera)
+{
+	return drawInstances(mesh, instances, num_instances, NULL, camera);
+}
+
+bool StandardMaterial::renderIndirect(Mesh* mesh, const Mesh::tIndirectBatch& batch, Camera* camera)
+{
+	return drawInstances(mesh, NULL, 0, &batch, camera);
+}
+
+bool StandardMaterial::drawInstances(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, const Mesh::tIndirectBatch* batch, Camera* camera)
+{
+	Shader* shader = this->shader ? this->shader->getInstancedVariant() : NULL;
+	if (!mesh || !shader || !shader->isReady())
+		return false;
+
+	setSolidState();
+	GLState::depthFunc(GL_LESS);
+	shader->enable();
+	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
+	shader->setUniform("u_camera_position", camera->eye);
+
+	// the instances have no common bounds here, without the grid they get every light
+	shader->setUniform("u_ambient_light", Application::instance->ambient_light);
+	if (!LightGrid::bind(shader))
+		LightBuffer::bind(shader);
+	ShadowAtlas::bind(shader);
+
+	bool drawn = drawInstanceData(mesh, instances, num_instances, batch);
+	shader->disable();
+	return drawn;
+}
+
 void StandardMaterial::renderInMenu()
 {
 	if (ImGui::Checkbox("Show Normals", &this->show_normals)) {
@@ -284,31 +434,104 @@ void StandardMaterial::renderInMenu()
 		else {
 			this->shader = this->base_shader;
 		}
+		markDirty();
 	}
 
-	if (!this->show_normals) ImGui::ColorEdit3("Color", (float*)&this->color);
+	if (!this->show_normals && ImGui::ColorEdit3("Color", (float*)&this->color))
+		markDirty();
 }
 
+ShaderPermutation* VolumeMaterial::permutation = NULL;
+bool VolumeMaterial::prewarm_variants = true;
+
 VolumeMaterial::VolumeMaterial() {
-	this->shader = Shader::Get("res/shaders/volume.vs", "res/shaders/bunnycloud.fs");
+	if (!permutation)
+	{
+		permutation = ShaderPermutation::Get("res/shaders/volume.vs", "res/shaders/bunnycloud.fs");
+		permutation->addOption("density", { "DENSITY_VDB", "DENSITY_NOISE", "DENSITY_CONSTANT" });
+		permutation->addOption("lighting", { "LIGHTING_ABSORPTION", "LIGHTING_SCATTERING" });
+
+		if (prewarm_variants)
+			permutation->prewarm();
+	}
+
+	this->shader = selectShader();
+	applyStepPreset(this->step_preset);
+}
+
+VolumeMaterial::~VolumeMaterial()
+{
+	delete this->noise_texture;
+}
+
+void VolumeMaterial::bakeNoise()
+{
+	int resolution = NoiseVolume::getResolution(this->noise_scale, this->noise_detail);
+	std::vector<float> data;
+	NoiseVolume::bake(this->noise_scale, this->noise_detail, resolution, data);
+
+	//same format and filters as the VDB density, the max mips keep the adaptive step from skipping the thin parts
+	if (!this->noise_texture || (int)this->noise_texture->width != resolution)
+	{
+		delete this->noise_texture;
+		this->noise_texture = new Texture();
+		this->noise_texture->mip_filter = MIP_FILTER_MAX;
+		this->noise_texture->create3D(resolution, resolution, resolution, GL_RED, GL_FLOAT, true, data.data(), GL_R8);
+	}
+	else
+		this->noise_texture->upload3D(data.data(), GL_LINEAR, GL_LINEAR_MIPMAP_LINEAR); // the chain is rebuilt with the max filter
+	this->noise_dirty = false;
+}
+
+void VolumeMaterial::applyStepPreset(int preset)
+{
+	this->step_preset = preset;
+	switch (preset)
+	{
+	case VOLUME_STEP_FIXED: // the reference, every step is step_size
+		this->step_distance_scale = 0.0; this->step_min_factor = 1.0; this->step_max_factor = 1.0;
+		this->step_density_weight = 0.0; this->step_gradient_weight = 0.0; this->step_lod = 0.0;
+		break;
+	case VOLUME_STEP_QUALITY:
+		this->step_distance_scale = 0.05; this->step_min_factor = 0.5; this->step_max_factor = 2.0;
+		this->step_density_weight = 8.0; this->step_gradient_weight = 16.0; this->step_lod = 2.0;
+		break;
+	case VOLUME_STEP_BALANCED:
+		this->step_distance_scale = 0.1; this->step_min_factor = 0.75; this->step_max_factor = 4.0;
+		this->step_density_weight = 4.0; this->step_gradient_weight = 8.0; this->step_lod = 3.0;
+		break;
+	case VOLUME_STEP_PERFORMANCE:
+		this->step_distance_scale = 0.25; this->step_min_factor = 1.0; this->step_max_factor = 8.0;
+		this->step_density_weight = 2.0; this->step_gradient_weight = 4.0; this->step_lod = 4.0;
+		break;
+	}
+}
+
+Shader* VolumeMaterial::selectShader()
+{
+	return permutation->get({ this->volume_type, this->lighting_model });
 }
 
 void VolumeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 {
+	// variants are cached, so selecting one every frame is just a map lookup
+	this->shader = selectShader();
 
 	if (mesh && this->shader) {
+		setVolumeState();
+
+		// variants being compiled in background are drawn flat until ready
+		if (renderFallback(mesh, model, camera))
+			return;
+
 		// enable shader
 		this->shader->enable();
 
-		// upload uniforms
+		// upload uniforms, the lights are the ones whose range reaches the volume box (none is fine)
 		setUniforms(camera, model);
-
-		Light* l = Application::instance->light_list[0];
-		glm::vec4 colorlight = l->color;
-		this->shader->setUniform("u_light_color", colorlight);
-		this->shader->setUniform("u_light_intensity", l->intensity);
-		glm::vec3 light_position = glm::vec3(l->model[3][0], l->model[3][1], l->model[3][2]);
-		this->shader->setUniform("u_light_position", light_position);
+		this->shader->setUniform("u_inverse_model", glm::inverse(model));
+		this->shader->setUniform("u_light_sampling", this->light_sampling);
+		LightBuffer::bind(this->shader, transformBoundingBox(model, mesh->box));
 
 		// do the draw call
 		mesh->render(GL_TRIANGLES);
@@ -316,51 +539,142 @@ void VolumeMaterial::render(Mesh* mesh, glm::mat4 model, Camera* camera)
 		this->shader->disable();
 	}
 }
+void VolumeMaterial::renderShadow(Mesh* mesh, glm::mat4 model, Camera* light_camera)
+{
+	static Shader* shadow_shader = Shader::Get("res/shaders/volume.vs", "res/shaders/volume_shadow.fs");
+	if (!mesh || !shadow_shader)
+		return;
+
+	shadow_shader->enable();
+	shadow_shader->setUniform("u_viewprojection", light_camera->viewprojection_matrix);
+	shadow_shader->setUniform("u_model", model);
+	shadow_shader->setUniform("u_inverse_model", glm::inverse(model));
+	shadow_shader->setUniform("u_light_position", light_camera->eye);
+	shadow_shader->setUniform("u_light_direction", glm::normalize(light_camera->center - light_camera->eye));
+	shadow_shader->setUniform("u_orthographic", light_camera->type == Camera::ORTHOGRAPHIC);
+	shadow_shader->setUniform("u_far", light_camera->far_plane);
+	// the same extinction the shadow rays of the volume use for its own lighting
+	shadow_shader->setUniform("u_extinction", this->lighting_model == VOLUME_LIGHTING_SCATTERING ? this->scattering : this->absorption);
+
+	Texture* density = NULL;
+	if (volume_type == VOLUME_DENSITY_VDB)
+		density = this->texture;
+	if (volume_type == VOLUME_DENSITY_NOISE) {
+		if (this->noise_dirty || !this->noise_texture)
+			bakeNoise();
+		density = this->noise_texture;
+	}
+	shadow_shader->setUniform("u_use_texture", density != NULL);
+	if (density)
+		shadow_shader->setUniform("u_texture", density, 0);
+
+	mesh->render(GL_TRIANGLES);
+	shadow_shader->disable();
+}
+
 void VolumeMaterial::setUniforms(Camera* camera, glm::mat4 model)
 {
 	//upload node uniforms
-	this->shader->setUniform("u_background_color", Application::instance->background_color);
 	this->shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
 	this->shader->setUniform("u_camera_position", camera->eye);
 	this->shader->setUniform("u_model", model);
 	this->shader->setUniform("u_model", model);
 	this->shader->setUniform("u_color", this->color);	
 	this->shader->setUniform("u_absorption", this->absorption);
-	this->shader->setUniform("u_density_type", this->volume_type);
 	this->shader->setUniform("u_step_size", this->step_size);
+	this->shader->setUniform("u_step_distance_scale", this->step_distance_scale);
+	this->shader->setUniform("u_step_factors", glm::vec2(this->step_min_factor, this->step_max_factor));
+	this->shader->setUniform("u_step_weights", glm::vec2(this->step_density_weight, this->step_gradient_weight));
+	this->shader->setUniform("u_step_lod", this->step_lod);
+	this->shader->setUniform("u_termination", glm::vec2(this->early_termination ? this->termination_epsilon : 0.f, this->roulette_survival));
+	VolumeProfiler::bind(this->shader);
+	//always bound, so the sampler never shares a unit with the 3D texture
+	this->shader->setUniform("u_blue_noise", BlueNoise::getTexture(), 1);
+	this->shader->setUniform("u_jitter", VolumePass::jitter);
+	this->shader->setUniform("u_jitter_offset", BlueNoise::getFrameOffset(VolumePass::frame));
 	this->shader->setUniform("u_scattering", this->scattering);
 	this->shader->setUniform("u_g", this->g);
 
-	if (volume_type == 0) {
+	if (volume_type == VOLUME_DENSITY_VDB && this->texture) {
 		this->shader->setUniform("u_texture", this->texture, 0);
 	}
-	if (volume_type == 1) {
-		this->shader->setUniform("u_noise_scale", this->noise_scale);
-		this->shader->setUniform("u_noise_detail", this->noise_detail);
+	if (volume_type == VOLUME_DENSITY_NOISE) {
+		if (this->noise_dirty || !this->noise_texture)
+			bakeNoise();
+		this->shader->setUniform("u_texture", this->noise_texture, 0);
 	}
 }
 
 void VolumeMaterial::renderInMenu() {
 
-	ImGui::SliderFloat("Absorption", &this->absorption, 0.0f, 2.0f);
-	ImGui::SliderFloat("Step Size", &this->step_size, 0.01f, 1.0f);
+	//any change restarts the accumulation of the volume (VolumePass)
+	bool changed = false;
+	changed |= ImGui::SliderFloat("Absorption", &this->absorption, 0.0f, 2.0f);
+	changed |= ImGui::SliderFloat("Step Size", &this->step_size, 0.01f, 1.0f);
+	if (ImGui::Combo("Step Preset", &this->step_preset, "Fixed\0Quality\0Balanced\0Performance\0Custom\0"))
+	{
+		applyStepPreset(this->step_preset);
+		changed = true;
+	}
+	if (ImGui::TreeNode("Adaptive Step"))
+	{
+		//touching any value turns the preset into a custom one
+		bool custom = false;
+		custom |= ImGui::SliderFloat("Distance Scale", &this->step_distance_scale, 0.0f, 1.0f);
+		custom |= ImGui::SliderFloat("Min Factor", &this->step_min_factor, 0.1f, 1.0f);
+		custom |= ImGui::SliderFloat("Max Factor", &this->step_max_factor, 1.0f, 16.0f);
+		custom |= ImGui::SliderFloat("Density Weight", &this->step_density_weight, 0.0f, 32.0f);
+		custom |= ImGui::SliderFloat("Gradient Weight", &this->step_gradient_weight, 0.0f, 32.0f);
+		custom |= ImGui::SliderFloat("Density LOD", &this->step_lod, 0.0f, 6.0f);
+		if (custom)
+			this->step_preset = VOLUME_STEP_CUSTOM;
+		changed |= custom;
+		ImGui::TreePop();
+	}
+	changed |= ImGui::Checkbox("Early Termination", &this->early_termination);
+	if (this->early_termination)
+	{
+		changed |= ImGui::SliderFloat("Transmittance Epsilon", &this->termination_epsilon, 0.0001f, 0.2f, "%.4f");
+		changed |= ImGui::SliderFloat("Roulette Survival", &this->roulette_survival, 0.0f, 1.0f);
+	}
+	int resolution = this->resolution_divider == 4 ? 2 : this->resolution_divider == 2 ? 1 : 0;
+	if (ImGui::Combo("Resolution", &resolution, "Full\0Half\0Quarter\0"))
+	{
+		this->resolution_divider = 1 << resolution;
+		changed = true;
+	}
 
-	ImGui::Combo("Density", &this->volume_type, "VDB File\0Noise3D\0Constant");
-	if (volume_type == 0)//charge the file from appliccationn
+	changed |= ImGui::Combo("Density", &this->volume_type, "VDB File\0Noise3D\0Constant");
+	changed |= ImGui::Combo("Lighting", &this->lighting_model, "Absorption\0Scattering");
+	if (volume_type == VOLUME_DENSITY_VDB)//charge the file from appliccationn
 	{
 		if (this->vdb_path.empty()) {
 			this->vdb_path = "res/meshes/bunny_cloud.vdb";  // Default path
 			std::cout << "[INFO] Initialized VDB Path: " << this->vdb_path << std::endl;
 		}
 	}
-	else if (volume_type == 1) {
+	else if (volume_type == VOLUME_DENSITY_NOISE) {
 		
-		ImGui::SliderFloat("Noise Scale", &this->noise_scale, 0.0f, 5.0f);
-		ImGui::SliderInt("Noise Detail", &this->noise_detail, 0, 5);
+		bool noise_changed = false;
+		noise_changed |= ImGui::SliderFloat("Noise Scale", &this->noise_scale, 0.0f, 5.0f);
+		noise_changed |= ImGui::SliderInt("Noise Detail", &this->noise_detail, 0, 5);
+		if (noise_changed)
+			this->noise_dirty = true;
+		changed |= noise_changed;
+		if (this->noise_texture)
+			ImGui::Text("Baked noise: %d^3", (int)this->noise_texture->width);
 	}
 
-	ImGui::ColorEdit3("Color", (float*)&this->color);
-	ImGui::SliderFloat("Scattering", &this->scattering, 0.0f, 1.0f);
-	ImGui::SliderFloat("g", &this->g, 0.0f, 1.0f);
+	changed |= ImGui::ColorEdit3("Color", (float*)&this->color);
+	changed |= ImGui::SliderFloat("Scattering", &this->scattering, 0.0f, 1.0f);
+	changed |= ImGui::SliderFloat("g", &this->g, 0.0f, 1.0f);
+	changed |= ImGui::Checkbox("Light Sampling", &this->light_sampling);
+	if (changed)
+		markDirty();
+
+	ImGui::Text("Shader variants: %d/%d submitted", (int)permutation->variants.size(), (int)permutation->getNumVariants());
+	ImGui::Text("Shaders compiling: %d%s", (int)Shader::s_pending.size(), Shader::s_parallel_compile ? " (parallel)" : "");
+	if (ImGui::Button("Compile all variants"))
+		permutation->prewarm();
 }
 
@@ -8,6 +8,7 @@
 #include "mesh.h"
 #include "texture.h"
 #include "shader.h"
+#include "permutation.h"
 
 // --- Lab 4 Libraries ---
 #include "openvdbReader.h"
@@ -20,10 +21,29 @@ public:
 	Texture* texture = NULL;
 	glm::vec4 color = glm::vec4(0.0, 0.0, 0.0, 1.0);
 
+	// increased every time a parameter changes (the menus call markDirty), consumers compare it with the one they saw
+	unsigned int version = 0;
+	void markDirty() { this->version++; }
+
 	virtual void setUniforms(Camera* camera, glm::mat4 model) = 0;
 	virtual void render(Mesh* mesh, glm::mat4 model, Camera* camera) = 0;
 	virtual void renderInMenu() = 0;
 	virtual void loadVDB(std::string file_path) {};
+	virtual bool isTransparent() { return false; } // blended after the opaque pass, sorted back to front
+	virtual int getResolutionDivider() { return 1; } // transparent draws can go to a reduced resolution target (VolumePass)
+
+	// materials with the same hash draw the same except for the color, their nodes can share an instanced draw
+	virtual size_t getInstancingHash();
+	// one draw for all the instances (world matrix and color each), returns false if not supported or not ready yet
+	virtual bool renderInstanced(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, Camera* camera) { return false; }
+	// same with the instances and draw commands already in the GPU (GPU culling)
+	virtual bool renderIndirect(Mesh* mesh, const Mesh::tIndirectBatch& batch, Camera* camera) { return false; }
+
+	// draws the mesh into a shadow map (ShadowAtlas) seen from the light camera, the atlas sets the state: depth only for the opaque ones
+	virtual void renderShadow(Mesh* mesh, glm::mat4 model, Camera* light_camera);
+
+	// draws with a flat shader while this->shader is still compiling, returns true in that case
+	bool renderFallback(Mesh* mesh, glm::mat4 model, Camera* camera);
 };
 
 class FlatMaterial : public Material {
@@ -34,7 +54,13 @@ public:
 
 	void setUniforms(Camera* camera, glm::mat4 model);
 	void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+	bool renderInstanced(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, Camera* camera);
+	bool renderIndirect(Mesh* mesh, const Mesh::tIndirectBatch& batch, Camera* camera);
 	void renderInMenu();
+
+protected:
+	// batch is NULL for instances in CPU memory
+	bool drawInstances(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, const Mesh::tIndirectBatch* batch, Camera* camera);
 };
 
 class WireframeMaterial : public FlatMaterial {
@@ -44,13 +70,14 @@ public:
 	~WireframeMaterial();
 
 	void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+	bool renderInstanced(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, Camera* camera);
+	bool renderIndirect(Mesh* mesh, const Mesh::tIndirectBatch& batch, Camera* camera);
 };
 
+// lit by every light that reaches the node in a single pass (LightBuffer)
 class StandardMaterial : public Material {
 public:
 
-	bool first_pass = false;
-
 	bool show_normals = false;
 	Shader* base_shader = NULL;
 	Shader* normal_shader = NULL;
@@ -60,12 +87,27 @@ public:
 
 	void setUniforms(Camera* camera, glm::mat4 model);
 	void render(Mesh* mesh, glm::mat4 model, Camera* camera);
+	bool renderInstanced(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, Camera* camera);
+	bool renderIndirect(Mesh* mesh, const Mesh::tIndirectBatch& batch, Camera* camera);
 	void renderInMenu();
+
+protected:
+	bool drawInstances(Mesh* mesh, const Mesh::tInstance* instances, int num_instances, const Mesh::tIndirectBatch* batch, Camera* camera);
 };
 //extend the material class:
 
+enum eVolumeDensity { VOLUME_DENSITY_VDB, VOLUME_DENSITY_NOISE, VOLUME_DENSITY_CONSTANT };
+enum eVolumeLighting { VOLUME_LIGHTING_ABSORPTION, VOLUME_LIGHTING_SCATTERING };
+enum eVolumeStepPreset { VOLUME_STEP_FIXED, VOLUME_STEP_QUALITY, VOLUME_STEP_BALANCED, VOLUME_STEP_PERFORMANCE, VOLUME_STEP_CUSTOM };
+
 class VolumeMaterial : public Material {
 public:
+	// options of the bunnycloud.fs uber-shader (order matches the selection passed to the permutation)
+	enum { OPTION_DENSITY, OPTION_LIGHTING };
+
+	static ShaderPermutation* permutation;
+	static bool prewarm_variants; // submit every variant when the first volume material is created
+
 	float absorption = 0.01; // Attribute for the absorption rate in volume rendering
 
 	VolumeMaterial();
@@ -74,18 +116,48 @@ public:
 	void setUniforms(Camera* camera, glm::mat4 model) override;
 	void renderInMenu() override; // For GUI control in ImGui
 	void render(Mesh* mesh, glm::mat4 model, Camera* camera) override;
+	bool isTransparent() override { return true; }
+	int getResolutionDivider() override { return this->resolution_divider; }
+	// writes the transmittance of the volume towards the light and the depths where it starts and ends
+	void renderShadow(Mesh* mesh, glm::mat4 model, Camera* light_camera) override;
+
+	// picks the compiled variant matching the current density and lighting
+	Shader* selectShader();
+	// sets the adaptive step parameters of a eVolumeStepPreset (custom keeps them)
+	void applyStepPreset(int preset);
+	// bakes noise_texture for the current noise_scale and noise_detail
+	void bakeNoise();
 
 	// Lab 4 Functions
 	void loadVDB(std::string file_path) override;
 	void estimate3DTexture(easyVDB::OpenVDBReader* vdbReader);
 
 	// Attributes
-	int volume_type = 2;
+	int volume_type = VOLUME_DENSITY_CONSTANT;
+	int lighting_model = VOLUME_LIGHTING_SCATTERING;
 	float step_size = 0.1;
+	// adaptive raymarch: the step grows with the distance to the camera and where the coarse density is empty or flat
+	int step_preset = VOLUME_STEP_BALANCED;
+	float step_distance_scale = 0.1; // growth per unit of distance (the pixel footprint grows linearly)
+	float step_min_factor = 0.75; // times step_size in detailed regions
+	float step_max_factor = 4.0; // and in empty ones
+	float step_density_weight = 4.0; // how much the coarse density counts as detail
+	float step_gradient_weight = 8.0; // and its variation
+	float step_lod = 3.0; // mip of the density texture that classifies the regions
+	// early termination: rays stop once the transmittance falls under the epsilon, russian roulette keeps the result unbiased
+	bool early_termination = true;
+	float termination_epsilon = 0.01;
+	float roulette_survival = 0.5; // probability to continue under the epsilon (weighted by 1 / p), 0 always cuts
+	// rendered at 1/divider of the screen resolution and upsampled with the scene depth (1, 2 or 4)
+	int resolution_divider = 2;
 	float noise_scale = 0.5;
 	int noise_detail = 2;
+	Texture* noise_texture = NULL; // the noise density baked in the CPU (NoiseVolume)
+	bool noise_dirty = true; // noise_scale or noise_detail changed, it is baked again before the next draw
 	float scattering = 0.1;
 	float g = 0.0;
+	// with several lights, march one shadow ray per sample to a light picked by its contribution instead of one per light
+	bool light_sampling = true;
 
 	std::string vdb_path;
 
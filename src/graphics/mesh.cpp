@@ -7,6 +7,8 @@
 
 #include "shader.h"
 #include "texture.h"
+#include "collision.h"
+#include "simplify.h"
 #include "../framework/includes.h"
 #include "../framework/utils.h"
 #include "../framework/camera.h"
@@ -14,6 +16,8 @@
 bool Mesh::use_binary = true;			//checks if there is .wbin, it there is one tries to read it instead of the other file
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
+bool Mesh::generate_lods = true;		//simplified versions for the distance, stored in the .mbin
+bool Mesh::generate_collision = true;	//triangle BVH for the ray and sphere queries, stored in the .mbin
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 long Mesh::num_meshes_rendered = 0;
@@ -24,39 +28,19 @@ long Mesh::num_triangles_rendered = 0;
 #define FORMAT_MBIN 3
 #define FORMAT_MESH 4
 
-const glm::vec3 corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
-
 BoundingBox transformBoundingBox(const glm::mat4 m, const BoundingBox& box)
 {
-	glm::vec3 box_min(10000000.0f, 1000000.0f, 1000000.0f);
-	glm::vec3 box_max(-10000000.0f, -1000000.0f, -1000000.0f);
-
-	for (int i = 0; i < 8; ++i)
-	{
-		glm::vec3 corner = corners[i];
-		corner = box.halfsize * corner;
-		corner = corner + box.center;
-		corner = m * glm::vec4(corner, 1.f);
-
-		//box_min.setMin(corner);
-		if (corner.x < box_min.x) box_min.x = corner.x;
-		if (corner.y < box_min.y) box_min.y = corner.y;
-		if (corner.z < box_min.z) box_min.z = corner.z;
-
-		//box_max.setMax(corner);
-		if (corner.x > box_min.x) box_min.x = corner.x;
-		if (corner.y > box_min.y) box_min.y = corner.y;
-		if (corner.z > box_min.z) box_min.z = corner.z;
-	}
-
-	glm::vec3 halfsize = (box_max - box_min) * 0.5f;
-	return BoundingBox(box_max - halfsize, halfsize);
+	//same result than transforming the 8 corners and taking min/max, but without the loop:
+	//the center is transformed as a point and every axis of the new halfsize adds the absolute projection of the old one
+	glm::vec3 center = m * glm::vec4(box.center, 1.f);
+	glm::vec3 halfsize = glm::abs(glm::vec3(m[0])) * box.halfsize.x + glm::abs(glm::vec3(m[1])) * box.halfsize.y + glm::abs(glm::vec3(m[2])) * box.halfsize.z;
+	return BoundingBox(center, halfsize);
 }
 
 Mesh::Mesh()
 {
 	radius = 0;
-	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = lod_indices_vbo_id = 0;
 	collision_model = NULL;
 	clear();
 }
@@ -87,9 +71,11 @@ void Mesh::clear()
 		glDeleteBuffersARB(1, &weights_vbo_id);
 	if (uvs1_vbo_id)
 		glDeleteBuffersARB(1, &uvs1_vbo_id);
+	if (lod_indices_vbo_id)
+		glDeleteBuffersARB(1, &lod_indices_vbo_id);
 
 	//VBOs ids
-	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = lod_indices_vbo_id = 0;
 
 	//buffers
 	vertices.clear();
@@ -101,6 +87,13 @@ void Mesh::clear()
 	bones.clear();
 	weights.clear();
 	uvs1.clear();
+	lods.clear();
+	lod_draw_calls.clear();
+	lod_indices.clear();
+	active_lod = 0;
+
+	delete collision_model;
+	collision_model = NULL;
 }
 
 int vertex_location = -1;
@@ -257,7 +250,25 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 	enableBuffers(shader);
 
 	//draw call
-	if (submesh_id == -1 && materials.size() > 0) // if there's mesh mtl
+	if (submesh_id == -1 && active_lod > 0 && active_lod <= (int)lods.size())
+	{
+		const sLODInfo& lod = lods[active_lod - 1];
+		for (uint32_t i = 0; i < lod.num_draw_calls; ++i)
+		{
+			const sLODDrawCall& ldc = lod_draw_calls[lod.first_draw_call + i];
+			if (materials.size() > 0 && ldc.submesh < submeshes.size())
+			{
+				const char* material = submeshes[ldc.submesh].draw_calls[ldc.draw_call].material;
+				if (materials.count(material) > 0) {
+					shader->setUniform("u_Ka", materials[material].Ka);
+					shader->setUniform("u_Kd", materials[material].Kd);
+					shader->setUniform("u_Ks", materials[material].Ks);
+				}
+			}
+			drawLODCall(primitive, ldc.start, ldc.count, num_instances);
+		}
+	}
+	else if (submesh_id == -1 && materials.size() > 0) // if there's mesh mtl
 	{
 		for (int i = 0; i < submeshes.size(); ++i) {
 			sSubmeshInfo& submesh = submeshes[i];
@@ -332,6 +343,24 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int draw_call_id, in
 	num_meshes_rendered++;
 }
 
+void Mesh::drawLODCall(unsigned int primitive, uint32_t start, uint32_t count, int num_instances)
+{
+	const void* offset = (void*)(start * sizeof(uint32_t));
+	if (lod_indices_vbo_id)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod_indices_vbo_id);
+	else
+		offset = &lod_indices[start];
+
+	if (num_instances > 0)
+		glDrawElementsInstanced(primitive, count, GL_UNSIGNED_INT, offset, num_instances);
+	else
+		glDrawElements(primitive, count, GL_UNSIGNED_INT, offset);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	num_triangles_rendered += static_cast<long>((count / 3) * (num_instances ? num_instances : 1));
+	num_meshes_rendered++;
+}
+
 void Mesh::disableBuffers(Shader* shader)
 {
 	glDisableVertexAttribArray(vertex_location);
@@ -417,6 +446,133 @@ void Mesh::renderInstanced(unsigned int primitive, const std::vector<glm::vec3>
 	glVertexAttribDivisor(attribLocation, 0);
 }
 
+//binds the tInstance layout of the buffer currently bound to GL_ARRAY_BUFFER, returns false if the shader has no instanced model
+static bool enableInstanceAttributes(Shader* shader, int& model_location, int& color_location)
+{
+	model_location = shader->getAttribLocation("u_model");
+	assert(model_location != -1 && "shader must have attribute mat4 u_model (not a uniform)");
+	if (model_location == -1)
+		return false;
+	color_location = shader->getAttribLocation("a_instance_color"); //removed by the linker if the fragment shader ignores it
+
+	for (int k = 0; k < 4; ++k)
+	{
+		glEnableVertexAttribArray(model_location + k);
+		glVertexAttribPointer(model_location + k, 4, GL_FLOAT, false, sizeof(Mesh::tInstance), (uint8_t*)(sizeof(float) * 4 * k));
+		glVertexAttribDivisor(model_location + k, 1);
+	}
+	if (color_location != -1)
+	{
+		glEnableVertexAttribArray(color_location);
+		glVertexAttribPointer(color_location, 4, GL_FLOAT, false, sizeof(Mesh::tInstance), (uint8_t*)offsetof(Mesh::tInstance, color));
+		glVertexAttribDivisor(color_location, 1);
+	}
+	return true;
+}
+
+static void disableInstanceAttributes(int model_location, int color_location)
+{
+	for (int k = 0; k < 4; ++k)
+	{
+		glDisableVertexAttribArray(model_location + k);
+		glVertexAttribDivisor(model_location + k, 0);
+	}
+	if (color_location != -1)
+	{
+		glDisableVertexAttribArray(color_location);
+		glVertexAttribDivisor(color_location, 0);
+	}
+}
+
+void Mesh::renderInstanced(unsigned int primitive, const tInstance* instances, int num_instances)
+{
+	if (!num_instances)
+		return;
+
+	Shader* shader = Shader::current;
+	assert(shader && "shader must be enabled");
+
+	if (instances_buffer_id == 0)
+		glGenBuffersARB(1, &instances_buffer_id);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
+	//orphan the previous contents, several groups can use this mesh in the same frame
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(tInstance), NULL, GL_STREAM_DRAW_ARB);
+	glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, num_instances * sizeof(tInstance), instances);
+
+	int model_location, color_location;
+	if (!enableInstanceAttributes(shader, model_location, color_location))
+		return;
+
+	//regular render
+	render(primitive, -1, num_instances);
+
+	disableInstanceAttributes(model_location, color_location);
+}
+
+Mesh::tIndirectCommand Mesh::getIndirectCommand(uint32_t base_instance, int lod)
+{
+	tIndirectCommand command;
+	command.instance_count = 1;
+	command.first = 0;
+	if (lod > 0 && lod <= (int)lods.size())
+	{
+		//the whole level in one command, its draw calls are contiguous
+		command.count = lods[lod - 1].count;
+		command.first = lods[lod - 1].start;
+		command.base_vertex = 0;
+		command.base_instance = base_instance;
+	}
+	else if (indices.size())
+	{
+		command.count = (uint32_t)indices.size() * 3;
+		command.base_vertex = 0;
+		command.base_instance = base_instance;
+	}
+	else
+	{
+		command.count = (uint32_t)(interleaved.size() ? interleaved.size() : vertices.size());
+		command.base_vertex = base_instance; //DrawArraysIndirectCommand has its base instance here
+		command.base_instance = 0;
+	}
+	return command;
+}
+
+bool Mesh::renderIndirect(unsigned int primitive, const tIndirectBatch& batch)
+{
+	if (!batch.num_commands)
+		return true;
+
+	//indirect draws can not source client memory
+	bool lod = batch.lod > 0 && batch.lod <= (int)lods.size();
+	if (!(vertices_vbo_id || interleaved_vbo_id) || (indices.size() && !indices_vbo_id) || (lod && !lod_indices_vbo_id))
+		return false;
+
+	Shader* shader = Shader::current;
+	assert(shader && "shader must be enabled");
+
+	glBindBuffer(GL_ARRAY_BUFFER, batch.instance_buffer);
+	int model_location, color_location;
+	if (!enableInstanceAttributes(shader, model_location, color_location))
+		return false;
+
+	enableBuffers(shader);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.command_buffer);
+	if (lod || indices.size())
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod ? lod_indices_vbo_id : indices_vbo_id);
+		glMultiDrawElementsIndirect(primitive, GL_UNSIGNED_INT, (void*)batch.command_offset, batch.num_commands, sizeof(tIndirectCommand));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	else
+		glMultiDrawArraysIndirect(primitive, (void*)batch.command_offset, batch.num_commands, sizeof(tIndirectCommand));
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	disableBuffers(shader);
+
+	disableInstanceAttributes(model_location, color_location);
+	num_meshes_rendered += batch.num_commands;
+	return true;
+}
+
 
 //super obsolete rendering method, do not use
 void Mesh::renderFixedPipeline(int primitive)
@@ -595,6 +751,15 @@ void Mesh::uploadToVRAM()
 		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
 		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(glm::uvec3), &indices[0], GL_STATIC_DRAW_ARB);
 	}
+
+	// LOD indices
+	if (lod_indices.size())
+	{
+		if (lod_indices_vbo_id == 0)
+			glGenBuffersARB(1, &lod_indices_vbo_id);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, lod_indices_vbo_id);
+		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, lod_indices.size() * sizeof(uint32_t), &lod_indices[0], GL_STATIC_DRAW_ARB);
+	}
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 
@@ -642,6 +807,10 @@ struct sMeshInfo
 	size_t num_submeshes = 0;
 	glm::mat4 bind_matrix;
 	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
+	size_t collision_bytes = 0; //triangle BVH at the end of the file, 0 if it was not built yet
+	size_t num_lods = 0; //after the collision model: sLODInfo, sLODDrawCall and the indices
+	size_t num_lod_draw_calls = 0;
+	size_t num_lod_indices = 0;
 	char extra[32]; //unused
 };
 
@@ -763,6 +932,32 @@ bool Mesh::readBin(const char* filename)
 		pos += sizeof(sSubmeshInfo) * info.num_submeshes;
 	}
 
+	if (info.collision_bytes)
+	{
+		collision_model = new CollisionModel();
+		if (collision_model->read((const uint8_t*)pos, std::min((size_t)(data + size - pos), info.collision_bytes)) != info.collision_bytes)
+		{
+			std::cout << "[WARN] loading BIN: invalid collision model, it will be rebuilt: " << filename << std::endl;
+			delete collision_model;
+			collision_model = NULL;
+		}
+		pos += info.collision_bytes;
+	}
+
+	if (info.num_lods)
+	{
+		lods.resize(info.num_lods);
+		memcpy((void*)&lods[0], pos, sizeof(sLODInfo) * info.num_lods);
+		pos += sizeof(sLODInfo) * info.num_lods;
+		lod_draw_calls.resize(info.num_lod_draw_calls);
+		memcpy((void*)&lod_draw_calls[0], pos, sizeof(sLODDrawCall) * info.num_lod_draw_calls);
+		pos += sizeof(sLODDrawCall) * info.num_lod_draw_calls;
+		lod_indices.resize(info.num_lod_indices);
+		memcpy((void*)&lod_indices[0], pos, sizeof(uint32_t) * info.num_lod_indices);
+		pos += sizeof(uint32_t) * info.num_lod_indices;
+	}
+	bin_filename = filename;
+
 	// if the mtl is not specified in the obj but it's needed
 	if (!materials.size()) {
 		std::string mesh_name = filename;
@@ -776,7 +971,6 @@ bool Mesh::readBin(const char* filename)
 		}
 	}
 
-	//createCollisionModel();
 	return true;
 }
 
@@ -811,6 +1005,14 @@ bool Mesh::writeBin(const char* filename)
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
 
+	std::vector<uint8_t> collision_data;
+	if (collision_model)
+		collision_model->write(collision_data);
+	info.collision_bytes = collision_data.size();
+	info.num_lods = lods.size();
+	info.num_lod_draw_calls = lod_draw_calls.size();
+	info.num_lod_indices = lod_indices.size();
+
 	info.streams[0] = interleaved.size() ? 'I' : 'V';
 	info.streams[1] = normals.size() ? 'N' : ' ';
 	info.streams[2] = uvs.size() ? 'U' : ' ';
@@ -853,7 +1055,236 @@ bool Mesh::writeBin(const char* filename)
 	if (submeshes.size())
 		fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
 
+	if (collision_data.size())
+		fwrite((void*)&collision_data[0], collision_data.size(), 1, f);
+
+	if (lods.size())
+	{
+		fwrite((void*)&lods[0], lods.size() * sizeof(sLODInfo), 1, f);
+		fwrite((void*)&lod_draw_calls[0], lod_draw_calls.size() * sizeof(sLODDrawCall), 1, f);
+		fwrite((void*)&lod_indices[0], lod_indices.size() * sizeof(uint32_t), 1, f);
+	}
+
 	fclose(f);
+	bin_filename = s_filename;
+	return true;
+}
+
+bool Mesh::createCollisionModel()
+{
+	if (collision_model)
+		return true;
+
+	size_t num_vertices = getNumVertices();
+	if (num_vertices < 3)
+		return false;
+
+	const glm::vec3* positions = interleaved.size() ? &interleaved[0].vertex : &vertices[0];
+	size_t stride = interleaved.size() ? sizeof(tInterleaved) : sizeof(glm::vec3);
+
+	long time = getTime();
+	collision_model = new CollisionModel();
+	collision_model->build(positions, num_vertices, stride, indices.size() ? &indices[0] : NULL, indices.size());
+	std::cout << " + Collision model: " << name << " Triangles: " << collision_model->getNumTriangles() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
+
+bool Mesh::createLODs()
+{
+	if (lods.size())
+		return true;
+
+	//only triangle soups, the indexed meshes come from the animation format
+	size_t num_vertices = getNumVertices();
+	if (indices.size() || num_vertices / 3 < MESH_LOD_MIN_TRIANGLES || radius <= 0.f)
+		return false;
+
+	long time = getTime();
+
+	//the soup repeats every vertex once per triangle, weld them to get the connectivity
+	std::vector<tInterleaved> packed;
+	const tInterleaved* data = interleaved.size() ? &interleaved[0] : NULL;
+	if (!data)
+	{
+		packed.resize(num_vertices);
+		for (size_t i = 0; i < num_vertices; ++i)
+		{
+			packed[i].vertex = vertices[i];
+			packed[i].normal = normals.size() ? normals[i] : glm::vec3(0.f);
+			packed[i].uv = uvs.size() ? uvs[i] : glm::vec2(0.f);
+		}
+		data = &packed[0];
+	}
+
+	//welded by all the attributes, the indices point to the first copy of every vertex so the levels use the same VBO.
+	//positions with more than one normal or uv are seams: they are locked or the simplification would open cracks there
+	std::vector<uint32_t> remap, position_remap;
+	size_t num_unique = MeshSimplifier::weld(data, sizeof(tInterleaved), sizeof(tInterleaved), num_vertices, remap);
+	MeshSimplifier::weld(data, sizeof(tInterleaved), sizeof(glm::vec3), num_vertices, position_remap);
+	std::vector<uint8_t> variants(num_vertices, 0);
+	for (size_t i = 0; i < num_vertices; ++i)
+		if (remap[i] == i && variants[position_remap[i]] < 2)
+			variants[position_remap[i]]++;
+	std::vector<bool> locked(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+		locked[i] = variants[position_remap[i]] > 1;
+
+	//every draw call is simplified on its own so the levels keep the materials
+	std::vector<sLODDrawCall> ranges;
+	for (uint32_t i = 0; i < submeshes.size(); ++i)
+		for (uint32_t j = 0; j < submeshes[i].num_draw_calls; ++j)
+		{
+			const sSubmeshDrawCallInfo& dc = submeshes[i].draw_calls[j];
+			assert(dc.start + dc.length <= num_vertices);
+			ranges.push_back({ i, j, (uint32_t)dc.start, (uint32_t)dc.length });
+		}
+	if (!ranges.size())
+		ranges.push_back({ UINT32_MAX, 0, 0, (uint32_t)num_vertices });
+
+	//levels[l][r] has the indices of the range r in the level l + 1, each level continues the previous one
+	std::vector<std::vector<std::vector<uint32_t>>> levels(MESH_MAX_LODS, std::vector<std::vector<uint32_t>>(ranges.size()));
+	float errors[MESH_MAX_LODS] = {};
+	for (size_t r = 0; r < ranges.size(); ++r)
+	{
+		const sLODDrawCall& range = ranges[r];
+		MeshSimplifier simplifier(&data[0].vertex, sizeof(tInterleaved), num_vertices, &remap[range.start], range.count, locked);
+		size_t num_triangles = simplifier.getNumTriangles();
+		for (int l = 0; l < MESH_MAX_LODS; ++l)
+		{
+			simplifier.simplify(num_triangles >> (l + 1), radius * MESH_LOD_MAX_ERROR);
+			simplifier.getIndices(levels[l][r]);
+			errors[l] = std::max(errors[l], simplifier.getError());
+		}
+	}
+
+	//the chain ends at the first level that does not reduce enough (locked borders, error limit)
+	size_t previous = num_vertices;
+	for (int l = 0; l < MESH_MAX_LODS; ++l)
+	{
+		size_t count = 0;
+		for (const std::vector<uint32_t>& range_indices : levels[l])
+			count += range_indices.size();
+		if (!count || count > previous * MESH_LOD_MIN_REDUCTION)
+			break;
+
+		sLODInfo lod;
+		lod.error = errors[l];
+		lod.start = (uint32_t)lod_indices.size();
+		lod.count = (uint32_t)count;
+		lod.first_draw_call = (uint32_t)lod_draw_calls.size();
+		lod.num_draw_calls = 0;
+		for (size_t r = 0; r < ranges.size(); ++r)
+		{
+			if (!levels[l][r].size())
+				continue;
+			sLODDrawCall dc = ranges[r];
+			dc.start = (uint32_t)lod_indices.size();
+			dc.count = (uint32_t)levels[l][r].size();
+			lod_draw_calls.push_back(dc);
+			lod_indices.insert(lod_indices.end(), levels[l][r].begin(), levels[l][r].end());
+			lod.num_draw_calls++;
+		}
+		lods.push_back(lod);
+		previous = count;
+	}
+
+	std::cout << " + LODs: " << name << " Vertices: " << num_unique << " Triangles:";
+	for (const sLODInfo& lod : lods)
+		std::cout << " " << lod.count / 3;
+	std::cout << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	if (!lods.size())
+		return false;
+
+	if (interleaved_vbo_id || vertices_vbo_id)
+	{
+		if (lod_indices_vbo_id == 0)
+			glGenBuffersARB(1, &lod_indices_vbo_id);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, lod_indices_vbo_id);
+		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, lod_indices.size() * sizeof(uint32_t), &lod_indices[0], GL_STATIC_DRAW_ARB);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	if (use_binary && bin_filename.size() > 5)
+		writeBin(bin_filename.substr(0, bin_filename.size() - 5).c_str());
+	return true;
+}
+
+int Mesh::selectLOD(float screen_radius, int current_lod, float max_error_pixels, float hysteresis)
+{
+	int num_lods = (int)lods.size();
+	if (!num_lods || radius <= 0.f)
+		return 0;
+
+	//errors are in object space, the radius relates them to the projected size
+	float pixels_per_unit = screen_radius / radius;
+	auto projectedError = [&](int lod) { return lod ? lods[lod - 1].error * pixels_per_unit : 0.f; };
+
+	int lod = std::min(std::max(current_lod, 0), num_lods);
+	while (lod > 0 && projectedError(lod) > max_error_pixels * (1.f + hysteresis))
+		lod--;
+	while (lod < num_lods && projectedError(lod + 1) < max_error_pixels * (1.f - hysteresis))
+		lod++;
+	return lod;
+}
+
+bool Mesh::testRayCollision(const glm::mat4& model, const glm::vec3& ray_origin, const glm::vec3& ray_direction, glm::vec3& collision, glm::vec3& normal, float max_ray_dist, bool in_object_space)
+{
+	if (!createCollisionModel())
+		return false;
+
+	//the ray goes to object space, the direction is not normalized so the distance along it is the same in both spaces
+	glm::mat4 inverse_model = glm::inverse(model);
+	glm::vec3 local_origin = inverse_model * glm::vec4(ray_origin, 1.f);
+	glm::vec3 local_direction = inverse_model * glm::vec4(ray_direction, 0.f);
+
+	float t;
+	glm::vec3 local_normal;
+	if (!collision_model->testRay(local_origin, local_direction, max_ray_dist, t, local_normal))
+		return false;
+
+	if (in_object_space)
+	{
+		collision = local_origin + local_direction * t;
+		normal = local_normal;
+	}
+	else
+	{
+		collision = ray_origin + ray_direction * t;
+		normal = glm::normalize(glm::vec3(glm::transpose(inverse_model) * glm::vec4(local_normal, 0.f)));
+	}
+	return true;
+}
+
+bool Mesh::testSphereCollision(const glm::mat4& model, const glm::vec3& center, float radius, glm::vec3& collision, glm::vec3& normal, bool in_object_space)
+{
+	if (!createCollisionModel())
+		return false;
+
+	//a scaled sphere is an ellipsoid, the search uses the radius for the smallest scale and the result is checked in world space
+	float min_scale = std::min(glm::length(glm::vec3(model[0])), std::min(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	if (min_scale <= 0.f)
+		return false;
+
+	glm::mat4 inverse_model = glm::inverse(model);
+	glm::vec3 local_center = inverse_model * glm::vec4(center, 1.f);
+	glm::vec3 local_point, local_normal;
+	if (!collision_model->testSphere(local_center, radius / min_scale, local_point, local_normal))
+		return false;
+
+	glm::vec3 world_point = model * glm::vec4(local_point, 1.f);
+	if (glm::length(world_point - center) > radius)
+		return false;
+
+	if (in_object_space)
+	{
+		collision = local_point;
+		normal = local_normal;
+	}
+	else
+	{
+		collision = world_point;
+		normal = glm::normalize(glm::vec3(glm::transpose(inverse_model) * glm::vec4(local_normal, 0.f)));
+	}
 	return true;
 }
 
@@ -1161,7 +1592,7 @@ bool Mesh::loadOBJ(const char* filename)
 
 	box.center = (aabb_max + aabb_min) * 0.5f;
 	box.halfsize = (aabb_max - box.center);
-	radius = (float)fmax(aabb_max.length(), aabb_min.length());
+	radius = glm::length(box.halfsize);
 
 	submesh_dc_info.length = vertices.size() - last_submesh_vertex;
 	submesh_info.draw_calls[submesh_draw_calls] = submesh_dc_info;
@@ -1259,7 +1690,7 @@ void Mesh::createCube()
 
 	box.center = glm::vec3(0, 0, 0);
 	box.halfsize = glm::vec3(1, 1, 1);
-	radius = (float)box.halfsize.length();
+	radius = glm::length(box.halfsize);
 
 	updateBoundingBox();
 }
@@ -1272,7 +1703,7 @@ void Mesh::createWireBox()
 
 	box.center = glm::vec3(0, 0, 0);
 	box.halfsize = glm::vec3(1, 1, 1);
-	radius = (float)box.halfsize.length();
+	radius = glm::length(box.halfsize);
 }
 
 void Mesh::createQuad(float center_x, float center_y, float w, float h, bool flip_uvs)
@@ -1343,7 +1774,7 @@ void Mesh::createPlane(float size)
 
 	box.center = glm::vec3(0, 0, 0);
 	box.halfsize = glm::vec3(size, 0, size);
-	radius = (float)box.halfsize.length();
+	radius = glm::length(box.halfsize);
 }
 
 void Mesh::createSubdividedPlane(float size, int subdivisions, bool centered)
@@ -1385,7 +1816,7 @@ void Mesh::createSubdividedPlane(float size, int subdivisions, bool centered)
 		box.center = glm::vec3(size * 0.5f, 0.0f, size * 0.5f);
 
 	box.halfsize = glm::vec3(size * 0.5f, 0.0f, size * 0.5f);
-	radius = static_cast<float>(box.halfsize.length());
+	radius = glm::length(box.halfsize);
 }
 
 void Mesh::displace(Image* heightmap, float altitude)
@@ -1408,7 +1839,7 @@ void Mesh::displace(Image* heightmap, float altitude)
 	}
 	box.center.y += altitude * 0.5f;
 	box.halfsize.y += altitude * 0.5f;
-	radius = static_cast<float>(box.halfsize.length());
+	radius = glm::length(box.halfsize);
 }
 
 
@@ -1565,6 +1996,14 @@ Mesh* Mesh::Get(const char* filename)
 			m->interleaveBuffers();
 		}
 
+		//bins written before the collision models existed, createLODs saves the bin with it too
+		bool missing_collision = generate_collision && !m->collision_model && m->createCollisionModel();
+
+		//bins written before the levels existed (or of meshes that could not be simplified)
+		bool saved = generate_lods && !m->lods.size() && m->createLODs();
+		if (missing_collision && !saved && m->bin_filename.size() > 5)
+			m->writeBin(m->bin_filename.substr(0, m->bin_filename.size() - 5).c_str());
+
 		if (auto_upload_to_vram)
 		{
 			std::cout << "[VRAM] ";
@@ -1599,6 +2038,13 @@ Mesh* Mesh::Get(const char* filename)
 		m->interleaveBuffers();
 	}
 
+	if (generate_lods)
+		m->createLODs();
+
+	//before the bin is written below, so it is saved with the mesh
+	if (generate_collision)
+		m->createCollisionModel();
+
 	//and upload them to VRAM
 	if (auto_upload_to_vram)
 	{
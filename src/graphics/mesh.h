@@ -13,12 +13,18 @@
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
+class CollisionModel; //triangle BVH
 
-//version from 21/01/2024
-#define MESH_BIN_VERSION 12 //this is used to regenerate bins if the format changes
+//version from 19/10/2026
+#define MESH_BIN_VERSION 14 //this is used to regenerate bins if the format changes
 
 #define MAX_SUBMESH_DRAW_CALLS 16
 
+#define MESH_MAX_LODS 3 //simplified levels besides the mesh itself, each one with half the triangles of the previous
+#define MESH_LOD_MIN_TRIANGLES 256 //smaller meshes are not simplified
+#define MESH_LOD_MAX_ERROR 0.05f //relative to the radius, the chain stops before moving the surface more than this
+#define MESH_LOD_MIN_REDUCTION 0.8f //a level must have less indices than this fraction of the previous one
+
 class BoundingBox
 {
 public:
@@ -88,6 +94,48 @@ public:
 
 	std::vector< tInterleaved > interleaved; //to render interleaved
 
+	//one entry of the instance buffer used by the USE_INSTANCING shader variants
+	struct tInstance {
+		glm::mat4 model; //attribute u_model
+		glm::vec4 color; //attribute a_instance_color
+	};
+
+	//multi-draw-indirect arguments, the same 20 bytes serve glMultiDrawArraysIndirect (base_vertex is its base instance, the last field is unused)
+	//and glMultiDrawElementsIndirect, so the culling shader only has to know where instance_count is
+	struct tIndirectCommand {
+		uint32_t count;
+		uint32_t instance_count;
+		uint32_t first;
+		uint32_t base_vertex;
+		uint32_t base_instance;
+	};
+
+	//instances already in GPU buffers, drawn with one multi-draw-indirect call (commands are usually written by a compute shader)
+	struct tIndirectBatch {
+		unsigned int instance_buffer = 0; //tInstance array, the commands point to it with base_instance
+		unsigned int command_buffer = 0;
+		size_t command_offset = 0; //bytes
+		int num_commands = 0;
+		int lod = 0; //level the commands were made for (see getIndirectCommand)
+	};
+
+	//levels of detail: simplified index buffers over the same vertices, level 0 is the mesh itself
+	//they are built once with quadric edge collapses and stored in the .mbin
+	struct sLODDrawCall {
+		uint32_t submesh; //UINT32_MAX if the mesh has no submeshes
+		uint32_t draw_call;
+		uint32_t start; //in lod_indices
+		uint32_t count;
+	};
+
+	struct sLODInfo {
+		float error; //max distance to the original surface, in object space
+		uint32_t start; //in lod_indices, the draw calls of a level are contiguous
+		uint32_t count;
+		uint32_t first_draw_call; //in lod_draw_calls
+		uint32_t num_draw_calls;
+	};
+
 	std::vector< glm::vec3 > indices; //for indexed meshes
 
 	//for animated meshes
@@ -113,6 +161,14 @@ public:
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
 
+	static bool generate_lods; //build the levels of detail of the loaded meshes that have none
+	static bool generate_collision; //build the collision model of the loaded meshes that have none, saved in the .mbin
+	std::vector<sLODInfo> lods; //level 1 onwards
+	std::vector<sLODDrawCall> lod_draw_calls;
+	std::vector<uint32_t> lod_indices;
+	unsigned int lod_indices_vbo_id;
+	int active_lod; //level drawn by render(), the RenderQueue sets it around its draws
+
 	Mesh();
 	~Mesh();
 
@@ -121,12 +177,16 @@ public:
 	void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
 	void renderInstanced(unsigned int primitive, const glm::mat4* instanced_models, int number);
 	void renderInstanced(unsigned int primitive, const std::vector<glm::vec3> positions, const char* uniform_name);
+	void renderInstanced(unsigned int primitive, const tInstance* instances, int num_instances);
+	bool renderIndirect(unsigned int primitive, const tIndirectBatch& batch); //false if the mesh is not in VRAM
+	tIndirectCommand getIndirectCommand(uint32_t base_instance, int lod = 0); //draws the whole mesh once
 	void renderBounding(const glm::mat4& model, bool world_bounding = true);
 	void renderFixedPipeline(int primitive); //sloooooooow
 	void renderAnimated(unsigned int primitive, Skeleton* sk);
 
 	void enableBuffers(Shader* shader);
 	void drawCall(unsigned int primitive, int submesh_id, int draw_call_id, int num_instances);
+	void drawLODCall(unsigned int primitive, uint32_t start, uint32_t count, int num_instances);
 	void disableBuffers(Shader* shader);
 
 	bool readBin(const char* filename);
@@ -135,12 +195,22 @@ public:
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
 	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
 
-	//collision testing
-	void* collision_model;
-	//bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
-	////help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
-	//bool testRayCollision(Matrix44 model, Vector3 ray_origin, Vector3 ray_direction, Vector3& collision, Vector3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false);
-	//bool testSphereCollision(Matrix44 model, Vector3 center, float radius, Vector3& collision, Vector3& normal);
+	//collision testing, the triangle BVH is built when the mesh is loaded and saved in the .mbin (see generate_collision),
+	//meshes without it build it in memory on the first query, the queries never write files
+	CollisionModel* collision_model;
+	std::string bin_filename; //.mbin read or written for this mesh
+	bool createCollisionModel();
+
+	//builds the simplified levels (only triangle soups), saved in the .mbin like the collision model
+	bool createLODs();
+	int getNumLODs() { return (int)lods.size() + 1; }
+	//coarsest level whose error projects under max_error_pixels, screen_radius is the bounding sphere in pixels.
+	//the current level is only left when its error (or the one of the next coarser) crosses the threshold by the hysteresis fraction
+	int selectLOD(float screen_radius, int current_lod, float max_error_pixels, float hysteresis);
+	//help: model is the transform of the mesh, ray origin and direction (world space), a vec3 where to store the collision if found, a vec3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
+	bool testRayCollision(const glm::mat4& model, const glm::vec3& ray_origin, const glm::vec3& ray_direction, glm::vec3& collision, glm::vec3& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false);
+	//same with a sphere in world space, collision is the closest point of the mesh to the center
+	bool testSphereCollision(const glm::mat4& model, const glm::vec3& center, float radius, glm::vec3& collision, glm::vec3& normal, bool in_object_space = false);
 
 	//loader
 	static Mesh* Get(const char* filename);
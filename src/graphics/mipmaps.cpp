@@ -0,0 +1,246 @@
+#include "mipmaps.h"
+
+#include "../framework/threadpool.h"
+
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define MIPMAPS_SSE2
+	#include <emmintrin.h>
+#endif
+
+#if defined(__F16C__)
+	#include <immintrin.h>
+#endif
+
+// voxels per job when splitting a volume in the pool (small levels run in a single chunk)
+#define MIPMAPS_VOXELS_PER_CHUNK 16384
+
+int getNumMipLevels(int width, int height, int depth)
+{
+	int size = std::max(width, std::max(height, depth));
+	int levels = 1;
+	while (size > 1)
+	{
+		size /= 2;
+		levels++;
+	}
+	return levels;
+}
+
+// one row of a single channel u8 volume, r0..r3 are the 4 source rows (y, y+1) x (z, z+1)
+static void downsampleRow(const uint8_t* r0, const uint8_t* r1, const uint8_t* r2, const uint8_t* r3, int width, int dst_width, uint8_t* out, eMipFilter filter)
+{
+	int x = 0;
+
+#ifdef MIPMAPS_SSE2
+	//16 source voxels -> 8 destination voxels per iteration
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= dst_width && x * 2 + 16 <= width; x += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(r0 + x * 2));
+		__m128i b = _mm_loadu_si128((const __m128i*)(r1 + x * 2));
+		__m128i c = _mm_loadu_si128((const __m128i*)(r2 + x * 2));
+		__m128i d = _mm_loadu_si128((const __m128i*)(r3 + x * 2));
+		__m128i result;
+
+		if (filter == MIP_FILTER_MAX)
+		{
+			__m128i m = _mm_max_epu8(_mm_max_epu8(a, b), _mm_max_epu8(c, d));
+			m = _mm_max_epu8(m, _mm_srli_epi16(m, 8)); // low byte of every pair holds its max
+			result = _mm_packus_epi16(_mm_and_si128(m, _mm_set1_epi16(0x00FF)), zero);
+		}
+		else
+		{
+			//widen to 16 bits and add the 4 rows
+			__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)), _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+			__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)), _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+
+			//add the pairs of neighbours in x, rounded average of 8
+			const __m128i mask = _mm_set1_epi32(0xFFFF);
+			const __m128i round = _mm_set1_epi32(4);
+			lo = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(_mm_and_si128(lo, mask), _mm_srli_epi32(lo, 16)), round), 3);
+			hi = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(_mm_and_si128(hi, mask), _mm_srli_epi32(hi, 16)), round), 3);
+			result = _mm_packus_epi16(_mm_packs_epi32(lo, hi), zero);
+		}
+
+		_mm_storel_epi64((__m128i*)(out + x), result);
+	}
+#endif
+
+	for (; x < dst_width; ++x)
+	{
+		int x0 = x * 2;
+		int x1 = std::min(x0 + 1, width - 1);
+		if (filter == MIP_FILTER_MAX)
+			out[x] = std::max(std::max(std::max(r0[x0], r0[x1]), std::max(r1[x0], r1[x1])), std::max(std::max(r2[x0], r2[x1]), std::max(r3[x0], r3[x1])));
+		else
+			out[x] = (uint8_t)((r0[x0] + r0[x1] + r1[x0] + r1[x1] + r2[x0] + r2[x1] + r3[x0] + r3[x1] + 4) >> 3);
+	}
+}
+
+// generic version for several interleaved channels
+template <typename T>
+static void downsampleRowChannels(const T* r0, const T* r1, const T* r2, const T* r3, int width, int dst_width, int channels, T* out, eMipFilter filter)
+{
+	for (int x = 0; x < dst_width; ++x)
+	{
+		int x0 = x * 2 * channels;
+		int x1 = std::min(x * 2 + 1, width - 1) * channels;
+		for (int c = 0; c < channels; ++c)
+		{
+			T values[8] = { r0[x0 + c], r0[x1 + c], r1[x0 + c], r1[x1 + c], r2[x0 + c], r2[x1 + c], r3[x0 + c], r3[x1 + c] };
+			if (filter == MIP_FILTER_MAX)
+				out[x * channels + c] = *std::max_element(values, values + 8);
+			else if constexpr (std::is_same<T, uint8_t>::value)
+			{
+				int sum = 4;
+				for (int i = 0; i < 8; ++i)
+					sum += values[i];
+				out[x * channels + c] = (uint8_t)(sum >> 3);
+			}
+			else
+			{
+				T sum = 0;
+				for (int i = 0; i < 8; ++i)
+					sum += values[i];
+				out[x * channels + c] = sum * (T)0.125;
+			}
+		}
+	}
+}
+
+template <typename T>
+static void downsampleVolumeT(const T* src, int width, int height, int depth, int channels, T* dst, eMipFilter filter)
+{
+	int dst_width = getMipSize(width);
+	int dst_height = getMipSize(height);
+	int dst_depth = getMipSize(depth);
+	size_t row = (size_t)width * channels;
+	size_t slice = row * height;
+	size_t dst_row = (size_t)dst_width * channels;
+
+	int min_chunk = std::max(1, MIPMAPS_VOXELS_PER_CHUNK / (dst_width * dst_height));
+	ThreadPool::Get()->parallelFor(0, dst_depth, [&](int z_begin, int z_end) {
+		for (int z = z_begin; z < z_end; ++z)
+		{
+			const T* s0 = src + (size_t)(z * 2) * slice;
+			const T* s1 = src + (size_t)std::min(z * 2 + 1, depth - 1) * slice;
+			for (int y = 0; y < dst_height; ++y)
+			{
+				size_t y0 = (size_t)(y * 2) * row;
+				size_t y1 = (size_t)std::min(y * 2 + 1, height - 1) * row;
+				T* out = dst + ((size_t)z * dst_height + y) * dst_row;
+
+				if constexpr (std::is_same<T, uint8_t>::value)
+					if (channels == 1)
+					{
+						downsampleRow(s0 + y0, s0 + y1, s1 + y0, s1 + y1, width, dst_width, out, filter);
+						continue;
+					}
+				downsampleRowChannels(s0 + y0, s0 + y1, s1 + y0, s1 + y1, width, dst_width, channels, out, filter);
+			}
+		}
+	}, min_chunk);
+}
+
+void downsampleVolume(const uint8_t* src, int width, int height, int depth, int channels, uint8_t* dst, eMipFilter filter)
+{
+	downsampleVolumeT(src, width, height, depth, channels, dst, filter);
+}
+
+void downsampleVolume(const float* src, int width, int height, int depth, int channels, float* dst, eMipFilter filter)
+{
+	downsampleVolumeT(src, width, height, depth, channels, dst, filter);
+}
+
+void convertToUnorm8(const float* src, uint8_t* dst, size_t count)
+{
+	ThreadPool::Get()->parallelFor(0, (int)((count + 15) / 16), [&](int begin, int end) {
+		size_t i = (size_t)begin * 16;
+		size_t last = std::min(count, (size_t)end * 16);
+
+#ifdef MIPMAPS_SSE2
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 scale = _mm_set1_ps(255.f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (; i + 16 <= last; i += 16)
+		{
+			__m128i v[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				__m128 f = _mm_loadu_ps(src + i + k * 4);
+				f = _mm_min_ps(_mm_max_ps(f, zero), one); // max(NaN, 0) returns 0
+				v[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+			}
+			__m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+			_mm_storeu_si128((__m128i*)(dst + i), packed);
+		}
+#endif
+
+		for (; i < last; ++i)
+		{
+			float f = src[i] > 0.f ? (src[i] < 1.f ? src[i] : 1.f) : 0.f;
+			dst[i] = (uint8_t)(f * 255.f + 0.5f);
+		}
+	}, 4096);
+}
+
+uint16_t floatToHalf(float value)
+{
+	uint32_t x;
+	memcpy(&x, &value, sizeof(x));
+
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t mantissa = x & 0x7fffff;
+	int exponent = (int)((x >> 23) & 0xff);
+
+	if (exponent == 255) // inf or nan
+		return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+	int e = exponent - 127 + 15;
+	if (e >= 31) // too big, infinity
+		return (uint16_t)(sign | 0x7c00);
+
+	if (e <= 0) // subnormal half (or zero)
+	{
+		if (e < -10)
+			return (uint16_t)sign;
+		mantissa |= 0x800000;
+		int shift = 14 - e;
+		uint32_t h = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (h & 1)))
+			h++;
+		return (uint16_t)(sign | h);
+	}
+
+	uint32_t h = sign | ((uint32_t)e << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++; // a carry into the exponent is still the right result
+	return (uint16_t)h;
+}
+
+void convertToHalf(const float* src, uint16_t* dst, size_t count)
+{
+	ThreadPool::Get()->parallelFor(0, (int)((count + 7) / 8), [&](int begin, int end) {
+		size_t i = (size_t)begin * 8;
+		size_t last = std::min(count, (size_t)end * 8);
+
+#if defined(__F16C__)
+		for (; i + 8 <= last; i += 8)
+		{
+			__m256 f = _mm256_loadu_ps(src + i);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+		}
+#endif
+
+		for (; i < last; ++i)
+			dst[i] = floatToHalf(src[i]);
+	}, 2048);
+}
@@ -0,0 +1,29 @@
+/*
+	CPU generation of 3D mip chains and conversion of float voxels to the narrow formats used for uploading.
+	Volumes are split by slices in the ThreadPool, the inner loops use SSE2 when it is available.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+enum eMipFilter { MIP_FILTER_BOX, MIP_FILTER_MAX };
+
+// number of levels of a full chain (down to 1x1x1)
+int getNumMipLevels(int width, int height, int depth);
+
+// size of the next level, odd sizes round down (never below 1)
+inline int getMipSize(int size) { return size > 1 ? size / 2 : 1; }
+
+// builds the next level (2x2x2 voxels -> 1), dst must hold getMipSize() of every axis * channels
+// axes of size 1 are not halved, the same voxel is used twice
+void downsampleVolume(const uint8_t* src, int width, int height, int depth, int channels, uint8_t* dst, eMipFilter filter);
+void downsampleVolume(const float* src, int width, int height, int depth, int channels, float* dst, eMipFilter filter);
+
+// same conversion GL applies to float data stored in a normalized format: clamp(f, 0, 1) * 255, rounded
+void convertToUnorm8(const float* src, uint8_t* dst, size_t count);
+
+// IEEE half floats, round to nearest even
+void convertToHalf(const float* src, uint16_t* dst, size_t count);
+uint16_t floatToHalf(float value);
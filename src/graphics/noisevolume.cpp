@@ -0,0 +1,191 @@
+#include "noisevolume.h"
+
+#include "../framework/threadpool.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define NOISEVOLUME_SSE2
+	#include <emmintrin.h>
+#endif
+
+static inline float fract(float x)
+{
+	return x - std::floor(x);
+}
+
+static inline float hash1(float n)
+{
+	return fract(n * 17.f * fract(n * 0.3183099f));
+}
+
+float NoiseVolume::noise(float x, float y, float z)
+{
+	float px = std::floor(x), py = std::floor(y), pz = std::floor(z);
+	float wx = x - px, wy = y - py, wz = z - pz;
+
+	float ux = wx * wx * wx * (wx * (wx * 6.f - 15.f) + 10.f);
+	float uy = wy * wy * wy * (wy * (wy * 6.f - 15.f) + 10.f);
+	float uz = wz * wz * wz * (wz * (wz * 6.f - 15.f) + 10.f);
+
+	float n = px + 317.f * py + 157.f * pz;
+
+	float a = hash1(n + 0.f);
+	float b = hash1(n + 1.f);
+	float c = hash1(n + 317.f);
+	float d = hash1(n + 318.f);
+	float e = hash1(n + 157.f);
+	float f = hash1(n + 158.f);
+	float g = hash1(n + 474.f);
+	float h = hash1(n + 475.f);
+
+	float k0 = a;
+	float k1 = b - a;
+	float k2 = c - a;
+	float k3 = e - a;
+	float k4 = a - b - c + d;
+	float k5 = a - c - e + g;
+	float k6 = a - b - e + f;
+	float k7 = -a + b + c - d + e - f - g + h;
+
+	return -1.f + 2.f * (k0 + k1 * ux + k2 * uy + k3 * uz + k4 * ux * uy + k5 * uy * uz + k6 * uz * ux + k7 * ux * uy * uz);
+}
+
+#ifdef NOISEVOLUME_SSE2
+static inline __m128 floor4(__m128 x)
+{
+	//truncation rounds the negatives up, one less for them (the noise coordinates are far from the int range)
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+}
+
+static inline __m128 fract4(__m128 x)
+{
+	return _mm_sub_ps(x, floor4(x));
+}
+
+static inline __m128 hash4(__m128 n)
+{
+	return fract4(_mm_mul_ps(_mm_mul_ps(n, _mm_set1_ps(17.f)), fract4(_mm_mul_ps(n, _mm_set1_ps(0.3183099f)))));
+}
+
+static inline __m128 fade4(__m128 w)
+{
+	__m128 inner = _mm_add_ps(_mm_mul_ps(w, _mm_sub_ps(_mm_mul_ps(w, _mm_set1_ps(6.f)), _mm_set1_ps(15.f))), _mm_set1_ps(10.f));
+	return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(w, w), w), inner);
+}
+
+static inline __m128 noise4(__m128 x, __m128 y, __m128 z)
+{
+	__m128 px = floor4(x), py = floor4(y), pz = floor4(z);
+	__m128 ux = fade4(_mm_sub_ps(x, px)), uy = fade4(_mm_sub_ps(y, py)), uz = fade4(_mm_sub_ps(z, pz));
+
+	__m128 n = _mm_add_ps(_mm_add_ps(px, _mm_mul_ps(_mm_set1_ps(317.f), py)), _mm_mul_ps(_mm_set1_ps(157.f), pz));
+
+	__m128 a = hash4(n);
+	__m128 b = hash4(_mm_add_ps(n, _mm_set1_ps(1.f)));
+	__m128 c = hash4(_mm_add_ps(n, _mm_set1_ps(317.f)));
+	__m128 d = hash4(_mm_add_ps(n, _mm_set1_ps(318.f)));
+	__m128 e = hash4(_mm_add_ps(n, _mm_set1_ps(157.f)));
+	__m128 f = hash4(_mm_add_ps(n, _mm_set1_ps(158.f)));
+	__m128 g = hash4(_mm_add_ps(n, _mm_set1_ps(474.f)));
+	__m128 h = hash4(_mm_add_ps(n, _mm_set1_ps(475.f)));
+
+	__m128 k1 = _mm_sub_ps(b, a);
+	__m128 k2 = _mm_sub_ps(c, a);
+	__m128 k3 = _mm_sub_ps(e, a);
+	__m128 k4 = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(a, b), c), d);
+	__m128 k5 = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(a, c), e), g);
+	__m128 k6 = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(a, b), e), f);
+	__m128 k7 = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_sub_ps(b, a), c), d), e), f), g), h);
+
+	__m128 uxy = _mm_mul_ps(ux, uy);
+	__m128 sum = _mm_add_ps(a, _mm_mul_ps(k1, ux));
+	sum = _mm_add_ps(sum, _mm_mul_ps(k2, uy));
+	sum = _mm_add_ps(sum, _mm_mul_ps(k3, uz));
+	sum = _mm_add_ps(sum, _mm_mul_ps(k4, uxy));
+	sum = _mm_add_ps(sum, _mm_mul_ps(k5, _mm_mul_ps(uy, uz)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(k6, _mm_mul_ps(uz, ux)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(k7, _mm_mul_ps(uxy, uz)));
+	return _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.f), sum), _mm_set1_ps(1.f));
+}
+#endif
+
+int NoiseVolume::getResolution(float scale, int detail)
+{
+	//cells of the finest octave across the box
+	float cells = 2.f * std::max(scale, 0.f) * (float)(1 << std::clamp(detail, 0, 16));
+	int resolution = NOISEVOLUME_MIN_RESOLUTION;
+	while (resolution < NOISEVOLUME_MAX_RESOLUTION && resolution < cells * NOISEVOLUME_TEXELS_PER_CELL)
+		resolution *= 2;
+	return resolution;
+}
+
+int NoiseVolume::getNumOctaves(float scale, int detail, int resolution)
+{
+	int octaves = 1; // the first one is the shape, always kept
+	float cells = 2.f * std::max(scale, 0.f);
+	for (int i = 1; i <= std::clamp(detail, 0, 16); ++i)
+	{
+		cells *= 2.f;
+		if (cells * NOISEVOLUME_TEXELS_PER_CELL > resolution)
+			break;
+		octaves++;
+	}
+	return octaves;
+}
+
+void NoiseVolume::bake(float scale, int detail, int resolution, std::vector<float>& out)
+{
+	out.resize((size_t)resolution * resolution * resolution);
+	int octaves = getNumOctaves(scale, detail, resolution);
+	float voxel = 2.f / resolution;
+
+	//a job per group of rows (y, z), the x of the row is the SIMD axis
+	ThreadPool::Get()->parallelFor(0, resolution * resolution, [&](int begin, int end) {
+		for (int row = begin; row < end; ++row)
+		{
+			int y = row % resolution, z = row / resolution;
+			float py = (-1.f + (y + 0.5f) * voxel) * scale;
+			float pz = (-1.f + (z + 0.5f) * voxel) * scale;
+			float* dst = &out[(size_t)row * resolution];
+			int x = 0;
+
+#ifdef NOISEVOLUME_SSE2
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			for (; x + 4 <= resolution; x += 4)
+			{
+				__m128 px = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(-1.f), _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lane), _mm_set1_ps(voxel))), _mm_set1_ps(scale));
+				__m128 sum = zero;
+				float frequency = 1.f, amplitude = 1.f;
+				for (int o = 0; o < octaves; ++o)
+				{
+					__m128 f = _mm_set1_ps(frequency);
+					__m128 value = noise4(_mm_mul_ps(px, f), _mm_set1_ps(py * frequency), _mm_set1_ps(pz * frequency));
+					sum = _mm_add_ps(sum, _mm_mul_ps(value, _mm_set1_ps(amplitude)));
+					amplitude *= 0.5f;
+					frequency *= 2.f;
+				}
+				_mm_storeu_ps(dst + x, _mm_min_ps(_mm_max_ps(sum, zero), one));
+			}
+#endif
+
+			for (; x < resolution; ++x)
+			{
+				float px = (-1.f + (x + 0.5f) * voxel) * scale;
+				float sum = 0.f;
+				float frequency = 1.f, amplitude = 1.f;
+				for (int o = 0; o < octaves; ++o)
+				{
+					sum += noise(px * frequency, py * frequency, pz * frequency) * amplitude;
+					amplitude *= 0.5f;
+					frequency *= 2.f;
+				}
+				dst[x] = std::clamp(sum, 0.f, 1.f);
+			}
+		}
+	}, 4);
+}
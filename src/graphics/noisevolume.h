@@ -0,0 +1,29 @@
+/*
+	Noise volume: the fractal value noise of bunnycloud.fs (cnoise) baked in the CPU over the [-1,1] box of the volume,
+	so the noise density is one texture fetch per sample instead of 8 hashes per octave.
+	The resolution follows the highest frequency of the noise, octaves finer than the texels are left out (they would alias).
+	Rows are baked in parallel in the ThreadPool, 4 voxels at a time with SSE2 when it is available.
+*/
+
+#pragma once
+
+#include <vector>
+
+#define NOISEVOLUME_MIN_RESOLUTION 32
+#define NOISEVOLUME_MAX_RESOLUTION 256
+#define NOISEVOLUME_TEXELS_PER_CELL 4 // texels across a cell of the finest octave that is baked
+
+class NoiseVolume
+{
+public:
+	// power of two that resolves every octave of the noise, within the limits
+	static int getResolution(float scale, int detail);
+	// octaves (1 + detail in the shader) that fit in the resolution
+	static int getNumOctaves(float scale, int detail, int resolution);
+
+	// cnoise(p, scale, detail) at the center of every voxel of a resolution^3 grid covering [-1,1]^3, x fastest
+	static void bake(float scale, int detail, int resolution, std::vector<float>& out);
+
+	// the scalar noise, same operations as the shader (for the remainders and to compare)
+	static float noise(float x, float y, float z);
+};
@@ -0,0 +1,99 @@
+#include "permutation.h"
+
+#include "shader.h"
+
+#include <cassert>
+#include <iostream>
+
+std::map<std::string, ShaderPermutation*> ShaderPermutation::sPermutationsLoaded;
+
+ShaderPermutation::ShaderPermutation(const char* vsf, const char* psf)
+{
+	assert(vsf && psf);
+	this->vs_filename = vsf;
+	this->ps_filename = psf;
+}
+
+int ShaderPermutation::addOption(const char* name, const std::vector<std::string>& defines)
+{
+	assert(defines.size() && "an option needs at least one value");
+	assert(this->variants.empty() && "options must be added before compiling any variant");
+
+	sOption option;
+	option.name = name;
+	option.defines = defines;
+	this->options.push_back(option);
+
+	return (int)this->options.size() - 1;
+}
+
+unsigned int ShaderPermutation::getKey(const std::vector<int>& selection) const
+{
+	assert(selection.size() == this->options.size() && "one value per option is needed");
+
+	unsigned int key = 0;
+	for (int i = (int)this->options.size() - 1; i >= 0; --i)
+	{
+		int value = selection[i];
+		assert(value >= 0 && value < (int)this->options[i].defines.size() && "option value out of range");
+		key = key * (unsigned int)this->options[i].defines.size() + (unsigned int)value;
+	}
+	return key;
+}
+
+unsigned int ShaderPermutation::getNumVariants() const
+{
+	unsigned int num = 1;
+	for (const sOption& option : this->options)
+		num *= (unsigned int)option.defines.size();
+	return num;
+}
+
+std::string ShaderPermutation::getMacros(unsigned int key) const
+{
+	std::string macros;
+	for (const sOption& option : this->options)
+	{
+		unsigned int size = (unsigned int)option.defines.size();
+		macros += "#define " + option.defines[key % size] + "\n";
+		key /= size;
+	}
+	return macros;
+}
+
+Shader* ShaderPermutation::get(unsigned int key)
+{
+	auto it = this->variants.find(key);
+	if (it != this->variants.end())
+		return it->second;
+
+	// Shader::GetAsync caches by filenames + macros, so variants shared by several permutations are compiled once.
+	// The variant is only submitted here, callers must check isReady() before using it
+	std::string macros = getMacros(key);
+	Shader* shader = Shader::GetAsync(this->vs_filename.c_str(), this->ps_filename.c_str(), macros.c_str());
+	if (!shader)
+		std::cout << "[ERROR] Shader variant could not be loaded: " << this->ps_filename << "\n" << macros << std::endl;
+
+	this->variants[key] = shader;
+	return shader;
+}
+
+void ShaderPermutation::prewarm()
+{
+	unsigned int num = getNumVariants();
+	for (unsigned int key = 0; key < num; ++key)
+		get(key);
+}
+
+ShaderPermutation* ShaderPermutation::Get(const char* vsf, const char* psf)
+{
+	std::string name = std::string(vsf) + "," + std::string(psf);
+
+	auto it = sPermutationsLoaded.find(name);
+	if (it != sPermutationsLoaded.end())
+		return it->second;
+
+	ShaderPermutation* permutation = new ShaderPermutation(vsf, psf);
+	sPermutationsLoaded[name] = permutation;
+	return permutation;
+}
@@ -0,0 +1,50 @@
+/*
+	Shader permutations: a single uber-shader source compiled into several variants through #defines,
+	so each variant only contains the code paths it really uses (no runtime branches on uniforms).
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+
+class Shader;
+
+class ShaderPermutation
+{
+public:
+	// Every option is a list of mutually exclusive defines, a variant picks one value per option
+	struct sOption {
+		std::string name;
+		std::vector<std::string> defines;
+	};
+
+	static std::map<std::string, ShaderPermutation*> sPermutationsLoaded;
+
+	std::string vs_filename;
+	std::string ps_filename;
+	std::vector<sOption> options;
+
+	// compiled variants, indexed by their key
+	std::map<unsigned int, Shader*> variants;
+
+	ShaderPermutation(const char* vsf, const char* psf);
+
+	// returns the index of the option
+	int addOption(const char* name, const std::vector<std::string>& defines);
+
+	// a key is the mixed-radix number made of the selected value of every option
+	unsigned int getKey(const std::vector<int>& selection) const;
+	unsigned int getNumVariants() const;
+	std::string getMacros(unsigned int key) const;
+
+	// variants are compiled lazily the first time they are requested
+	Shader* get(const std::vector<int>& selection) { return get(getKey(selection)); }
+	Shader* get(unsigned int key);
+
+	// submit all the variants up front so the driver compiles them in parallel (avoids hitches when switching options)
+	void prewarm();
+
+	static ShaderPermutation* Get(const char* vsf, const char* psf);
+};
@@ -0,0 +1,365 @@
+#include "renderqueue.h"
+
+#include "material.h"
+#include "mesh.h"
+#include "gpuculling.h"
+#include "../framework/renderproxy.h"
+#include "../framework/camera.h"
+#include "../framework/includes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <glm/geometric.hpp>
+
+bool RenderQueue::sorting = true;
+bool RenderQueue::instancing = true;
+bool RenderQueue::lods = true;
+float RenderQueue::lod_max_error = 1.f;
+float RenderQueue::lod_hysteresis = 0.25f;
+
+uint64_t RenderQueue::makeKey(eRenderPass pass, uint32_t shader, uint32_t material, uint32_t mesh, float depth)
+{
+	const uint64_t max_depth = (1ull << RENDERQUEUE_DEPTH_BITS) - 1;
+	uint64_t d = (uint64_t)(std::min(std::max(depth, 0.f), 1.f) * max_depth);
+	uint64_t s = shader & ((1u << RENDERQUEUE_SHADER_BITS) - 1);
+	uint64_t m = material & ((1u << RENDERQUEUE_MATERIAL_BITS) - 1);
+	uint64_t g = mesh & ((1u << RENDERQUEUE_MESH_BITS) - 1);
+
+	uint64_t key = (uint64_t)pass << 62;
+	if (pass == RENDER_PASS_OPAQUE)
+		key |= (s << (RENDERQUEUE_MATERIAL_BITS + RENDERQUEUE_MESH_BITS + RENDERQUEUE_DEPTH_BITS)) | (m << (RENDERQUEUE_MESH_BITS + RENDERQUEUE_DEPTH_BITS)) | (g << RENDERQUEUE_DEPTH_BITS) | d;
+	else
+		key |= ((max_depth - d) << (RENDERQUEUE_SHADER_BITS + RENDERQUEUE_MATERIAL_BITS + RENDERQUEUE_MESH_BITS)) | (s << (RENDERQUEUE_MATERIAL_BITS + RENDERQUEUE_MESH_BITS)) | (m << RENDERQUEUE_MESH_BITS) | g;
+	return key;
+}
+
+uint32_t RenderQueue::getShaderId(Shader* shader)
+{
+	auto it = this->shader_ids.find(shader);
+	if (it != this->shader_ids.end())
+		return it->second;
+	uint32_t id = (uint32_t)this->shader_ids.size();
+	this->shader_ids[shader] = id;
+	return id;
+}
+
+uint32_t RenderQueue::getStateId(size_t hash)
+{
+	auto it = this->state_ids.find(hash);
+	if (it != this->state_ids.end())
+		return it->second;
+	uint32_t id = (uint32_t)this->state_ids.size();
+	this->state_ids[hash] = id;
+	return id;
+}
+
+void RenderQueue::build(const RenderProxies& proxies, const std::vector<uint32_t>& visible, Camera* camera)
+{
+	//materials can switch shader or parameters at any time (variants, debug views), there are few of them so refresh all
+	size_t num_materials = proxies.materials.size();
+	this->material_shaders.resize(num_materials);
+	this->material_states.resize(num_materials);
+	for (size_t i = 0; i < num_materials; ++i)
+	{
+		Material* material = proxies.materials[i];
+		this->material_shaders[i] = material ? getShaderId(material->shader) : 0;
+		this->material_states[i] = material ? getStateId(material->getInstancingHash()) : 0;
+	}
+
+	//depth along the view direction, from the third row of the view matrix
+	const glm::mat4& view = camera->view_matrix;
+	glm::vec4 view_z(view[0][2], view[1][2], view[2][2], view[3][2]);
+	float inv_range = 1.f / std::max(camera->far_plane - camera->near_plane, 1e-6f);
+
+	//projected radius in pixels is radius * pixel_scale / distance (not divided in orthographic)
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	float pixel_scale = camera->projection_matrix[1][1] * viewport[3] * 0.5f;
+	bool perspective = camera->type == Camera::PERSPECTIVE;
+	this->proxy_lods.resize(proxies.size(), 0);
+
+	this->draws.clear();
+	this->stats.opaque = this->stats.transparent = 0;
+	memset(this->stats.lod_draws, 0, sizeof(this->stats.lod_draws));
+
+	for (uint32_t index : visible)
+	{
+		uint8_t flags = proxies.flags[index];
+		if ((flags & (PROXY_VISIBLE | PROXY_HAS_MATERIAL)) != (PROXY_VISIBLE | PROXY_HAS_MATERIAL))
+			continue;
+
+		//bounds center if there is a mesh, the origin of the node otherwise
+		glm::vec3 center = (flags & PROXY_HAS_MESH) ? glm::vec3(proxies.sphere_x[index], proxies.sphere_y[index], proxies.sphere_z[index]) : glm::vec3(proxies.models[index][3]);
+		float depth = -(view_z.x * center.x + view_z.y * center.y + view_z.z * center.z + view_z.w);
+		depth = (depth - camera->near_plane) * inv_range;
+
+		eRenderPass pass = (flags & PROXY_TRANSPARENT) ? RENDER_PASS_TRANSPARENT : RENDER_PASS_OPAQUE;
+
+		uint8_t lod = 0;
+		Mesh* mesh = proxies.meshes[proxies.mesh_ids[index]];
+		if (lods && pass == RENDER_PASS_OPAQUE && mesh && mesh->lods.size())
+		{
+			float distance = glm::length(center - camera->eye);
+			float screen_radius = proxies.sphere_radius[index] * pixel_scale / (perspective ? std::max(distance, camera->near_plane) : 1.f);
+			lod = (uint8_t)mesh->selectLOD(screen_radius, this->proxy_lods[index], lod_max_error, lod_hysteresis);
+		}
+		this->proxy_lods[index] = lod;
+		if (pass == RENDER_PASS_OPAQUE)
+			this->stats.lod_draws[lod]++;
+
+		uint32_t material = proxies.material_ids[index];
+		sDrawCall draw;
+		draw.key = makeKey(pass, this->material_shaders[material], this->material_states[material], (proxies.mesh_ids[index] << RENDERQUEUE_LOD_BITS) | lod, depth);
+		draw.proxy = index;
+		this->draws.push_back(draw);
+
+		if (pass == RENDER_PASS_OPAQUE) this->stats.opaque++;
+		else this->stats.transparent++;
+	}
+
+	//the GPU path culls the opaque batches itself, the rest is tested against the frustum while submitting
+	this->gpu_culling = GPUCulling::isActive();
+	if (this->gpu_culling)
+		this->frustum.fromMatrix(camera->viewprojection_matrix);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	if (sorting)
+		radixSort();
+	else // only split the passes, keeping the list order inside them
+		std::stable_partition(this->draws.begin(), this->draws.end(), [](const sDrawCall& draw) { return (draw.key >> 62) == RENDER_PASS_OPAQUE; });
+	this->stats.sort_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	this->first_transparent = this->stats.opaque;
+}
+
+void RenderQueue::radixSort()
+{
+	//LSD radix sort by bytes, all the histograms are built in a single pass
+	size_t count = this->draws.size();
+	this->stats.radix_passes = 0;
+	if (count < 2)
+		return;
+
+	static uint32_t histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (const sDrawCall& draw : this->draws)
+		for (int b = 0; b < 8; ++b)
+			histograms[b][(draw.key >> (b * 8)) & 0xFF]++;
+
+	this->temp.resize(count);
+	sDrawCall* src = this->draws.data();
+	sDrawCall* dst = this->temp.data();
+
+	for (int b = 0; b < 8; ++b)
+	{
+		uint32_t* histogram = histograms[b];
+
+		//bytes that are equal in every key do not change the order (ids and passes use few of the bits)
+		if (histogram[(src[0].key >> (b * 8)) & 0xFF] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			uint32_t n = histogram[i];
+			histogram[i] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			int digit = (src[i].key >> (b * 8)) & 0xFF;
+			dst[histogram[digit]++] = src[i];
+		}
+		std::swap(src, dst);
+		this->stats.radix_passes++;
+	}
+
+	if (src != this->draws.data())
+		this->draws.swap(this->temp);
+}
+
+void RenderQueue::drawOne(const RenderProxies& proxies, uint32_t index, Camera* camera)
+{
+	uint32_t material = proxies.material_ids[index];
+	Mesh* mesh = proxies.meshes[proxies.mesh_ids[index]];
+	if (mesh)
+		mesh->active_lod = this->proxy_lods[index];
+	proxies.materials[material]->render(mesh, proxies.models[index], camera);
+	if (mesh)
+		mesh->active_lod = 0; //picking, wireframes and other passes draw the full mesh
+}
+
+bool RenderQueue::passesCulling(const RenderProxies& proxies, uint32_t index) const
+{
+	//with GPU culling the queue holds every visible proxy, the draws that do not go through it are tested here
+	if (!this->gpu_culling || !(proxies.flags[index] & PROXY_HAS_MESH))
+		return true;
+	BoundingBox box(glm::vec3(proxies.box_x[index], proxies.box_y[index], proxies.box_z[index]), glm::vec3(proxies.half_x[index], proxies.half_y[index], proxies.half_z[index]));
+	return this->frustum.testSphere(glm::vec3(proxies.sphere_x[index], proxies.sphere_y[index], proxies.sphere_z[index]), proxies.sphere_radius[index]) && this->frustum.testBox(box);
+}
+
+bool RenderQueue::hasDraws(const RenderProxies& proxies, eRenderPass pass, int divider) const
+{
+	int begin = pass == RENDER_PASS_OPAQUE ? 0 : this->first_transparent;
+	int end = pass == RENDER_PASS_OPAQUE ? this->first_transparent : (int)this->draws.size();
+	for (int i = begin; i < end; ++i)
+		if (proxies.materials[proxies.material_ids[this->draws[i].proxy]]->getResolutionDivider() == divider)
+			return true;
+	return false;
+}
+
+void RenderQueue::submit(const RenderProxies& proxies, eRenderPass pass, Camera* camera, int divider)
+{
+	int begin = pass == RENDER_PASS_OPAQUE ? 0 : this->first_transparent;
+	int end = pass == RENDER_PASS_OPAQUE ? this->first_transparent : (int)this->draws.size();
+	bool gpu = this->gpu_culling && pass == RENDER_PASS_OPAQUE;
+
+	if (pass == RENDER_PASS_OPAQUE)
+		this->stats.shader_changes = this->stats.material_changes = this->stats.mesh_changes = this->stats.instanced_draws = this->stats.instances = this->stats.gpu_batches = 0;
+
+	//groups are the runs of draws with the same state and mesh, they are contiguous after sorting
+	this->groups.clear();
+	uint32_t last_shader = UINT32_MAX, last_material = UINT32_MAX, last_mesh = UINT32_MAX;
+	for (int i = begin; i < end;)
+	{
+		uint32_t index = this->draws[i].proxy;
+		uint32_t material = proxies.material_ids[index];
+		if (divider && proxies.materials[material]->getResolutionDivider() != divider)
+		{
+			++i;
+			continue;
+		}
+		uint32_t mesh = proxies.mesh_ids[index];
+		uint8_t lod = this->proxy_lods[index];
+		uint32_t shader = this->material_shaders[material];
+		uint32_t state = this->material_states[material];
+
+		this->stats.shader_changes += shader != last_shader;
+		this->stats.material_changes += material != last_material;
+		this->stats.mesh_changes += mesh != last_mesh;
+		last_shader = shader; last_material = material; last_mesh = mesh;
+
+		sGroup group;
+		group.begin = i;
+		group.end = i + 1;
+		if ((instancing || gpu) && pass == RENDER_PASS_OPAQUE)
+			while (group.end < end)
+			{
+				uint32_t next = this->draws[group.end].proxy;
+				if (proxies.mesh_ids[next] != mesh || this->proxy_lods[next] != lod || this->material_states[proxies.material_ids[next]] != state)
+					break;
+				group.end++;
+			}
+		this->groups.push_back(group);
+		i = group.end;
+	}
+
+	//all the batches are culled by a single dispatch
+	if (gpu)
+	{
+		GPUCulling::begin();
+		for (sGroup& group : this->groups)
+		{
+			uint32_t first = this->draws[group.begin].proxy;
+			Mesh* mesh = proxies.meshes[proxies.mesh_ids[first]];
+			if (!mesh)
+				continue;
+			int lod = this->proxy_lods[first];
+
+			group.first_command = (int)GPUCulling::commands.size();
+			for (int i = group.begin; i < group.end; ++i)
+			{
+				uint32_t index = this->draws[i].proxy;
+				Mesh::tInstance instance;
+				instance.model = proxies.models[index];
+				instance.color = proxies.materials[proxies.material_ids[index]]->color;
+
+				GPUCulling::sBounds bounds;
+				bounds.sphere = glm::vec4(proxies.sphere_x[index], proxies.sphere_y[index], proxies.sphere_z[index], proxies.sphere_radius[index]);
+				bounds.box_center = glm::vec4(proxies.box_x[index], proxies.box_y[index], proxies.box_z[index], 0.f);
+				bounds.box_halfsize = glm::vec4(proxies.half_x[index], proxies.half_y[index], proxies.half_z[index], 0.f);
+
+				GPUCulling::commands.push_back(mesh->getIndirectCommand((uint32_t)GPUCulling::instances.size(), lod));
+				GPUCulling::instances.push_back(instance);
+				GPUCulling::bounds.push_back(bounds);
+			}
+		}
+		GPUCulling::dispatch(camera);
+	}
+
+	for (const sGroup& group : this->groups)
+	{
+		uint32_t first = this->draws[group.begin].proxy;
+		Material* material = proxies.materials[proxies.material_ids[first]];
+		Mesh* mesh = proxies.meshes[proxies.mesh_ids[first]];
+		int count = group.end - group.begin;
+
+		if (group.first_command >= 0)
+		{
+			Mesh::tIndirectBatch batch = GPUCulling::getBatch(group.first_command, count);
+			batch.lod = this->proxy_lods[first];
+			if (material->renderIndirect(mesh, batch, camera))
+			{
+				this->stats.gpu_batches++;
+				continue;
+			}
+		}
+
+		if (count >= RENDERQUEUE_MIN_INSTANCES)
+		{
+			this->instances.clear();
+			for (int i = group.begin; i < group.end; ++i)
+			{
+				uint32_t index = this->draws[i].proxy;
+				if (!passesCulling(proxies, index))
+					continue;
+				Mesh::tInstance instance;
+				instance.model = proxies.models[index];
+				instance.color = proxies.materials[proxies.material_ids[index]]->color;
+				this->instances.push_back(instance);
+			}
+
+			int num_instances = (int)this->instances.size();
+			if (!num_instances)
+				continue;
+			mesh->active_lod = this->proxy_lods[first];
+			bool instanced = num_instances >= RENDERQUEUE_MIN_INSTANCES && material->renderInstanced(mesh, this->instances.data(), num_instances, camera);
+			mesh->active_lod = 0;
+			if (instanced)
+			{
+				this->stats.instanced_draws++;
+				this->stats.instances += num_instances;
+				continue;
+			}
+		}
+
+		//not instanced (single draw, transparent pass, material without support or variant still compiling)
+		for (int i = group.begin; i < group.end; ++i)
+			if (passesCulling(proxies, this->draws[i].proxy))
+				drawOne(proxies, this->draws[i].proxy, camera);
+	}
+}
+
+void RenderQueue::renderInMenu()
+{
+	ImGui::Checkbox("Sort draws", &sorting);
+	ImGui::Checkbox("Instancing", &instancing);
+	ImGui::Checkbox("Levels of detail", &lods);
+	ImGui::SliderFloat("LOD max error (px)", &lod_max_error, 0.1f, 16.f);
+	ImGui::SliderFloat("LOD hysteresis", &lod_hysteresis, 0.f, 0.9f);
+	std::string lod_draws;
+	for (int i = 0; i <= MESH_MAX_LODS; ++i)
+		lod_draws += (i ? ", " : "") + std::to_string(this->stats.lod_draws[i]);
+	ImGui::Text("Draws per LOD: %s", lod_draws.c_str());
+	ImGui::Text("Opaque: %d, transparent: %d", this->stats.opaque, this->stats.transparent);
+	ImGui::Text("Shader changes: %d", this->stats.shader_changes);
+	ImGui::Text("Material changes: %d", this->stats.material_changes);
+	ImGui::Text("Mesh changes: %d", this->stats.mesh_changes);
+	ImGui::Text("Instanced draws: %d (%d instances)", this->stats.instanced_draws, this->stats.instances);
+	ImGui::Text("GPU culled batches: %d", this->stats.gpu_batches);
+	ImGui::Text("Radix passes: %d", this->stats.radix_passes);
+	ImGui::Text("Sort: %.3f ms", this->stats.sort_time);
+}
@@ -0,0 +1,106 @@
+/*
+	Render queue: every visible proxy becomes a draw with a 64 bit sort key, the keys are radix sorted every frame.
+	Opaque draws are grouped by shader, material and mesh (front to back inside each group, to reduce overdraw),
+	transparent ones (volumes) go back to front so they blend in the right order.
+	Materials are keyed by their instancing hash, so consecutive opaque draws of the same mesh become one instanced draw.
+	Opaque meshes with levels of detail use the one that fits their projected size, the level is part of the mesh bits.
+*/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "mesh.h"
+#include "../framework/culling.h"
+
+class RenderProxies;
+class Camera;
+class Shader;
+
+enum eRenderPass { RENDER_PASS_OPAQUE, RENDER_PASS_TRANSPARENT };
+
+// key layout, from the most significant bit:
+// opaque:      pass(2) shader(10) material(14) mesh(14) depth(24)
+// transparent: pass(2) inverted depth(24) shader(10) material(14) mesh(14)
+// the mesh bits are the mesh id (12) and the level of detail (2)
+#define RENDERQUEUE_SHADER_BITS 10
+#define RENDERQUEUE_MATERIAL_BITS 14
+#define RENDERQUEUE_MESH_BITS 14
+#define RENDERQUEUE_DEPTH_BITS 24
+#define RENDERQUEUE_LOD_BITS 2
+
+static_assert(MESH_MAX_LODS < (1 << RENDERQUEUE_LOD_BITS), "the levels of detail do not fit in the key");
+
+#define RENDERQUEUE_MIN_INSTANCES 2 // smaller groups are drawn one by one
+
+class RenderQueue
+{
+public:
+	struct sDrawCall {
+		uint64_t key;
+		uint32_t proxy; // index in the RenderProxies arrays
+	};
+
+	struct sStats {
+		int opaque = 0;
+		int transparent = 0;
+		int shader_changes = 0; // between consecutive draws of the last submit
+		int material_changes = 0;
+		int mesh_changes = 0;
+		int instanced_draws = 0;
+		int instances = 0; // draws merged into the instanced ones
+		int gpu_batches = 0; // groups culled in the GPU and drawn with multi-draw-indirect
+		int lod_draws[MESH_MAX_LODS + 1] = {}; // opaque draws per level of detail
+		int radix_passes = 0; // byte passes that were not skipped
+		double sort_time = 0.0; // ms
+	};
+
+	static bool sorting; // off keeps the order of the node list, to compare
+	static bool instancing;
+	static bool lods;
+	static float lod_max_error; // pixels the simplification can move the surface on screen
+	static float lod_hysteresis; // fraction of the threshold, avoids popping back and forth at a distance
+
+	std::vector<sDrawCall> draws; // sorted, opaque first
+	sStats stats;
+
+	// depth is the view distance normalized to [0, 1]
+	static uint64_t makeKey(eRenderPass pass, uint32_t shader, uint32_t material, uint32_t mesh, float depth);
+
+	void build(const RenderProxies& proxies, const std::vector<uint32_t>& visible, Camera* camera);
+
+	// draws every call of the pass, in the sorted order
+	// a divider other than 0 only draws the materials rendered at that fraction of the resolution (see Material::getResolutionDivider)
+	void submit(const RenderProxies& proxies, eRenderPass pass, Camera* camera, int divider = 0);
+	bool hasDraws(const RenderProxies& proxies, eRenderPass pass, int divider) const;
+
+	void renderInMenu();
+
+private:
+	//run of consecutive draws with the same state and mesh
+	struct sGroup {
+		int begin;
+		int end;
+		int first_command = -1; // in GPUCulling::commands, -1 if it is not culled in the GPU
+	};
+
+	std::vector<sDrawCall> temp; // radix sort ping-pong
+	std::vector<sGroup> groups;
+	bool gpu_culling = false; // this frame
+	Frustum frustum; // only set with GPU culling
+	std::unordered_map<Shader*, uint32_t> shader_ids;
+	std::unordered_map<size_t, uint32_t> state_ids; // by instancing hash
+	std::vector<uint32_t> material_shaders; // shader id of every material in the proxies table
+	std::vector<uint32_t> material_states; // state id of every material, the key sorts by it instead of the material
+	std::vector<Mesh::tInstance> instances; // reused every group
+	std::vector<uint8_t> proxy_lods; // level of every proxy in the last frame, for the hysteresis
+	int first_transparent = 0;
+
+	uint32_t getShaderId(Shader* shader);
+	uint32_t getStateId(size_t hash);
+	void drawOne(const RenderProxies& proxies, uint32_t index, Camera* camera);
+	bool passesCulling(const RenderProxies& proxies, uint32_t index) const;
+	void radixSort();
+};
@@ -9,6 +9,7 @@
 #include <locale>
 
 #include "texture.h"
+#include "glstate.h"
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
@@ -55,6 +56,8 @@ REGISTER_GLEXT(void, glUniformMatrix4fv, GLint location, GLsizei count, GLboolea
 #endif
 
 std::map<std::string, Shader*> Shader::s_Shaders;
+std::vector<Shader*> Shader::s_pending;
+bool Shader::s_parallel_compile = false;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
 
@@ -63,7 +66,10 @@ Shader::Shader()
 	if (!Shader::s_ready)
 		Shader::init();
 	compiled = false;
+	pending = false;
+	failed = false;
 	from_atlas = false;
+	vs = fs = program = 0;
 }
 
 Shader::~Shader()
@@ -77,11 +83,8 @@ void Shader::setFilenames(const std::string& vsf, const std::string& psf)
 	ps_filename = psf;
 }
 
-bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros)
+bool Shader::readSources(const std::string& vsf, const std::string& psf, const char* macros, std::string& vsm, std::string& psm)
 {
-	assert(compiled == false);
-	assert(glGetError() == GL_NO_ERROR);
-
 	vs_filename = vsf;
 	ps_filename = psf;
 	from_atlas = false;
@@ -89,7 +92,6 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	bool printMacros = false;
 
 	std::cout << " + Shader: Vertex: " << vsf << "  Pixel: " << psf << "  " << (macros && printMacros ? macros : "") << std::endl;
-	std::string vsm, psm;
 	if (!readFile(vsf, vsm) || !readFile(psf, psm))
 		return false;
 
@@ -97,11 +99,23 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 	if (macros)
 	{
-		vsm = macros + vsm;
-		psm = macros + psm;
+		vsm = injectMacros(vsm, macros);
+		psm = injectMacros(psm, macros);
 		this->macros = macros;
 	}
 
+	return true;
+}
+
+bool Shader::load(const std::string& vsf, const std::string& psf, const char* macros)
+{
+	assert(compiled == false);
+	assert(glGetError() == GL_NO_ERROR);
+
+	std::string vsm, psm;
+	if (!readSources(vsf, psf, macros, vsm, psm))
+		return false;
+
 	if (!compileFromMemory(vsm, psm))
 		return false;
 
@@ -110,7 +124,19 @@ bool Shader::load(const std::string& vsf, const std::string& psf, const char* ma
 	return true;
 }
 
-Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
+bool Shader::loadAsync(const std::string& vsf, const std::string& psf, const char* macros)
+{
+	assert(compiled == false && pending == false);
+	assert(glGetError() == GL_NO_ERROR);
+
+	std::string vsm, psm;
+	if (!readSources(vsf, psf, macros, vsm, psm))
+		return false;
+
+	return submitFromMemory(vsm, psm);
+}
+
+Shader* Shader::getOrLoad(const char* vsf, const char* psf, const char* macros, bool async)
 {
 	std::string name;
 
@@ -120,25 +146,87 @@ Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
 		name = vsf;
 	std::map<std::string, Shader*>::iterator it = s_Shaders.find(name);
 	if (it != s_Shaders.end())
-		return it->second;
+	{
+		Shader* sh = it->second;
+		//a synchronous request cannot return a shader still in flight
+		if (!async && sh->pending && !sh->finishCompilation())
+			return NULL;
+		return sh;
+	}
 
 	if (!psf)
 		return NULL;
 
 	Shader* sh = new Shader();
-	if (!sh->load(vsf, psf, macros))
+	if (!(async ? sh->loadAsync(vsf, psf, macros) : sh->load(vsf, psf, macros)))
 		return NULL;
 	s_Shaders[name] = sh;
 	return sh;
 }
 
+Shader* Shader::Get(const char* vsf, const char* psf, const char* macros)
+{
+	return getOrLoad(vsf, psf, macros, false);
+}
+
+Shader* Shader::GetAsync(const char* vsf, const char* psf, const char* macros)
+{
+	return getOrLoad(vsf, psf, macros, true);
+}
+
+Shader* Shader::getInstancedVariant()
+{
+	if (!this->instanced_variant && !this->from_atlas)
+	{
+		std::string variant_macros = this->macros + "#define USE_INSTANCING\n";
+		this->instanced_variant = GetAsync(this->vs_filename.c_str(), this->ps_filename.c_str(), variant_macros.c_str());
+	}
+	return this->instanced_variant;
+}
+
 void Shader::ReloadAll()
 {
+	//resubmit everything at once so the driver can compile them in parallel, materials use the fallback meanwhile
 	for (std::map<std::string, Shader*>::iterator it = s_Shaders.begin(); it != s_Shaders.end(); it++)
-		it->second->recompile();
+		it->second->recompileAsync();
 	if (!s_shader_atlas_filename.empty())
 		LoadAtlas(s_shader_atlas_filename.c_str());
-	std::cout << "Shaders recompiled" << std::endl;
+	std::cout << "Shaders submitted for recompilation: " << s_pending.size() << std::endl;
+}
+
+void Shader::UpdatePending()
+{
+	if (s_parallel_compile)
+	{
+		//only the ones the driver finished, finishCompilation removes them from the list so iterate over a copy
+		std::vector<Shader*> pending_shaders = s_pending;
+		for (Shader* shader : pending_shaders)
+		{
+			GLint done = GL_FALSE;
+			glGetProgramiv(shader->program, GL_COMPLETION_STATUS_KHR, &done);
+			if (done)
+				shader->finishCompilation();
+		}
+	}
+	else if (s_pending.size())
+		s_pending.front()->finishCompilation(); //without the extension checking blocks, so spread them one per frame
+}
+
+//inserts the macros right after the #version directive (GLSL requires it to be the first statement)
+std::string Shader::injectMacros(const std::string& code, const std::string& macros)
+{
+	if (macros.empty())
+		return code;
+
+	size_t start = code.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos || code.compare(start, 8, "#version") != 0)
+		return macros + "\n" + code;
+
+	size_t end = code.find('\n', start);
+	if (end == std::string::npos)
+		return code + "\n" + macros + "\n";
+
+	return code.substr(0, end + 1) + macros + "\n" + code.substr(end + 1);
 }
 
 //functions to trim strings
@@ -239,8 +327,8 @@ bool Shader::LoadAtlas(const char* filename)
 			continue;
 		}
 
-		vs_code = macros + "\n" + vs_code;
-		fs_code = macros + "\n" + fs_code;
+		vs_code = injectMacros(vs_code, macros);
+		fs_code = injectMacros(fs_code, macros);
 
 		Shader* shader = NULL;
 		auto it = s_Shaders.find(name);
@@ -283,6 +371,14 @@ bool Shader::recompile()
 	return load(vs_filename, ps_filename, macros.size() ? macros.c_str() : NULL);
 }
 
+bool Shader::recompileAsync()
+{
+	if (from_atlas || !vs_filename.size() || !ps_filename.size())
+		return false;
+	release();
+	return loadAsync(vs_filename, ps_filename, macros.size() ? macros.c_str() : NULL);
+}
+
 std::string Shader::getInfoLog() const
 {
 	return info_log;
@@ -296,6 +392,14 @@ bool Shader::hasInfoLog() const
 // ******************************************
 
 bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
+{
+	if (!submitFromMemory(vsm, psm))
+		return false;
+	return finishCompilation();
+}
+
+//no status is queried here, so with GL_KHR_parallel_shader_compile the driver keeps working in its own threads
+bool Shader::submitFromMemory(const std::string& vsm, const std::string& psm)
 {
 	if (glCreateProgram == 0)
 	{
@@ -303,33 +407,58 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		exit(0);
 	}
 
+	if (pending) //resubmitted before finishing
+		release();
+	failed = false;
+
 	program = glCreateProgram();
 	assert(glGetError() == GL_NO_ERROR);
 
-	if (!createVertexShaderObject(vsm))
-	{
-		printf("Vertex shader compilation failed\n");
-		return false;
-	}
-
-	if (!createFragmentShaderObject(psm))
-	{
-		printf("Fragment shader compilation failed\n");
-		return false;
-	}
+	createVertexShaderObject(vsm);
+	createFragmentShaderObject(psm);
 
 	glLinkProgram(program);
 	assert(glGetError() == GL_NO_ERROR);
 
-	GLint linked = 0;
+	pending_vs_code = vsm;
+	pending_ps_code = psm;
+	pending = true;
+	s_pending.push_back(this);
 
-	glGetProgramiv(program, GL_LINK_STATUS, &linked);
-	assert(glGetError() == GL_NO_ERROR);
+	return true;
+}
+
+bool Shader::finishCompilation()
+{
+	assert(pending && "Shader was not submitted");
+	pending = false;
+	s_pending.erase(std::remove(s_pending.begin(), s_pending.end(), this), s_pending.end());
+
+	bool vs_ok = checkShaderObject(vs, pending_vs_code);
+	if (!vs_ok)
+		printf("Vertex shader compilation failed\n");
+	bool fs_ok = vs_ok && checkShaderObject(fs, pending_ps_code);
+	if (vs_ok && !fs_ok)
+		printf("Fragment shader compilation failed\n");
+
+	pending_vs_code.clear();
+	pending_ps_code.clear();
+
+	GLint linked = 0;
+	if (vs_ok && fs_ok)
+	{
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		assert(glGetError() == GL_NO_ERROR);
+		if (!linked)
+			saveProgramInfoLog(program);
+	}
 
+	//the materials keep drawing their fallback, the log above is the only report until it is submitted again
 	if (!linked)
 	{
-		saveProgramInfoLog(program);
+		std::cout << "[ERROR] Shader " << vs_filename << " " << ps_filename << " failed, it will not be used" << std::endl;
 		release();
+		failed = true;
 		return false;
 	}
 
@@ -386,6 +515,15 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 	glCompileShader(handle);
 	assert(glGetError() == GL_NO_ERROR);
 
+	//the status is checked later in checkShaderObject, a failed shader just makes the link fail
+	glAttachShader(program, handle);
+	assert(glGetError() == GL_NO_ERROR);
+
+	return true;
+}
+
+bool Shader::checkShaderObject(GLuint handle, const std::string& code)
+{
 	GLint compile = 0;
 	glGetShaderiv(handle, GL_COMPILE_STATUS, &compile);
 	assert(glGetError() == GL_NO_ERROR);
@@ -395,16 +533,13 @@ bool Shader::createShaderObject(unsigned int type, GLuint& handle, const std::st
 	{
 		saveShaderInfoLog(handle);
 		std::cout << "Shader code:\n " << std::endl;
-		std::vector<std::string> lines = split(fullcode, '\n');
+		std::vector<std::string> lines = split(code, '\n');
 		for (size_t i = 0; i < lines.size(); ++i)
 			std::cout << i << "  " << lines[i] << std::endl;
 
 		return false;
 	}
 
-	glAttachShader(program, handle);
-	assert(glGetError() == GL_NO_ERROR);
-
 	return true;
 }
 
@@ -427,11 +562,18 @@ void Shader::release()
 
 	if (program)
 	{
+		GLState::onProgramDeleted(program);
 		glDeleteProgram(program);
 		assert(glGetError() == GL_NO_ERROR);
 		program = 0;
 	}
 
+	if (pending)
+	{
+		s_pending.erase(std::remove(s_pending.begin(), s_pending.end(), this), s_pending.end());
+		pending = false;
+	}
+
 	locations.clear();
 
 	compiled = false;
@@ -445,7 +587,7 @@ void Shader::enable()
 
 	current = this;
 
-	glUseProgram(program);
+	GLState::useProgram(program);
 	GLuint err = glGetError();
 	assert(err == GL_NO_ERROR);
 
@@ -455,16 +597,14 @@ void Shader::enable()
 
 void Shader::disable()
 {
+	//the program stays bound, so the next shader enabled with the same program costs nothing
 	current = NULL;
-
-	glUseProgram(0);
-	//glActiveTexture(GL_TEXTURE0);
-	assert(glGetError() == GL_NO_ERROR);
 }
 
 void Shader::disableShaders()
 {
-	glUseProgram(0);
+	current = NULL;
+	GLState::useProgram(0);
 	assert(glGetError() == GL_NO_ERROR);
 }
 
@@ -564,8 +704,11 @@ int Shader::getUniformLocation(const char* varname)
 
 void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
-	glBindTexture(tex->texture_type, tex->texture_id);
-	glActiveTexture(GL_TEXTURE0 + slot);
+	//textures still streaming are replaced by a placeholder
+	if (!tex->resident)
+		tex = Texture::getWhiteTexture();
+
+	GLState::bindTexture(slot, tex->texture_type, tex->texture_id);
 	setUniform1(varname, slot);
 }
 
@@ -780,11 +923,24 @@ void Shader::init()
 		IMPORT_GLEXT(glUniform4fv);
 		IMPORT_GLEXT(glUniformMatrix4fv);
 #endif
+
+		//let the driver compile and link in its own threads
+		s_parallel_compile = isGLExtensionSupported("GL_KHR_parallel_shader_compile");
+		if (s_parallel_compile)
+		{
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); //driver decides the number of threads
+			std::cout << "[INFO] Parallel shader compilation enabled" << std::endl;
+		}
 	}
 
 	firsttime = false;
 }
 
+Shader* Shader::getFallbackShader()
+{
+	return getDefaultShader("flat");
+}
+
 Shader* Shader::getDefaultShader(std::string name)
 {
 	auto it = s_Shaders.find(name);
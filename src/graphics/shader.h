@@ -39,10 +39,15 @@ public:
 	virtual bool compile();
 	virtual bool recompile();
 
+	virtual bool recompileAsync();
+
 	virtual bool load(const std::string& vsf, const std::string& psf, const char* macros);
+	virtual bool loadAsync(const std::string& vsf, const std::string& psf, const char* macros); //returns before the driver finishes
 
 	//internal functions
 	virtual bool compileFromMemory(const std::string& vsm, const std::string& psm);
+	virtual bool submitFromMemory(const std::string& vsm, const std::string& psm); //sends the code to the driver without waiting
+	virtual bool finishCompilation(); //waits for the driver and checks the compile/link status
 	virtual void release();
 	virtual void enable();
 	virtual void disable();
@@ -108,13 +113,29 @@ public:
 	std::string getInfoLog() const;
 	bool hasInfoLog() const;
 	bool compiled;
+	bool pending; //submitted to the driver but not checked yet
+	bool failed; //the last submission did not compile or link, its log was printed once
+	GLuint getProgram() const { return program; }
+
+	//true once UpdatePending (or a synchronous load) finished the program, it never blocks
+	bool isReady() const { return compiled; }
 
 	void setMacros(const char* macros);
 
+	// same files and macros plus USE_INSTANCING (model and color come from the instance buffer), compiled on first use
+	Shader* getInstancedVariant();
+	static std::string injectMacros(const std::string& code, const std::string& macros);
+
 	static Shader* Get(const char* vsf, const char* psf = NULL, const char* macros = NULL);
+	static Shader* GetAsync(const char* vsf, const char* psf, const char* macros = NULL); //check isReady() before using it
 	static void ReloadAll();
+	static void UpdatePending(); //call once per frame to finish the shaders compiled in background, the only place they are finished
 	static std::map<std::string, Shader*> s_Shaders;
 
+	//shaders still being compiled by the driver
+	static std::vector<Shader*> s_pending;
+	static bool s_parallel_compile; //GL_KHR_parallel_shader_compile available
+
 	//this is a way to load a single file that contains all the shaders 
 	//to know more about the file format, it is based in this https://github.com/jagenjo/rendeer.js/tree/master/guides#the-shaders but with tiny differences
 	static bool LoadAtlas(const char* filename);
@@ -122,6 +143,7 @@ public:
 	static std::map<std::string, std::string> s_shaders_atlas; //stores strings, no shaders
 
 	static Shader* getDefaultShader(std::string name);
+	static Shader* getFallbackShader(); //used by materials while their shader is not ready
 
 protected:
 
@@ -130,10 +152,14 @@ protected:
 	std::string ps_filename;
 	std::string macros;
 	bool from_atlas;
+	Shader* instanced_variant = NULL;
 
 	bool createVertexShaderObject(const std::string& shader);
 	bool createFragmentShaderObject(const std::string& shader);
 	bool createShaderObject(unsigned int type, GLuint& handle, const std::string& shader);
+	bool checkShaderObject(GLuint handle, const std::string& shader);
+	bool readSources(const std::string& vsf, const std::string& psf, const char* macros, std::string& vsm, std::string& psm);
+	static Shader* getOrLoad(const char* vsf, const char* psf, const char* macros, bool async);
 	void saveShaderInfoLog(GLuint obj);
 	void saveProgramInfoLog(GLuint obj);
 
@@ -144,6 +170,10 @@ protected:
 	GLuint program;
 	std::string log;
 
+	//code kept until the compilation is checked, to print it on errors
+	std::string pending_vs_code;
+	std::string pending_ps_code;
+
 	//this is a hack to speed up shader usage (save info locally)
 private:
 
@@ -0,0 +1,490 @@
+#include "shadowatlas.h"
+
+#include "fbo.h"
+#include "texture.h"
+#include "shader.h"
+#include "mesh.h"
+#include "material.h"
+#include "glstate.h"
+#include "../framework/camera.h"
+#include "../framework/light.h"
+#include "../framework/renderproxy.h"
+#include "../framework/scenenode.h"
+#include "../framework/bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+
+#define SHADOWATLAS_NEAR 0.05f // of the perspective views
+#define SHADOWATLAS_SPOT_MARGIN 2.f // degrees added to the cone, the filter reads around the edge
+
+bool ShadowAtlas::enabled = true;
+int ShadowAtlas::budget = 8;
+float ShadowAtlas::shadow_distance = 50.f;
+float ShadowAtlas::cascade_lambda = 0.75f;
+ShadowAtlas::sStats ShadowAtlas::stats;
+FBO* ShadowAtlas::fbo = NULL;
+Camera* ShadowAtlas::light_camera = NULL;
+GLuint ShadowAtlas::buffer = 0;
+ShadowAtlas::sView ShadowAtlas::views[SHADOWATLAS_MAX_VIEWS];
+ShadowAtlas::sTileState ShadowAtlas::tiles[SHADOWATLAS_MAX_VIEWS];
+std::unordered_map<Light*, ShadowAtlas::sLightEntry> ShadowAtlas::entries;
+int ShadowAtlas::frame = 0;
+
+// up vector that is never parallel to the direction
+static glm::vec3 getUpVector(const glm::vec3& direction)
+{
+	return fabsf(direction.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+}
+
+bool ShadowAtlas::init()
+{
+	if (fbo)
+		return true;
+
+	//depth compared by the sampler (bilinear PCF), the transmittance of the volumes and where they start and end
+	Texture* depth = new Texture();
+	depth->create(SHADOWATLAS_SIZE, SHADOWATLAS_SIZE, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, false, NULL, GL_DEPTH_COMPONENT24);
+	depth->bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	depth->unbind();
+	Texture* transmittance = new Texture();
+	transmittance->create(SHADOWATLAS_SIZE, SHADOWATLAS_SIZE, GL_RED, GL_UNSIGNED_BYTE, false, NULL, GL_R8);
+	Texture* range = new Texture();
+	range->create(SHADOWATLAS_SIZE, SHADOWATLAS_SIZE, GL_RG, GL_HALF_FLOAT, false, NULL, GL_RG16F);
+
+	fbo = new FBO();
+	if (!fbo->setTextures({ transmittance, range }, depth))
+	{
+		std::cout << "[ERROR] Shadow atlas could not be created, shadows disabled" << std::endl;
+		delete fbo;
+		delete transmittance;
+		delete range;
+		delete depth;
+		fbo = NULL;
+		enabled = false;
+		return false;
+	}
+	fbo->owns_textures = true;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(views), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//the constructor makes it the current camera, it is not
+	Camera* current = Camera::current;
+	light_camera = new Camera();
+	Camera::current = current;
+	return true;
+}
+
+int ShadowAtlas::allocate(int num_views)
+{
+	//first run of free tiles, the views of a light are consecutive so the shaders find them from the first one
+	for (int first = 0; first + num_views <= SHADOWATLAS_MAX_VIEWS; ++first)
+	{
+		int count = 0;
+		while (count < num_views && !tiles[first + count].light)
+			count++;
+		if (count == num_views)
+			return first;
+		first += count;
+	}
+	return -1;
+}
+
+void ShadowAtlas::release(sLightEntry& entry)
+{
+	for (int i = 0; entry.first_tile >= 0 && i < entry.num_views; ++i)
+		tiles[entry.first_tile + i] = sTileState();
+	entry.first_tile = -1;
+}
+
+void ShadowAtlas::setView(int tile, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eye, const glm::vec4& sphere, const glm::vec4& params)
+{
+	sTileState& state = tiles[tile];
+	float scale = 1.f / SHADOWATLAS_TILES_PER_ROW;
+	state.pending.viewprojection = projection * view;
+	state.pending.rect = glm::vec4((tile % SHADOWATLAS_TILES_PER_ROW) * scale, (tile / SHADOWATLAS_TILES_PER_ROW) * scale, scale, scale);
+	state.pending.params = params;
+	state.view_matrix = view;
+	state.projection_matrix = projection;
+	state.eye = eye;
+	state.sphere = sphere;
+}
+
+void ShadowAtlas::computeViews(Light* light, const sLightEntry& entry, Camera* camera)
+{
+	const glm::mat4& global = light->getGlobalMatrix();
+	glm::vec3 position = glm::vec3(global[3]);
+	glm::vec3 direction = glm::normalize(glm::vec3(global[2]));
+	float range = std::max(light->max_distance, SHADOWATLAS_NEAR * 2.f);
+
+	if (light->light_type == LIGHT_SPOT)
+	{
+		float fov = std::min(2.f * light->cone_angle + SHADOWATLAS_SPOT_MARGIN, 170.f);
+		float texel = 2.f * tanf(glm::radians(fov) * 0.5f) / SHADOWATLAS_TILE_SIZE;
+		setView(entry.first_tile, glm::lookAt(position, position + direction, getUpVector(direction)),
+			glm::perspective(glm::radians(fov), 1.f, SHADOWATLAS_NEAR, range), position,
+			glm::vec4(position, range), glm::vec4(0.0002f, texel * 1.5f, 0.f, range));
+	}
+	else if (light->light_type == LIGHT_POINT)
+	{
+		//same order the shaders pick the face with: +x -x +y -y +z -z
+		static const glm::vec3 faces[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+		glm::mat4 projection = glm::perspective(glm::radians(90.f), 1.f, SHADOWATLAS_NEAR, range);
+		float texel = 2.f / SHADOWATLAS_TILE_SIZE;
+		for (int i = 0; i < 6; ++i)
+			setView(entry.first_tile + i, glm::lookAt(position, position + faces[i], getUpVector(faces[i])), projection, position,
+				glm::vec4(position, range), glm::vec4(0.0002f, texel * 1.5f, 0.f, range));
+	}
+	else
+	{
+		//cascades: slices of the camera frustum, closer to logarithmic the more lambda
+		float near_plane = camera->near_plane;
+		float far_plane = std::max(std::min(camera->far_plane, shadow_distance), near_plane * 2.f);
+		auto getSplit = [&](int i) {
+			float f = i / (float)SHADOWATLAS_CASCADES;
+			return glm::mix(near_plane + (far_plane - near_plane) * f, near_plane * powf(far_plane / near_plane, f), cascade_lambda);
+		};
+
+		glm::vec3 front = glm::normalize(camera->center - camera->eye);
+		glm::vec3 right = glm::normalize(glm::cross(front, camera->up));
+		glm::vec3 up = glm::cross(right, front);
+		float tan_y = tanf(glm::radians(camera->fov) * 0.5f);
+		float tan_x = tan_y * camera->aspect;
+		glm::vec3 light_up = getUpVector(direction);
+		glm::mat4 rotation = glm::lookAt(glm::vec3(0.f), direction, light_up);
+
+		for (int c = 0; c < SHADOWATLAS_CASCADES; ++c)
+		{
+			//bounding sphere of the slice, its size does not change when the camera turns so the texels do not swim
+			float depths[2] = { getSplit(c), getSplit(c + 1) };
+			glm::vec3 corners[8];
+			glm::vec3 center(0.f);
+			for (int i = 0; i < 8; ++i)
+			{
+				float depth = depths[i / 4];
+				corners[i] = camera->eye + front * depth + right * (depth * tan_x * ((i & 1) ? 1.f : -1.f)) + up * (depth * tan_y * ((i & 2) ? 1.f : -1.f));
+				center += corners[i] / 8.f;
+			}
+			float radius = 0.f;
+			for (const glm::vec3& corner : corners)
+				radius = std::max(radius, glm::length(corner - center));
+			radius = ceilf(radius * 16.f) / 16.f;
+
+			//moved in whole texels of the light space
+			float texel = 2.f * radius / SHADOWATLAS_TILE_SIZE;
+			glm::vec3 snapped = glm::vec3(rotation * glm::vec4(center, 1.f));
+			snapped.x = floorf(snapped.x / texel) * texel;
+			snapped.y = floorf(snapped.y / texel) * texel;
+			center = glm::vec3(glm::inverse(rotation) * glm::vec4(snapped, 1.f));
+
+			//the casters up to max_distance behind the slice are inside too
+			glm::vec3 eye = center - direction * (radius + range);
+			glm::vec3 sphere_center = center - direction * (range * 0.5f);
+			setView(entry.first_tile + c, glm::lookAt(eye, center, light_up), glm::ortho(-radius, radius, -radius, radius, 0.f, 2.f * radius + range), eye,
+				glm::vec4(sphere_center, glm::length(glm::vec3(radius, radius, radius + range * 0.5f))), glm::vec4(0.0005f, 0.f, texel * 1.5f, 0.f));
+		}
+	}
+}
+
+static bool touchesSphere(const RenderProxies& proxies, int i, const glm::vec4& sphere)
+{
+	float dx = proxies.sphere_x[i] - sphere.x, dy = proxies.sphere_y[i] - sphere.y, dz = proxies.sphere_z[i] - sphere.z;
+	float reach = proxies.sphere_radius[i] + sphere.w;
+	return dx * dx + dy * dy + dz * dz <= reach * reach;
+}
+
+void ShadowAtlas::gatherCasters(sLightEntry& entry, const RenderProxies& proxies, const SceneBVH* bvh)
+{
+	//one sphere around the views of all the tiles (the cascades, the faces)
+	glm::vec4 bounds = tiles[entry.first_tile].sphere;
+	for (int i = 1; i < entry.num_views; ++i)
+	{
+		const glm::vec4& sphere = tiles[entry.first_tile + i].sphere;
+		float distance = glm::length(glm::vec3(sphere) - glm::vec3(bounds));
+		if (distance + sphere.w <= bounds.w)
+			continue;
+		if (distance + bounds.w <= sphere.w)
+		{
+			bounds = sphere;
+			continue;
+		}
+		float radius = (distance + bounds.w + sphere.w) * 0.5f;
+		glm::vec3 center = glm::vec3(bounds) + (glm::vec3(sphere) - glm::vec3(bounds)) * ((radius - bounds.w) / distance);
+		bounds = glm::vec4(center, radius);
+	}
+
+	static std::vector<int> candidates;
+	candidates.clear();
+	if (bvh)
+		bvh->querySphere(glm::vec3(bounds), bounds.w, candidates);
+	else
+		for (int i = 0; i < proxies.size(); ++i)
+			candidates.push_back(i);
+
+	uint64_t hash = 14695981039346656037ull;
+	auto combine = [&hash](uint64_t value) { hash = (hash ^ value) * 1099511628211ull; };
+
+	//in index order, so the hash does not depend on the order the tree returns them
+	std::sort(candidates.begin(), candidates.end());
+	entry.casters.clear();
+	const uint8_t required = PROXY_VISIBLE | PROXY_HAS_MESH | PROXY_HAS_MATERIAL;
+	for (int i : candidates)
+	{
+		if (i >= proxies.size() || (proxies.flags[i] & required) != required || proxies.nodes[i]->type == NODE_LIGHT) // the spheres that show the lights cast nothing
+			continue;
+		if (!touchesSphere(proxies, i, bounds))
+			continue;
+
+		entry.casters.push_back((uint32_t)i);
+		combine(i);
+		combine(proxies.nodes[i]->world_version);
+		combine(proxies.mesh_ids[i]);
+		//the density of the volumes changes their transmittance, the parameters of the opaque materials change nothing
+		if (proxies.flags[i] & PROXY_TRANSPARENT)
+			combine(proxies.materials[proxies.material_ids[i]]->version);
+	}
+	entry.casters_hash = hash;
+}
+
+void ShadowAtlas::renderTile(int tile, const RenderProxies& proxies, const std::vector<uint32_t>& light_casters)
+{
+	sTileState& state = tiles[tile];
+	static std::vector<uint32_t> casters;
+	casters.clear();
+	for (uint32_t i : light_casters)
+		if (touchesSphere(proxies, i, state.sphere))
+			casters.push_back(i);
+
+	light_camera->type = state.pending.params.w > 0.f ? Camera::PERSPECTIVE : Camera::ORTHOGRAPHIC;
+	light_camera->eye = state.eye;
+	light_camera->center = state.eye - glm::vec3(state.view_matrix[0][2], state.view_matrix[1][2], state.view_matrix[2][2]);
+	light_camera->far_plane = state.pending.params.w;
+	light_camera->view_matrix = state.view_matrix;
+	light_camera->projection_matrix = state.projection_matrix;
+	light_camera->viewprojection_matrix = state.pending.viewprojection;
+
+	int x = (tile % SHADOWATLAS_TILES_PER_ROW) * SHADOWATLAS_TILE_SIZE;
+	int y = (tile / SHADOWATLAS_TILES_PER_ROW) * SHADOWATLAS_TILE_SIZE;
+	fbo->bind();
+	glViewport(x, y, SHADOWATLAS_TILE_SIZE, SHADOWATLAS_TILE_SIZE);
+	glScissor(x, y, SHADOWATLAS_TILE_SIZE, SHADOWATLAS_TILE_SIZE);
+	GLState::enable(GL_SCISSOR_TEST);
+
+	//no volume: full transmittance, and a range that starts at the far plane
+	const GLfloat one[4] = { 1.f, 1.f, 1.f, 1.f };
+	GLState::depthMask(true);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glClearBufferfv(GL_COLOR, 0, one);
+	glClearBufferfv(GL_COLOR, 1, one);
+	glClearBufferfv(GL_DEPTH, 0, one);
+
+	//opaque casters, depth only with a slope bias
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	GLState::polygonMode(GL_FILL);
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::depthFunc(GL_LESS);
+	GLState::disable(GL_BLEND);
+	GLState::enable(GL_CULL_FACE);
+	GLState::enable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.f, 4.f);
+	for (uint32_t i : casters)
+	{
+		if (proxies.flags[i] & PROXY_TRANSPARENT)
+			continue;
+		proxies.materials[proxies.material_ids[i]]->renderShadow(proxies.meshes[proxies.mesh_ids[i]], proxies.models[i], light_camera);
+		stats.casters++;
+	}
+	GLState::disable(GL_POLYGON_OFFSET_FILL);
+
+	//volumes: the transmittance multiplies, the range keeps the closest start and the farthest end (stored negated)
+	//the back faces are drawn so the volumes that contain the light are not missed
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	GLState::depthMask(false);
+	GLState::disable(GL_DEPTH_TEST);
+	GLState::enable(GL_BLEND);
+	GLState::blendFunc(GL_ZERO, GL_SRC_COLOR);
+	glBlendEquationi(1, GL_MIN);
+	glCullFace(GL_FRONT);
+	for (uint32_t i : casters)
+	{
+		if (!(proxies.flags[i] & PROXY_TRANSPARENT))
+			continue;
+		proxies.materials[proxies.material_ids[i]]->renderShadow(proxies.meshes[proxies.mesh_ids[i]], proxies.models[i], light_camera);
+		stats.casters++;
+	}
+	glCullFace(GL_BACK);
+	glBlendEquation(GL_FUNC_ADD);
+	GLState::disable(GL_BLEND);
+	GLState::enable(GL_DEPTH_TEST);
+	GLState::depthMask(true);
+	GLState::disable(GL_SCISSOR_TEST);
+	fbo->unbind();
+
+	views[tile] = state.pending;
+	state.hash = state.pending_hash;
+	state.rendered = true;
+	state.waiting = 0;
+	stats.rendered++;
+}
+
+void ShadowAtlas::update(const std::vector<Light*>& light_list, Camera* camera, const RenderProxies& proxies, const SceneBVH* bvh)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	stats = sStats();
+	frame++;
+	if (!enabled || !init())
+	{
+		for (auto& it : entries)
+			release(it.second);
+		entries.clear();
+		return;
+	}
+
+	for (Light* light : light_list)
+	{
+		if (!light->visible || !light->cast_shadows)
+			continue;
+		int num_views = light->light_type == LIGHT_DIRECTIONAL ? SHADOWATLAS_CASCADES : (light->light_type == LIGHT_POINT ? 6 : 1);
+		sLightEntry& entry = entries[light];
+		entry.last_frame = frame;
+		if (entry.light_type != (int)light->light_type)
+		{
+			release(entry);
+			entry.light_type = light->light_type;
+			entry.num_views = num_views;
+		}
+		//the ones that did not fit try again every frame
+		if (entry.first_tile < 0)
+		{
+			entry.first_tile = allocate(num_views);
+			if (entry.first_tile < 0)
+			{
+				stats.rejected++;
+				continue;
+			}
+			for (int i = 0; i < num_views; ++i)
+				tiles[entry.first_tile + i].light = light;
+		}
+		stats.lights++;
+		computeViews(light, entry, camera);
+	}
+
+	//lights removed or without shadows now give their tiles back
+	for (auto it = entries.begin(); it != entries.end();)
+	{
+		if (it->second.last_frame != frame)
+		{
+			release(it->second);
+			it = entries.erase(it);
+		}
+		else
+			++it;
+	}
+
+	//the casters are gathered and hashed once per light, whatever the number of its tiles
+	for (auto& it : entries)
+		if (it.second.first_tile >= 0)
+			gatherCasters(it.second, proxies, bvh);
+
+	//a tile changed if its view or any caster in the range of its light did
+	static std::vector<int> dirty;
+	dirty.clear();
+	for (int t = 0; t < SHADOWATLAS_MAX_VIEWS; ++t)
+	{
+		sTileState& state = tiles[t];
+		if (!state.light)
+			continue;
+		stats.tiles++;
+
+		uint64_t hash = entries[state.light].casters_hash;
+		const float* matrix = &state.pending.viewprojection[0][0];
+		for (int i = 0; i < 16; ++i)
+			hash = (hash ^ *(const uint32_t*)&matrix[i]) * 1099511628211ull;
+		state.pending_hash = hash;
+		if (!state.rendered || hash != state.hash)
+		{
+			state.waiting++;
+			dirty.push_back(t);
+		}
+	}
+
+	//the budget goes first to the tiles without a map, then to the ones waiting the longest
+	std::sort(dirty.begin(), dirty.end(), [](int a, int b) {
+		if (tiles[a].rendered != tiles[b].rendered)
+			return !tiles[a].rendered;
+		if (tiles[a].waiting != tiles[b].waiting)
+			return tiles[a].waiting > tiles[b].waiting;
+		return a < b;
+	});
+	int count = std::min((int)dirty.size(), std::max(budget, 0));
+	for (int i = 0; i < count; ++i)
+		renderTile(dirty[i], proxies, entries[tiles[dirty[i]].light].casters);
+	stats.deferred = (int)dirty.size() - count;
+
+	if (count)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(views), views);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, SHADOWATLAS_BINDING, buffer);
+	stats.time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int ShadowAtlas::getFirstView(Light* light, int& num_views)
+{
+	num_views = 0;
+	auto it = entries.find(light);
+	if (!enabled || it == entries.end() || it->second.first_tile < 0)
+		return -1;
+
+	//all the views need a map, a light with some missing is lit without shadows until they are rendered
+	const sLightEntry& entry = it->second;
+	for (int i = 0; i < entry.num_views; ++i)
+		if (!tiles[entry.first_tile + i].rendered)
+			return -1;
+	num_views = entry.num_views;
+	return entry.first_tile;
+}
+
+void ShadowAtlas::bind(Shader* shader)
+{
+	//the samplers always point to their own units, so they never share one with a sampler of other type
+	shader->setUniform("u_shadow_atlas", SHADOWATLAS_DEPTH_UNIT);
+	shader->setUniform("u_shadow_transmittance", SHADOWATLAS_TRANSMITTANCE_UNIT);
+	shader->setUniform("u_shadow_range", SHADOWATLAS_RANGE_UNIT);
+	shader->setUniform("u_shadows", enabled && fbo != NULL);
+	if (!enabled || !fbo)
+		return;
+
+	GLuint block = glGetUniformBlockIndex(shader->getProgram(), "ShadowViews");
+	if (block != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader->getProgram(), block, SHADOWATLAS_BINDING);
+	GLState::bindTexture(SHADOWATLAS_DEPTH_UNIT, GL_TEXTURE_2D, fbo->depth_texture->texture_id);
+	GLState::bindTexture(SHADOWATLAS_TRANSMITTANCE_UNIT, GL_TEXTURE_2D, fbo->color_textures[0]->texture_id);
+	GLState::bindTexture(SHADOWATLAS_RANGE_UNIT, GL_TEXTURE_2D, fbo->color_textures[1]->texture_id);
+}
+
+void ShadowAtlas::renderInMenu()
+{
+	ImGui::Checkbox("Enabled", &enabled);
+	ImGui::SliderInt("Tiles per frame", &budget, 1, SHADOWATLAS_MAX_VIEWS);
+	ImGui::SliderFloat("Shadow distance", &shadow_distance, 1.f, 500.f);
+	ImGui::SliderFloat("Cascade split", &cascade_lambda, 0.f, 1.f);
+	ImGui::Text("Atlas: %dx%d, %d tiles of %d", SHADOWATLAS_SIZE, SHADOWATLAS_SIZE, SHADOWATLAS_MAX_VIEWS, SHADOWATLAS_TILE_SIZE);
+	ImGui::Text("Lights: %d (%d did not fit)", stats.lights, stats.rejected);
+	ImGui::Text("Tiles in use: %d", stats.tiles);
+	ImGui::Text("Rendered: %d, waiting: %d", stats.rendered, stats.deferred);
+	ImGui::Text("Caster draws: %d", stats.casters);
+	ImGui::Text("Update: %.3f ms", stats.time);
+}
@@ -0,0 +1,118 @@
+/*
+	Shadow atlas: the shadow maps of every light with cast_shadows share one depth texture split in square tiles.
+	Directional lights use cascades that follow the camera, point lights the 6 faces of a cube (one perspective tile each)
+	and spot lights a single perspective tile, all of them reach max_distance.
+	A tile is only rendered again when its view or the casters inside the range of its light change (gathered and hashed
+	once per light with the scene BVH, every tile of the light reuses them), and at most a budget of tiles
+	is rendered per frame (the ones waiting the longest first), a tile waiting keeps the view of the map it holds.
+	Volumes cast too: their transmittance towards the light is integrated into two extra targets (deep shadow),
+	the transmittance at the back of the volumes and the depths where they start and end, so the receivers in between fade.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <glm/vec4.hpp>
+#include <glm/matrix.hpp>
+
+class Light;
+class Camera;
+class Shader;
+class FBO;
+class RenderProxies;
+class SceneBVH;
+
+#define SHADOWATLAS_SIZE 4096
+#define SHADOWATLAS_TILE_SIZE 512
+#define SHADOWATLAS_TILES_PER_ROW (SHADOWATLAS_SIZE / SHADOWATLAS_TILE_SIZE)
+#define SHADOWATLAS_MAX_VIEWS (SHADOWATLAS_TILES_PER_ROW * SHADOWATLAS_TILES_PER_ROW) // one per tile, the index is the tile (MAX_SHADOW_VIEWS in the shaders)
+#define SHADOWATLAS_CASCADES 4
+#define SHADOWATLAS_BINDING 1 // uniform buffer binding point of the ShadowViews block
+#define SHADOWATLAS_DEPTH_UNIT 8 // texture units of the atlas targets
+#define SHADOWATLAS_TRANSMITTANCE_UNIT 9
+#define SHADOWATLAS_RANGE_UNIT 10
+
+class ShadowAtlas
+{
+public:
+	// std140 layout, one per tile
+	struct sView {
+		glm::mat4 viewprojection;
+		glm::vec4 rect; // xy offset and zw scale of the tile in the atlas uvs
+		// x depth bias, y normal offset per unit of distance to the light (perspective), z constant normal offset (orthographic),
+		// w far plane of the perspective views (the volume depths are distances to the light over it), 0 if orthographic
+		glm::vec4 params;
+	};
+
+	struct sStats {
+		int lights = 0; // with a shadow this frame
+		int rejected = 0; // did not fit in the atlas
+		int tiles = 0; // in use
+		int rendered = 0; // tiles updated this frame
+		int deferred = 0; // changed but over the budget, they keep the previous map
+		int casters = 0; // draws of the rendered tiles
+		double time = 0.0; // ms of CPU
+	};
+
+	static bool enabled;
+	static int budget; // tiles rendered per frame at most
+	static float shadow_distance; // the cascades cover the camera frustum up to here
+	static float cascade_lambda; // 0 uniform splits, 1 logarithmic
+	static sStats stats;
+
+	// before LightBuffer::update: allocates the tiles of the lights, finds the ones that changed and renders the budget
+	// the casters are found with the bvh (built over the proxies), or testing every proxy without it
+	static void update(const std::vector<Light*>& light_list, Camera* camera, const RenderProxies& proxies, const SceneBVH* bvh = NULL);
+
+	// first view of the light and how many it has (cascades, faces), -1 if it has no map yet
+	static int getFirstView(Light* light, int& num_views);
+
+	// the ShadowViews block and the atlas targets
+	static void bind(Shader* shader);
+
+	static void renderInMenu();
+
+private:
+	struct sLightEntry {
+		int first_tile = -1;
+		int num_views = 0;
+		int light_type = -1;
+		int last_frame = 0; // seen in the light list
+		std::vector<uint32_t> casters; // proxies inside the views of all its tiles
+		uint64_t casters_hash = 0;
+	};
+
+	// what the tile holds and what it should hold
+	struct sTileState {
+		Light* light = NULL;
+		bool rendered = false;
+		uint64_t hash = 0; // of the rendered map (view and casters)
+		uint64_t pending_hash = 0;
+		int waiting = 0; // frames since it changed
+		sView pending; // the view to render next time
+		glm::mat4 view_matrix; // the camera of the pending view
+		glm::mat4 projection_matrix;
+		glm::vec3 eye;
+		glm::vec4 sphere; // world bounds of the view, for the casters
+	};
+
+	static FBO* fbo;
+	static Camera* light_camera; // the materials draw the casters with it
+	static GLuint buffer;
+	static sView views[SHADOWATLAS_MAX_VIEWS]; // the ones uploaded, of the rendered maps
+	static sTileState tiles[SHADOWATLAS_MAX_VIEWS];
+	static std::unordered_map<Light*, sLightEntry> entries;
+	static int frame;
+
+	static bool init();
+	static int allocate(int num_views);
+	static void release(sLightEntry& entry);
+	static void computeViews(Light* light, const sLightEntry& entry, Camera* camera);
+	static void setView(int tile, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eye, const glm::vec4& sphere, const glm::vec4& params);
+	static void gatherCasters(sLightEntry& entry, const RenderProxies& proxies, const SceneBVH* bvh);
+	static void renderTile(int tile, const RenderProxies& proxies, const std::vector<uint32_t>& light_casters);
+};
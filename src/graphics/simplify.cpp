@@ -0,0 +1,226 @@
+#include "simplify.h"
+
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <glm/geometric.hpp>
+
+void MeshSimplifier::sQuadric::addPlane(const glm::vec3& n, double d)
+{
+	a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z; a[3] += n.x * d;
+	a[4] += n.y * n.y; a[5] += n.y * n.z; a[6] += n.y * d;
+	a[7] += n.z * n.z; a[8] += n.z * d;
+	a[9] += d * d;
+}
+
+double MeshSimplifier::sQuadric::evaluate(const glm::vec3& p) const
+{
+	//sum of the squared distances to the planes: p^T Q p with p = (x, y, z, 1)
+	double x = p.x, y = p.y, z = p.z;
+	double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+		+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+		+ a[7] * z * z + 2 * a[8] * z
+		+ a[9];
+	return std::max(e, 0.0);
+}
+
+MeshSimplifier::MeshSimplifier(const glm::vec3* positions, size_t stride, size_t num_vertices, const uint32_t* indices, size_t num_indices, const std::vector<bool>& locked)
+{
+	this->positions.resize(num_vertices);
+	for (size_t i = 0; i < num_vertices; ++i)
+		this->positions[i] = *(const glm::vec3*)((const uint8_t*)positions + i * stride);
+
+	this->triangles.assign(indices, indices + num_indices - num_indices % 3);
+	this->num_triangles = this->triangles.size() / 3;
+	this->removed.assign(this->num_triangles, false);
+	this->vertex_triangles.resize(num_vertices);
+	this->quadrics.resize(num_vertices);
+	this->locked = locked;
+	this->locked.resize(num_vertices, false);
+	this->collapsed.assign(num_vertices, false);
+	this->stamps.assign(num_vertices, 0);
+
+	//every vertex accumulates the planes of its triangles, edges used once are borders
+	std::unordered_map<uint64_t, int> edge_count;
+	for (size_t t = 0; t < this->num_triangles; ++t)
+	{
+		const uint32_t* tri = &this->triangles[t * 3];
+		const glm::vec3& p0 = this->positions[tri[0]];
+		glm::vec3 n = glm::cross(this->positions[tri[1]] - p0, this->positions[tri[2]] - p0);
+		float length = glm::length(n);
+		if (length > 0.f)
+		{
+			n /= length;
+			for (int k = 0; k < 3; ++k)
+				this->quadrics[tri[k]].addPlane(n, -glm::dot(n, p0));
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			this->vertex_triangles[tri[k]].push_back((uint32_t)t);
+			uint32_t a = tri[k], b = tri[(k + 1) % 3];
+			edge_count[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+		}
+	}
+	for (const auto& edge : edge_count)
+		if (edge.second == 1)
+			this->locked[edge.first >> 32] = this->locked[edge.first & 0xFFFFFFFF] = true;
+
+	//an interior edge appears in two triangles with opposite winding, it is pushed once
+	for (size_t t = 0; t < this->num_triangles; ++t)
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t a = this->triangles[t * 3 + k], b = this->triangles[t * 3 + (k + 1) % 3];
+			if (a < b)
+				pushEdge(a, b);
+		}
+}
+
+void MeshSimplifier::pushEdge(uint32_t a, uint32_t b)
+{
+	if (a == b || (this->locked[a] && this->locked[b]))
+		return;
+
+	sQuadric q = this->quadrics[a];
+	q.add(this->quadrics[b]);
+
+	//the cheapest direction of the two, the vertex that stays keeps its position
+	sCollapse c;
+	if (this->locked[a] || (!this->locked[b] && q.evaluate(this->positions[b]) > q.evaluate(this->positions[a])))
+	{
+		c.from = b;
+		c.to = a;
+	}
+	else
+	{
+		c.from = a;
+		c.to = b;
+	}
+	c.cost = (float)q.evaluate(this->positions[c.to]);
+	c.from_stamp = this->stamps[c.from];
+	c.to_stamp = this->stamps[c.to];
+	this->heap.push(c);
+}
+
+bool MeshSimplifier::canCollapse(uint32_t from, uint32_t to) const
+{
+	//the triangles that survive must not flip or degenerate when the vertex moves
+	const glm::vec3& target = this->positions[to];
+	for (uint32_t t : this->vertex_triangles[from])
+	{
+		if (this->removed[t])
+			continue;
+		const uint32_t* tri = &this->triangles[t * 3];
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+			continue;
+
+		glm::vec3 p[3], q[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			p[k] = this->positions[tri[k]];
+			q[k] = tri[k] == from ? target : p[k];
+		}
+		glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+		glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+		if (glm::dot(n0, n1) <= SIMPLIFY_MIN_NORMAL_DOT * glm::length(n0) * glm::length(n1))
+			return false;
+	}
+	return true;
+}
+
+void MeshSimplifier::collapse(uint32_t from, uint32_t to)
+{
+	std::vector<uint32_t>& to_triangles = this->vertex_triangles[to];
+	for (uint32_t t : this->vertex_triangles[from])
+	{
+		if (this->removed[t])
+			continue;
+		uint32_t* tri = &this->triangles[t * 3];
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+		{
+			this->removed[t] = true; // the edge was one of its sides
+			this->num_triangles--;
+			continue;
+		}
+		for (int k = 0; k < 3; ++k)
+			if (tri[k] == from)
+				tri[k] = to;
+		to_triangles.push_back(t);
+	}
+	this->vertex_triangles[from].clear();
+	this->vertex_triangles[from].shrink_to_fit();
+	this->collapsed[from] = true;
+
+	this->quadrics[to].add(this->quadrics[from]);
+	this->stamps[to]++;
+	to_triangles.erase(std::remove_if(to_triangles.begin(), to_triangles.end(), [this](uint32_t t) { return (bool)this->removed[t]; }), to_triangles.end());
+
+	//the cost of every edge around the vertex changed with its quadric
+	for (uint32_t t : to_triangles)
+		for (int k = 0; k < 3; ++k)
+			if (this->triangles[t * 3 + k] != to)
+				pushEdge(to, this->triangles[t * 3 + k]);
+}
+
+void MeshSimplifier::simplify(size_t target_triangles, float max_error)
+{
+	double max_cost = (double)max_error * max_error;
+	while (this->num_triangles > target_triangles && !this->heap.empty())
+	{
+		sCollapse c = this->heap.top();
+		if (this->collapsed[c.from] || this->collapsed[c.to] || this->stamps[c.from] != c.from_stamp || this->stamps[c.to] != c.to_stamp)
+		{
+			this->heap.pop();
+			continue;
+		}
+		if (c.cost > max_cost)
+			break; // kept in the heap, a next call with a larger error can continue
+		this->heap.pop();
+
+		//rejected edges are pushed again when their neighbourhood changes
+		if (!canCollapse(c.from, c.to))
+			continue;
+		collapse(c.from, c.to);
+		this->error = std::max(this->error, std::sqrt(c.cost));
+	}
+}
+
+void MeshSimplifier::getIndices(std::vector<uint32_t>& out) const
+{
+	for (size_t t = 0; t < this->removed.size(); ++t)
+		if (!this->removed[t])
+			out.insert(out.end(), &this->triangles[t * 3], &this->triangles[t * 3] + 3);
+}
+
+size_t MeshSimplifier::weld(const void* vertices, size_t stride, size_t vertex_bytes, size_t num_vertices, std::vector<uint32_t>& remap)
+{
+	remap.resize(num_vertices);
+	std::unordered_multimap<uint64_t, uint32_t> lookup;
+	lookup.reserve(num_vertices);
+	size_t unique = 0;
+
+	for (size_t i = 0; i < num_vertices; ++i)
+	{
+		const uint8_t* vertex = (const uint8_t*)vertices + i * stride;
+
+		//FNV-1a of the bytes, equal vertices are compared with memcmp
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t b = 0; b < vertex_bytes; ++b)
+			hash = (hash ^ vertex[b]) * 1099511628211ull;
+
+		remap[i] = (uint32_t)i;
+		auto range = lookup.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it)
+			if (memcmp(vertex, (const uint8_t*)vertices + it->second * stride, vertex_bytes) == 0)
+			{
+				remap[i] = it->second;
+				break;
+			}
+		if (remap[i] == i)
+		{
+			lookup.emplace(hash, (uint32_t)i);
+			unique++;
+		}
+	}
+	return unique;
+}
@@ -0,0 +1,66 @@
+/*
+	Mesh simplification by edge collapse with quadric error metrics (Garland & Heckbert).
+	Collapses are half-edge: a vertex moves onto one of its neighbours, so the result is only a new index buffer
+	over the same vertices and every level of detail can share the vertex buffer of the original mesh.
+	Simplifying again continues from the current state, so a chain of levels is built with successive calls.
+*/
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <cstdint>
+#include <glm/vec3.hpp>
+
+#define SIMPLIFY_MIN_NORMAL_DOT 0.2f // collapses that rotate a triangle more than this are rejected (flips)
+
+class MeshSimplifier
+{
+public:
+	// positions with a stride in bytes, triangles index them (3 per triangle), locked vertices never move
+	// the vertices in a border (edge with a single triangle) are locked too, so the outline and the seams are kept
+	MeshSimplifier(const glm::vec3* positions, size_t stride, size_t num_vertices, const uint32_t* indices, size_t num_indices, const std::vector<bool>& locked);
+
+	// collapses edges until there are target_triangles or less, or the next collapse moves the surface more than max_error
+	void simplify(size_t target_triangles, float max_error);
+
+	size_t getNumTriangles() const { return this->num_triangles; }
+	float getError() const { return this->error; } // approximated distance to the original surface, max of all the collapses done
+	void getIndices(std::vector<uint32_t>& out) const; // appends the remaining triangles
+
+	// maps every vertex to the first one with the same bytes (soups repeat every vertex of every triangle), returns the number of different ones
+	static size_t weld(const void* vertices, size_t stride, size_t vertex_bytes, size_t num_vertices, std::vector<uint32_t>& remap);
+
+private:
+	struct sQuadric {
+		double a[10] = {}; // upper triangle of the symmetric 4x4: xx xy xz xw yy yz yw zz zw ww
+		void addPlane(const glm::vec3& n, double d);
+		void add(const sQuadric& q) { for (int i = 0; i < 10; ++i) a[i] += q.a[i]; }
+		double evaluate(const glm::vec3& p) const;
+	};
+
+	struct sCollapse {
+		float cost;
+		uint32_t from;
+		uint32_t to;
+		uint32_t from_stamp; // the quadrics of both ends when it was pushed, if one changed the entry is outdated
+		uint32_t to_stamp;
+		bool operator>(const sCollapse& other) const { return cost > other.cost; }
+	};
+
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> triangles;
+	std::vector<bool> removed; // per triangle
+	std::vector<std::vector<uint32_t>> vertex_triangles;
+	std::vector<sQuadric> quadrics;
+	std::vector<bool> locked;
+	std::vector<bool> collapsed;
+	std::vector<uint32_t> stamps;
+	std::priority_queue<sCollapse, std::vector<sCollapse>, std::greater<sCollapse>> heap;
+	size_t num_triangles = 0;
+	float error = 0.f;
+
+	void pushEdge(uint32_t a, uint32_t b);
+	bool canCollapse(uint32_t from, uint32_t to) const;
+	void collapse(uint32_t from, uint32_t to);
+};
@@ -8,6 +8,9 @@
 
 #include "mesh.h"
 #include "shader.h"
+#include "glstate.h"
+#include "decoders.h"
+#include "textureloader.h"
 #include <cassert>
 
 //bilinear interpolation
@@ -79,8 +82,9 @@ Texture::~Texture()
 void Texture::clear()
 {
 	glDeleteTextures(1, &texture_id);
-	glBindTexture(this->texture_type, 0);
+	GLState::onTextureDeleted(texture_id);
 	texture_id = 0;
+	num_levels = 0;
 }
 
 void Texture::create(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, uint8_t* data, unsigned int internal_format)
@@ -108,6 +112,27 @@ void Texture::create(unsigned int width, unsigned int height, unsigned int forma
 	upload(format, type, mipmaps, data, internal_format);
 }
 
+static int getNumChannels(unsigned int format)
+{
+	switch (format)
+	{
+	case GL_RG: return 2;
+	case GL_RGB: return 3;
+	case GL_RGBA: return 4;
+	default: return 1;
+	}
+}
+
+static bool isUnorm8Format(unsigned int sized_format)
+{
+	return sized_format == GL_R8 || sized_format == GL_RG8 || sized_format == GL_RGB8 || sized_format == GL_RGBA8;
+}
+
+static bool isHalfFormat(unsigned int sized_format)
+{
+	return sized_format == GL_R16F || sized_format == GL_RG16F || sized_format == GL_RGB16F || sized_format == GL_RGBA16F;
+}
+
 void Texture::create3D(unsigned int width, unsigned int height, unsigned int depth, unsigned int format, unsigned int type, bool mipmaps, uint8_t* data, unsigned int internal_format)
 {
 	assert(width && height && depth && "texture must have a size");
@@ -118,7 +143,7 @@ void Texture::create3D(unsigned int width, unsigned int height, unsigned int dep
 	this->format = format;
 	this->internal_format = internal_format;
 	this->type = type;
-	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT && isPowerOfTwo(this->depth);
+	this->mipmaps = mipmaps && format != GL_DEPTH_COMPONENT; //the mip chain is built by us, any size works
 
 	//Delete previous texture and ensure that previous bounded texture_id is not of another texture type
 	if (this->texture_id != 0)
@@ -144,7 +169,7 @@ void Texture::create3D(unsigned int width, unsigned int height, unsigned int dep
 	this->format = format; // GL_RED
 	this->internal_format = internal_format; // GL_R8, GL_R32F, depends on the volume voxelchannels (Sized Internal Format)
 	this->type = type; // GL_BYTE, GL_UNSIGNED_BYTE, GL_FLOAT
-	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT && isPowerOfTwo(this->depth);
+	this->mipmaps = mipmaps && format != GL_DEPTH_COMPONENT;
 
 	//Delete previous texture and ensure that previous bounded texture_id is not of another texture type
 	if (this->texture_id != 0)
@@ -164,7 +189,13 @@ void Texture::upload3D(float* data, unsigned int mag_filter, unsigned int min_fi
 	assert(this->texture_id && "Must create texture before uploading data.");
 	assert(this->texture_type == GL_TEXTURE_3D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, this->texture_id); //we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, this->texture_id); //we activate this id to tell opengl we are going to use this texture
+
+	//with a chain the min filter must be a mipmap one, otherwise textureLod only ever reads level 0
+	if (this->mipmaps && min_filter == GL_LINEAR)
+		min_filter = GL_LINEAR_MIPMAP_LINEAR;
+	else if (this->mipmaps && min_filter == GL_NEAREST)
+		min_filter = GL_NEAREST_MIPMAP_NEAREST;
 
 	// specify parameters
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, min_filter);	//set the min filter
@@ -173,14 +204,100 @@ void Texture::upload3D(float* data, unsigned int mag_filter, unsigned int min_fi
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, wrap);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_R, wrap);
 
-	glTexImage3D(this->texture_type, 0, this->internal_format, this->width, this->height, this->depth, 0, this->format, this->type, data);
+	if (this->num_levels == 0)
+		allocate3D(this->mipmaps ? getNumMipLevels(this->width, this->height, this->depth) : 1);
+
+	if (data)
+	{
+		int w = this->width;
+		int h = this->height;
+		int d = this->depth;
+		int channels = getNumChannels(this->format);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		if (isUnorm8Format(this->internal_format))
+		{
+			//convert once to bytes and build the chain from them, a quarter of the memory to filter and to send
+			std::vector<uint8_t> level((size_t)w * h * d * channels);
+			std::vector<uint8_t> next;
+			convertToUnorm8(data, level.data(), level.size());
+
+			for (int i = 0; i < this->num_levels; ++i)
+			{
+				glTexSubImage3D(this->texture_type, i, 0, 0, 0, w, h, d, this->format, GL_UNSIGNED_BYTE, level.data());
+				if (i + 1 == this->num_levels)
+					break;
+				next.resize((size_t)getMipSize(w) * getMipSize(h) * getMipSize(d) * channels);
+				downsampleVolume(level.data(), w, h, d, channels, next.data(), this->mip_filter);
+				level.swap(next);
+				w = getMipSize(w); h = getMipSize(h); d = getMipSize(d);
+			}
+		}
+		else
+		{
+			//float formats filter in float, half formats are converted before sending every level
+			bool half = isHalfFormat(this->internal_format);
+			const float* level = data;
+			std::vector<float> buffer;
+			std::vector<float> next;
+			std::vector<uint16_t> halfs;
+
+			for (int i = 0; i < this->num_levels; ++i)
+			{
+				size_t count = (size_t)w * h * d * channels;
+				if (half)
+				{
+					halfs.resize(count);
+					convertToHalf(level, halfs.data(), count);
+					glTexSubImage3D(this->texture_type, i, 0, 0, 0, w, h, d, this->format, GL_HALF_FLOAT, halfs.data());
+				}
+				else
+					glTexSubImage3D(this->texture_type, i, 0, 0, 0, w, h, d, this->format, GL_FLOAT, level);
+
+				if (i + 1 == this->num_levels)
+					break;
+				next.resize((size_t)getMipSize(w) * getMipSize(h) * getMipSize(d) * channels);
+				downsampleVolume(level, w, h, d, channels, next.data(), this->mip_filter);
+				buffer.swap(next);
+				level = buffer.data();
+				w = getMipSize(w); h = getMipSize(h); d = getMipSize(d);
+			}
+		}
 
-	if (data && this->mipmaps) glGenerateMipmap(texture_type);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
 
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
+void Texture::allocate3D(int levels)
+{
+	unsigned int sized_format = getSizedFormat(this->internal_format ? this->internal_format : this->format, this->type);
+	this->internal_format = sized_format;
+	this->num_levels = levels;
+
+	if (isTextureStorageSupported())
+		glTexStorage3D(this->texture_type, levels, sized_format, this->width, this->height, this->depth);
+	else
+	{
+		//same layout than the immutable storage, every level defined explicitly
+		int w = this->width;
+		int h = this->height;
+		int d = this->depth;
+		for (int i = 0; i < levels; ++i)
+		{
+			glTexImage3D(this->texture_type, i, sized_format, w, h, d, 0, this->format, this->type, NULL);
+			w = getMipSize(w); h = getMipSize(h); d = getMipSize(d);
+		}
+	}
+
+	//so the texture is complete even if the chain stops before 1x1x1
+	glTexParameteri(this->texture_type, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
 void Texture::createCubemap(unsigned int width, unsigned int height, uint8_t** data, unsigned int format, unsigned int type, bool mipmaps, unsigned int internal_format)
 {
 	assert(width && height && "texture must have a size");
@@ -200,7 +317,7 @@ void Texture::createCubemap(unsigned int width, unsigned int height, uint8_t** d
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 	uploadCubemap(format, type, mipmaps, data, internal_format);
 }
 
@@ -213,14 +330,17 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 	if (it != sTexturesLoaded.end())
 		return it->second;
 
-	//load it
+	//stream it, until then it behaves as the white texture
 	Texture* texture = new Texture();
-	if (!texture->load(filename, mipmaps, wrap))
+	texture->filename = filename;
+	texture->resident = false;
+	if (!TextureLoader::load(texture, filename, mipmaps, wrap))
 	{
 		delete texture;
 		return NULL;
 	}
 
+	texture->setName(filename);
 	return texture;
 }
 
@@ -243,12 +363,14 @@ bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int t
 	else
 	{
 		std::cout << "[ERROR]: unsupported format" << std::endl;
+		delete image;
 		return false; //unsupported file type
 	}
 
 	if (!found) //file not found
 	{
 		std::cout << " [ERROR]: Texture not found " << std::endl;
+		delete image;
 		return false;
 	}
 
@@ -268,6 +390,7 @@ bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int t
 		generateMipmaps();
 
 	this->image.clear();
+	delete image;
 	std::cout << "[OK] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	setName(filename);
 	return true;
@@ -284,7 +407,7 @@ void Texture::upload(unsigned int format, unsigned int type, bool mipmaps, uint8
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_2D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	glTexImage2D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data);
 
@@ -297,7 +420,7 @@ void Texture::upload(unsigned int format, unsigned int type, bool mipmaps, uint8
 	if (data && this->mipmaps)
 		generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
 
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
@@ -305,9 +428,45 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, uin
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_3D && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
-	glTexImage3D(this->texture_type, 0, internal_format == 0 ? format : internal_format, width, height, depth, 0, format, type, data);
+	if (this->num_levels == 0)
+	{
+		this->internal_format = internal_format;
+		allocate3D(this->mipmaps ? getNumMipLevels(width, height, depth) : 1);
+	}
+
+	if (data)
+	{
+		int w = width;
+		int h = height;
+		int d = depth;
+		int channels = getNumChannels(format);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(this->texture_type, 0, 0, 0, 0, w, h, d, format, type, data);
+
+		//bytes are filtered in the CPU, other types still rely on the driver
+		if (type == GL_UNSIGNED_BYTE)
+		{
+			std::vector<uint8_t> level;
+			std::vector<uint8_t> next;
+			const uint8_t* src = data;
+			for (int i = 1; i < this->num_levels; ++i)
+			{
+				next.resize((size_t)getMipSize(w) * getMipSize(h) * getMipSize(d) * channels);
+				downsampleVolume(src, w, h, d, channels, next.data(), this->mip_filter);
+				level.swap(next);
+				src = level.data();
+				w = getMipSize(w); h = getMipSize(h); d = getMipSize(d);
+				glTexSubImage3D(this->texture_type, i, 0, 0, 0, w, h, d, format, type, src);
+			}
+		}
+		else if (this->num_levels > 1)
+			glGenerateMipmap(this->texture_type);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
 
 	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);	//set the min filter
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);   //set the mag filter
@@ -315,10 +474,7 @@ void Texture::upload3D(unsigned int format, unsigned int type, bool mipmaps, uin
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_R, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 
-	if (data && this->mipmaps)
-		generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D); 
-
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	assert(checkGLErrors() && "Error uploading texture");
 }
 
@@ -327,7 +483,7 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	assert(texture_id && "Must create texture before uploading data.");
 	assert(texture_type == GL_TEXTURE_CUBE_MAP && "Texture type does not match.");
 
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 
 	for (int i = 0; i < 6; i++)
 		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data ? data[i] : NULL);
@@ -340,7 +496,7 @@ void Texture::uploadCubemap(unsigned int format, unsigned int type, bool mipmaps
 	if (data && this->mipmaps)
 		generateMipmaps();
 
-	glBindTexture(this->texture_type, 0);
+	GLState::bindTexture(this->texture_type, 0);
 	assert(glGetError() == GL_NO_ERROR && "Error creating texture");
 }
 
@@ -397,7 +553,7 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 	assert(glGetError() == GL_NO_ERROR);
 	if (texture_id == 0)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-	glBindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	GLState::bindTexture(this->texture_type, texture_id);	//we activate this id to tell opengl we are going to use this texture
 	glTexImage3D(this->texture_type, 0, format, width, height, num_textures, 0, dataFormat, type, data);
 	assert(glGetError() == GL_NO_ERROR);
 
@@ -418,13 +574,13 @@ void Texture::uploadAsArray(unsigned int texture_size, bool mipmaps)
 void Texture::bind()
 {
 	//glEnable(this->texture_type); //enable the textures 
-	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 }
 
 void Texture::unbind()
 {
 	//glDisable(this->texture_type); //disable the textures 
-	glBindTexture(this->texture_type, 0);	//disable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, 0);	//disable the id of the texture we are going to use
 }
 
 void Texture::UnbindAll()
@@ -432,9 +588,9 @@ void Texture::UnbindAll()
 	glDisable(GL_TEXTURE_CUBE_MAP);
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_TEXTURE_3D);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-	glBindTexture(GL_TEXTURE_3D, 0);
+	GLState::bindTexture(GL_TEXTURE_2D, 0);
+	GLState::bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	GLState::bindTexture(GL_TEXTURE_3D, 0);
 }
 
 void Texture::generateMipmaps()
@@ -442,7 +598,7 @@ void Texture::generateMipmaps()
 	if (!glGenerateMipmapEXT)
 		return;
 
-	glBindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
+	GLState::bindTexture(this->texture_type, texture_id);	//enable the id of the texture we are going to use
 	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, Texture::default_min_filter); //set the mag filter
 	glGenerateMipmapEXT(this->texture_type);
 }
@@ -479,6 +635,35 @@ Texture* Texture::getWhiteTexture()
 	return white;
 }
 
+unsigned int Texture::getSizedFormat(unsigned int format, unsigned int type)
+{
+	bool is_float = type == GL_FLOAT;
+	bool is_half = type == GL_HALF_FLOAT;
+
+	switch (format)
+	{
+	case GL_RED: return is_float ? GL_R32F : (is_half ? GL_R16F : GL_R8);
+	case GL_RG: return is_float ? GL_RG32F : (is_half ? GL_RG16F : GL_RG8);
+	case GL_RGB: return is_float ? GL_RGB32F : (is_half ? GL_RGB16F : GL_RGB8);
+	case GL_RGBA: return is_float ? GL_RGBA32F : (is_half ? GL_RGBA16F : GL_RGBA8);
+	case GL_DEPTH_COMPONENT: return is_float ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24;
+	default: return format; //already sized
+	}
+}
+
+bool Texture::isTextureStorageSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		supported = (major > 4 || (major == 4 && minor >= 2) || isGLExtensionSupported("GL_ARB_texture_storage")) ? 1 : 0;
+	}
+	return supported == 1;
+}
+
 void Image::fromScreen(int width, int height)
 {
 	if (data && (width != this->width || height != this->height))
@@ -515,111 +700,38 @@ void Image::fromTexture(Texture* texture)
 //also on https://gshaw.ca/closecombat/formats/tga.html
 bool Image::loadTGA(const char* filename)
 {
-	GLubyte TGAheader[12] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	GLubyte TGAcompare[12];
-	GLubyte header[6];
-	GLuint imageSize;
-	//GLuint type = GL_RGBA;
-
-	FILE* file = fopen(filename, "rb");
-
-	if (file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-		memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-		fread(header, 1, sizeof(header), file) != sizeof(header))
-	{
-		if (file == NULL)
-			return NULL;
-		else
-		{
-			fclose(file);
-			return NULL;
-		}
-	}
-
-	width = header[1] * 256 + header[0];
-	height = header[3] * 256 + header[2];
-	bytes_per_pixel = header[4] / 8;
-
-	bool error = false;
-
-	if (bytes_per_pixel != 3 && bytes_per_pixel != 4)
-	{
-		error = true;
-		std::cerr << "File format not supported: " << bytes_per_pixel << " bytes per pixel" << std::endl;
-	}
-
-	if (width <= 0 || height <= 0)
-	{
-		error = true;
-		std::cerr << "Wrong texture size: " << width << "x" << height << " pixels" << std::endl;
-	}
-
-	if (error)
-	{
-		fclose(file);
+	std::vector<uint8_t> buffer;
+	std::vector<uint8_t> pixels;
+	if (!readFileBytes(filename, buffer))
 		return false;
-	}
-
-	imageSize = width * height * bytes_per_pixel;
-
-	data = new GLubyte[imageSize];
-	if (data == NULL || fread(data, 1, imageSize, file) != imageSize)
-	{
-		if (data != NULL)
-			delete[]data;
-		fclose(file);
-		return NULL;
-	}
-
-	if (header[5] & (1 << 5)) //flip
-		origin_topleft = true;
 
-	//flip BGR to RGB pixels
-	for (GLuint i = 0; i < int(imageSize); i += bytes_per_pixel)
+	int w = 0, h = 0, bpp = 0;
+	bool topleft = false;
+	if (!decodeTGA(pixels, w, h, bpp, topleft, &buffer[0], buffer.size()))
 	{
-		uint8_t temp = data[i];
-		data[i] = data[i + 2];
-		data[i + 2] = temp;
+		std::cerr << "File format not supported: " << filename << std::endl;
+		return false;
 	}
 
-	fclose(file);
+	resize(w, h, bpp);
+	memcpy(data, &pixels[0], pixels.size());
+	origin_topleft = topleft;
 	return true;
 }
 
-#include <iostream>
-#include <fstream>
-
 bool Image::loadPNG(const char* filename, bool flip_y)
 {
-	std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-
-	//get filesize
-	std::streamsize size = 0;
-	if (file.seekg(0, std::ios::end).good()) size = file.tellg();
-	if (file.seekg(0, std::ios::beg).good()) size -= file.tellg();
-
-	if (!size)
+	std::vector<uint8_t> buffer;
+	if (!readFileBytes(filename, buffer))
 		return false;
 
-	std::vector<unsigned char> buffer;
-
-	//read contents of the file into the vector
-	if (size > 0)
-	{
-		buffer.resize((size_t)size);
-		file.read((char*)(&buffer[0]), size);
-	}
-	else
-		buffer.clear();
-
-	std::vector<unsigned char> out_image;
-
-	//if (decodePNG(out_image, width, height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0)
-	//	return false;
+	std::vector<uint8_t> out_image;
+	int w = 0, h = 0;
+	if (decodePNG(out_image, w, h, &buffer[0], buffer.size(), true) != 0)
+		return false;
 
-	data = new uint8_t[out_image.size()];
+	resize(w, h, 4);
 	memcpy(data, &out_image[0], out_image.size());
-	bytes_per_pixel = 4;
 
 	//flip pixels in Y
 	if (flip_y)
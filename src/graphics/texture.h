@@ -5,6 +5,7 @@
 #pragma once
 
 #include "../framework/includes.h"
+#include "mipmaps.h"
 #include <map>
 #include <string>
 #include <cassert>
@@ -84,6 +85,12 @@ public:
 	unsigned int wrapS = GL_CLAMP_TO_EDGE;
 	unsigned int wrapT = GL_CLAMP_TO_EDGE;
 
+	bool resident = true; //false while the TextureLoader is still streaming it, shaders get the white texture instead
+
+	//3D textures: levels allocated with immutable storage (0 until the first upload) and filter used to build them in the CPU
+	int num_levels = 0;
+	eMipFilter mip_filter = MIP_FILTER_BOX;
+
 	//original data info
 	Image image;
 
@@ -106,6 +113,9 @@ public:
 	void uploadCubemap(unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, uint8_t** data = NULL, unsigned int internal_format = 0);
 	void uploadAsArray(unsigned int texture_size, bool mipmaps = true);
 
+	//allocates all the levels of a 3D texture at once (glTexStorage3D when available), the texture must be bound
+	void allocate3D(int levels);
+
 	void bind();
 	void unbind();
 
@@ -117,6 +127,7 @@ public:
 	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
 
 	//load using the manager (caching loaded ones to avoid reloading them)
+	//the file is decoded and uploaded in background, check resident to know when the data is there
 	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
 	void setName(const char* name) { sTexturesLoaded[name] = this; }
 
@@ -127,6 +138,10 @@ public:
 
 	static Texture* getBlackTexture();
 	static Texture* getWhiteTexture();
+
+	//sized internal format for a format and type (GL_RED + GL_UNSIGNED_BYTE -> GL_R8), sized formats are returned as they are
+	static unsigned int getSizedFormat(unsigned int format, unsigned int type);
+	static bool isTextureStorageSupported();
 };
 
 bool isPowerOfTwo(int n);
\ No newline at end of file
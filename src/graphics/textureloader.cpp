@@ -0,0 +1,188 @@
+#include "textureloader.h"
+
+#include "texture.h"
+#include "decoders.h"
+#include "glstate.h"
+#include "../framework/threadpool.h"
+#include "../framework/utils.h"
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+size_t TextureLoader::upload_budget = 4 * 1024 * 1024;
+
+std::mutex TextureLoader::mutex;
+std::deque<TextureLoader::sRequest*> TextureLoader::decoded;
+std::deque<TextureLoader::sRequest*> TextureLoader::uploading;
+std::atomic<int> TextureLoader::num_decoding(0);
+std::vector<std::vector<uint8_t>*> TextureLoader::buffer_pool;
+GLuint TextureLoader::pbos[2] = { 0, 0 };
+int TextureLoader::next_pbo = 0;
+
+bool TextureLoader::load(Texture* texture, const char* filename, bool mipmaps, bool wrap)
+{
+	std::string str = filename;
+	std::string ext = str.size() > 4 ? str.substr(str.size() - 4, 4) : "";
+	if (ext != ".tga" && ext != ".TGA" && ext != ".png" && ext != ".PNG")
+	{
+		std::cout << "[ERROR]: unsupported format " << filename << std::endl;
+		return false;
+	}
+
+	sRequest* request = new sRequest();
+	request->texture = texture;
+	request->filename = filename;
+	request->mipmaps = mipmaps;
+	request->wrap = wrap;
+
+	num_decoding++;
+	ThreadPool::Get()->submit([request]() { decode(request); });
+	return true;
+}
+
+void TextureLoader::decode(sRequest* request)
+{
+	std::vector<uint8_t>* file = acquireBuffer();
+	std::vector<uint8_t>* pixels = acquireBuffer();
+
+	std::string& filename = request->filename;
+	std::string ext = filename.substr(filename.size() - 4, 4);
+
+	bool ok = readFileBytes(filename, *file);
+	if (ok && (ext == ".tga" || ext == ".TGA"))
+	{
+		bool origin_topleft = false;
+		ok = decodeTGA(*pixels, request->width, request->height, request->bytes_per_pixel, origin_topleft, file->data(), file->size());
+	}
+	else if (ok)
+	{
+		ok = decodePNG(*pixels, request->width, request->height, file->data(), file->size()) == 0;
+		request->bytes_per_pixel = 4;
+	}
+
+	releaseBuffer(file);
+	if (ok)
+		request->pixels = pixels;
+	else
+	{
+		releaseBuffer(pixels);
+		request->failed = true;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	decoded.push_back(request);
+	num_decoding--;
+}
+
+std::vector<uint8_t>* TextureLoader::acquireBuffer()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (buffer_pool.empty())
+		return new std::vector<uint8_t>();
+
+	std::vector<uint8_t>* buffer = buffer_pool.back();
+	buffer_pool.pop_back();
+	return buffer;
+}
+
+void TextureLoader::releaseBuffer(std::vector<uint8_t>* buffer)
+{
+	buffer->clear(); // keeps the capacity
+	std::lock_guard<std::mutex> lock(mutex);
+	buffer_pool.push_back(buffer);
+}
+
+void TextureLoader::update()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (!decoded.empty())
+		{
+			uploading.push_back(decoded.front());
+			decoded.pop_front();
+		}
+	}
+
+	size_t budget = upload_budget;
+	while (!uploading.empty() && budget > 0)
+	{
+		sRequest* request = uploading.front();
+		if (!request->failed && !uploadRows(request, budget))
+			break; // out of budget, continue next frame
+
+		if (request->failed)
+			std::cout << " [ERROR]: Texture could not be loaded: " << request->filename << std::endl;
+		else
+			releaseBuffer(request->pixels);
+
+		uploading.pop_front();
+		delete request;
+	}
+}
+
+bool TextureLoader::uploadRows(sRequest* request, size_t& budget)
+{
+	Texture* texture = request->texture;
+	unsigned int format = request->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA;
+	size_t row_size = (size_t)request->width * request->bytes_per_pixel;
+
+	//first slice: allocate the storage without data
+	if (request->uploaded_rows == 0)
+	{
+		texture->create(request->width, request->height, format, GL_UNSIGNED_BYTE, request->mipmaps, NULL, 0);
+		if (!pbos[0])
+			glGenBuffers(2, pbos);
+	}
+
+	//at least one row per frame so big textures always make progress
+	int rows = (int)std::max<size_t>(1, budget / row_size);
+	rows = std::min(rows, request->height - request->uploaded_rows);
+	size_t size = rows * row_size;
+	budget -= std::min(budget, size);
+
+	const uint8_t* src = request->pixels->data() + request->uploaded_rows * row_size;
+	GLuint pbo = pbos[next_pbo];
+	next_pbo = (next_pbo + 1) % 2;
+
+	GLState::bindTexture(texture->texture_type, texture->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB rows are not 4 bytes aligned
+
+	//the copy into the PBO returns at once, the driver moves it to the texture asynchronously
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW); // orphan the previous storage
+	void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (ptr)
+	{
+		memcpy(ptr, src, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexSubImage2D(texture->texture_type, 0, 0, request->uploaded_rows, request->width, rows, format, GL_UNSIGNED_BYTE, (void*)0);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (!ptr) // mapping failed, send from client memory instead
+		glTexSubImage2D(texture->texture_type, 0, 0, request->uploaded_rows, request->width, rows, format, GL_UNSIGNED_BYTE, src);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	request->uploaded_rows += rows;
+	if (request->uploaded_rows < request->height)
+		return false;
+
+	//all the data is in VRAM
+	glTexParameteri(texture->texture_type, GL_TEXTURE_WRAP_S, texture->mipmaps && request->wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(texture->texture_type, GL_TEXTURE_WRAP_T, texture->mipmaps && request->wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	if (texture->mipmaps)
+		texture->generateMipmaps();
+
+	texture->resident = true;
+	assert(checkGLErrors() && "Error streaming texture");
+	return true;
+}
+
+void TextureLoader::renderInMenu()
+{
+	ImGui::Text("Textures decoding: %d, uploading: %d", (int)num_decoding, (int)uploading.size());
+	int budget_kb = (int)(upload_budget / 1024);
+	if (ImGui::SliderInt("Upload budget (KB/frame)", &budget_kb, 64, 32 * 1024))
+		upload_budget = (size_t)budget_kb * 1024;
+}
@@ -0,0 +1,67 @@
+/*
+	Asynchronous texture loading: files are read and decoded in the thread pool into pooled buffers,
+	then the main thread uploads them through pixel unpack buffers, a few rows at a time within a per-frame budget.
+	Until a texture is resident the shaders see Texture::getWhiteTexture() instead.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+class Texture;
+
+class TextureLoader
+{
+public:
+	struct sRequest {
+		Texture* texture;
+		std::string filename;
+		bool mipmaps;
+		bool wrap;
+
+		//filled by the worker
+		bool failed = false;
+		int width = 0;
+		int height = 0;
+		int bytes_per_pixel = 0;
+		std::vector<uint8_t>* pixels = NULL;
+
+		//upload progress, only touched by the main thread
+		int uploaded_rows = 0;
+	};
+
+	static size_t upload_budget; // bytes sent to the GPU per frame
+
+	// queues the file, returns false for unsupported formats
+	static bool load(Texture* texture, const char* filename, bool mipmaps, bool wrap);
+
+	// main thread, once per frame: uploads the decoded textures within the budget
+	static void update();
+
+	static int getNumPending() { return num_decoding + (int)uploading.size(); }
+	static void renderInMenu();
+
+private:
+	static std::mutex mutex;
+	static std::deque<sRequest*> decoded; // filled by the workers
+	static std::deque<sRequest*> uploading;
+	static std::atomic<int> num_decoding;
+
+	//buffers are recycled between requests, so streaming many textures does not hit the allocator
+	static std::vector<std::vector<uint8_t>*> buffer_pool;
+	static std::vector<uint8_t>* acquireBuffer();
+	static void releaseBuffer(std::vector<uint8_t>* buffer);
+
+	//small ring of PBOs, orphaned every time so the upload never waits for the previous one
+	static GLuint pbos[2];
+	static int next_pbo;
+
+	static void decode(sRequest* request); // worker thread
+	static bool uploadRows(sRequest* request, size_t& budget); // true once finished
+};
@@ -0,0 +1,109 @@
+#include "texturepool.h"
+
+#include "texture.h"
+
+TexturePool::sStats TexturePool::stats;
+std::vector<TexturePool::sEntry> TexturePool::entries;
+int TexturePool::frame = 0;
+
+size_t sTextureDesc::getBytes() const
+{
+	size_t texel = 4;
+	switch (internal_format)
+	{
+	case GL_R8: texel = 1; break;
+	case GL_RG8: case GL_R16F: texel = 2; break;
+	case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8: case GL_R32F: case GL_RG16F: case GL_RGBA8: texel = 4; break;
+	case GL_RGBA16F: case GL_RG32F: texel = 8; break;
+	case GL_RGBA32F: texel = 16; break;
+	}
+	return texel * width * height;
+}
+
+Texture* TexturePool::acquire(const sTextureDesc& desc)
+{
+	for (sEntry& entry : entries)
+	{
+		if (entry.in_use || !(entry.desc == desc))
+			continue;
+		if (entry.last_frame == frame)
+			stats.aliased++;
+		entry.in_use = true;
+		entry.last_frame = frame;
+		stats.reused++;
+		stats.in_use++;
+		return entry.texture;
+	}
+
+	//render targets are read at their resolution (or by texelFetch), no mipmaps
+	Texture* texture = new Texture();
+	texture->create(desc.width, desc.height, desc.format, desc.type, false, NULL, desc.internal_format);
+	texture->bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	texture->unbind();
+
+	entries.push_back({ texture, desc, true, frame });
+	stats.created++;
+	stats.textures++;
+	stats.in_use++;
+	stats.bytes += desc.getBytes();
+	return texture;
+}
+
+void TexturePool::release(Texture* texture)
+{
+	for (sEntry& entry : entries)
+		if (entry.texture == texture && entry.in_use)
+		{
+			entry.in_use = false;
+			entry.last_frame = frame;
+			stats.in_use--;
+			return;
+		}
+}
+
+void TexturePool::newFrame()
+{
+	frame++;
+	stats.created = stats.reused = stats.aliased = 0;
+
+	//targets of features turned off
+	for (size_t i = 0; i < entries.size();)
+	{
+		if (!entries[i].in_use && frame - entries[i].last_frame > TEXTUREPOOL_MAX_IDLE_FRAMES)
+			destroy(i);
+		else
+			++i;
+	}
+}
+
+void TexturePool::onResize()
+{
+	for (size_t i = 0; i < entries.size();)
+	{
+		if (!entries[i].in_use)
+			destroy(i);
+		else
+			++i;
+	}
+}
+
+void TexturePool::destroy(size_t index)
+{
+	sEntry& entry = entries[index];
+	stats.textures--;
+	stats.bytes -= entry.desc.getBytes();
+	delete entry.texture;
+	entries[index] = entries.back();
+	entries.pop_back();
+}
+
+void TexturePool::renderInMenu()
+{
+	ImGui::Text("Textures: %d (%d in use)", stats.textures, stats.in_use);
+	ImGui::Text("Memory: %.2f MB", stats.bytes / (1024.0 * 1024.0));
+	ImGui::Text("This frame: %d created, %d reused (%d aliased)", stats.created, stats.reused, stats.aliased);
+	for (const sEntry& entry : entries)
+		ImGui::Text("%dx%d 0x%04X%s", entry.desc.width, entry.desc.height, entry.desc.internal_format, entry.in_use ? " (in use)" : "");
+}
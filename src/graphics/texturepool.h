@@ -0,0 +1,70 @@
+/*
+	Texture pool: render targets that only live inside a frame (the transient resources of the FrameGraph) are taken from here
+	and given back after their last use, so a later target with the same description reuses the same texture in that frame
+	(aliasing) and in the next ones. Textures unused for a few frames are deleted, so the memory follows the targets in use
+	instead of growing with every resize or feature.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <vector>
+#include <cstddef>
+
+class Texture;
+
+#define TEXTUREPOOL_MAX_IDLE_FRAMES 4 // free textures unused for longer are deleted
+
+struct sTextureDesc
+{
+	int width = 0;
+	int height = 0;
+	unsigned int format = GL_RGBA; // the ones of Texture::create
+	unsigned int type = GL_UNSIGNED_BYTE;
+	unsigned int internal_format = GL_RGBA8;
+
+	bool operator==(const sTextureDesc& other) const {
+		return width == other.width && height == other.height && format == other.format && type == other.type && internal_format == other.internal_format;
+	}
+	size_t getBytes() const; // approximated from the internal format
+};
+
+class TexturePool
+{
+public:
+	struct sStats {
+		int textures = 0; // allocated, in use or free
+		int in_use = 0;
+		int created = 0; // this frame
+		int reused = 0; // acquisitions served by a free texture this frame
+		int aliased = 0; // of them, textures that another resource used earlier in the same frame
+		size_t bytes = 0;
+	};
+
+	static sStats stats;
+
+	// a texture with the description, nearest filter and clamped, its content is undefined
+	static Texture* acquire(const sTextureDesc& desc);
+	static void release(Texture* texture);
+
+	// deletes the textures idle for too long and starts the counters of the frame
+	static void newFrame();
+	// the window changed size, the free textures (every transient, between frames) are deleted now
+	static void onResize();
+
+	static void renderInMenu();
+
+private:
+	struct sEntry {
+		Texture* texture;
+		sTextureDesc desc;
+		bool in_use;
+		int last_frame; // released or acquired
+	};
+
+	static std::vector<sEntry> entries;
+	static int frame;
+
+	static void destroy(size_t index);
+};
@@ -0,0 +1,289 @@
+#include "volumepass.h"
+
+#include "fbo.h"
+#include "fbopool.h"
+#include "texture.h"
+#include "shader.h"
+#include "mesh.h"
+#include "glstate.h"
+#include "renderqueue.h"
+#include "../framework/camera.h"
+#include "../framework/renderproxy.h"
+#include "../framework/scenenode.h"
+
+bool VolumePass::enabled = true;
+bool VolumePass::temporal = true;
+bool VolumePass::progressive = false;
+bool VolumePass::jitter = true;
+unsigned int VolumePass::frame = 0;
+
+VolumePass::~VolumePass()
+{
+	for (sLayer& layer : this->layers)
+		releaseLayer(layer);
+}
+
+void VolumePass::releaseLayer(sLayer& layer)
+{
+	FBOPool::release(layer.target);
+	FBOPool::release(layer.history[0]);
+	FBOPool::release(layer.history[1]);
+	layer = sLayer();
+}
+
+bool VolumePass::init()
+{
+	if (!this->downsample_shader)
+	{
+		this->downsample_shader = Shader::Get("res/shaders/screen.vs", "res/shaders/depth_downsample.fs");
+		this->upsample_shader = Shader::Get("res/shaders/screen.vs", "res/shaders/bilateral_upsample.fs");
+		this->resolve_shader = Shader::Get("res/shaders/screen.vs", "res/shaders/temporal_resolve.fs");
+	}
+	return this->downsample_shader && this->downsample_shader->compiled && this->upsample_shader && this->upsample_shader->compiled
+		&& this->resolve_shader && this->resolve_shader->compiled;
+}
+
+static void setFilter(Texture* texture, GLint filter)
+{
+	texture->bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	texture->unbind();
+}
+
+uint64_t VolumePass::getSceneVersion(const RenderProxies& proxies, Camera* camera)
+{
+	uint64_t version = 14695981039346656037ull;
+	auto combine = [&version](uint64_t value) { version = (version ^ value) * 1099511628211ull; };
+	combine(camera->version);
+	combine(proxies.nodes.size());
+	for (SceneNode* node : proxies.nodes)
+	{
+		combine(node->version);
+		combine(node->world_version);
+	}
+	for (Material* material : proxies.materials)
+		if (material)
+			combine(material->version);
+	return version;
+}
+
+bool VolumePass::prepareLayer(sLayer& layer, int divider, int width, int height, bool float_history)
+{
+	int w = std::max(width / divider, 1);
+	int h = std::max(height / divider, 1);
+	if (layer.target && layer.target->width == w && layer.target->height == h && layer.float_history == float_history)
+		return true;
+
+	releaseLayer(layer);
+	layer.float_history = float_history;
+	//premultiplied color and alpha, half floats so the dim parts of the volumes do not band
+	sFBODesc desc;
+	desc.width = w;
+	desc.height = h;
+	desc.type = GL_HALF_FLOAT;
+	desc.internal_format = GL_RGBA16F;
+	layer.target = FBOPool::acquire(desc);
+	if (!layer.target)
+	{
+		releaseLayer(layer);
+		return false;
+	}
+	setFilter(layer.target->color_textures[0], GL_NEAREST); // read with texelFetch
+
+	//the history is sampled at the reprojected positions, between texels
+	desc.depth = false;
+	desc.type = float_history ? GL_FLOAT : GL_HALF_FLOAT;
+	desc.internal_format = float_history ? GL_RGBA32F : GL_RGBA16F;
+	for (int i = 0; i < 2; ++i)
+	{
+		layer.history[i] = FBOPool::acquire(desc);
+		if (!layer.history[i])
+		{
+			releaseLayer(layer);
+			return false;
+		}
+		setFilter(layer.history[i]->color_textures[0], GL_LINEAR);
+	}
+	return true;
+}
+
+// accumulate: plain average of the frames without reprojection nor clamp (progressive), otherwise the temporal blend
+Texture* VolumePass::resolve(sLayer& layer, Camera* camera, bool accumulate)
+{
+	//while the camera moves the history is shortened, the clamp alone would keep too much of the old frames
+	if (!accumulate && layer.frames && layer.viewprojection != camera->viewprojection_matrix)
+		layer.frames = std::min(layer.frames, VOLUMEPASS_MOVING_FRAMES);
+
+	FBO* previous = layer.history[layer.current];
+	layer.current = 1 - layer.current;
+	FBO* output = layer.history[layer.current];
+
+	output->bind();
+	GLState::disable(GL_BLEND);
+	GLState::disable(GL_DEPTH_TEST);
+	GLState::disable(GL_CULL_FACE);
+	this->resolve_shader->enable();
+	this->resolve_shader->setUniform("u_current_texture", layer.target->color_textures[0], 0);
+	this->resolve_shader->setUniform("u_history_texture", previous->color_textures[0], 1);
+	this->resolve_shader->setUniform("u_depth_texture", layer.target->depth_texture, 2);
+	this->resolve_shader->setUniform("u_inverse_viewprojection", glm::inverse(camera->viewprojection_matrix));
+	this->resolve_shader->setUniform("u_previous_viewprojection", layer.viewprojection);
+	this->resolve_shader->setUniform("u_history_valid", layer.frames > 0);
+	this->resolve_shader->setUniform("u_clamp", !accumulate);
+	this->resolve_shader->setUniform("u_blend", 1.f / (layer.frames + 1));
+	Mesh::getQuad()->render(GL_TRIANGLES);
+	this->resolve_shader->disable();
+	output->unbind();
+
+	layer.frames = accumulate ? layer.frames + 1 : std::min(layer.frames + 1, std::max(this->max_history_frames, 1));
+	layer.viewprojection = camera->viewprojection_matrix;
+	return output->color_textures[0];
+}
+
+bool VolumePass::needsSceneDepth(const RenderQueue& queue, const RenderProxies& proxies)
+{
+	if (!enabled || !init())
+		return false;
+	bool accumulate = temporal || progressive;
+	for (int l = 0; l < VOLUMEPASS_NUM_LAYERS; ++l)
+		if ((getDivider(l) > 1 || accumulate) && queue.hasDraws(proxies, RENDER_PASS_TRANSPARENT, getDivider(l)))
+			return true;
+	return false;
+}
+
+void VolumePass::render(RenderQueue& queue, const RenderProxies& proxies, Camera* camera, Texture* scene_depth)
+{
+	this->stats.layers = 0;
+	frame++;
+	if (!enabled || !init() || !scene_depth)
+	{
+		queue.submit(proxies, RENDER_PASS_TRANSPARENT, camera);
+		return;
+	}
+
+	//the depth of the framebuffer being drawn (the screen), read by the downsample and by the upsample
+	this->scene_depth = scene_depth;
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	Mesh* quad = Mesh::getQuad();
+
+	//shaders still compiling are drawn with a fallback, the image changes when they finish
+	uint64_t version = getSceneVersion(proxies, camera);
+	bool scene_changed = version != this->scene_version || this->reset || !Shader::s_pending.empty();
+	this->scene_version = version;
+	this->reset = false;
+	if (scene_changed && progressive)
+		this->stats.resets++;
+
+	//coarsest first, they are composited under the finer ones
+	for (int l = VOLUMEPASS_NUM_LAYERS - 1; l >= 0; --l)
+	{
+		sLayer& layer = this->layers[l];
+		int divider = getDivider(l);
+		this->stats.history_frames[l] = 0;
+
+		//full resolution volumes only need a target to accumulate them
+		bool accumulate = temporal || progressive;
+		bool offscreen = divider > 1 || accumulate;
+		if (!offscreen || !queue.hasDraws(proxies, RENDER_PASS_TRANSPARENT, divider))
+		{
+			layer.frames = 0;
+			if (!offscreen)
+				queue.submit(proxies, RENDER_PASS_TRANSPARENT, camera, divider);
+			continue;
+		}
+
+		if (!prepareLayer(layer, divider, viewport[2], viewport[3], progressive))
+		{
+			queue.submit(proxies, RENDER_PASS_TRANSPARENT, camera, divider);
+			continue;
+		}
+		this->stats.layers++;
+		this->stats.width[l] = layer.target->width;
+		this->stats.height[l] = layer.target->height;
+
+		//a change restarts the average, the temporal blend only shortens its history as when the camera moves
+		if (scene_changed && progressive)
+			layer.frames = 0;
+		else if (scene_changed && layer.frames)
+			layer.frames = std::min(layer.frames, VOLUMEPASS_MOVING_FRAMES);
+		//converged: the history is shown again without drawing the volumes
+		Texture* color = layer.target->color_textures[0];
+		if (progressive && layer.frames >= this->progressive_samples)
+		{
+			color = layer.history[layer.current]->color_textures[0];
+			this->stats.history_frames[l] = layer.frames;
+			composite(color, layer.target->depth_texture, camera);
+			continue;
+		}
+
+		layer.target->bind();
+		glClearColor(0.f, 0.f, 0.f, 0.f);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		//the scene depth at this resolution, written by a fullscreen quad without color
+		GLState::disable(GL_BLEND);
+		GLState::disable(GL_CULL_FACE);
+		GLState::enable(GL_DEPTH_TEST);
+		GLState::depthFunc(GL_ALWAYS);
+		GLState::depthMask(true);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		this->downsample_shader->enable();
+		this->downsample_shader->setUniform("u_scene_depth", this->scene_depth, 0);
+		this->downsample_shader->setUniform("u_factor", divider);
+		quad->render(GL_TRIANGLES);
+		this->downsample_shader->disable();
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		GLState::depthFunc(GL_LESS);
+
+		queue.submit(proxies, RENDER_PASS_TRANSPARENT, camera, divider);
+		layer.target->unbind();
+
+		if (accumulate)
+		{
+			color = resolve(layer, camera, progressive);
+			this->stats.history_frames[l] = layer.frames;
+		}
+		else
+			layer.frames = 0;
+
+		composite(color, layer.target->depth_texture, camera);
+	}
+}
+
+void VolumePass::composite(Texture* color, Texture* depth, Camera* camera)
+{
+	//over the screen with the same blending the volumes use
+	GLState::disable(GL_DEPTH_TEST);
+	GLState::depthMask(false);
+	GLState::disable(GL_CULL_FACE);
+	GLState::enable(GL_BLEND);
+	GLState::blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	this->upsample_shader->enable();
+	this->upsample_shader->setUniform("u_color_texture", color, 0);
+	this->upsample_shader->setUniform("u_depth_texture", depth, 1);
+	this->upsample_shader->setUniform("u_scene_depth", this->scene_depth, 2);
+	this->upsample_shader->setUniform("u_camera_nearfar", glm::vec2(camera->near_plane, camera->far_plane));
+	this->upsample_shader->setUniform("u_depth_sharpness", this->depth_sharpness);
+	Mesh::getQuad()->render(GL_TRIANGLES);
+	this->upsample_shader->disable();
+	GLState::enable(GL_DEPTH_TEST);
+}
+
+void VolumePass::renderInMenu()
+{
+	ImGui::Checkbox("Offscreen volumes", &enabled);
+	this->reset |= ImGui::Checkbox("Jitter", &jitter);
+	ImGui::Checkbox("Temporal accumulation", &temporal);
+	ImGui::SliderInt("Max history frames", &this->max_history_frames, 1, 256);
+	this->reset |= ImGui::Checkbox("Progressive", &progressive);
+	this->reset |= ImGui::SliderInt("Progressive samples", &this->progressive_samples, 1, 4096);
+	ImGui::Text("Progressive resets: %d", this->stats.resets);
+	ImGui::SliderFloat("Upsample depth sharpness", &this->depth_sharpness, 1.f, 128.f);
+	ImGui::Text("Layers: %d", this->stats.layers);
+	for (int l = 0; l < VOLUMEPASS_NUM_LAYERS; ++l)
+		if (this->stats.width[l])
+			ImGui::Text("1/%d: %dx%d, history %d%s", getDivider(l), this->stats.width[l], this->stats.height[l], this->stats.history_frames[l],
+				progressive && this->stats.history_frames[l] >= this->progressive_samples ? " (converged)" : "");
+}
@@ -0,0 +1,89 @@
+/*
+	Volume pass: the transparent draws (volumes) whose material asks for a fraction of the resolution are rendered into
+	a half or quarter resolution target, with the scene depth downsampled into it so the opaque geometry still occludes them.
+	The result is upsampled with a bilateral filter guided by the full resolution depth and blended over the screen.
+	With temporal accumulation every layer (full resolution too) is blended with its history, reprojected with the camera
+	of the previous frame and clamped to the neighbourhood of the new frame to reject what was disoccluded. The volumes jitter
+	their ray starts with blue noise every frame, so the history converges to the result of a much smaller step.
+	The progressive mode accumulates the plain average of the frames in a float target while nothing changes (camera, nodes,
+	materials and lights, by their versions) and stops drawing the volumes once it has enough samples, any change restarts it.
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <glm/matrix.hpp>
+#include <cstdint>
+
+class FBO;
+class Texture;
+class Shader;
+class Camera;
+class RenderQueue;
+class RenderProxies;
+
+#define VOLUMEPASS_NUM_LAYERS 3 // full, half and quarter resolution
+#define VOLUMEPASS_MOVING_FRAMES 8 // history length kept while the camera moves (blend of 1 / 9)
+
+class VolumePass
+{
+public:
+	struct sStats {
+		int layers = 0; // offscreen targets used in the last frame
+		int width[VOLUMEPASS_NUM_LAYERS] = {};
+		int height[VOLUMEPASS_NUM_LAYERS] = {};
+		int history_frames[VOLUMEPASS_NUM_LAYERS] = {};
+		int resets = 0; // of the progressive accumulation
+	};
+
+	static bool enabled; // off draws every volume at full resolution
+	static bool temporal; // accumulate the layers with their reprojected history
+	static bool progressive; // average every frame while the scene is static, until progressive_samples
+	static bool jitter; // blue noise offsets of the ray starts (read by VolumeMaterial)
+	static unsigned int frame; // changes the jitter pattern
+
+	float depth_sharpness = 32.f;
+	int max_history_frames = 64; // while the camera is still, the blend falls to 1 / (max + 1)
+	int progressive_samples = 256; // frames averaged before the progressive mode stops drawing
+	sStats stats;
+
+	~VolumePass();
+
+	// whether this frame renders some layer offscreen, which needs a copy of the scene depth
+	bool needsSceneDepth(const RenderQueue& queue, const RenderProxies& proxies);
+	// draws the transparent pass of the queue, after the opaque one (the depth buffer has the scene)
+	// scene_depth is a copy of that depth buffer, without it every volume is drawn at full resolution
+	void render(RenderQueue& queue, const RenderProxies& proxies, Camera* camera, Texture* scene_depth);
+
+	void renderInMenu();
+
+	static int getDivider(int layer) { return 1 << layer; }
+
+	// combination of the versions of everything the volumes depend on, it changes with any of them
+	static uint64_t getSceneVersion(const RenderProxies& proxies, Camera* camera);
+
+private:
+	struct sLayer {
+		FBO* target = NULL; // color and downsampled scene depth of this frame
+		FBO* history[2] = {}; // accumulated color, ping-pong
+		int current = 0; // history written this frame
+		int frames = 0; // accumulated in the history, 0 if it is not valid
+		bool float_history = false; // 32 bit channels, for the progressive average
+		glm::mat4 viewprojection; // camera of the history
+	};
+
+	sLayer layers[VOLUMEPASS_NUM_LAYERS];
+	Texture* scene_depth = NULL; // copy of the depth buffer, from the frame graph, only valid inside render()
+	Shader* downsample_shader = NULL;
+	Shader* upsample_shader = NULL;
+	Shader* resolve_shader = NULL;
+	uint64_t scene_version = 0;
+	bool reset = false; // settings of the pass changed
+
+	bool init();
+	bool prepareLayer(sLayer& layer, int divider, int width, int height, bool float_history);
+	Texture* resolve(sLayer& layer, Camera* camera, bool accumulate);
+	void composite(Texture* color, Texture* depth, Camera* camera);
+	void releaseLayer(sLayer& layer);
+};
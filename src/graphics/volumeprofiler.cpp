@@ -0,0 +1,160 @@
+#include "volumeprofiler.h"
+
+#include "shader.h"
+#include "gpuculling.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+bool VolumeProfiler::enabled = false;
+VolumeProfiler::sStats VolumeProfiler::stats;
+GLuint VolumeProfiler::program = 0;
+GLuint VolumeProfiler::tile_buffer = 0;
+int VolumeProfiler::tiles_x = 0;
+int VolumeProfiler::tiles_y = 0;
+int VolumeProfiler::num_tiles = 0;
+GLuint VolumeProfiler::total_buffers[VOLUMEPROFILER_LATENCY] = {};
+GLsync VolumeProfiler::fences[VOLUMEPROFILER_LATENCY] = {};
+int VolumeProfiler::current = 0;
+bool VolumeProfiler::pending = false;
+
+bool VolumeProfiler::isSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0, fragment_blocks = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major > 4 || (major == 4 && minor >= 3))
+			glGetIntegerv(GL_MAX_FRAGMENT_SHADER_STORAGE_BLOCKS, &fragment_blocks);
+
+		supported = fragment_blocks > 0;
+		if (!supported)
+			std::cout << "[INFO] Volume sample counters not available (" << major << "." << minor << ")" << std::endl;
+	}
+	return supported == 1;
+}
+
+bool VolumeProfiler::init()
+{
+	static bool initialized = false;
+	if (initialized)
+		return program != 0;
+	initialized = true;
+
+	program = GPUCulling::loadComputeProgram("res/shaders/sample_counters.cs");
+	if (!program)
+	{
+		std::cout << "[WARN] Volume sample counters disabled" << std::endl;
+		return false;
+	}
+
+	sCounters zero = {};
+	glGenBuffers(1, &tile_buffer);
+	glGenBuffers(VOLUMEPROFILER_LATENCY, total_buffers);
+	for (GLuint buffer : total_buffers)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zero), &zero, GL_DYNAMIC_READ);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return true;
+}
+
+void VolumeProfiler::newFrame()
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	tiles_x = (viewport[2] + VOLUMEPROFILER_TILE_SIZE - 1) / VOLUMEPROFILER_TILE_SIZE;
+	tiles_y = (viewport[3] + VOLUMEPROFILER_TILE_SIZE - 1) / VOLUMEPROFILER_TILE_SIZE;
+
+	//the totals written VOLUMEPROFILER_LATENCY frames ago, only if the GPU is done with them (no wait)
+	GLsync& fence = fences[current];
+	if (fence)
+	{
+		GLenum state = glClientWaitSync(fence, 0, 0);
+		if (state == GL_ALREADY_SIGNALED || state == GL_CONDITION_SATISFIED)
+		{
+			sCounters counters = {};
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, total_buffers[current]);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), &counters);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			stats.rays = (int64_t)counters.rays;
+			stats.samples = (int64_t)counters.samples;
+			stats.light_samples = (int64_t)counters.light_samples;
+			stats.reference_samples = (int64_t)counters.reference_samples;
+			stats.terminated_rays = (int64_t)counters.terminated_rays;
+		}
+		//still running after that many frames, the sample is dropped and the buffer written again
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (!pending)
+		return;
+	pending = false;
+
+	//sums the tiles the draws of the last frame counted in, and clears them
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "u_num_tiles"), num_tiles);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VOLUMEPROFILER_BINDING, tile_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VOLUMEPROFILER_TOTALS_BINDING, total_buffers[current]);
+	glDispatchCompute(1, 1, 1);
+	glUseProgram(0);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current = (current + 1) % VOLUMEPROFILER_LATENCY;
+}
+
+void VolumeProfiler::bind(Shader* shader)
+{
+	GLuint block = GL_INVALID_INDEX;
+	if (enabled && isSupported() && init())
+		block = glGetProgramResourceIndex(shader->getProgram(), GL_SHADER_STORAGE_BLOCK, "SampleCounters");
+
+	//the driver may not expose the extension to the shader even with a 4.3 context
+	shader->setUniform("u_profile", block != GL_INVALID_INDEX);
+	if (block == GL_INVALID_INDEX)
+		return;
+
+	//after a resize the tiles are allocated again (zeroed), the counts of that frame are lost
+	if (num_tiles != tiles_x * tiles_y)
+	{
+		num_tiles = std::max(tiles_x * tiles_y, 1);
+		std::vector<GLuint> zero((size_t)num_tiles * 4, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, zero.size() * sizeof(GLuint), zero.data(), GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	shader->setUniform("u_profile_tile_size", VOLUMEPROFILER_TILE_SIZE);
+	shader->setUniform("u_profile_tiles_x", tiles_x);
+	shader->setUniform("u_profile_num_tiles", num_tiles);
+	glShaderStorageBlockBinding(shader->getProgram(), block, VOLUMEPROFILER_BINDING);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VOLUMEPROFILER_BINDING, tile_buffer);
+	pending = true;
+}
+
+void VolumeProfiler::renderInMenu()
+{
+	if (!isSupported())
+	{
+		ImGui::Text("Not supported (needs storage buffers in fragment shaders)");
+		return;
+	}
+	ImGui::Checkbox("Count samples", &enabled);
+	if (!enabled || !stats.rays)
+		return;
+
+	ImGui::Text("Rays: %lld (%lld terminated)", (long long)stats.rays, (long long)stats.terminated_rays);
+	ImGui::Text("Samples: %lld (%.1f per ray)", (long long)stats.samples, stats.samples / (double)stats.rays);
+	ImGui::Text("Shadow samples: %lld (%.1f per ray)", (long long)stats.light_samples, stats.light_samples / (double)stats.rays);
+	ImGui::Text("Fixed step reference: %lld (%.1f per ray)", (long long)stats.reference_samples, stats.reference_samples / (double)stats.rays);
+	if (stats.reference_samples)
+		ImGui::Text("Reduction: %.1f%%", 100.0 * (1.0 - stats.samples / (double)stats.reference_samples));
+	ImGui::Text("Read %d frames late", VOLUMEPROFILER_LATENCY);
+}
@@ -0,0 +1,66 @@
+/*
+	Volume profiler: the raymarching shaders count their samples in the counters of their screen tile, so only the few
+	rays of a tile share them. At the start of the next frame a compute pass sums the tiles into 64 bit totals and clears
+	them, the totals are read a few frames later from a ring of buffers, once their fence has passed, so the GPU is not
+	stalled. Compares the samples taken with the ones a fixed step without early termination would take, to see what
+	the adaptive step and the termination save. Needs compute shaders and storage buffers in the fragment shader (GL 4.3).
+*/
+
+#pragma once
+
+#include "../framework/includes.h"
+
+#include <cstdint>
+
+class Shader;
+
+#define VOLUMEPROFILER_BINDING 3 // storage buffer binding of the SampleCounters block, 0-2 are used by the GPU culling
+#define VOLUMEPROFILER_TOTALS_BINDING 4 // SampleTotals block of sample_counters.cs
+#define VOLUMEPROFILER_TILE_SIZE 4 // pixels per side of a tile
+#define VOLUMEPROFILER_LATENCY 3 // totals in flight, they are read this many frames after the reduction
+
+class VolumeProfiler
+{
+public:
+	// the SampleTotals block of sample_counters.cs, pairs of words read as 64 bit integers (little endian)
+	struct sCounters {
+		uint64_t rays;
+		uint64_t samples;
+		uint64_t light_samples;
+		uint64_t reference_samples;
+		uint64_t terminated_rays;
+	};
+
+	struct sStats {
+		int64_t rays = 0;
+		int64_t samples = 0;
+		int64_t light_samples = 0;
+		int64_t reference_samples = 0;
+		int64_t terminated_rays = 0;
+	};
+
+	static bool enabled;
+	static sStats stats; // of a frame VOLUMEPROFILER_LATENCY frames ago
+
+	static bool isSupported();
+
+	// once per frame before drawing the volumes: sums the counters of the last frame and reads the oldest totals that are ready
+	static void newFrame();
+	// after enabling a volume shader, binds the counters if the shader has them
+	static void bind(Shader* shader);
+
+	static void renderInMenu();
+
+private:
+	static GLuint program; // sample_counters.cs
+	static GLuint tile_buffer;
+	static int tiles_x; // of the screen, the buffer is resized when they change
+	static int tiles_y;
+	static int num_tiles; // in the buffer
+	static GLuint total_buffers[VOLUMEPROFILER_LATENCY];
+	static GLsync fences[VOLUMEPROFILER_LATENCY];
+	static int current; // ring position written by the next reduction
+	static bool pending; // some shader counted this frame
+
+	static bool init();
+};
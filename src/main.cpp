@@ -137,6 +137,14 @@ void mainLoop(GLFWwindow* window)
 	while (!glfwWindowShouldClose(window))
 	{
 		glfwGetFramebufferSize(window, &width, &height);
+		// minimized, nothing can be drawn into an empty framebuffer
+		if (!width || !height)
+		{
+			glfwWaitEvents();
+			continue;
+		}
+		if (width != app->window_width || height != app->window_height)
+			app->onResize(width, height);
 		glViewport(0, 0, width, height);
 
 		// Poll for and process events
@@ -180,10 +188,18 @@ int main(void)
 		return -1;
 
 	/* Create a windowed mode window and its OpenGL context */
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
-
-	GLFWwindow* window = glfwCreateWindow(1600, 900, "Advanced Computer Graphics", nullptr, nullptr); // 1600, 900 or 1280, 720
+	// 4.3 enables the GPU culling (compute shaders, multi-draw-indirect), older drivers get 3.0 and the CPU paths
+	const int context_versions[][2] = { { 4, 3 }, { 3, 0 } };
+	GLFWwindow* window = nullptr;
+	for (const int* context_version : context_versions)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, context_version[0]);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, context_version[1]);
+		window = glfwCreateWindow(1600, 900, "Advanced Computer Graphics", nullptr, nullptr); // 1600, 900 or 1280, 720
+		if (window)
+			break;
+		std::cout << "[WARN] OpenGL " << context_version[0] << "." << context_version[1] << " context not available" << std::endl;
+	}
 	if (!window)
 	{
 		glfwTerminate();